@@ -33,39 +33,87 @@
 #endif
 
 #include <btBulletDynamicsCommon.h>
+#if BT_THREADSAFE
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <LinearMath/btThreads.h>
+#endif
 
 namespace mmd {
     class BulletPhysicsReactor : public PhysicsReactor {
+        class PoserBinding;
     public:
+        // Hands one rigid body of a binding to Bullet; its state lives in the binding.
         class PoserMotionState : public btMotionState {
         public:
-            PoserMotionState(Poser &poser, const Model::RigidBody &body, const btTransform &body_transform);
+            PoserMotionState(PoserBinding &binding, size_t index);
             /*virtual*/ void getWorldTransform(btTransform &transform) const;
             /*virtual*/ void setWorldTransform(const btTransform &transform);
-            void Synchronize();
-            void Fix();
-            void Reset() const;
         private:
-            Poser &poser_;
-            bool passive_; // kinematics only
-            bool strict_; // bones are not allowed to shake its length
-            bool ghost_; // bones do not affect bone
-            BulletPhysicsReactor::BoneImageReference target_;
-            mutable btTransform transform_;
-            btTransform body_transform_;
-            btTransform body_transform_inv_;
-
-            PoserMotionState &operator=(const PoserMotionState&);
+            PoserBinding *binding_;
+            size_t index_;
         };
 
-        BulletPhysicsReactor();
+        /**
+          With thread_num above 1, and Bullet built with BT_THREADSAFE (the
+          MMD_BULLET_MULTITHREADING build option), the world is a
+          btDiscreteDynamicsWorldMt: collision pairs, islands and large
+          islands' constraints are processed on Bullet's task scheduler. The
+          scheduler is shared by all reactors and runs the thread count last
+          asked for, at most one per core. Otherwise thread_num is ignored.
+        **/
+        explicit BulletPhysicsReactor(int thread_num = 1);
         virtual ~BulletPhysicsReactor();
 
+        int GetThreadNum() const;
+
         /*virtual*/ void AddPoser(Poser &poser);
         /*virtual*/ void RemovePoser(Poser &poser);
         /*virtual*/ void Reset();
         /*virtual*/ void React(float step);
 
+        /**
+          React advances the world in fixed steps of 1/rate seconds, as many
+          as the elapsed time covers but at most max_step_num, and carries the
+          remainder to the next call. Bones follow the bodies interpolated
+          between the last two steps, so the simulation does not depend on
+          how often React is called.
+        **/
+        void SetFixedStepRate(float rate);
+        float GetFixedStepRate() const;
+        void SetMaxStepNum(int max_step_num);
+        int GetMaxStepNum() const;
+        int GetLastStepNum() const;
+
+        /**
+          Eases the bodies into the current pose after a jump, such as a seek
+          or a new motion, instead of letting them snap: runs exactly step_num
+          fixed steps, kinematic bodies moving from where the last step left
+          them to the current pose over the first half, then stops every body.
+          The cost depends on step_num alone.
+        **/
+        void Settle(int step_num);
+
+        /**
+          In deterministic mode a run depends on the posers and the steps
+          asked for alone: React never drops time (max_step_num is ignored),
+          the solver runs a fixed number of iterations in a fixed order, and
+          Reset rebuilds the world with the floor, bodies and constraints
+          added in poser order, whatever was added or removed before. Call
+          Reset after adding posers. Multi-threaded worlds are not
+          deterministic.
+
+          Leaving deterministic mode restores the solver settings it replaced.
+
+          GetStepChecksums hashes all rigid body transforms after each step
+          of the last React or Settle, in deterministic mode only.
+        **/
+        void SetDeterministic(bool deterministic);
+        bool IsDeterministic() const;
+        std::uint64_t GetChecksum() const;
+        const std::vector<std::uint64_t> &GetStepChecksums() const;
+
         /*virtual*/ void SetGravityStrength(float strength);
         /*virtual*/ void SetGravityDirection(const Vector3f &direction);
 
@@ -75,11 +123,149 @@ namespace mmd {
         /*virtual*/ void SetFloor(bool has_floor);
         /*virtual*/ bool IsHasFloor() const;
 
+        /**
+          Bones a poser's rigid bodies pose, each listed once: React writes
+          their skinning matrices, and the local matrices of the fixed ones
+          (see PhysicsCache).
+        **/
+        void GetPhysicsBones(const Poser &poser, std::vector<size_t> &bones, std::vector<size_t> &fixed_bones) const;
+
+        /**
+          Posers share the world: one broadphase, one solver step. A poser's
+          bodies stand at its offset (in model space units), so several
+          instances of a model can stand side by side; SetPoserOffset moves
+          them there at once. Bodies of two posers collide when their
+          collision groups and masks allow it and each poser's scene group
+          is in the other's scene mask. By default every poser collides
+          with every other.
+        **/
+        void SetPoserOffset(const Poser &poser, const Vector3f &offset);
+        Vector3f GetPoserOffset(const Poser &poser) const;
+        void SetPoserCollision(const Poser &poser, unsigned scene_group, unsigned scene_mask);
+
+        // Transforms and velocities of all rigid bodies, 13 floats each.
+        void SaveState(std::vector<float> &state) const;
+        void LoadState(const std::vector<float> &state);
+
+        /**
+          Level of detail: which dynamic bodies are worth simulating. With
+          the policy enabled, a body in a disabled collision group, lighter
+          than min_mass, with a bounding radius under min_size or farther
+          than far_distance from the viewer (0 for no limit) is made
+          kinematic: it follows its bone's animated pose, and bodies hanging
+          from it hang from that. With sleep, simulated bodies at rest drop
+          out of the steps until a contact, or the kinematic body they are
+          jointed to, moves them again.
+
+          React applies the policy before stepping. It is ignored in
+          deterministic mode.
+        **/
+        struct LodPolicy {
+            LodPolicy();
+
+            bool enabled;
+            std::bitset<16> disabled_groups;
+            float min_mass;
+            float min_size;
+            float far_distance;
+            bool sleep;
+            float sleep_linear_velocity; // units per second
+            float sleep_angular_velocity; // radians per second
+        };
+
+        // Dynamic bodies of one collision group, as the last React left them.
+        struct GroupStats {
+            size_t body_num;
+            size_t simulated_num; // not made kinematic
+            size_t awake_num; // simulated and not sleeping
+            size_t constraint_num; // joints of awake bodies, which the solver works on
+        };
+
+        void SetLodPolicy(const LodPolicy &policy);
+        const LodPolicy &GetLodPolicy() const;
+        // Where far_distance is measured from, in model space.
+        void SetLodViewer(const Vector3f &position);
+        // One entry per collision group.
+        const std::vector<GroupStats> &GetGroupStats() const;
+
     private:
+        /**
+          Physics of one poser. Everything per rigid body sits in arrays
+          indexed by body, in model order; the bodies physics moves and the
+          strict ones are listed up front, so synchronizing bones is a flat
+          loop. Motion states are stored by value and rigid bodies and
+          constraints in one aligned block each, so adding and removing a
+          poser costs a handful of allocations.
+        **/
+        class PoserBinding {
+        public:
+            PoserBinding(Poser &poser, size_t body_num, size_t constraint_num);
+            ~PoserBinding();
+
+            void ResetTransform(size_t index);
+            void Step();
+            void Synchronize(btScalar alpha);
+            void Fix();
+            void BeginSettle();
+            void SetSleeping(bool sleeping, btScalar linear, btScalar angular);
+            void Wake(btScalar linear, btScalar angular);
+
+            Poser &poser;
+
+            std::vector<size_t> bones;
+            std::vector<char> kinematic; // frozen bodies included
+            std::vector<char> frozen; // dynamic, made kinematic by the level of detail
+            bool sleeping; // dynamic bodies may sleep
+            btVector3 offset; // of the bodies in the world
+            unsigned scene_group;
+            unsigned scene_mask;
+            std::vector<short> groups;
+            std::vector<short> masks;
+            btAlignedObjectArray<btTransform> transforms;
+            btAlignedObjectArray<btTransform> previous_transforms; // before the last step
+            btAlignedObjectArray<btTransform> settle_transforms; // kinematics only, where the settle starts
+            btAlignedObjectArray<btTransform> body_transforms;
+            btAlignedObjectArray<btTransform> body_transforms_inv;
+            btScalar settle_alpha;
+
+            std::vector<size_t> dynamic_bodies; // pose their bones, ghosts excluded
+            std::vector<size_t> strict_bodies; // bones are not allowed to shake its length
+
+            std::vector<PoserMotionState> motion_states;
+            std::vector<btCollisionShape*> collision_shapes;
+            btRigidBody *rigid_bodies; // rigid_body_num constructed
+            size_t rigid_body_num;
+            btGeneric6DofSpringConstraint *constraints; // constraint_num constructed
+            size_t constraint_num;
+
+        private:
+            PoserBinding(const PoserBinding&);
+            PoserBinding &operator=(const PoserBinding&);
+        };
+
+        // Pairs bodies by their collision groups and masks, and bodies of
+        // different posers by their posers' scene groups and masks too.
+        class PoserFilter : public btOverlapFilterCallback {
+        public:
+            /*virtual*/ bool needBroadphaseCollision(btBroadphaseProxy *proxy0, btBroadphaseProxy *proxy1) const;
+        };
+
+        PoserBinding *FindBinding(const Poser &poser) const;
+
+        void StepMotionStates();
+        void SynchronizeMotionStates(btScalar alpha);
+        void StepSimulation();
+        void RebuildWorld();
+        void UpdateLod();
+        void FreezeBody(PoserBinding &binding, size_t index, bool frozen);
+        void UpdateGroupStats();
+
         btDefaultCollisionConfiguration *configuration_;
         btCollisionDispatcher *dispatcher_;
         btBroadphaseInterface *broadphase_;
-        btSequentialImpulseConstraintSolver *solver_;
+        btConstraintSolver *solver_;
+        btConstraintSolver *solver_pool_; // multi-threaded worlds only
+        int thread_num_;
         btDiscreteDynamicsWorld *world_;
 
         btCollisionShape *ground_shape_;
@@ -91,10 +277,22 @@ namespace mmd {
 
         bool has_floor_;
 
-        std::map<Poser*, std::vector<btCollisionShape*>> collision_shapes_;
-        std::map<Poser*, std::vector<PoserMotionState*>> motion_states_;
-        std::map<Poser*, std::vector<btRigidBody*>> rigid_bodies_;
-        std::map<Poser*, std::vector<btGeneric6DofSpringConstraint*>> constraints_;
+        btScalar fixed_step_;
+        int max_step_num_;
+        btScalar accumulated_time_;
+        int last_step_num_;
+
+        bool deterministic_;
+        int free_iteration_num_; // solver settings to restore on leaving deterministic mode
+        int free_solver_mode_;
+        std::vector<std::uint64_t> step_checksums_;
+
+        LodPolicy lod_policy_;
+        btVector3 lod_viewer_;
+        std::vector<GroupStats> group_stats_;
+
+        std::vector<PoserBinding*> bindings_; // in the order posers were added
+        PoserFilter poser_filter_;
     };
 
 #include "mmd-bullet_impl.inl"
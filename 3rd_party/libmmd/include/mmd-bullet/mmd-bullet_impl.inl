@@ -6,67 +6,192 @@
             http://www.boost.org/LICENSE_1_0.txt)
 **/
 
-inline BulletPhysicsReactor::PoserMotionState::PoserMotionState(Poser& poser, const Model::RigidBody& body, const btTransform& body_transform)
-  : poser_(poser),
-    passive_(body.GetType()==Model::RigidBody::RIGID_TYPE_KINEMATIC),
-    strict_(body.GetType()==Model::RigidBody::RIGID_TYPE_PHYSICS_STRICT),
-    ghost_(body.GetType()==Model::RigidBody::RIGID_TYPE_PHYSICS_GHOST),
-    target_(BulletPhysicsReactor::GetPoserBoneImage(poser, body.GetAssociatedBoneIndex())),
-    body_transform_(body_transform),
-    body_transform_inv_(body_transform.inverse())
-{
-    Reset();
-}
+inline BulletPhysicsReactor::PoserMotionState::PoserMotionState(PoserBinding& binding, size_t index) : binding_(&binding), index_(index) {}
 
 inline void BulletPhysicsReactor::PoserMotionState::getWorldTransform(btTransform& transform) const {
-    if(passive_) {
-        Reset();
+    if(binding_->kinematic[index_]) {
+        binding_->ResetTransform(index_);
+        if(binding_->settle_alpha<btScalar(1.0f)) {
+            const btTransform& from = binding_->settle_transforms[index_];
+            btTransform& to = binding_->transforms[index_];
+            to = btTransform(
+                from.getRotation().slerp(to.getRotation(), binding_->settle_alpha),
+                from.getOrigin().lerp(to.getOrigin(), binding_->settle_alpha)
+            );
+        }
     }
-    transform = transform_;
+    transform = binding_->transforms[index_];
 }
 
 inline void BulletPhysicsReactor::PoserMotionState::setWorldTransform(const btTransform& transform) {
-    if(!passive_) {
-        transform_ = transform;
+    if(!binding_->kinematic[index_]) {
+        binding_->transforms[index_] = transform;
     }
 }
 
-inline void BulletPhysicsReactor::PoserMotionState::Synchronize() {
-    if(!(passive_||ghost_)) {
-        btTransform bt_transform;
-        bt_transform = transform_*body_transform_inv_;
-        bt_transform.getOpenGLMatrix(target_.skinning_matrix_.v);
+
+inline BulletPhysicsReactor::PoserBinding::PoserBinding(Poser& poser, size_t body_num, size_t constraint_num)
+  : poser(poser),
+    bones(body_num),
+    kinematic(body_num),
+    frozen(body_num),
+    sleeping(false),
+    offset(btScalar(0.0f), btScalar(0.0f), btScalar(0.0f)),
+    scene_group(1),
+    scene_mask(~0u),
+    groups(body_num),
+    masks(body_num),
+    settle_alpha(btScalar(1.0f)),
+    rigid_bodies(NULL),
+    rigid_body_num(0),
+    constraints(NULL),
+    constraint_num(0)
+{
+    transforms.resize(int(body_num));
+    previous_transforms.resize(int(body_num));
+    settle_transforms.resize(int(body_num));
+    body_transforms.resize(int(body_num));
+    body_transforms_inv.resize(int(body_num));
+    motion_states.reserve(body_num); // Bullet keeps their addresses
+    collision_shapes.reserve(body_num);
+    if(body_num>0) {
+        rigid_bodies = static_cast<btRigidBody*>(btAlignedAlloc(sizeof(btRigidBody)*body_num, 16));
+    }
+    if(constraint_num>0) {
+        constraints = static_cast<btGeneric6DofSpringConstraint*>(btAlignedAlloc(sizeof(btGeneric6DofSpringConstraint)*constraint_num, 16));
     }
 }
 
-inline void BulletPhysicsReactor::PoserMotionState::Fix() {
-    if(strict_) {
+inline BulletPhysicsReactor::PoserBinding::~PoserBinding() {
+    for(size_t i=0;i<constraint_num;++i) {
+        constraints[i].~btGeneric6DofSpringConstraint();
+    }
+    for(size_t i=0;i<rigid_body_num;++i) {
+        rigid_bodies[i].~btRigidBody();
+    }
+    btAlignedFree(constraints);
+    btAlignedFree(rigid_bodies);
+    for(std::vector<btCollisionShape*>::iterator i=collision_shapes.begin();i!=collision_shapes.end();++i) {
+        delete (*i);
+    }
+}
+
+inline void BulletPhysicsReactor::PoserBinding::ResetTransform(size_t index) {
+    btTransform& transform = transforms[int(index)];
+    transform.setFromOpenGLMatrix(BulletPhysicsReactor::GetPoserBoneImage(poser, bones[index]).skinning_matrix_.v);
+    transform = transform*body_transforms[int(index)];
+    transform.getOrigin() += offset;
+}
+
+inline void BulletPhysicsReactor::PoserBinding::Step() {
+    for(std::vector<size_t>::const_iterator i=dynamic_bodies.begin();i!=dynamic_bodies.end();++i) {
+        previous_transforms[int(*i)] = transforms[int(*i)];
+    }
+}
+
+inline void BulletPhysicsReactor::PoserBinding::Synchronize(btScalar alpha) {
+    for(std::vector<size_t>::const_iterator i=dynamic_bodies.begin();i!=dynamic_bodies.end();++i) {
+        if(frozen[*i]) {
+            continue; // the bone keeps its animated pose
+        }
+        const btTransform& previous_transform = previous_transforms[int(*i)];
+        const btTransform& transform = transforms[int(*i)];
+        btTransform bt_transform(
+            previous_transform.getRotation().slerp(transform.getRotation(), alpha),
+            previous_transform.getOrigin().lerp(transform.getOrigin(), alpha)-offset
+        );
+        bt_transform = bt_transform*body_transforms_inv[int(*i)];
+        bt_transform.getOpenGLMatrix(BulletPhysicsReactor::GetPoserBoneImage(poser, bones[*i]).skinning_matrix_.v);
+    }
+}
+
+inline void BulletPhysicsReactor::PoserBinding::Fix() {
+    for(std::vector<size_t>::const_iterator i=strict_bodies.begin();i!=strict_bodies.end();++i) {
+        if(frozen[*i]) {
+            continue;
+        }
+        BulletPhysicsReactor::BoneImageReference target = BulletPhysicsReactor::GetPoserBoneImage(poser, bones[*i]);
         Matrix4f parent_local_matrix;
-        target_.local_matrix_ = target_.global_offset_matrix_inv_*target_.skinning_matrix_;
-        if(target_.has_parent_) {
-            parent_local_matrix = BulletPhysicsReactor::GetPoserBoneImage(poser_, target_.parent_).local_matrix_;
-            target_.local_matrix_ = target_.local_matrix_*parent_local_matrix.Inverse();
+        target.local_matrix_ = target.global_offset_matrix_inv_*target.skinning_matrix_;
+        if(target.has_parent_) {
+            parent_local_matrix = BulletPhysicsReactor::GetPoserBoneImage(poser, target.parent_).local_matrix_;
+            target.local_matrix_ = target.local_matrix_*parent_local_matrix.Inverse();
         }
-        target_.local_matrix_.r.v[3].downgrade.vector3d = target_.total_translation_+target_.local_offset_;
-        if(target_.has_parent_) {
-            target_.local_matrix_ = target_.local_matrix_*parent_local_matrix;
+        target.local_matrix_.r.v[3].downgrade.vector3d = target.total_translation_+target.local_offset_;
+        if(target.has_parent_) {
+            target.local_matrix_ = target.local_matrix_*parent_local_matrix;
         }
-        target_.skinning_matrix_ = target_.global_offset_matrix_*target_.local_matrix_;
+        target.skinning_matrix_ = target.global_offset_matrix_*target.local_matrix_;
     }
 }
 
-inline void BulletPhysicsReactor::PoserMotionState::Reset() const {
-    transform_.setFromOpenGLMatrix(target_.skinning_matrix_.v);
-    transform_ = transform_*body_transform_;
+inline void BulletPhysicsReactor::PoserBinding::BeginSettle() {
+    for(size_t i=0;i<bones.size();++i) {
+        if(kinematic[i]) {
+            settle_transforms[int(i)] = transforms[int(i)];
+        }
+    }
+}
+
+inline void BulletPhysicsReactor::PoserBinding::SetSleeping(bool sleeping, btScalar linear, btScalar angular) {
+    for(size_t i=0;i<rigid_body_num;++i) {
+        if(kinematic[i]) {
+            continue; // kinematic bodies stay awake to pass their moves on
+        }
+        btRigidBody& rigid_body = rigid_bodies[i];
+        rigid_body.setSleepingThresholds(linear, angular);
+        if(sleeping!=this->sleeping) {
+            rigid_body.forceActivationState(sleeping ? ACTIVE_TAG : DISABLE_DEACTIVATION);
+            rigid_body.setDeactivationTime(btScalar(0.0f));
+        }
+    }
+    this->sleeping = sleeping;
+}
+
+// Bullet wakes bodies a kinematic body touches, but not those jointed to it.
+inline void BulletPhysicsReactor::PoserBinding::Wake(btScalar linear, btScalar angular) {
+    for(size_t i=0;i<constraint_num;++i) {
+        btRigidBody* anchor = &constraints[i].getRigidBodyA();
+        btRigidBody* body = &constraints[i].getRigidBodyB();
+        if(!anchor->isKinematicObject()) {
+            std::swap(anchor, body);
+        }
+        if(!anchor->isKinematicObject()||body->isKinematicObject()||body->getActivationState()!=ISLAND_SLEEPING) {
+            continue;
+        }
+        if(anchor->getLinearVelocity().length2()>linear*linear||anchor->getAngularVelocity().length2()>angular*angular) {
+            body->activate();
+        }
+    }
 }
 
 
-inline BulletPhysicsReactor::BulletPhysicsReactor() : configuration_(NULL), dispatcher_(NULL), broadphase_(NULL), solver_(NULL), world_(NULL), has_floor_(true) {
+inline BulletPhysicsReactor::BulletPhysicsReactor(int thread_num) : configuration_(NULL), dispatcher_(NULL), broadphase_(NULL), solver_(NULL), solver_pool_(NULL), thread_num_(1), world_(NULL), has_floor_(true), fixed_step_(btScalar(1.0f/60.0f)), max_step_num_(4), accumulated_time_(btScalar(0.0f)), last_step_num_(0), deterministic_(false), free_iteration_num_(0), free_solver_mode_(0), lod_viewer_(btScalar(0.0f), btScalar(0.0f), btScalar(0.0f)), group_stats_(16) {
     configuration_ = new btDefaultCollisionConfiguration();
-    dispatcher_ = new btCollisionDispatcher(configuration_);
     broadphase_ = new btDbvtBroadphase();
-    solver_ = new btSequentialImpulseConstraintSolver();
-    world_ = new btDiscreteDynamicsWorld(dispatcher_, broadphase_, solver_, configuration_);
+#if BT_THREADSAFE
+    if(thread_num>1) {
+        // Created once; Bullet keeps a single global scheduler.
+        static btITaskScheduler *scheduler = btCreateDefaultTaskScheduler();
+        if(scheduler!=NULL&&scheduler->getMaxNumThreads()>1) {
+            thread_num_ = btMin(thread_num, scheduler->getMaxNumThreads());
+            scheduler->setNumThreads(thread_num_);
+            btSetTaskScheduler(scheduler);
+
+            dispatcher_ = new btCollisionDispatcherMt(configuration_);
+            solver_pool_ = new btConstraintSolverPoolMt(thread_num_);
+            solver_ = new btSequentialImpulseConstraintSolverMt();
+            world_ = new btDiscreteDynamicsWorldMt(dispatcher_, broadphase_, static_cast<btConstraintSolverPoolMt*>(solver_pool_), solver_, configuration_);
+        }
+    }
+#else
+    (void)thread_num;
+#endif
+    if(world_==NULL) {
+        dispatcher_ = new btCollisionDispatcher(configuration_);
+        solver_ = new btSequentialImpulseConstraintSolver();
+        world_ = new btDiscreteDynamicsWorld(dispatcher_, broadphase_, solver_, configuration_);
+    }
 
     btVector3 gravity = world_->getGravity();
     gravity_direction_ = btVector3(btScalar(0.0f), btScalar(-1.0f), btScalar(0.0f));
@@ -86,11 +211,12 @@ inline BulletPhysicsReactor::BulletPhysicsReactor() : configuration_(NULL), disp
     ground_rigid_body_->setActivationState(DISABLE_DEACTIVATION);
 
     world_->addRigidBody(ground_rigid_body_);
+    world_->getPairCache()->setOverlapFilterCallback(&poser_filter_);
 }
 
 inline BulletPhysicsReactor::~BulletPhysicsReactor() {
-    while(rigid_bodies_.size()>0) {
-        RemovePoser(*(rigid_bodies_.begin()->first));
+    while(bindings_.size()>0) {
+        RemovePoser(bindings_.back()->poser);
     }
 
     delete ground_rigid_body_;
@@ -99,11 +225,16 @@ inline BulletPhysicsReactor::~BulletPhysicsReactor() {
 
     delete world_;
     delete solver_;
+    delete solver_pool_;
     delete broadphase_;
     delete dispatcher_;
     delete configuration_;
 }
 
+inline int BulletPhysicsReactor::GetThreadNum() const {
+    return thread_num_;
+}
+
 inline void BulletPhysicsReactor::SetGravityStrength(float strength) {
     gravity_strength_ = strength;
     world_->setGravity(gravity_direction_*gravity_strength_*btScalar(10.0f));
@@ -143,19 +274,26 @@ inline bool BulletPhysicsReactor::IsHasFloor() const {
     return has_floor_;
 }
 
+inline BulletPhysicsReactor::PoserBinding* BulletPhysicsReactor::FindBinding(const Poser& poser) const {
+    for(std::vector<PoserBinding*>::const_iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        if(&(*i)->poser==&poser) {
+            return *i;
+        }
+    }
+    return NULL;
+}
+
 inline void BulletPhysicsReactor::AddPoser(Poser& poser) {
     const Model& model = poser.GetModel();
 
-    if(rigid_bodies_.count(&poser)>0) {
+    if(FindBinding(poser)!=NULL) {
         return;
     }
 
     poser.ResetPosing();
 
-    std::vector<btCollisionShape*>& collision_shapes = collision_shapes_[&poser];
-    std::vector<PoserMotionState*>& motion_states = motion_states_[&poser];
-    std::vector<btRigidBody*>& rigid_bodies = rigid_bodies_[&poser];
-    std::vector<btGeneric6DofSpringConstraint*>& constraints = constraints_[&poser];
+    PoserBinding* binding = new PoserBinding(poser, model.GetRigidBodyNum(), model.GetConstraintNum());
+    bindings_.push_back(binding);
 
     for(size_t i=0;i<model.GetRigidBodyNum();++i) {
         const Model::RigidBody& body = model.GetRigidBody(i);
@@ -183,18 +321,32 @@ inline void BulletPhysicsReactor::AddPoser(Poser& poser) {
         Matrix4f body_transform = YXZToQuaternion(body.GetRotation()).ToRotateMatrix();
         body_transform.r.v[3].downgrade.vector3d = body.GetPosition();
 
-        btTransform bt_body_transform;
+        btTransform& bt_body_transform = binding->body_transforms[int(i)];
         bt_body_transform.setFromOpenGLMatrix(body_transform.v);
+        binding->body_transforms_inv[int(i)] = bt_body_transform.inverse();
+        binding->bones[i] = body.GetAssociatedBoneIndex();
+        binding->kinematic[i] = body.GetType()==Model::RigidBody::RIGID_TYPE_KINEMATIC;
+        // ghost bodies do not affect their bones
+        if(body.GetType()==Model::RigidBody::RIGID_TYPE_PHYSICS||body.GetType()==Model::RigidBody::RIGID_TYPE_PHYSICS_STRICT) {
+            binding->dynamic_bodies.push_back(i);
+        }
+        if(body.GetType()==Model::RigidBody::RIGID_TYPE_PHYSICS_STRICT) {
+            binding->strict_bodies.push_back(i);
+        }
+        binding->ResetTransform(i);
+        binding->previous_transforms[int(i)] = binding->transforms[int(i)];
 
-        PoserMotionState* bt_motion_state = new PoserMotionState(poser, body, bt_body_transform);
+        binding->motion_states.push_back(PoserMotionState(*binding, i));
 
-        btRigidBody::btRigidBodyConstructionInfo bt_info(bt_mass, bt_motion_state, bt_shape, bt_local_inertia);
+        btRigidBody::btRigidBodyConstructionInfo bt_info(bt_mass, &binding->motion_states.back(), bt_shape, bt_local_inertia);
         bt_info.m_linearDamping = body.GetTranslateDamp();
         bt_info.m_angularDamping = body.GetRotateDamp();
         bt_info.m_restitution = body.GetRestitution();
         bt_info.m_friction = body.GetFriction();
 
-        btRigidBody* bt_rigid_body = new btRigidBody(bt_info);
+        btRigidBody* bt_rigid_body = new (binding->rigid_bodies+i) btRigidBody(bt_info);
+        binding->rigid_body_num = i+1;
+        bt_rigid_body->setUserPointer(binding); // for PoserFilter
 
         bt_rigid_body->setActivationState(DISABLE_DEACTIVATION);
 
@@ -202,18 +354,19 @@ inline void BulletPhysicsReactor::AddPoser(Poser& poser) {
             bt_rigid_body->setCollisionFlags(bt_rigid_body->getCollisionFlags()|btCollisionObject::CF_KINEMATIC_OBJECT);
         }
 
-        world_->addRigidBody(bt_rigid_body, (short)(1<<body.GetCollisionGroup()), (short)body.GetCollisionMask().to_ulong());
+        // A group past the 16-bit mask is in no group: nothing collides with it.
+        binding->groups[i] = body.GetCollisionGroup()<16 ? (short)(1<<body.GetCollisionGroup()) : (short)0;
+        binding->masks[i] = (short)body.GetCollisionMask().to_ulong();
+        world_->addRigidBody(bt_rigid_body, binding->groups[i], binding->masks[i]);
 
-        collision_shapes.push_back(bt_shape);
-        motion_states.push_back(bt_motion_state);
-        rigid_bodies.push_back(bt_rigid_body);
+        binding->collision_shapes.push_back(bt_shape);
     }
 
     for(size_t i=0;i<model.GetConstraintNum();++i) {
         const Model::Constraint& constraint = model.GetConstraint(i);
 
-        btRigidBody& bt_body_1 = *rigid_bodies[constraint.GetAssociatedRigidBodyIndex(0)];
-        btRigidBody& bt_body_2 = *rigid_bodies[constraint.GetAssociatedRigidBodyIndex(1)];
+        btRigidBody& bt_body_1 = binding->rigid_bodies[constraint.GetAssociatedRigidBodyIndex(0)];
+        btRigidBody& bt_body_2 = binding->rigid_bodies[constraint.GetAssociatedRigidBodyIndex(1)];
 
         const Vector3f &position_low_limit = constraint.GetPositionLowLimit();
         const Vector3f &position_high_limit = constraint.GetPositionHighLimit();
@@ -229,7 +382,8 @@ inline void BulletPhysicsReactor::AddPoser(Poser& poser) {
         btTransform bt_localization_transform_1 = bt_body_1.getWorldTransform().inverseTimes(bt_constraint_transform);
         btTransform bt_localization_transform_2 = bt_body_2.getWorldTransform().inverseTimes(bt_constraint_transform);
 
-        btGeneric6DofSpringConstraint* bt_constraint = new btGeneric6DofSpringConstraint(bt_body_1, bt_body_2, bt_localization_transform_1, bt_localization_transform_2, true);
+        btGeneric6DofSpringConstraint* bt_constraint = new (binding->constraints+i) btGeneric6DofSpringConstraint(bt_body_1, bt_body_2, bt_localization_transform_1, bt_localization_transform_2, true);
+        binding->constraint_num = i+1;
 
         bt_constraint->setLinearLowerLimit(btVector3(position_low_limit.p.x, position_low_limit.p.y, position_low_limit.p.z));
         bt_constraint->setLinearUpperLimit(btVector3(position_high_limit.p.x, position_high_limit.p.y, position_high_limit.p.z));
@@ -245,55 +399,35 @@ inline void BulletPhysicsReactor::AddPoser(Poser& poser) {
         }
 
         world_->addConstraint(bt_constraint);
-        constraints.push_back(bt_constraint);
     }
 }
 
 inline void BulletPhysicsReactor::RemovePoser(Poser& poser) {
-    if(rigid_bodies_.count(&poser)==0) {
+    PoserBinding* binding = FindBinding(poser);
+    if(binding==NULL) {
         return;
     }
 
-    std::vector<btGeneric6DofSpringConstraint*>& constraints = constraints_[&poser];
-    std::vector<PoserMotionState*>& motion_states = motion_states_[&poser];
-    std::vector<btRigidBody*>& rigid_bodies = rigid_bodies_[&poser];
-    std::vector<btCollisionShape*>& collision_shapes = collision_shapes_[&poser];
-
-    for(std::vector<btGeneric6DofSpringConstraint*>::iterator i=constraints.begin();i!=constraints.end();++i) {
-        world_->removeConstraint(*i);
-        delete (*i);
-    }
-    for(std::vector<btRigidBody*>::iterator i=rigid_bodies.begin();i!=rigid_bodies.end();++i) {
-        world_->removeRigidBody(*i);
-    }
-    for(std::vector<PoserMotionState*>::iterator i=motion_states.begin();i!=motion_states.end();++i) {
-        delete (*i);
-    }
-    for(std::vector<btRigidBody*>::iterator i=rigid_bodies.begin();i!=rigid_bodies.end();++i) {
-        delete (*i);
+    for(size_t i=0;i<binding->constraint_num;++i) {
+        world_->removeConstraint(binding->constraints+i);
     }
-    for(std::vector<btCollisionShape*>::iterator i=collision_shapes.begin();i!=collision_shapes.end();++i) {
-        delete (*i);
+    for(size_t i=0;i<binding->rigid_body_num;++i) {
+        world_->removeRigidBody(binding->rigid_bodies+i);
     }
 
-    constraints_.erase(&poser);
-    rigid_bodies_.erase(&poser);
-    motion_states_.erase(&poser);
-    collision_shapes_.erase(&poser);
+    bindings_.erase(std::find(bindings_.begin(), bindings_.end(), binding));
+    delete binding;
 }
 
 inline void BulletPhysicsReactor::Reset() {
-    for(std::map<Poser*, std::vector<PoserMotionState*>>::iterator i=motion_states_.begin();i!=motion_states_.end();++i) {
-        std::vector<PoserMotionState*>& poser_motion_states = i->second;
-        for(std::vector<PoserMotionState*>::iterator j=poser_motion_states.begin();j!=poser_motion_states.end();++j) {
-            PoserMotionState& motion_state = **j;
-            motion_state.Reset();
-        }
+    if(deterministic_) {
+        RebuildWorld();
     }
-    for(std::map<Poser*, std::vector<btRigidBody*>>::iterator i=rigid_bodies_.begin();i!=rigid_bodies_.end();++i) {
-        std::vector<btRigidBody*>& poser_rigid_bodies = i->second;
-        for(std::vector<btRigidBody*>::iterator j=poser_rigid_bodies.begin();j!=poser_rigid_bodies.end();++j) {
-            btRigidBody& rigid_body = **j;
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        PoserBinding& binding = **i;
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            btRigidBody& rigid_body = binding.rigid_bodies[j];
+            binding.ResetTransform(j);
             btTransform transform;
             rigid_body.getMotionState()->getWorldTransform(transform);
             rigid_body.setCenterOfMassTransform(transform);
@@ -303,24 +437,461 @@ inline void BulletPhysicsReactor::Reset() {
             rigid_body.setLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
             rigid_body.setInterpolationLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
             rigid_body.clearForces();
+            rigid_body.activate();
         }
     }
+    StepMotionStates();
+    accumulated_time_ = btScalar(0.0f);
+    world_->getBroadphase()->resetPool(world_->getDispatcher());
+    world_->getConstraintSolver()->reset();
+}
+
+inline void BulletPhysicsReactor::GetPhysicsBones(const Poser& poser, std::vector<size_t>& bones, std::vector<size_t>& fixed_bones) const {
+    bones.clear();
+    fixed_bones.clear();
+    const PoserBinding* binding = FindBinding(poser);
+    if(binding==NULL) {
+        return;
+    }
+    for(std::vector<size_t>::const_iterator i=binding->dynamic_bodies.begin();i!=binding->dynamic_bodies.end();++i) {
+        bones.push_back(binding->bones[*i]);
+    }
+    for(std::vector<size_t>::const_iterator i=binding->strict_bodies.begin();i!=binding->strict_bodies.end();++i) {
+        fixed_bones.push_back(binding->bones[*i]);
+    }
+    std::sort(bones.begin(), bones.end());
+    bones.erase(std::unique(bones.begin(), bones.end()), bones.end());
+    std::sort(fixed_bones.begin(), fixed_bones.end());
+    fixed_bones.erase(std::unique(fixed_bones.begin(), fixed_bones.end()), fixed_bones.end());
+}
+
+inline void BulletPhysicsReactor::SaveState(std::vector<float>& state) const {
+    state.clear();
+    for(std::vector<PoserBinding*>::const_iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        const PoserBinding& binding = **i;
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            const btRigidBody& rigid_body = binding.rigid_bodies[j];
+            const btTransform& transform = rigid_body.getCenterOfMassTransform();
+            const btVector3& origin = transform.getOrigin();
+            btQuaternion rotation = transform.getRotation();
+            const btVector3& linear_velocity = rigid_body.getLinearVelocity();
+            const btVector3& angular_velocity = rigid_body.getAngularVelocity();
+            float values[13] = {
+                float(origin.x()), float(origin.y()), float(origin.z()),
+                float(rotation.x()), float(rotation.y()), float(rotation.z()), float(rotation.w()),
+                float(linear_velocity.x()), float(linear_velocity.y()), float(linear_velocity.z()),
+                float(angular_velocity.x()), float(angular_velocity.y()), float(angular_velocity.z())
+            };
+            state.insert(state.end(), values, values+13);
+        }
+    }
+}
+
+inline void BulletPhysicsReactor::LoadState(const std::vector<float>& state) {
+    size_t body_num = 0;
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        body_num += (*i)->rigid_body_num;
+    }
+    if(state.size()!=body_num*13) {
+        throw exception(std::string("BulletPhysicsReactor::LoadState: State does not match rigid bodies."));
+    }
+    const float *values = state.empty() ? NULL : &state[0];
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        PoserBinding& binding = **i;
+        for(size_t j=0;j<binding.rigid_body_num;++j, values+=13) {
+            btRigidBody& rigid_body = binding.rigid_bodies[j];
+            btTransform transform(
+                btQuaternion(values[3], values[4], values[5], values[6]),
+                btVector3(values[0], values[1], values[2])
+            );
+            btVector3 linear_velocity(values[7], values[8], values[9]);
+            btVector3 angular_velocity(values[10], values[11], values[12]);
+            rigid_body.setCenterOfMassTransform(transform);
+            rigid_body.setInterpolationWorldTransform(transform);
+            rigid_body.setLinearVelocity(linear_velocity);
+            rigid_body.setInterpolationLinearVelocity(linear_velocity);
+            rigid_body.setAngularVelocity(angular_velocity);
+            rigid_body.setInterpolationAngularVelocity(angular_velocity);
+            rigid_body.clearForces();
+            rigid_body.activate();
+            rigid_body.getMotionState()->setWorldTransform(transform);
+        }
+    }
+    StepMotionStates();
+    accumulated_time_ = btScalar(0.0f);
     world_->getBroadphase()->resetPool(world_->getDispatcher());
     world_->getConstraintSolver()->reset();
 }
 
 inline void BulletPhysicsReactor::React(float step) {
-    world_->stepSimulation(step, 60);
+    UpdateLod();
+    accumulated_time_ += btScalar(step);
+    last_step_num_ = 0;
+    step_checksums_.clear();
+    while(accumulated_time_>=fixed_step_) {
+        if(last_step_num_==max_step_num_&&!deterministic_) {
+            // Too far behind: drop the time rather than spiral.
+            accumulated_time_ = btScalar(0.0f);
+            break;
+        }
+        StepMotionStates();
+        StepSimulation();
+        accumulated_time_ -= fixed_step_;
+        ++last_step_num_;
+    }
+    SynchronizeMotionStates(accumulated_time_/fixed_step_);
+    UpdateGroupStats();
+}
+
+inline void BulletPhysicsReactor::Settle(int step_num) {
+    if(step_num<=0) {
+        return;
+    }
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        (*i)->BeginSettle();
+    }
+
+    // Kinematics arrive halfway, the rest of the steps let the bodies catch up.
+    int move_num = (step_num+1)/2;
+    step_checksums_.clear();
+    for(int k=0;k<step_num;++k) {
+        btScalar alpha = btMin(btScalar(k+1)/btScalar(move_num), btScalar(1.0f));
+        for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+            (*i)->settle_alpha = alpha;
+        }
+        StepSimulation();
+    }
+
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        PoserBinding& binding = **i;
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            btRigidBody& rigid_body = binding.rigid_bodies[j];
+            rigid_body.setAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+            rigid_body.setInterpolationAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+            rigid_body.setLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
+            rigid_body.setInterpolationLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
+            rigid_body.clearForces();
+        }
+    }
+    StepMotionStates();
+    accumulated_time_ = btScalar(0.0f);
+    SynchronizeMotionStates(btScalar(1.0f));
+}
+
+inline void BulletPhysicsReactor::SetFixedStepRate(float rate) {
+    fixed_step_ = btScalar(1.0f/rate);
+}
+
+inline float BulletPhysicsReactor::GetFixedStepRate() const {
+    return float(btScalar(1.0f)/fixed_step_);
+}
+
+inline void BulletPhysicsReactor::SetMaxStepNum(int max_step_num) {
+    max_step_num_ = max_step_num;
+}
+
+inline int BulletPhysicsReactor::GetMaxStepNum() const {
+    return max_step_num_;
+}
+
+inline int BulletPhysicsReactor::GetLastStepNum() const {
+    return last_step_num_;
+}
+
+inline void BulletPhysicsReactor::StepMotionStates() {
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        (*i)->Step();
+    }
+}
+
+inline void BulletPhysicsReactor::SynchronizeMotionStates(btScalar alpha) {
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        (*i)->Synchronize(alpha);
+        (*i)->Fix();
+    }
+}
+
+inline void BulletPhysicsReactor::SetDeterministic(bool deterministic) {
+    btContactSolverInfo& solver_info = world_->getSolverInfo();
+    if(deterministic&&!deterministic_) {
+        free_iteration_num_ = solver_info.m_numIterations;
+        free_solver_mode_ = solver_info.m_solverMode;
+        solver_info.m_numIterations = 10;
+        solver_info.m_solverMode &= ~SOLVER_RANDMIZE_ORDER;
+    } else if(!deterministic&&deterministic_) {
+        solver_info.m_numIterations = free_iteration_num_;
+        solver_info.m_solverMode = free_solver_mode_;
+    }
+    deterministic_ = deterministic;
+    step_checksums_.clear();
+    UpdateLod(); // before Reset rebuilds the world
+}
+
+inline bool BulletPhysicsReactor::IsDeterministic() const {
+    return deterministic_;
+}
+
+inline std::uint64_t BulletPhysicsReactor::GetChecksum() const {
+    std::vector<float> values;
+    for(std::vector<PoserBinding*>::const_iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        const PoserBinding& binding = **i;
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            const btTransform& transform = binding.rigid_bodies[j].getCenterOfMassTransform();
+            const btMatrix3x3& basis = transform.getBasis();
+            const btVector3& origin = transform.getOrigin();
+            for(int r=0;r<3;++r) {
+                values.push_back(float(basis[r].x()));
+                values.push_back(float(basis[r].y()));
+                values.push_back(float(basis[r].z()));
+            }
+            values.push_back(float(origin.x()));
+            values.push_back(float(origin.y()));
+            values.push_back(float(origin.z()));
+        }
+    }
+    return values.empty() ? HashFNV1a(NULL, 0) : HashFNV1a(&values[0], values.size()*sizeof(float));
+}
+
+inline const std::vector<std::uint64_t>& BulletPhysicsReactor::GetStepChecksums() const {
+    return step_checksums_;
+}
+
+inline void BulletPhysicsReactor::StepSimulation() {
+    world_->stepSimulation(fixed_step_, 0);
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        if((*i)->sleeping) {
+            (*i)->Wake(btScalar(lod_policy_.sleep_linear_velocity), btScalar(lod_policy_.sleep_angular_velocity));
+        }
+    }
+    if(deterministic_) {
+        step_checksums_.push_back(GetChecksum());
+    }
+}
+
+inline void BulletPhysicsReactor::RebuildWorld() {
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        PoserBinding& binding = **i;
+        for(size_t j=0;j<binding.constraint_num;++j) {
+            world_->removeConstraint(binding.constraints+j);
+        }
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            world_->removeRigidBody(binding.rigid_bodies+j);
+        }
+    }
+    if(has_floor_) {
+        world_->removeRigidBody(ground_rigid_body_);
+    }
+
+    // A fresh broadphase, so pairs are found in insertion order again.
+    btBroadphaseInterface* broadphase = new btDbvtBroadphase();
+    world_->setBroadphase(broadphase);
+    delete broadphase_;
+    broadphase_ = broadphase;
+    world_->getPairCache()->setOverlapFilterCallback(&poser_filter_);
 
-    for(std::map<Poser*, std::vector<PoserMotionState*>>::iterator i=motion_states_.begin();i!=motion_states_.end();++i) {
-        std::vector<PoserMotionState*>& poser_motion_states = i->second;
-        for(std::vector<PoserMotionState*>::iterator j=poser_motion_states.begin();j!=poser_motion_states.end();++j) {
-            PoserMotionState& motion_state = **j;
-            motion_state.Synchronize();
+    if(has_floor_) {
+        world_->addRigidBody(ground_rigid_body_);
+    }
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        PoserBinding& binding = **i;
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            world_->addRigidBody(binding.rigid_bodies+j, binding.groups[j], binding.masks[j]);
         }
-        for(std::vector<PoserMotionState*>::iterator j=poser_motion_states.begin();j!=poser_motion_states.end();++j) {
-            PoserMotionState& motion_state = **j;
-            motion_state.Fix();
+        for(size_t j=0;j<binding.constraint_num;++j) {
+            world_->addConstraint(binding.constraints+j);
         }
     }
 }
+
+inline BulletPhysicsReactor::LodPolicy::LodPolicy()
+  : enabled(false),
+    min_mass(0.0f),
+    min_size(0.0f),
+    far_distance(0.0f),
+    sleep(true),
+    sleep_linear_velocity(0.8f),
+    sleep_angular_velocity(1.0f)
+{}
+
+inline void BulletPhysicsReactor::SetLodPolicy(const LodPolicy& policy) {
+    lod_policy_ = policy;
+}
+
+inline const BulletPhysicsReactor::LodPolicy& BulletPhysicsReactor::GetLodPolicy() const {
+    return lod_policy_;
+}
+
+inline void BulletPhysicsReactor::SetLodViewer(const Vector3f& position) {
+    lod_viewer_.setValue(btScalar(position.p.x), btScalar(position.p.y), btScalar(position.p.z));
+}
+
+inline const std::vector<BulletPhysicsReactor::GroupStats>& BulletPhysicsReactor::GetGroupStats() const {
+    return group_stats_;
+}
+
+inline void BulletPhysicsReactor::UpdateLod() {
+    bool enabled = lod_policy_.enabled&&!deterministic_;
+    bool sleeping = enabled&&lod_policy_.sleep;
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        PoserBinding& binding = **i;
+        const Model& model = binding.poser.GetModel();
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            const Model::RigidBody& body = model.GetRigidBody(j);
+            if(body.GetType()==Model::RigidBody::RIGID_TYPE_KINEMATIC) {
+                continue;
+            }
+            bool frozen = false;
+            if(enabled) {
+                size_t group = body.GetCollisionGroup();
+                frozen = (group<lod_policy_.disabled_groups.size()&&lod_policy_.disabled_groups[group])||body.GetMass()<lod_policy_.min_mass;
+                if(!frozen&&lod_policy_.min_size>0.0f) {
+                    btVector3 center;
+                    btScalar radius;
+                    binding.collision_shapes[j]->getBoundingSphere(center, radius);
+                    frozen = radius<btScalar(lod_policy_.min_size);
+                }
+                if(!frozen&&lod_policy_.far_distance>0.0f) {
+                    // A little closer to come back, so bodies at the edge do not flicker.
+                    btScalar far_distance = btScalar(lod_policy_.far_distance)*(binding.frozen[j] ? btScalar(0.9f) : btScalar(1.0f));
+                    frozen = binding.transforms[int(j)].getOrigin().distance2(lod_viewer_)>far_distance*far_distance;
+                }
+            }
+            if(frozen!=(binding.frozen[j]!=0)) {
+                FreezeBody(binding, j, frozen);
+            }
+        }
+        if(sleeping||binding.sleeping) {
+            binding.SetSleeping(sleeping, btScalar(lod_policy_.sleep_linear_velocity), btScalar(lod_policy_.sleep_angular_velocity));
+        }
+    }
+}
+
+inline void BulletPhysicsReactor::FreezeBody(PoserBinding& binding, size_t index, bool frozen) {
+    btRigidBody& rigid_body = binding.rigid_bodies[index];
+    // Out of the world while switching, so it files the body anew.
+    world_->removeRigidBody(&rigid_body);
+    binding.frozen[index] = frozen;
+    binding.kinematic[index] = frozen;
+    if(frozen) {
+        rigid_body.setMassProps(btScalar(0.0f), btVector3(btScalar(0.0f), btScalar(0.0f), btScalar(0.0f)));
+        rigid_body.setCollisionFlags(rigid_body.getCollisionFlags()|btCollisionObject::CF_KINEMATIC_OBJECT);
+        rigid_body.forceActivationState(DISABLE_DEACTIVATION);
+    } else {
+        btScalar mass = btScalar(binding.poser.GetModel().GetRigidBody(index).GetMass());
+        btVector3 local_inertia(btScalar(0.0f), btScalar(0.0f), btScalar(0.0f));
+        rigid_body.getCollisionShape()->calculateLocalInertia(mass, local_inertia);
+        rigid_body.setCollisionFlags(rigid_body.getCollisionFlags()&~btCollisionObject::CF_KINEMATIC_OBJECT);
+        rigid_body.setMassProps(mass, local_inertia);
+        rigid_body.updateInertiaTensor();
+        // Simulation picks up from the animated pose.
+        const btTransform& transform = binding.transforms[int(index)];
+        rigid_body.setCenterOfMassTransform(transform);
+        rigid_body.setInterpolationWorldTransform(transform);
+        binding.previous_transforms[int(index)] = transform;
+        rigid_body.forceActivationState(binding.sleeping ? ACTIVE_TAG : DISABLE_DEACTIVATION);
+        rigid_body.setDeactivationTime(btScalar(0.0f));
+    }
+    rigid_body.setAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+    rigid_body.setInterpolationAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+    rigid_body.setLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
+    rigid_body.setInterpolationLinearVelocity(btVector3(0.0f, 0.0f, 0.0f));
+    rigid_body.clearForces();
+    world_->addRigidBody(&rigid_body, binding.groups[index], binding.masks[index]);
+}
+
+inline void BulletPhysicsReactor::UpdateGroupStats() {
+    group_stats_.assign(16, GroupStats());
+    for(std::vector<PoserBinding*>::const_iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        const PoserBinding& binding = **i;
+        const Model& model = binding.poser.GetModel();
+        for(size_t j=0;j<binding.rigid_body_num;++j) {
+            const Model::RigidBody& body = model.GetRigidBody(j);
+            // Models built in code may carry groups past the mask, which the readers reject.
+            if(body.GetType()==Model::RigidBody::RIGID_TYPE_KINEMATIC||body.GetCollisionGroup()>=group_stats_.size()) {
+                continue;
+            }
+            GroupStats& stats = group_stats_[body.GetCollisionGroup()];
+            ++stats.body_num;
+            if(!binding.frozen[j]) {
+                ++stats.simulated_num;
+                if(binding.rigid_bodies[j].isActive()) {
+                    ++stats.awake_num;
+                }
+            }
+        }
+        // A joint counts toward the group of its awake body, the child's if both are.
+        for(size_t j=0;j<binding.constraint_num;++j) {
+            const btTypedConstraint& constraint = binding.constraints[j];
+            size_t body = size_t(&constraint.getRigidBodyB()-binding.rigid_bodies);
+            if(binding.kinematic[body]||!binding.rigid_bodies[body].isActive()) {
+                body = size_t(&constraint.getRigidBodyA()-binding.rigid_bodies);
+                if(binding.kinematic[body]||!binding.rigid_bodies[body].isActive()) {
+                    continue;
+                }
+            }
+            size_t group = model.GetRigidBody(body).GetCollisionGroup();
+            if(group<group_stats_.size()) {
+                ++group_stats_[group].constraint_num;
+            }
+        }
+    }
+}
+
+inline bool BulletPhysicsReactor::PoserFilter::needBroadphaseCollision(btBroadphaseProxy* proxy0, btBroadphaseProxy* proxy1) const {
+    if((proxy0->m_collisionFilterGroup&proxy1->m_collisionFilterMask)==0||(proxy1->m_collisionFilterGroup&proxy0->m_collisionFilterMask)==0) {
+        return false;
+    }
+    const PoserBinding* binding0 = static_cast<const PoserBinding*>(static_cast<btCollisionObject*>(proxy0->m_clientObject)->getUserPointer());
+    const PoserBinding* binding1 = static_cast<const PoserBinding*>(static_cast<btCollisionObject*>(proxy1->m_clientObject)->getUserPointer());
+    if(binding0==NULL||binding1==NULL||binding0==binding1) {
+        return true; // the floor, or one poser
+    }
+    return (binding0->scene_group&binding1->scene_mask)!=0&&(binding1->scene_group&binding0->scene_mask)!=0;
+}
+
+inline void BulletPhysicsReactor::SetPoserOffset(const Poser& poser, const Vector3f& offset) {
+    PoserBinding* binding = FindBinding(poser);
+    if(binding==NULL) {
+        return;
+    }
+    btVector3 bt_offset(btScalar(offset.p.x), btScalar(offset.p.y), btScalar(offset.p.z));
+    btVector3 move = bt_offset-binding->offset;
+    binding->offset = bt_offset;
+    // Kinematic bodies too, or the jump would show as a velocity.
+    for(size_t i=0;i<binding->rigid_body_num;++i) {
+        btRigidBody& rigid_body = binding->rigid_bodies[i];
+        btTransform transform = rigid_body.getCenterOfMassTransform();
+        transform.getOrigin() += move;
+        rigid_body.setCenterOfMassTransform(transform);
+        rigid_body.setInterpolationWorldTransform(transform);
+        binding->transforms[int(i)].getOrigin() += move;
+        binding->previous_transforms[int(i)].getOrigin() += move;
+        binding->settle_transforms[int(i)].getOrigin() += move;
+    }
+}
+
+inline Vector3f BulletPhysicsReactor::GetPoserOffset(const Poser& poser) const {
+    Vector3f offset;
+    offset.p.x = offset.p.y = offset.p.z = 0.0f;
+    const PoserBinding* binding = FindBinding(poser);
+    if(binding!=NULL) {
+        offset.p.x = float(binding->offset.x());
+        offset.p.y = float(binding->offset.y());
+        offset.p.z = float(binding->offset.z());
+    }
+    return offset;
+}
+
+inline void BulletPhysicsReactor::SetPoserCollision(const Poser& poser, unsigned scene_group, unsigned scene_mask) {
+    PoserBinding* binding = FindBinding(poser);
+    if(binding==NULL||(binding->scene_group==scene_group&&binding->scene_mask==scene_mask)) {
+        return;
+    }
+    binding->scene_group = scene_group;
+    binding->scene_mask = scene_mask;
+    // Filed anew, so pairs already found are filtered again.
+    for(size_t i=0;i<binding->rigid_body_num;++i) {
+        world_->removeRigidBody(binding->rigid_bodies+i);
+        world_->addRigidBody(binding->rigid_bodies+i, binding->groups[i], binding->masks[i]);
+    }
+}
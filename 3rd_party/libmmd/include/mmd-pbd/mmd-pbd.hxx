@@ -0,0 +1,229 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+/**
+  A light physics binding for the rigid body chains MMD models are made of,
+  hair, skirts and accessories, as an alternative to mmd-bullet. It needs
+  nothing but libmmd and the standard library.
+
+  Rigid bodies physics moves are simulated as particles with position based
+  dynamics, in small fixed substeps of one pass each (XPBD). Every dynamic
+  body hangs from one parent, over the first joint found on the way to a
+  kinematic body; its remaining joints are kept as links. Per substep, root
+  to tip:
+
+    - the body keeps to its rest distance from the joint, when the parent
+      is kinematic, or from the parent itself, within the joint's
+      translation limits, and within a cone of the joint's largest rotation
+      limit around its rest direction; the joint's rotation spring pulls it
+      back to rest with the matching compliance. A dynamic parent takes its
+      share of the correction by inverse mass.
+    - links pull the joint anchors of the two bodies together.
+    - the body is pushed out of the kinematic bodies it collides with, as
+      the collision groups and masks allow, and off the floor.
+    - the body takes the rotation of its parent, turned by the shortest arc
+      from its rest direction to where it is.
+
+  Kinematic bodies move from where the last React left them to the current
+  pose across the steps and substeps of a React, so fast motions do not
+  tunnel through them.
+
+  Simplifications against mmd-bullet: dynamic bodies collide as spheres (of
+  their smallest extent) and only with kinematic bodies of their own poser;
+  kinematic boxes collide as the capsule spanning their two larger extents;
+  twist about a chain is inherited from its parent, not simulated.
+
+  Bodies joined by links or joints form an island; islands do not interact,
+  so with thread_num above 1 they are stepped on worker threads. Particle
+  state is stored structure-of-arrays, an island contiguous, and collision
+  tests run four kinematic bodies at a time with SSE2.
+**/
+#ifndef __MMD_PBD_HXX_208548ED2FC1E2FDE31292122F5962CE_INCLUDED__
+#define __MMD_PBD_HXX_208548ED2FC1E2FDE31292122F5962CE_INCLUDED__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace mmd {
+    class PbdPhysicsReactor : public PhysicsReactor {
+    public:
+        // Islands are spread over thread_num threads, the calling one included.
+        explicit PbdPhysicsReactor(int thread_num = 1);
+        virtual ~PbdPhysicsReactor();
+
+        int GetThreadNum() const;
+
+        /*virtual*/ void AddPoser(Poser &poser);
+        /*virtual*/ void RemovePoser(Poser &poser);
+        /*virtual*/ void Reset();
+        /*virtual*/ void React(float step);
+
+        // As BulletPhysicsReactor: fixed steps of 1/rate seconds, interpolated.
+        void SetFixedStepRate(float rate);
+        float GetFixedStepRate() const;
+        void SetMaxStepNum(int max_step_num);
+        int GetMaxStepNum() const;
+        int GetLastStepNum() const;
+
+        // Solver passes per fixed step; more are stiffer and cost linearly.
+        void SetSubstepNum(int substep_num);
+        int GetSubstepNum() const;
+
+        /*virtual*/ void SetGravityStrength(float strength);
+        /*virtual*/ void SetGravityDirection(const Vector3f &direction);
+
+        /*virtual*/ float GetGravityStrength() const;
+        /*virtual*/ Vector3f GetGravityDirection() const;
+
+        /*virtual*/ void SetFloor(bool has_floor);
+        /*virtual*/ bool IsHasFloor() const;
+
+        // As BulletPhysicsReactor::GetPhysicsBones.
+        void GetPhysicsBones(const Poser &poser, std::vector<size_t> &bones, std::vector<size_t> &fixed_bones) const;
+
+    private:
+        /**
+          Physics of one poser. Vectors are component blocks: x of every
+          entry, then y, then z (and w), as MotionPlayer lays out its curves.
+          Particles are ordered island by island, parents before children.
+        **/
+        class PoserBinding {
+        public:
+            PoserBinding(Poser &poser);
+
+            void ComputeBodyTransform(size_t body, float *rotation, float *position) const;
+            void UpdateKinematics();
+            void CommitKinematics();
+            void GetKinematicTransform(size_t body, float t, float *rotation, float *position) const;
+            void ResetParticles();
+            void Synchronize(float alpha);
+            void Fix();
+
+            Poser &poser;
+
+            // Per rigid body, in model order.
+            size_t body_num;
+            std::vector<size_t> bones;
+            std::vector<float> body_rotations;
+            std::vector<float> body_positions;
+            std::vector<size_t> body_particles; // nil for kinematic bodies
+            // Kinematic bodies where the last React left them, and now.
+            std::vector<float> kinematic_rotations[2];
+            std::vector<float> kinematic_positions[2];
+            std::vector<size_t> kinematic_bodies;
+
+            size_t particle_num;
+            std::vector<size_t> particle_bodies;
+            std::vector<char> ghosts; // simulated, but do not pose their bones
+            std::vector<size_t> strict_particles;
+            std::vector<size_t> parent_bodies; // nil for free bodies
+            std::vector<size_t> parent_particles; // nil for kinematic parents
+            std::vector<float> joints; // in the parent body's frame
+            std::vector<float> offsets; // rest body position from the joint, parent frame
+            std::vector<float> rest_rotations; // relative to the parent
+            std::vector<float> min_lengths;
+            std::vector<float> max_lengths;
+            std::vector<float> cone_cosines; // of the largest angle off rest
+            std::vector<float> cone_sines;
+            std::vector<float> bend_stiffnesses;
+            std::vector<float> inverse_masses;
+            std::vector<float> damps;
+            std::vector<float> retains; // velocity kept per substep
+            std::vector<float> radii;
+            std::vector<unsigned> groups;
+            std::vector<unsigned> masks;
+
+            std::vector<float> positions;
+            std::vector<float> velocities;
+            std::vector<float> substep_positions; // before the current substep
+            std::vector<float> step_positions; // before the last step
+            std::vector<float> rotations;
+            std::vector<float> step_rotations;
+
+            // Joints to bodies other than the parent; a is always a particle.
+            size_t link_num;
+            std::vector<size_t> link_particles[2]; // b nil when kinematic
+            std::vector<size_t> link_bodies[2];
+            std::vector<float> link_anchors[2]; // in each body's frame
+            std::vector<float> link_slacks;
+
+            // Kinematic bodies as capsules: the segment ends at the last React
+            // and their move since, radius and filter.
+            size_t collider_num;
+            std::vector<size_t> collider_bodies;
+            std::vector<float> collider_axes; // half segment in the body frame
+            std::vector<float> collider_ends[2];
+            std::vector<float> collider_moves[2];
+            std::vector<float> collider_radii;
+            std::vector<unsigned> collider_groups;
+            std::vector<unsigned> collider_masks;
+
+            // Island boundaries, island_num+1 each.
+            std::vector<size_t> island_particles;
+            std::vector<size_t> island_links;
+
+        private:
+            PoserBinding(const PoserBinding&);
+            PoserBinding &operator=(const PoserBinding&);
+        };
+
+        struct Island {
+            PoserBinding *binding;
+            size_t particle_begin;
+            size_t particle_end;
+            size_t link_begin;
+            size_t link_end;
+        };
+
+        PbdPhysicsReactor(const PbdPhysicsReactor&);
+        PbdPhysicsReactor &operator=(const PbdPhysicsReactor&);
+
+        PoserBinding *FindBinding(const Poser &poser) const;
+        void BuildIslands();
+        void RunIslands(int step_num);
+        void RunWorker();
+        void RunIsland(const Island &island, int step_num);
+        void StepIsland(const Island &island, float t0, float t1);
+        void Collide(PoserBinding &binding, size_t particle, float t) const;
+
+        static void Multiply(const float *a, const float *b, float *result);
+        static void Rotate(const float *q, const float *v, float *result);
+        static void NLerp(const float *a, const float *b, float t, float *result);
+        static void ShortestArc(const float *from, const float *to, float *result);
+        static void MatrixToQuaternion(const Matrix4f &m, float *q);
+
+        std::vector<PoserBinding*> bindings_; // in the order posers were added
+        std::vector<Island> islands_;
+
+        float gravity_direction_[3];
+        float gravity_strength_;
+        bool has_floor_;
+
+        float fixed_step_;
+        int max_step_num_;
+        int substep_num_;
+        float accumulated_time_;
+        int last_step_num_;
+
+        int thread_num_;
+        std::vector<std::thread> workers_;
+        std::mutex mutex_;
+        std::condition_variable start_condition_;
+        std::condition_variable done_condition_;
+        size_t generation_;
+        int busy_num_;
+        bool quit_;
+        std::atomic<size_t> next_island_;
+        int task_step_num_;
+    };
+
+#include "mmd-pbd_impl.inl"
+} /* End of namespace mmd */
+
+#endif /* __MMD_PBD_HXX_208548ED2FC1E2FDE31292122F5962CE_INCLUDED__ */
@@ -0,0 +1,1205 @@
+
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+// Quaternions are (x, y, z, w) in four floats, rotating column vectors.
+inline void PbdPhysicsReactor::Multiply(const float *a, const float *b, float *result) {
+    float q[4] = {
+        a[3]*b[0]+a[0]*b[3]+a[1]*b[2]-a[2]*b[1],
+        a[3]*b[1]-a[0]*b[2]+a[1]*b[3]+a[2]*b[0],
+        a[3]*b[2]+a[0]*b[1]-a[1]*b[0]+a[2]*b[3],
+        a[3]*b[3]-a[0]*b[0]-a[1]*b[1]-a[2]*b[2]
+    };
+    std::memcpy(result, q, sizeof(q));
+}
+
+inline void PbdPhysicsReactor::Rotate(const float *q, const float *v, float *result) {
+    // v+2w(u x v)+2u x (u x v), u the vector part
+    float t[3] = {
+        2.0f*(q[1]*v[2]-q[2]*v[1]),
+        2.0f*(q[2]*v[0]-q[0]*v[2]),
+        2.0f*(q[0]*v[1]-q[1]*v[0])
+    };
+    float r[3] = {
+        v[0]+q[3]*t[0]+q[1]*t[2]-q[2]*t[1],
+        v[1]+q[3]*t[1]+q[2]*t[0]-q[0]*t[2],
+        v[2]+q[3]*t[2]+q[0]*t[1]-q[1]*t[0]
+    };
+    std::memcpy(result, r, sizeof(r));
+}
+
+inline void PbdPhysicsReactor::NLerp(const float *a, const float *b, float t, float *result) {
+    float dot = a[0]*b[0]+a[1]*b[1]+a[2]*b[2]+a[3]*b[3];
+    float s = 1.0f-t;
+    if(dot<0.0f) {
+        t = -t;
+    }
+    float q[4];
+    float norm = 0.0f;
+    for(size_t c=0;c<4;++c) {
+        q[c] = a[c]*s+b[c]*t;
+        norm += q[c]*q[c];
+    }
+    norm = 1.0f/std::sqrt(norm);
+    for(size_t c=0;c<4;++c) {
+        result[c] = q[c]*norm;
+    }
+}
+
+// The smallest rotation turning unit vector from onto unit vector to.
+inline void PbdPhysicsReactor::ShortestArc(const float *from, const float *to, float *result) {
+    float dot = from[0]*to[0]+from[1]*to[1]+from[2]*to[2];
+    float q[4];
+    if(dot<-0.9999f) {
+        // Half a turn about any axis normal to from.
+        q[0] = 0.0f; q[1] = -from[2]; q[2] = from[1]; q[3] = 0.0f;
+        if(q[1]*q[1]+q[2]*q[2]<1e-6f) {
+            q[0] = from[2]; q[1] = 0.0f; q[2] = -from[0];
+        }
+    } else {
+        q[0] = from[1]*to[2]-from[2]*to[1];
+        q[1] = from[2]*to[0]-from[0]*to[2];
+        q[2] = from[0]*to[1]-from[1]*to[0];
+        q[3] = 1.0f+dot;
+    }
+    float norm = 1.0f/std::sqrt(q[0]*q[0]+q[1]*q[1]+q[2]*q[2]+q[3]*q[3]);
+    for(size_t c=0;c<4;++c) {
+        result[c] = q[c]*norm;
+    }
+}
+
+// libmmd matrices transform row vectors: the rotation is the transpose.
+inline void PbdPhysicsReactor::MatrixToQuaternion(const Matrix4f &m, float *q) {
+    float v[16];
+    std::memcpy(v, &m, sizeof(v));
+    float r00 = v[0], r11 = v[5], r22 = v[10];
+    float trace = r00+r11+r22;
+    if(trace>0.0f) {
+        float s = 2.0f*std::sqrt(trace+1.0f);
+        q[3] = 0.25f*s;
+        q[0] = (v[6]-v[9])/s;
+        q[1] = (v[8]-v[2])/s;
+        q[2] = (v[1]-v[4])/s;
+    } else if(r00>r11&&r00>r22) {
+        float s = 2.0f*std::sqrt(1.0f+r00-r11-r22);
+        q[3] = (v[6]-v[9])/s;
+        q[0] = 0.25f*s;
+        q[1] = (v[4]+v[1])/s;
+        q[2] = (v[8]+v[2])/s;
+    } else if(r11>r22) {
+        float s = 2.0f*std::sqrt(1.0f+r11-r00-r22);
+        q[3] = (v[8]-v[2])/s;
+        q[0] = (v[4]+v[1])/s;
+        q[1] = 0.25f*s;
+        q[2] = (v[9]+v[6])/s;
+    } else {
+        float s = 2.0f*std::sqrt(1.0f+r22-r00-r11);
+        q[3] = (v[1]-v[4])/s;
+        q[0] = (v[8]+v[2])/s;
+        q[1] = (v[9]+v[6])/s;
+        q[2] = 0.25f*s;
+    }
+}
+
+
+inline PbdPhysicsReactor::PoserBinding::PoserBinding(Poser &poser)
+  : poser(poser), body_num(0), particle_num(0), link_num(0), collider_num(0) {}
+
+// Where the current pose puts a body: its bone's skinning after the body's rest transform.
+inline void PbdPhysicsReactor::PoserBinding::ComputeBodyTransform(size_t body, float *rotation, float *position) const {
+    const Matrix4f &skinning = PbdPhysicsReactor::GetPoserBoneImage(poser, bones[body]).skinning_matrix_;
+    float skinning_rotation[4];
+    PbdPhysicsReactor::MatrixToQuaternion(skinning, skinning_rotation);
+    float body_rotation[4];
+    float body_position[3];
+    for(size_t c=0;c<4;++c) {
+        body_rotation[c] = body_rotations[c*body_num+body];
+    }
+    for(size_t c=0;c<3;++c) {
+        body_position[c] = body_positions[c*body_num+body];
+    }
+    PbdPhysicsReactor::Multiply(skinning_rotation, body_rotation, rotation);
+    PbdPhysicsReactor::Rotate(skinning_rotation, body_position, position);
+    for(size_t c=0;c<3;++c) {
+        position[c] += skinning.v[12+c];
+    }
+}
+
+inline void PbdPhysicsReactor::PoserBinding::UpdateKinematics() {
+    for(std::vector<size_t>::const_iterator i=kinematic_bodies.begin();i!=kinematic_bodies.end();++i) {
+        float rotation[4];
+        float position[3];
+        ComputeBodyTransform(*i, rotation, position);
+        for(size_t c=0;c<4;++c) {
+            kinematic_rotations[1][c*body_num+*i] = rotation[c];
+        }
+        for(size_t c=0;c<3;++c) {
+            kinematic_positions[1][c*body_num+*i] = position[c];
+        }
+    }
+    for(size_t j=0;j<collider_num;++j) {
+        size_t body = collider_bodies[j];
+        float axis[3] = {collider_axes[j], collider_axes[collider_num+j], collider_axes[2*collider_num+j]};
+        float ends[2][2][3];
+        for(size_t k=0;k<2;++k) {
+            float rotation[4];
+            for(size_t c=0;c<4;++c) {
+                rotation[c] = kinematic_rotations[k][c*body_num+body];
+            }
+            float half[3];
+            PbdPhysicsReactor::Rotate(rotation, axis, half);
+            for(size_t c=0;c<3;++c) {
+                float center = kinematic_positions[k][c*body_num+body];
+                ends[k][0][c] = center+half[c];
+                ends[k][1][c] = center-half[c];
+            }
+        }
+        for(size_t e=0;e<2;++e) {
+            for(size_t c=0;c<3;++c) {
+                collider_ends[e][c*collider_num+j] = ends[0][e][c];
+                collider_moves[e][c*collider_num+j] = ends[1][e][c]-ends[0][e][c];
+            }
+        }
+    }
+}
+
+inline void PbdPhysicsReactor::PoserBinding::CommitKinematics() {
+    kinematic_rotations[0] = kinematic_rotations[1];
+    kinematic_positions[0] = kinematic_positions[1];
+    for(size_t e=0;e<2;++e) {
+        for(size_t i=0;i<3*collider_num;++i) {
+            collider_ends[e][i] += collider_moves[e][i];
+            collider_moves[e][i] = 0.0f;
+        }
+    }
+}
+
+inline void PbdPhysicsReactor::PoserBinding::GetKinematicTransform(size_t body, float t, float *rotation, float *position) const {
+    float from[4], to[4];
+    for(size_t c=0;c<4;++c) {
+        from[c] = kinematic_rotations[0][c*body_num+body];
+        to[c] = kinematic_rotations[1][c*body_num+body];
+    }
+    PbdPhysicsReactor::NLerp(from, to, t, rotation);
+    for(size_t c=0;c<3;++c) {
+        float p0 = kinematic_positions[0][c*body_num+body];
+        position[c] = p0+(kinematic_positions[1][c*body_num+body]-p0)*t;
+    }
+}
+
+inline void PbdPhysicsReactor::PoserBinding::ResetParticles() {
+    UpdateKinematics();
+    CommitKinematics();
+    for(size_t i=0;i<particle_num;++i) {
+        float rotation[4];
+        float position[3];
+        ComputeBodyTransform(particle_bodies[i], rotation, position);
+        for(size_t c=0;c<4;++c) {
+            rotations[c*particle_num+i] = rotation[c];
+        }
+        for(size_t c=0;c<3;++c) {
+            positions[c*particle_num+i] = position[c];
+        }
+    }
+    std::fill(velocities.begin(), velocities.end(), 0.0f);
+    substep_positions = positions;
+    step_positions = positions;
+    step_rotations = rotations;
+}
+
+inline void PbdPhysicsReactor::PoserBinding::Synchronize(float alpha) {
+    for(size_t i=0;i<particle_num;++i) {
+        if(ghosts[i]) {
+            continue;
+        }
+        float from[4], to[4], rotation[4], position[3];
+        for(size_t c=0;c<4;++c) {
+            from[c] = step_rotations[c*particle_num+i];
+            to[c] = rotations[c*particle_num+i];
+        }
+        PbdPhysicsReactor::NLerp(from, to, alpha, rotation);
+        for(size_t c=0;c<3;++c) {
+            float p0 = step_positions[c*particle_num+i];
+            position[c] = p0+(positions[c*particle_num+i]-p0)*alpha;
+        }
+
+        // skinning = world*rest^-1
+        size_t body = particle_bodies[i];
+        float body_rotation_inv[4] = {
+            -body_rotations[body], -body_rotations[body_num+body],
+            -body_rotations[2*body_num+body], body_rotations[3*body_num+body]
+        };
+        float body_position[3] = {
+            body_positions[body], body_positions[body_num+body], body_positions[2*body_num+body]
+        };
+        float skinning_rotation[4];
+        PbdPhysicsReactor::Multiply(rotation, body_rotation_inv, skinning_rotation);
+        float moved[3];
+        PbdPhysicsReactor::Rotate(skinning_rotation, body_position, moved);
+
+        Quaternionf q;
+        q.i = skinning_rotation[0];
+        q.j = skinning_rotation[1];
+        q.k = skinning_rotation[2];
+        q.e = skinning_rotation[3];
+        Matrix4f &skinning = PbdPhysicsReactor::GetPoserBoneImage(poser, bones[body]).skinning_matrix_;
+        skinning = q.ToRotateMatrix();
+        for(size_t c=0;c<3;++c) {
+            skinning.v[12+c] = position[c]-moved[c];
+        }
+    }
+}
+
+inline void PbdPhysicsReactor::PoserBinding::Fix() {
+    for(std::vector<size_t>::const_iterator i=strict_particles.begin();i!=strict_particles.end();++i) {
+        PbdPhysicsReactor::BoneImageReference target = PbdPhysicsReactor::GetPoserBoneImage(poser, bones[particle_bodies[*i]]);
+        Matrix4f parent_local_matrix;
+        target.local_matrix_ = target.global_offset_matrix_inv_*target.skinning_matrix_;
+        if(target.has_parent_) {
+            parent_local_matrix = PbdPhysicsReactor::GetPoserBoneImage(poser, target.parent_).local_matrix_;
+            target.local_matrix_ = target.local_matrix_*parent_local_matrix.Inverse();
+        }
+        target.local_matrix_.r.v[3].downgrade.vector3d = target.total_translation_+target.local_offset_;
+        if(target.has_parent_) {
+            target.local_matrix_ = target.local_matrix_*parent_local_matrix;
+        }
+        target.skinning_matrix_ = target.global_offset_matrix_*target.local_matrix_;
+    }
+}
+
+
+inline PbdPhysicsReactor::PbdPhysicsReactor(int thread_num)
+  : gravity_strength_(9.8f),
+    has_floor_(true),
+    fixed_step_(1.0f/60.0f),
+    max_step_num_(4),
+    substep_num_(4),
+    accumulated_time_(0.0f),
+    last_step_num_(0),
+    thread_num_(1),
+    generation_(0),
+    busy_num_(0),
+    quit_(false),
+    next_island_(0),
+    task_step_num_(0)
+{
+    gravity_direction_[0] = 0.0f;
+    gravity_direction_[1] = -1.0f;
+    gravity_direction_[2] = 0.0f;
+
+    int core_num = int(std::thread::hardware_concurrency());
+    if(thread_num>1&&core_num>1) {
+        thread_num_ = std::min(thread_num, core_num);
+    }
+    for(int i=1;i<thread_num_;++i) {
+        workers_.push_back(std::thread(&PbdPhysicsReactor::RunWorker, this));
+    }
+}
+
+inline PbdPhysicsReactor::~PbdPhysicsReactor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    start_condition_.notify_all();
+    for(std::vector<std::thread>::iterator i=workers_.begin();i!=workers_.end();++i) {
+        i->join();
+    }
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        delete *i;
+    }
+}
+
+inline int PbdPhysicsReactor::GetThreadNum() const {
+    return thread_num_;
+}
+
+inline PbdPhysicsReactor::PoserBinding *PbdPhysicsReactor::FindBinding(const Poser &poser) const {
+    for(std::vector<PoserBinding*>::const_iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        if(&(*i)->poser==&poser) {
+            return *i;
+        }
+    }
+    return NULL;
+}
+
+inline void PbdPhysicsReactor::AddPoser(Poser &poser) {
+    const Model &model = poser.GetModel();
+
+    if(FindBinding(poser)!=NULL) {
+        return;
+    }
+
+    poser.ResetPosing();
+
+    PoserBinding *binding = new PoserBinding(poser);
+    size_t n = model.GetRigidBodyNum();
+    binding->body_num = n;
+    binding->bones.resize(n);
+    binding->body_rotations.resize(4*n);
+    binding->body_positions.resize(3*n);
+    binding->body_particles.assign(n, nil);
+    binding->kinematic_rotations[0].resize(4*n);
+    binding->kinematic_rotations[1].resize(4*n);
+    binding->kinematic_positions[0].resize(3*n);
+    binding->kinematic_positions[1].resize(3*n);
+
+    std::vector<char> dynamic(n);
+    for(size_t i=0;i<n;++i) {
+        const Model::RigidBody &body = model.GetRigidBody(i);
+        Quaternionf rotation = YXZToQuaternion(body.GetRotation());
+        float q[4] = {rotation.i, rotation.j, rotation.k, rotation.e};
+        for(size_t c=0;c<4;++c) {
+            binding->body_rotations[c*n+i] = q[c];
+        }
+        for(size_t c=0;c<3;++c) {
+            binding->body_positions[c*n+i] = body.GetPosition().v[c];
+        }
+        binding->bones[i] = body.GetAssociatedBoneIndex();
+        dynamic[i] = body.GetType()!=Model::RigidBody::RIGID_TYPE_KINEMATIC;
+        if(!dynamic[i]) {
+            binding->kinematic_bodies.push_back(i);
+        }
+    }
+
+    // Joints, each dynamic body hanging from the first found towards a kinematic body.
+    std::vector<std::vector<std::pair<size_t, size_t> > > edges(n);
+    for(size_t i=0;i<model.GetConstraintNum();++i) {
+        const Model::Constraint &constraint = model.GetConstraint(i);
+        size_t a = constraint.GetAssociatedRigidBodyIndex(0);
+        size_t b = constraint.GetAssociatedRigidBodyIndex(1);
+        if(a>=n||b>=n||a==b||(!dynamic[a]&&!dynamic[b])) {
+            continue;
+        }
+        edges[a].push_back(std::make_pair(b, i));
+        edges[b].push_back(std::make_pair(a, i));
+    }
+    std::vector<size_t> parents(n, nil);
+    std::vector<size_t> parent_constraints(n, nil);
+    std::vector<char> tree_constraints(model.GetConstraintNum());
+    std::vector<char> visited(n);
+    std::vector<size_t> order; // dynamic bodies, parents first
+    std::deque<size_t> queue(binding->kinematic_bodies.begin(), binding->kinematic_bodies.end());
+    for(std::vector<size_t>::const_iterator i=binding->kinematic_bodies.begin();i!=binding->kinematic_bodies.end();++i) {
+        visited[*i] = true;
+    }
+    for(size_t root=0;root<=n;++root) {
+        while(!queue.empty()) {
+            size_t u = queue.front();
+            queue.pop_front();
+            for(std::vector<std::pair<size_t, size_t> >::const_iterator e=edges[u].begin();e!=edges[u].end();++e) {
+                if(!visited[e->first]) {
+                    visited[e->first] = true;
+                    parents[e->first] = u;
+                    parent_constraints[e->first] = e->second;
+                    tree_constraints[e->second] = true;
+                    order.push_back(e->first);
+                    queue.push_back(e->first);
+                }
+            }
+        }
+        // Bodies no joint leads to fall freely, and their chains with them.
+        if(root<n&&!visited[root]) {
+            visited[root] = true;
+            order.push_back(root);
+            queue.push_back(root);
+        }
+    }
+
+    // Islands: dynamic bodies joined by joints or links.
+    std::vector<size_t> islands(n);
+    for(size_t i=0;i<n;++i) {
+        islands[i] = i;
+    }
+    for(size_t i=0;i<model.GetConstraintNum();++i) {
+        const Model::Constraint &constraint = model.GetConstraint(i);
+        size_t a = constraint.GetAssociatedRigidBodyIndex(0);
+        size_t b = constraint.GetAssociatedRigidBodyIndex(1);
+        if(a>=n||b>=n||!dynamic[a]||!dynamic[b]) {
+            continue;
+        }
+        while(islands[a]!=a) {
+            a = islands[a] = islands[islands[a]];
+        }
+        while(islands[b]!=b) {
+            b = islands[b] = islands[islands[b]];
+        }
+        islands[std::max(a, b)] = std::min(a, b);
+    }
+    std::vector<size_t> island_of(n, nil);
+    std::vector<std::vector<size_t> > island_bodies;
+    for(std::vector<size_t>::const_iterator i=order.begin();i!=order.end();++i) {
+        size_t root = *i;
+        while(islands[root]!=root) {
+            root = islands[root];
+        }
+        if(island_of[root]==nil) {
+            island_of[root] = island_bodies.size();
+            island_bodies.push_back(std::vector<size_t>());
+        }
+        island_of[*i] = island_of[root];
+        island_bodies[island_of[root]].push_back(*i);
+    }
+
+    size_t m = order.size();
+    binding->particle_num = m;
+    binding->ghosts.resize(m);
+    binding->parent_bodies.resize(m);
+    binding->parent_particles.resize(m);
+    binding->joints.assign(3*m, 0.0f);
+    binding->offsets.assign(3*m, 0.0f);
+    binding->rest_rotations.assign(4*m, 0.0f);
+    binding->min_lengths.resize(m);
+    binding->max_lengths.resize(m);
+    binding->cone_cosines.assign(m, -1.0f);
+    binding->cone_sines.assign(m, 0.0f);
+    binding->bend_stiffnesses.resize(m);
+    binding->inverse_masses.resize(m);
+    binding->damps.resize(m);
+    binding->retains.resize(m);
+    binding->radii.resize(m);
+    binding->groups.resize(m);
+    binding->masks.resize(m);
+    binding->positions.resize(3*m);
+    binding->velocities.resize(3*m);
+    binding->rotations.resize(4*m);
+    binding->island_particles.push_back(0);
+    for(std::vector<std::vector<size_t> >::const_iterator i=island_bodies.begin();i!=island_bodies.end();++i) {
+        for(std::vector<size_t>::const_iterator j=i->begin();j!=i->end();++j) {
+            binding->body_particles[*j] = binding->particle_bodies.size();
+            binding->particle_bodies.push_back(*j);
+        }
+        binding->island_particles.push_back(binding->particle_bodies.size());
+    }
+
+    for(size_t i=0;i<m;++i) {
+        size_t b = binding->particle_bodies[i];
+        const Model::RigidBody &body = model.GetRigidBody(b);
+        const Vector3f &dimensions = body.GetDimensions();
+
+        binding->ghosts[i] = body.GetType()==Model::RigidBody::RIGID_TYPE_PHYSICS_GHOST;
+        if(body.GetType()==Model::RigidBody::RIGID_TYPE_PHYSICS_STRICT) {
+            binding->strict_particles.push_back(i);
+        }
+        binding->inverse_masses[i] = body.GetMass()>0.0f ? 1.0f/body.GetMass() : 1.0f;
+        binding->damps[i] = body.GetTranslateDamp();
+        switch(body.GetShape()) {
+        case Model::RigidBody::RIGID_SHAPE_BOX:
+            binding->radii[i] = std::min(dimensions.p.x, std::min(dimensions.p.y, dimensions.p.z)); break;
+        default:
+            binding->radii[i] = dimensions.p.x; break;
+        }
+        // As mmd-bullet, a group past the 16-bit mask is in no group.
+        binding->groups[i] = body.GetCollisionGroup()<16 ? 1u<<body.GetCollisionGroup() : 0u;
+        binding->masks[i] = unsigned(body.GetCollisionMask().to_ulong());
+
+        size_t p = parents[b];
+        binding->parent_bodies[i] = p;
+        binding->parent_particles[i] = p==nil ? nil : binding->body_particles[p];
+        binding->rest_rotations[3*m+i] = 1.0f;
+        if(p==nil) {
+            continue;
+        }
+
+        // The joint and the body's rest place and rotation, in the parent's frame.
+        const Model::Constraint &constraint = model.GetConstraint(parent_constraints[b]);
+        float parent_rotation_inv[4], body_rotation[4], rest_rotation[4];
+        for(size_t c=0;c<4;++c) {
+            parent_rotation_inv[c] = (c<3 ? -1.0f : 1.0f)*binding->body_rotations[c*n+p];
+            body_rotation[c] = binding->body_rotations[c*n+b];
+        }
+        Multiply(parent_rotation_inv, body_rotation, rest_rotation);
+        float joint[3], offset[3], local[3];
+        for(size_t c=0;c<3;++c) {
+            joint[c] = constraint.GetPosition().v[c]-binding->body_positions[c*n+p];
+            offset[c] = binding->body_positions[c*n+b]-constraint.GetPosition().v[c];
+        }
+        if(dynamic[p]) {
+            for(size_t c=0;c<3;++c) {
+                offset[c] += joint[c];
+                joint[c] = 0.0f;
+            }
+        }
+        float length = std::sqrt(offset[0]*offset[0]+offset[1]*offset[1]+offset[2]*offset[2]);
+        Rotate(parent_rotation_inv, joint, local);
+        for(size_t c=0;c<3;++c) {
+            binding->joints[c*m+i] = local[c];
+        }
+        Rotate(parent_rotation_inv, offset, local);
+        for(size_t c=0;c<3;++c) {
+            binding->offsets[c*m+i] = local[c];
+        }
+        for(size_t c=0;c<4;++c) {
+            binding->rest_rotations[c*m+i] = rest_rotation[c];
+        }
+
+        float slack = 0.0f, cone = 0.0f, spring = 0.0f;
+        for(size_t c=0;c<3;++c) {
+            slack = std::max(slack, std::max(std::fabs(constraint.GetPositionLowLimit().v[c]), std::fabs(constraint.GetPositionHighLimit().v[c])));
+            cone = std::max(cone, std::max(std::fabs(constraint.GetRotationLowLimit().v[c]), std::fabs(constraint.GetRotationHighLimit().v[c])));
+            spring += constraint.GetSpringRotate().v[c]/3.0f;
+        }
+        binding->min_lengths[i] = std::max(length-slack, 0.0f);
+        binding->max_lengths[i] = length+slack;
+        binding->cone_cosines[i] = std::cos(std::min(cone, 3.14159265f));
+        binding->cone_sines[i] = std::sin(std::min(cone, 3.14159265f));
+        binding->bend_stiffnesses[i] = std::max(spring, 0.0f);
+    }
+
+    // Links, grouped by island as the particles are.
+    std::vector<std::vector<size_t> > island_links(island_bodies.size());
+    for(size_t i=0;i<model.GetConstraintNum();++i) {
+        const Model::Constraint &constraint = model.GetConstraint(i);
+        size_t a = constraint.GetAssociatedRigidBodyIndex(0);
+        size_t b = constraint.GetAssociatedRigidBodyIndex(1);
+        if(tree_constraints[i]||a>=n||b>=n||a==b||(!dynamic[a]&&!dynamic[b])) {
+            continue;
+        }
+        island_links[island_of[dynamic[a] ? a : b]].push_back(i);
+    }
+    binding->island_links.push_back(0);
+    for(std::vector<std::vector<size_t> >::const_iterator i=island_links.begin();i!=island_links.end();++i) {
+        for(std::vector<size_t>::const_iterator j=i->begin();j!=i->end();++j) {
+            const Model::Constraint &constraint = model.GetConstraint(*j);
+            size_t ends[2] = {constraint.GetAssociatedRigidBodyIndex(0), constraint.GetAssociatedRigidBodyIndex(1)};
+            if(!dynamic[ends[0]]) {
+                std::swap(ends[0], ends[1]);
+            }
+            float slack = 0.0f;
+            for(size_t c=0;c<3;++c) {
+                slack = std::max(slack, std::max(std::fabs(constraint.GetPositionLowLimit().v[c]), std::fabs(constraint.GetPositionHighLimit().v[c])));
+            }
+            binding->link_slacks.push_back(slack);
+            for(size_t k=0;k<2;++k) {
+                binding->link_bodies[k].push_back(ends[k]);
+                binding->link_particles[k].push_back(binding->body_particles[ends[k]]);
+                float rotation_inv[4], anchor[3], local[3];
+                for(size_t c=0;c<4;++c) {
+                    rotation_inv[c] = (c<3 ? -1.0f : 1.0f)*binding->body_rotations[c*n+ends[k]];
+                }
+                for(size_t c=0;c<3;++c) {
+                    anchor[c] = constraint.GetPosition().v[c]-binding->body_positions[c*n+ends[k]];
+                }
+                Rotate(rotation_inv, anchor, local);
+                binding->link_anchors[k].insert(binding->link_anchors[k].end(), local, local+3);
+            }
+        }
+        binding->island_links.push_back(binding->link_slacks.size());
+    }
+    // Anchors were gathered entry by entry; store them as blocks.
+    binding->link_num = binding->link_slacks.size();
+    for(size_t k=0;k<2;++k) {
+        std::vector<float> anchors(3*binding->link_num);
+        for(size_t i=0;i<binding->link_num;++i) {
+            for(size_t c=0;c<3;++c) {
+                anchors[c*binding->link_num+i] = binding->link_anchors[k][3*i+c];
+            }
+        }
+        binding->link_anchors[k].swap(anchors);
+    }
+
+    // Kinematic bodies as capsules.
+    size_t k = binding->kinematic_bodies.size();
+    binding->collider_num = k;
+    binding->collider_bodies = binding->kinematic_bodies;
+    binding->collider_axes.assign(3*k, 0.0f);
+    binding->collider_radii.resize(k);
+    binding->collider_groups.resize(k);
+    binding->collider_masks.resize(k);
+    for(size_t e=0;e<2;++e) {
+        binding->collider_ends[e].resize(3*k);
+        binding->collider_moves[e].resize(3*k);
+    }
+    for(size_t j=0;j<k;++j) {
+        const Model::RigidBody &body = model.GetRigidBody(binding->collider_bodies[j]);
+        const Vector3f &dimensions = body.GetDimensions();
+        switch(body.GetShape()) {
+        case Model::RigidBody::RIGID_SHAPE_SPHERE:
+            binding->collider_radii[j] = dimensions.p.x;
+            break;
+        case Model::RigidBody::RIGID_SHAPE_CAPSULE:
+            binding->collider_radii[j] = dimensions.p.x;
+            binding->collider_axes[k+j] = dimensions.p.y*0.5f;
+            break;
+        case Model::RigidBody::RIGID_SHAPE_BOX: {
+            size_t axes[3] = {0, 1, 2};
+            for(size_t a=0;a<2;++a) {
+                for(size_t b=a+1;b<3;++b) {
+                    if(dimensions.v[axes[b]]>dimensions.v[axes[a]]) {
+                        std::swap(axes[a], axes[b]);
+                    }
+                }
+            }
+            binding->collider_radii[j] = dimensions.v[axes[1]];
+            binding->collider_axes[axes[0]*k+j] = dimensions.v[axes[0]]-dimensions.v[axes[1]];
+            break;
+        }
+        }
+        binding->collider_groups[j] = body.GetCollisionGroup()<16 ? 1u<<body.GetCollisionGroup() : 0u;
+        binding->collider_masks[j] = unsigned(body.GetCollisionMask().to_ulong());
+    }
+
+    binding->ResetParticles();
+    bindings_.push_back(binding);
+    BuildIslands();
+}
+
+inline void PbdPhysicsReactor::RemovePoser(Poser &poser) {
+    PoserBinding *binding = FindBinding(poser);
+    if(binding==NULL) {
+        return;
+    }
+    bindings_.erase(std::find(bindings_.begin(), bindings_.end(), binding));
+    delete binding;
+    BuildIslands();
+}
+
+// Largest islands first, so the last ones handed out are short.
+inline void PbdPhysicsReactor::BuildIslands() {
+    islands_.clear();
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        PoserBinding &binding = **i;
+        for(size_t j=0;j+1<binding.island_particles.size();++j) {
+            Island island;
+            island.binding = &binding;
+            island.particle_begin = binding.island_particles[j];
+            island.particle_end = binding.island_particles[j+1];
+            island.link_begin = binding.island_links[j];
+            island.link_end = binding.island_links[j+1];
+            islands_.push_back(island);
+        }
+    }
+    for(size_t i=1;i<islands_.size();++i) {
+        Island island = islands_[i];
+        size_t size = island.particle_end-island.particle_begin;
+        size_t j = i;
+        for(;j>0&&islands_[j-1].particle_end-islands_[j-1].particle_begin<size;--j) {
+            islands_[j] = islands_[j-1];
+        }
+        islands_[j] = island;
+    }
+}
+
+inline void PbdPhysicsReactor::Reset() {
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        (*i)->ResetParticles();
+    }
+    accumulated_time_ = 0.0f;
+}
+
+inline void PbdPhysicsReactor::React(float step) {
+    accumulated_time_ += step;
+    last_step_num_ = 0;
+    while(accumulated_time_>=fixed_step_) {
+        if(last_step_num_==max_step_num_) {
+            // Too far behind: drop the time rather than spiral.
+            accumulated_time_ = 0.0f;
+            break;
+        }
+        accumulated_time_ -= fixed_step_;
+        ++last_step_num_;
+    }
+    if(last_step_num_>0) {
+        for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+            (*i)->UpdateKinematics();
+        }
+        RunIslands(last_step_num_);
+        for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+            (*i)->CommitKinematics();
+        }
+    }
+    for(std::vector<PoserBinding*>::iterator i=bindings_.begin();i!=bindings_.end();++i) {
+        (*i)->Synchronize(accumulated_time_/fixed_step_);
+        (*i)->Fix();
+    }
+}
+
+inline void PbdPhysicsReactor::RunIslands(int step_num) {
+    if(workers_.empty()||islands_.size()<2) {
+        for(std::vector<Island>::const_iterator i=islands_.begin();i!=islands_.end();++i) {
+            RunIsland(*i, step_num);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_step_num_ = step_num;
+        next_island_ = 0;
+        busy_num_ = int(workers_.size());
+        ++generation_;
+    }
+    start_condition_.notify_all();
+    for(size_t i=next_island_++;i<islands_.size();i=next_island_++) {
+        RunIsland(islands_[i], step_num);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(busy_num_>0) {
+        done_condition_.wait(lock);
+    }
+}
+
+inline void PbdPhysicsReactor::RunWorker() {
+    size_t generation = 0;
+    for(;;) {
+        int step_num;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while(generation_==generation&&!quit_) {
+                start_condition_.wait(lock);
+            }
+            if(quit_) {
+                return;
+            }
+            generation = generation_;
+            step_num = task_step_num_;
+        }
+        for(size_t i=next_island_++;i<islands_.size();i=next_island_++) {
+            RunIsland(islands_[i], step_num);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(--busy_num_==0) {
+                done_condition_.notify_one();
+            }
+        }
+    }
+}
+
+// Kinematic bodies move across all steps of a React, from 0 to 1.
+inline void PbdPhysicsReactor::RunIsland(const Island &island, int step_num) {
+    PoserBinding &binding = *island.binding;
+    size_t m = binding.particle_num;
+    float h = fixed_step_/float(substep_num_);
+    for(size_t i=island.particle_begin;i<island.particle_end;++i) {
+        binding.retains[i] = std::pow(std::max(1.0f-binding.damps[i], 0.0f), h);
+    }
+    for(int k=0;k<step_num;++k) {
+        if(k+1==step_num) {
+            for(size_t c=0;c<3;++c) {
+                std::copy(binding.positions.begin()+c*m+island.particle_begin, binding.positions.begin()+c*m+island.particle_end,
+                          binding.step_positions.begin()+c*m+island.particle_begin);
+            }
+            for(size_t c=0;c<4;++c) {
+                std::copy(binding.rotations.begin()+c*m+island.particle_begin, binding.rotations.begin()+c*m+island.particle_end,
+                          binding.step_rotations.begin()+c*m+island.particle_begin);
+            }
+        }
+        StepIsland(island, float(k)/float(step_num), float(k+1)/float(step_num));
+    }
+}
+
+inline void PbdPhysicsReactor::StepIsland(const Island &island, float t0, float t1) {
+    PoserBinding &binding = *island.binding;
+    const size_t m = binding.particle_num;
+    const size_t l = binding.link_num;
+    float *x = &binding.positions[0];
+    float *v = &binding.velocities[0];
+    float *s = &binding.substep_positions[0];
+    float *q = &binding.rotations[0];
+    const float *retains = &binding.retains[0];
+    const float h = fixed_step_/float(substep_num_);
+    const float h2 = h*h;
+    float gravity[3];
+    for(size_t c=0;c<3;++c) {
+        gravity[c] = gravity_direction_[c]*gravity_strength_*10.0f; // MMD units are 0.1m
+    }
+
+    for(int sub=0;sub<substep_num_;++sub) {
+        float t = t0+(t1-t0)*float(sub+1)/float(substep_num_);
+
+        // Predict.
+        for(size_t c=0;c<3;++c) {
+            float *xc = x+c*m, *vc = v+c*m, *sc = s+c*m;
+            size_t i = island.particle_begin;
+#ifdef MMD_HAS_SSE2
+            const __m128 g = _mm_set1_ps(gravity[c]*h);
+            const __m128 dt = _mm_set1_ps(h);
+            for(;i+4<=island.particle_end;i+=4) {
+                __m128 p = _mm_loadu_ps(xc+i);
+                __m128 u = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(vc+i), _mm_loadu_ps(retains+i)), g);
+                _mm_storeu_ps(sc+i, p);
+                _mm_storeu_ps(vc+i, u);
+                _mm_storeu_ps(xc+i, _mm_add_ps(p, _mm_mul_ps(u, dt)));
+            }
+#endif
+            for(;i<island.particle_end;++i) {
+                sc[i] = xc[i];
+                vc[i] = vc[i]*retains[i]+gravity[c]*h;
+                xc[i] += vc[i]*h;
+            }
+        }
+
+        // Joints, root to tip.
+        for(size_t i=island.particle_begin;i<island.particle_end;++i) {
+            size_t parent = binding.parent_particles[i];
+            if(binding.parent_bodies[i]==nil) {
+                continue;
+            }
+            float parent_rotation[4], parent_position[3];
+            if(parent==nil) {
+                binding.GetKinematicTransform(binding.parent_bodies[i], t, parent_rotation, parent_position);
+            } else {
+                for(size_t c=0;c<4;++c) {
+                    parent_rotation[c] = q[c*m+parent];
+                }
+                for(size_t c=0;c<3;++c) {
+                    parent_position[c] = x[c*m+parent];
+                }
+            }
+            float local[3], joint[3], rest[3], d[3];
+            for(size_t c=0;c<3;++c) {
+                local[c] = binding.joints[c*m+i];
+            }
+            Rotate(parent_rotation, local, joint);
+            for(size_t c=0;c<3;++c) {
+                local[c] = binding.offsets[c*m+i];
+            }
+            Rotate(parent_rotation, local, rest);
+            for(size_t c=0;c<3;++c) {
+                joint[c] += parent_position[c];
+                d[c] = x[c*m+i]-joint[c];
+            }
+            float rest_length = std::sqrt(rest[0]*rest[0]+rest[1]*rest[1]+rest[2]*rest[2]);
+            float w = binding.inverse_masses[i];
+            float wp = parent==nil ? 0.0f : binding.inverse_masses[parent];
+
+            // Where the joint wants the body, from the joint: sprung back to
+            // rest with compliance length^2/stiffness, into the cone, at length.
+            float target[3] = {d[0], d[1], d[2]};
+            float k = binding.bend_stiffnesses[i]*(w+wp)*h2;
+            if(k>0.0f) {
+                float f = k/(k+rest_length*rest_length);
+                for(size_t c=0;c<3;++c) {
+                    target[c] -= (target[c]-rest[c])*f;
+                }
+            }
+            float length = std::sqrt(target[0]*target[0]+target[1]*target[1]+target[2]*target[2]);
+            if(rest_length>1e-6f&&length>1e-6f) {
+                float r[3] = {rest[0]/rest_length, rest[1]/rest_length, rest[2]/rest_length};
+                float u[3] = {target[0]/length, target[1]/length, target[2]/length};
+                float cos_angle = r[0]*u[0]+r[1]*u[1]+r[2]*u[2];
+                float cos_limit = binding.cone_cosines[i];
+                if(cos_angle<cos_limit) {
+                    // Back onto the cone, in the plane of r and u.
+                    float normal[3] = {u[0]-r[0]*cos_angle, u[1]-r[1]*cos_angle, u[2]-r[2]*cos_angle};
+                    float norm = std::sqrt(normal[0]*normal[0]+normal[1]*normal[1]+normal[2]*normal[2]);
+                    if(norm<1e-6f) {
+                        normal[0] = r[1]; normal[1] = -r[0]; normal[2] = 0.0f;
+                        if(std::fabs(r[2])>0.9f) {
+                            normal[0] = 0.0f; normal[1] = r[2]; normal[2] = -r[1];
+                        }
+                        norm = std::sqrt(normal[0]*normal[0]+normal[1]*normal[1]+normal[2]*normal[2]);
+                    }
+                    float sin_limit = binding.cone_sines[i];
+                    for(size_t c=0;c<3;++c) {
+                        u[c] = r[c]*cos_limit+normal[c]/norm*sin_limit;
+                    }
+                }
+                length = std::min(std::max(length, binding.min_lengths[i]), binding.max_lengths[i]);
+                for(size_t c=0;c<3;++c) {
+                    target[c] = u[c]*length;
+                }
+            } else {
+                for(size_t c=0;c<3;++c) {
+                    target[c] = rest[c];
+                }
+            }
+
+            // The correction is shared with a dynamic parent by inverse mass;
+            // the joint moves with the parent, so the body ends at the target.
+            for(size_t c=0;c<3;++c) {
+                float move = (target[c]-d[c])/(w+wp);
+                x[c*m+i] += move*w;
+                if(parent!=nil) {
+                    x[c*m+parent] -= move*wp;
+                }
+            }
+        }
+
+        // Links pull their anchors together, by inverse mass.
+        for(size_t j=island.link_begin;j<island.link_end;++j) {
+            float anchors[2][3];
+            for(size_t e=0;e<2;++e) {
+                size_t particle = binding.link_particles[e][j];
+                float rotation[4], position[3], local[3];
+                if(particle==nil) {
+                    binding.GetKinematicTransform(binding.link_bodies[e][j], t, rotation, position);
+                } else {
+                    for(size_t c=0;c<4;++c) {
+                        rotation[c] = q[c*m+particle];
+                    }
+                    for(size_t c=0;c<3;++c) {
+                        position[c] = x[c*m+particle];
+                    }
+                }
+                for(size_t c=0;c<3;++c) {
+                    local[c] = binding.link_anchors[e][c*l+j];
+                }
+                Rotate(rotation, local, anchors[e]);
+                for(size_t c=0;c<3;++c) {
+                    anchors[e][c] += position[c];
+                }
+            }
+            float d[3] = {anchors[0][0]-anchors[1][0], anchors[0][1]-anchors[1][1], anchors[0][2]-anchors[1][2]};
+            float length = std::sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+            if(length<=binding.link_slacks[j]) {
+                continue;
+            }
+            size_t a = binding.link_particles[0][j], b = binding.link_particles[1][j];
+            float wa = binding.inverse_masses[a];
+            float wb = b==nil ? 0.0f : binding.inverse_masses[b];
+            float f = (length-binding.link_slacks[j])/(length*(wa+wb));
+            for(size_t c=0;c<3;++c) {
+                x[c*m+a] -= d[c]*f*wa;
+                if(b!=nil) {
+                    x[c*m+b] += d[c]*f*wb;
+                }
+            }
+        }
+
+        // Collisions, then rotations, root to tip.
+        for(size_t i=island.particle_begin;i<island.particle_end;++i) {
+            Collide(binding, i, t);
+            size_t parent = binding.parent_particles[i];
+            if(binding.parent_bodies[i]==nil) {
+                continue;
+            }
+            float parent_rotation[4], parent_position[3];
+            if(parent==nil) {
+                binding.GetKinematicTransform(binding.parent_bodies[i], t, parent_rotation, parent_position);
+            } else {
+                for(size_t c=0;c<4;++c) {
+                    parent_rotation[c] = q[c*m+parent];
+                }
+                for(size_t c=0;c<3;++c) {
+                    parent_position[c] = x[c*m+parent];
+                }
+            }
+            float local[3], joint[3], rest[3], rest_rotation[4], rotation[4];
+            for(size_t c=0;c<3;++c) {
+                local[c] = binding.joints[c*m+i];
+            }
+            Rotate(parent_rotation, local, joint);
+            for(size_t c=0;c<3;++c) {
+                local[c] = binding.offsets[c*m+i];
+            }
+            Rotate(parent_rotation, local, rest);
+            for(size_t c=0;c<4;++c) {
+                rest_rotation[c] = binding.rest_rotations[c*m+i];
+            }
+            Multiply(parent_rotation, rest_rotation, rotation);
+
+            float d[3];
+            for(size_t c=0;c<3;++c) {
+                d[c] = x[c*m+i]-parent_position[c]-joint[c];
+            }
+            float rest_length = std::sqrt(rest[0]*rest[0]+rest[1]*rest[1]+rest[2]*rest[2]);
+            float length = std::sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+            if(rest_length>1e-6f&&length>1e-6f) {
+                float r[3] = {rest[0]/rest_length, rest[1]/rest_length, rest[2]/rest_length};
+                float u[3] = {d[0]/length, d[1]/length, d[2]/length};
+                float arc[4];
+                ShortestArc(r, u, arc);
+                Multiply(arc, rotation, rotation);
+            }
+            for(size_t c=0;c<4;++c) {
+                q[c*m+i] = rotation[c];
+            }
+        }
+
+        // Velocities from the moves the constraints left.
+        for(size_t c=0;c<3;++c) {
+            float *xc = x+c*m, *vc = v+c*m, *sc = s+c*m;
+            size_t i = island.particle_begin;
+#ifdef MMD_HAS_SSE2
+            const __m128 inv_dt = _mm_set1_ps(1.0f/h);
+            for(;i+4<=island.particle_end;i+=4) {
+                _mm_storeu_ps(vc+i, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xc+i), _mm_loadu_ps(sc+i)), inv_dt));
+            }
+#endif
+            for(;i<island.particle_end;++i) {
+                vc[i] = (xc[i]-sc[i])/h;
+            }
+        }
+    }
+}
+
+/**
+  Pushes a particle out of the capsules of its poser's kinematic bodies,
+  those at t of their move, and off the floor. Distances are tested four
+  capsules at a time; the few hits are resolved one by one.
+**/
+inline void PbdPhysicsReactor::Collide(PoserBinding &binding, size_t particle, float t) const {
+    const size_t m = binding.particle_num;
+    const size_t k = binding.collider_num;
+    float p[3] = {binding.positions[particle], binding.positions[m+particle], binding.positions[2*m+particle]};
+    float radius = binding.radii[particle];
+    unsigned group = binding.groups[particle], mask = binding.masks[particle];
+
+    size_t j = 0;
+#ifdef MMD_HAS_SSE2
+    if(k>=4) {
+        const __m128 tt = _mm_set1_ps(t);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 tiny = _mm_set1_ps(1e-12f);
+        const __m128 r = _mm_set1_ps(radius);
+        for(;j+4<=k;j+=4) {
+            __m128 a[3], ab[3], ap[3];
+            for(size_t c=0;c<3;++c) {
+                a[c] = _mm_add_ps(_mm_loadu_ps(&binding.collider_ends[0][c*k+j]), _mm_mul_ps(_mm_loadu_ps(&binding.collider_moves[0][c*k+j]), tt));
+                __m128 b = _mm_add_ps(_mm_loadu_ps(&binding.collider_ends[1][c*k+j]), _mm_mul_ps(_mm_loadu_ps(&binding.collider_moves[1][c*k+j]), tt));
+                ab[c] = _mm_sub_ps(b, a[c]);
+                ap[c] = _mm_sub_ps(_mm_set1_ps(p[c]), a[c]);
+            }
+            __m128 ab_ab = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ab[0], ab[0]), _mm_mul_ps(ab[1], ab[1])), _mm_mul_ps(ab[2], ab[2]));
+            __m128 ap_ab = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ap[0], ab[0]), _mm_mul_ps(ap[1], ab[1])), _mm_mul_ps(ap[2], ab[2]));
+            __m128 s = _mm_min_ps(_mm_max_ps(_mm_div_ps(ap_ab, _mm_max_ps(ab_ab, tiny)), zero), one);
+            __m128 distance = zero;
+            for(size_t c=0;c<3;++c) {
+                __m128 d = _mm_sub_ps(ap[c], _mm_mul_ps(ab[c], s));
+                distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+            }
+            __m128 reach = _mm_add_ps(_mm_loadu_ps(&binding.collider_radii[j]), r);
+            int hits = _mm_movemask_ps(_mm_cmplt_ps(distance, _mm_mul_ps(reach, reach)));
+            for(size_t e=0;hits!=0;++e, hits>>=1) {
+                if(!(hits&1)||!(binding.collider_groups[j+e]&mask)||!(group&binding.collider_masks[j+e])) {
+                    continue;
+                }
+                float a_c[3], ab_c[3], ap_c[3];
+                for(size_t c=0;c<3;++c) {
+                    a_c[c] = binding.collider_ends[0][c*k+j+e]+binding.collider_moves[0][c*k+j+e]*t;
+                    ab_c[c] = binding.collider_ends[1][c*k+j+e]+binding.collider_moves[1][c*k+j+e]*t-a_c[c];
+                    ap_c[c] = p[c]-a_c[c];
+                }
+                float l2 = ab_c[0]*ab_c[0]+ab_c[1]*ab_c[1]+ab_c[2]*ab_c[2];
+                float u = l2>1e-12f ? (ap_c[0]*ab_c[0]+ap_c[1]*ab_c[1]+ap_c[2]*ab_c[2])/l2 : 0.0f;
+                u = std::min(std::max(u, 0.0f), 1.0f);
+                float d[3] = {ap_c[0]-ab_c[0]*u, ap_c[1]-ab_c[1]*u, ap_c[2]-ab_c[2]*u};
+                float length = std::sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+                float reach_c = binding.collider_radii[j+e]+radius;
+                if(length>=reach_c||length<1e-6f) {
+                    continue;
+                }
+                for(size_t c=0;c<3;++c) {
+                    p[c] += d[c]/length*(reach_c-length);
+                }
+            }
+        }
+    }
+#endif
+    for(;j<k;++j) {
+        if(!(binding.collider_groups[j]&mask)||!(group&binding.collider_masks[j])) {
+            continue;
+        }
+        float a[3], ab[3], ap[3];
+        for(size_t c=0;c<3;++c) {
+            a[c] = binding.collider_ends[0][c*k+j]+binding.collider_moves[0][c*k+j]*t;
+            ab[c] = binding.collider_ends[1][c*k+j]+binding.collider_moves[1][c*k+j]*t-a[c];
+            ap[c] = p[c]-a[c];
+        }
+        float l2 = ab[0]*ab[0]+ab[1]*ab[1]+ab[2]*ab[2];
+        float u = l2>1e-12f ? (ap[0]*ab[0]+ap[1]*ab[1]+ap[2]*ab[2])/l2 : 0.0f;
+        u = std::min(std::max(u, 0.0f), 1.0f);
+        float d[3] = {ap[0]-ab[0]*u, ap[1]-ab[1]*u, ap[2]-ab[2]*u};
+        float length = std::sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+        float reach = binding.collider_radii[j]+radius;
+        if(length>=reach||length<1e-6f) {
+            continue;
+        }
+        for(size_t c=0;c<3;++c) {
+            p[c] += d[c]/length*(reach-length);
+        }
+    }
+
+    if(has_floor_&&p[1]<radius) {
+        p[1] = radius;
+    }
+    for(size_t c=0;c<3;++c) {
+        binding.positions[c*m+particle] = p[c];
+    }
+}
+
+inline void PbdPhysicsReactor::SetFixedStepRate(float rate) {
+    fixed_step_ = 1.0f/rate;
+}
+
+inline float PbdPhysicsReactor::GetFixedStepRate() const {
+    return 1.0f/fixed_step_;
+}
+
+inline void PbdPhysicsReactor::SetMaxStepNum(int max_step_num) {
+    max_step_num_ = max_step_num;
+}
+
+inline int PbdPhysicsReactor::GetMaxStepNum() const {
+    return max_step_num_;
+}
+
+inline int PbdPhysicsReactor::GetLastStepNum() const {
+    return last_step_num_;
+}
+
+inline void PbdPhysicsReactor::SetSubstepNum(int substep_num) {
+    substep_num_ = std::max(substep_num, 1);
+}
+
+inline int PbdPhysicsReactor::GetSubstepNum() const {
+    return substep_num_;
+}
+
+inline void PbdPhysicsReactor::SetGravityStrength(float strength) {
+    gravity_strength_ = strength;
+}
+
+inline void PbdPhysicsReactor::SetGravityDirection(const Vector3f &direction) {
+    Vector3f d = direction.Normalize();
+    for(size_t c=0;c<3;++c) {
+        gravity_direction_[c] = d.v[c];
+    }
+}
+
+inline float PbdPhysicsReactor::GetGravityStrength() const {
+    return gravity_strength_;
+}
+
+inline Vector3f PbdPhysicsReactor::GetGravityDirection() const {
+    Vector3f d;
+    for(size_t c=0;c<3;++c) {
+        d.v[c] = gravity_direction_[c];
+    }
+    return d;
+}
+
+inline void PbdPhysicsReactor::SetFloor(bool has_floor) {
+    has_floor_ = has_floor;
+}
+
+inline bool PbdPhysicsReactor::IsHasFloor() const {
+    return has_floor_;
+}
+
+inline void PbdPhysicsReactor::GetPhysicsBones(const Poser &poser, std::vector<size_t> &bones, std::vector<size_t> &fixed_bones) const {
+    bones.clear();
+    fixed_bones.clear();
+    const PoserBinding *binding = FindBinding(poser);
+    if(binding==NULL) {
+        return;
+    }
+    for(size_t i=0;i<binding->particle_num;++i) {
+        if(!binding->ghosts[i]) {
+            bones.push_back(binding->bones[binding->particle_bodies[i]]);
+        }
+    }
+    for(std::vector<size_t>::const_iterator i=binding->strict_particles.begin();i!=binding->strict_particles.end();++i) {
+        fixed_bones.push_back(binding->bones[binding->particle_bodies[*i]]);
+    }
+    std::sort(bones.begin(), bones.end());
+    bones.erase(std::unique(bones.begin(), bones.end()), bones.end());
+    std::sort(fixed_bones.begin(), fixed_bones.end());
+    fixed_bones.erase(std::unique(fixed_bones.begin(), fixed_bones.end()), fixed_bones.end());
+}
@@ -52,6 +52,7 @@
 
 #include <bitset>
 #include <deque>
+#include <limits>
 #include <list>
 #include <map>
 #include <set>
@@ -60,8 +61,17 @@
 
 #include <exception>
 
-#ifndef MMD_WINDOWS
-#include <iconv.h>
+#ifdef MMD_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef MMD_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 #include "util/dwarf.inl"
@@ -87,11 +97,19 @@ namespace mmd {
 
 #include "model/model.inl"
 #include "motion/motion.inl"
+#include "motion/compiled_motion.inl"
+#include "motion/motion_compressor.inl"
 #include "motion/poser.inl"
+#include "motion/layered_motion_player.inl"
+#include "motion/instanced_motion_player.inl"
+#include "motion/baked_motion.inl"
+#include "motion/pose_cache.inl"
+#include "motion/physics_cache.inl"
 
 #include "motion/physics.inl"
 
 #include "scene/camera.inl"
+#include "scene/light.inl"
 
 namespace mmd {
     class MMD {
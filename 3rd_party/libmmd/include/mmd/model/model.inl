@@ -508,6 +508,8 @@ namespace mmd {
             const MorphData &GetMorphData(size_t index) const;
             MorphData &GetMorphData(size_t index);
             MorphData &NewMorphData();
+            // Resizes the data to morph_data_num default entries, to fill in place.
+            void SetMorphDataNum(size_t morph_data_num);
         private:
             std::wstring name_;
             std::wstring name_en_;
@@ -667,11 +669,14 @@ namespace mmd {
         Vertex<cref> GetVertex(size_t index) const;
         Vertex<ref> GetVertex(size_t index);
         Vertex<ref> NewVertex();
+        // Resizes every vertex array at once, for readers to fill in place.
+        void SetVertexNum(size_t vertex_num);
 
         size_t GetTriangleNum() const;
         const Vector3D<std::uint32_t> &GetTriangle(size_t index) const;
         Vector3D<std::uint32_t> &GetTriangle(size_t index);
         Vector3D<std::uint32_t> &NewTriangle();
+        void SetTriangleNum(size_t triangle_num);
 
         size_t GetPartNum() const;
         const Part &GetPart(size_t index) const;
@@ -702,6 +707,7 @@ namespace mmd {
         const float *GetNormalPointer() const;
         const float *GetUVCoordPointer() const;
         const std::uint32_t *GetTrianglePointer() const;
+        std::uint32_t *GetTrianglePointer();
 
         void Clear();
 
@@ -225,6 +225,18 @@ Model::NewVertex() {
     return GetVertex(GetVertexNum()-1);
 }
 
+inline void
+Model::SetVertexNum(size_t vertex_num) {
+    vertex_info_.coordinates_.resize(vertex_num);
+    vertex_info_.normals_.resize(vertex_num);
+    vertex_info_.uv_coords_.resize(vertex_num);
+    for(size_t i=0;i<GetExtraUVNumber();++i) {
+        vertex_info_.extra_uv_coords_[i].resize(vertex_num);
+    }
+    vertex_info_.skinning_operators_.resize(vertex_num);
+    vertex_info_.edge_scales_.resize(vertex_num, 0.0f);
+}
+
 //// omember: triangle
 inline size_t
 Model::GetTriangleNum() const {
@@ -247,6 +259,11 @@ Model::NewTriangle() {
     return triangles_.back();
 }
 
+inline void
+Model::SetTriangleNum(size_t triangle_num) {
+    triangles_.resize(triangle_num);
+}
+
 //// omember: part
 inline size_t
 Model::GetPartNum() const {
@@ -312,6 +329,16 @@ Model::GetTrianglePointer() const {
     return &triangles_[0].v[0];
 }
 
+inline std::uint32_t*
+Model::GetTrianglePointer() {
+    if(triangles_.empty()) {
+        return NULL;
+    }
+    // The elements are packed, but 12 bytes each from an aligned allocation.
+    void *data = triangles_.data();
+    return static_cast<std::uint32_t*>(data);
+}
+
 //// omember: morph
 inline size_t
 Model::GetMorphNum() const {
@@ -406,3 +406,8 @@ Model::Morph::NewMorphData() {
     morph_data_.push_back(Model::Morph::MorphData());
     return morph_data_.back();
 }
+
+inline void
+Model::Morph::SetMorphDataNum(size_t morph_data_num) {
+    morph_data_.resize(morph_data_num);
+}
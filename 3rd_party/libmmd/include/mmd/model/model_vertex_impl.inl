@@ -106,12 +106,16 @@ Model::Vertex<T>::SetExtraUVCoordinate(size_t index, const Vector4f &uv_coord) {
     switch(index) {
     default: case 0:
         extra_uv_coord_1_ = uv_coord;
+        break;
     case 1:
         extra_uv_coord_2_ = uv_coord;
+        break;
     case 2:
         extra_uv_coord_3_ = uv_coord;
+        break;
     case 3:
         extra_uv_coord_4_ = uv_coord;
+        break;
     }
 }
 
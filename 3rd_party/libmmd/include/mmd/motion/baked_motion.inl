@@ -0,0 +1,54 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __BAKED_MOTION_HXX_BA99837FA20F076159A7E590FD1EB20B_INCLUDED__
+#define __BAKED_MOTION_HXX_BA99837FA20F076159A7E590FD1EB20B_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Per-frame poses of one motion on one model, as PrePhysicsPosing
+      resolved them (see Poser::GetBakedBonePose). Replaying a baked frame
+      skips keyframe search, curve evaluation, bone morphs, append and IK.
+
+      Storage is quantized: rotations as snorm16 quaternions, translations
+      and morph rates as half floats. Frames that do not fit the
+      memory budget given at construction are not baked.
+    **/
+    class BakedMotion {
+    public:
+        BakedMotion(const Poser &poser, size_t frame_num, size_t memory_budget);
+
+        // Number of frames [0, n) this bake holds, at most the requested num.
+        size_t GetFrameNum() const;
+        size_t GetResidentSize() const;
+
+        void Capture(size_t frame, const Poser &poser);
+
+        // Equivalent to seeking the motion to frame and PrePhysicsPosing.
+        void Apply(size_t frame, Poser &poser) const;
+
+    private:
+        static std::int16_t EncodeSnorm(float x);
+        static float DecodeSnorm(std::int16_t x);
+        static std::uint16_t EncodeHalf(float x);
+        static float DecodeHalf(std::uint16_t x);
+
+        size_t bone_num_;
+        size_t morph_num_;
+        size_t frame_num_;
+
+        std::vector<std::int16_t> rotations_;
+        std::vector<std::uint16_t> translations_;
+        std::vector<std::uint16_t> morph_rates_;
+    };
+
+#include "baked_motion_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __BAKED_MOTION_HXX_BA99837FA20F076159A7E590FD1EB20B_INCLUDED__ */
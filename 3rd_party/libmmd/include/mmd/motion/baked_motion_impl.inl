@@ -0,0 +1,120 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+inline BakedMotion::BakedMotion(const Poser &poser, size_t frame_num, size_t memory_budget)
+  : bone_num_(poser.GetModel().GetBoneNum()), morph_num_(poser.GetModel().GetMorphNum()) {
+    size_t frame_size = bone_num_*7*sizeof(std::uint16_t)+morph_num_*sizeof(std::uint16_t);
+    frame_num_ = std::min(frame_num, memory_budget/std::max(frame_size, size_t(1)));
+
+    rotations_.resize(frame_num_*bone_num_*4);
+    translations_.resize(frame_num_*bone_num_*3);
+    morph_rates_.resize(frame_num_*morph_num_);
+}
+
+inline size_t BakedMotion::GetFrameNum() const {
+    return frame_num_;
+}
+
+inline size_t BakedMotion::GetResidentSize() const {
+    return sizeof(BakedMotion)
+        + rotations_.capacity()*sizeof(std::int16_t)
+        + translations_.capacity()*sizeof(std::uint16_t)
+        + morph_rates_.capacity()*sizeof(std::uint16_t);
+}
+
+inline void BakedMotion::Capture(size_t frame, const Poser &poser) {
+    if(frame>=frame_num_) {
+        return;
+    }
+    std::int16_t *rotation = &rotations_[frame*bone_num_*4];
+    std::uint16_t *translation = &translations_[frame*bone_num_*3];
+    for(size_t i=0;i<bone_num_;++i) {
+        Motion::BonePose pose = poser.GetBakedBonePose(i);
+        for(size_t c=0;c<4;++c) {
+            *rotation++ = EncodeSnorm(pose.GetRotation().v[c]);
+        }
+        for(size_t c=0;c<3;++c) {
+            *translation++ = EncodeHalf(pose.GetTranslation().v[c]);
+        }
+    }
+    std::uint16_t *morph_rate = morph_num_?&morph_rates_[frame*morph_num_]:NULL;
+    for(size_t i=0;i<morph_num_;++i) {
+        *morph_rate++ = EncodeHalf(poser.GetMorphPose(i).GetWeight());
+    }
+}
+
+inline void BakedMotion::Apply(size_t frame, Poser &poser) const {
+    if(frame>=frame_num_) {
+        return;
+    }
+    const std::int16_t *rotation = &rotations_[frame*bone_num_*4];
+    const std::uint16_t *translation = &translations_[frame*bone_num_*3];
+    for(size_t i=0;i<bone_num_;++i) {
+        Vector4f r;
+        Vector3f t;
+        for(size_t c=0;c<4;++c) {
+            r.v[c] = DecodeSnorm(*rotation++);
+        }
+        for(size_t c=0;c<3;++c) {
+            t.v[c] = DecodeHalf(*translation++);
+        }
+        r.q = r.q.Normalize();
+        poser.SetBakedBonePose(i, Motion::BonePose(t, r));
+    }
+    const std::uint16_t *morph_rate = morph_num_?&morph_rates_[frame*morph_num_]:NULL;
+    for(size_t i=0;i<morph_num_;++i) {
+        poser.SetMorphPose(i, Motion::MorphPose(DecodeHalf(*morph_rate++)));
+    }
+    poser.BakedPrePhysicsPosing();
+}
+
+inline std::int16_t BakedMotion::EncodeSnorm(float x) {
+    x = math::clamp(x, -1.0f, 1.0f)*32767.0f;
+    return std::int16_t((x>=0.0f)?(x+0.5f):(x-0.5f));
+}
+
+inline float BakedMotion::DecodeSnorm(std::int16_t x) {
+    return x/32767.0f;
+}
+
+// IEEE 754 binary16, rounded to nearest; out of range values saturate to
+// infinity and denormals are flushed to zero.
+inline std::uint16_t BakedMotion::EncodeHalf(float x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    std::uint16_t sign = std::uint16_t((bits>>16)&0x8000u);
+    std::int32_t exponent = std::int32_t((bits>>23)&0xffu)-127+15;
+    std::uint32_t mantissa = bits&0x7fffffu;
+    if(exponent<=0) {
+        return sign;
+    } else if(exponent>=31) {
+        return std::uint16_t(sign|0x7c00u);
+    }
+    std::uint32_t half = (std::uint32_t(exponent)<<10)|(mantissa>>13);
+    // Round to nearest; a carry out of the mantissa bumps the exponent.
+    if(mantissa&0x1000u) {
+        ++half;
+    }
+    return std::uint16_t(sign|std::min(half, 0x7c00u));
+}
+
+inline float BakedMotion::DecodeHalf(std::uint16_t x) {
+    std::uint32_t sign = std::uint32_t(x&0x8000u)<<16;
+    std::uint32_t exponent = (x>>10)&0x1fu;
+    std::uint32_t mantissa = x&0x3ffu;
+    std::uint32_t bits;
+    if(exponent==0) {
+        bits = sign;
+    } else if(exponent==31) {
+        bits = sign|0x7f800000u|(mantissa<<13);
+    } else {
+        bits = sign|((exponent-15+127)<<23)|(mantissa<<13);
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
@@ -0,0 +1,150 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __COMPILED_MOTION_HXX_2AA8D259EB730120336A4222687F7F59_INCLUDED__
+#define __COMPILED_MOTION_HXX_2AA8D259EB730120336A4222687F7F59_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Read-only, flat image of a Motion that is used in place, straight from
+      a memory mapped file, without any parsing:
+
+        Header
+        Track       bone_tracks[bone_track_num]     sorted by name
+        Track       morph_tracks[morph_track_num]   sorted by name
+        uint32      bone_frames[bone_key_num]
+        BoneKey     bone_keys[bone_key_num]
+        uint32      morph_frames[morph_key_num]
+        MorphKey    morph_keys[morph_key_num]
+        float       curve_samples[curve_num*Motion::interpolator_sample_num]
+        uint16      names[name_length]              UTF-16, motion name first
+
+      Keys of a track are contiguous and ordered by frame; frames are kept
+      apart from key data so that the searches touch as little memory as
+      possible. Everything is little endian and 4-byte aligned.
+
+      The header records a hash of the source the image was compiled from,
+      so a cache can tell when it went stale.
+    **/
+    class CompiledMotion {
+    public:
+        struct Track {
+            std::uint32_t name_offset;
+            std::uint32_t name_length;
+            std::uint32_t first_key;
+            std::uint32_t key_num;
+        };
+
+        // Rotation is packed by PackRotation.
+        struct BoneKey {
+            float translation[3];
+            std::uint32_t rotation[2];
+            std::uint32_t curves[4];
+        };
+
+        struct MorphKey {
+            float weight;
+            std::uint32_t curve;
+        };
+
+        // Maps a compiled motion file.
+        CompiledMotion(const std::wstring &filename);
+        // Compiles motion in memory.
+        CompiledMotion(const Motion &motion);
+
+        static void Compile(
+            const Motion &motion, std::uint64_t source_hash, buffer_type &image
+        );
+
+        std::uint64_t GetSourceHash() const;
+        std::wstring GetName() const;
+        size_t GetLength() const;
+        size_t GetImageSize() const;
+
+        size_t GetBoneTrackNum() const;
+        std::wstring GetBoneTrackName(size_t track) const;
+        size_t FindBoneTrack(const std::wstring &bone_name) const;
+        size_t GetBoneKeyNum(size_t track) const;
+        const std::uint32_t *GetBoneFrames(size_t track) const;
+        const BoneKey *GetBoneKeys(size_t track) const;
+
+        size_t GetMorphTrackNum() const;
+        std::wstring GetMorphTrackName(size_t track) const;
+        size_t FindMorphTrack(const std::wstring &morph_name) const;
+        size_t GetMorphKeyNum(size_t track) const;
+        const std::uint32_t *GetMorphFrames(size_t track) const;
+        const MorphKey *GetMorphKeys(size_t track) const;
+
+        size_t GetInterpolatorNum() const;
+        const float *GetInterpolatorSamples() const;
+
+        // Same results as Motion::GetBonePose/GetMorphPose, by track index.
+        Motion::BonePose GetBonePose(size_t track, size_t frame) const;
+        Motion::MorphPose GetMorphPose(size_t track, size_t frame) const;
+
+        /**
+          Smallest-three packing of a unit quaternion (i, j, k, e) into 64
+          bits: the largest component is dropped, made positive by negating
+          the quaternion, and rebuilt from the unit norm; its index takes 2
+          bits and the other three take 20 bits each over +-1/sqrt(2). The
+          rotation error stays around 4e-6 rad.
+        **/
+        static void PackRotation(const float *rotation, std::uint32_t *packed);
+        static void UnpackRotation(const std::uint32_t *packed, float *rotation);
+
+    private:
+        struct Header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t length;
+            std::uint64_t source_hash;
+            std::uint32_t image_size;
+
+            std::uint32_t bone_track_num;
+            std::uint32_t morph_track_num;
+            std::uint32_t bone_key_num;
+            std::uint32_t morph_key_num;
+            std::uint32_t curve_num;
+            std::uint32_t name_length;
+            std::uint32_t motion_name_length;
+
+            std::uint32_t bone_track_offset;
+            std::uint32_t morph_track_offset;
+            std::uint32_t bone_frame_offset;
+            std::uint32_t bone_key_offset;
+            std::uint32_t morph_frame_offset;
+            std::uint32_t morph_key_offset;
+            std::uint32_t curve_offset;
+            std::uint32_t name_offset;
+        };
+
+        CompiledMotion(const CompiledMotion&);
+        CompiledMotion &operator=(const CompiledMotion&);
+
+        void Attach(const std::uint8_t *image, size_t size);
+
+        template <typename T> const T *At(std::uint32_t offset) const;
+        std::wstring GetString(std::uint32_t offset, std::uint32_t length) const;
+        size_t FindTrack(
+            const Track *tracks, size_t track_num, const std::wstring &name
+        ) const;
+
+        static const std::uint32_t rotation_bits = 20;
+
+        MappedFile file_;
+        buffer_type buffer_;
+
+        const std::uint8_t *image_;
+        const Header *header_;
+    };
+
+#include "compiled_motion_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __COMPILED_MOTION_HXX_2AA8D259EB730120336A4222687F7F59_INCLUDED__ */
@@ -0,0 +1,420 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+namespace {
+    const char compiled_motion_magic[8] = {'M', 'M', 'D', 'C', 'M', 'O', 'T', '\0'};
+    const std::uint32_t compiled_motion_version = 2;
+}
+
+inline CompiledMotion::CompiledMotion(const std::wstring &filename)
+  : file_(filename) {
+    Attach(file_.GetData(), file_.GetLength());
+}
+
+inline CompiledMotion::CompiledMotion(const Motion &motion) {
+    Compile(motion, 0, buffer_);
+    Attach(&buffer_[0], buffer_.size());
+}
+
+inline void CompiledMotion::Attach(const std::uint8_t *image, size_t size) {
+    if(size<sizeof(Header)) {
+        throw exception(std::string("CompiledMotion: Image is truncated."));
+    }
+    image_ = image;
+    header_ = reinterpret_cast<const Header*>(image);
+    if(std::memcmp(header_->magic, compiled_motion_magic, sizeof(compiled_motion_magic))!=0) {
+        throw exception(std::string("CompiledMotion: Not a compiled motion."));
+    }
+    if(header_->version!=compiled_motion_version) {
+        throw exception(std::string("CompiledMotion: Unsupported version."));
+    }
+    if(header_->image_size!=size) {
+        throw exception(std::string("CompiledMotion: Image is truncated."));
+    }
+
+    // Key values are trusted, as the image is a cache written by Compile;
+    // what sampling indexes with or searches is checked: the layout, curve
+    // indices, rotation component selectors, and frames ascending within
+    // each track.
+    struct __ {
+        static bool InImage(std::uint64_t offset, std::uint64_t length, std::uint64_t size) {
+            return (offset%4==0)&&(offset+length<=size);
+        }
+        static bool IsAscending(const std::uint32_t *frames, const Track &track) {
+            for(size_t i=1;i<track.key_num;++i) {
+                if(frames[track.first_key+i-1]>=frames[track.first_key+i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+    const Header &h = *header_;
+    if(!__::InImage(h.bone_track_offset, std::uint64_t(h.bone_track_num)*sizeof(Track), size)
+     ||!__::InImage(h.morph_track_offset, std::uint64_t(h.morph_track_num)*sizeof(Track), size)
+     ||!__::InImage(h.bone_frame_offset, std::uint64_t(h.bone_key_num)*sizeof(std::uint32_t), size)
+     ||!__::InImage(h.bone_key_offset, std::uint64_t(h.bone_key_num)*sizeof(BoneKey), size)
+     ||!__::InImage(h.morph_frame_offset, std::uint64_t(h.morph_key_num)*sizeof(std::uint32_t), size)
+     ||!__::InImage(h.morph_key_offset, std::uint64_t(h.morph_key_num)*sizeof(MorphKey), size)
+     ||!__::InImage(h.curve_offset, std::uint64_t(h.curve_num)*Motion::interpolator_sample_num*sizeof(float), size)
+     ||!__::InImage(h.name_offset, std::uint64_t(h.name_length)*sizeof(std::uint16_t), size)
+     ||(h.curve_num==0)||(h.motion_name_length>h.name_length)) {
+        throw exception(std::string("CompiledMotion: Corrupted image."));
+    }
+    const Track *bone_tracks = At<Track>(h.bone_track_offset);
+    const std::uint32_t *bone_frames = At<std::uint32_t>(h.bone_frame_offset);
+    for(size_t i=0;i<h.bone_track_num;++i) {
+        if(std::uint64_t(bone_tracks[i].first_key)+bone_tracks[i].key_num>h.bone_key_num
+         ||std::uint64_t(bone_tracks[i].name_offset)+bone_tracks[i].name_length>h.name_length
+         ||!__::IsAscending(bone_frames, bone_tracks[i])) {
+            throw exception(std::string("CompiledMotion: Corrupted image."));
+        }
+    }
+    const Track *morph_tracks = At<Track>(h.morph_track_offset);
+    const std::uint32_t *morph_frames = At<std::uint32_t>(h.morph_frame_offset);
+    for(size_t i=0;i<h.morph_track_num;++i) {
+        if(std::uint64_t(morph_tracks[i].first_key)+morph_tracks[i].key_num>h.morph_key_num
+         ||std::uint64_t(morph_tracks[i].name_offset)+morph_tracks[i].name_length>h.name_length
+         ||!__::IsAscending(morph_frames, morph_tracks[i])) {
+            throw exception(std::string("CompiledMotion: Corrupted image."));
+        }
+    }
+    const BoneKey *bone_keys = At<BoneKey>(h.bone_key_offset);
+    for(size_t i=0;i<h.bone_key_num;++i) {
+        for(size_t j=0;j<4;++j) {
+            if(bone_keys[i].curves[j]>=h.curve_num) {
+                throw exception(std::string("CompiledMotion: Corrupted image."));
+            }
+        }
+        // UnpackRotation writes the largest component at this selector
+        if((bone_keys[i].rotation[1]>>(3*rotation_bits-32))>3) {
+            throw exception(std::string("CompiledMotion: Corrupted image."));
+        }
+    }
+    const MorphKey *morph_keys = At<MorphKey>(h.morph_key_offset);
+    for(size_t i=0;i<h.morph_key_num;++i) {
+        if(morph_keys[i].curve>=h.curve_num) {
+            throw exception(std::string("CompiledMotion: Corrupted image."));
+        }
+    }
+}
+
+inline void CompiledMotion::Compile(
+    const Motion &motion, std::uint64_t source_hash, buffer_type &image
+) {
+    struct __ {
+        static void AppendName(std::vector<std::uint16_t> &names, const std::wstring &name, Track &track) {
+            track.name_offset = (std::uint32_t)names.size();
+            track.name_length = (std::uint32_t)name.size();
+            for(size_t i=0;i<name.size();++i) {
+                names.push_back((std::uint16_t)name[i]);
+            }
+        }
+        static std::uint32_t Append(buffer_type &image, const void *data, size_t length) {
+            std::uint32_t offset = (std::uint32_t)image.size();
+            const std::uint8_t *p = reinterpret_cast<const std::uint8_t*>(data);
+            image.insert(image.end(), p, p+length);
+            return offset;
+        }
+    };
+
+    std::vector<std::uint16_t> names;
+    for(size_t i=0;i<motion.GetName().size();++i) {
+        names.push_back((std::uint16_t)motion.GetName()[i]);
+    }
+
+    // std::map iterates in name order, which is the order FindTrack expects.
+    std::vector<Track> bone_tracks;
+    std::vector<std::uint32_t> bone_frames;
+    std::vector<BoneKey> bone_keys;
+    for(std::map<std::wstring, Motion::BoneTrack>::const_iterator i=motion.bone_motions_.begin();i!=motion.bone_motions_.end();++i) {
+        Track track;
+        __::AppendName(names, i->first, track);
+        track.first_key = (std::uint32_t)bone_keys.size();
+        track.key_num = (std::uint32_t)i->second.size();
+        bone_tracks.push_back(track);
+        for(Motion::BoneTrack::const_iterator j=i->second.begin();j!=i->second.end();++j) {
+            BoneKey key;
+            for(size_t c=0;c<3;++c) {
+                key.translation[c] = j->second.GetTranslation().v[c];
+            }
+            float rotation[4];
+            for(size_t c=0;c<4;++c) {
+                rotation[c] = j->second.GetRotation().v[c];
+            }
+            PackRotation(rotation, key.rotation);
+            key.curves[0] = (std::uint32_t)j->second.GetXInterpolator();
+            key.curves[1] = (std::uint32_t)j->second.GetYInterpolator();
+            key.curves[2] = (std::uint32_t)j->second.GetZInterpolator();
+            key.curves[3] = (std::uint32_t)j->second.GetRInterpolator();
+            bone_frames.push_back((std::uint32_t)j->first);
+            bone_keys.push_back(key);
+        }
+    }
+
+    std::vector<Track> morph_tracks;
+    std::vector<std::uint32_t> morph_frames;
+    std::vector<MorphKey> morph_keys;
+    for(std::map<std::wstring, Motion::MorphTrack>::const_iterator i=motion.morph_motions_.begin();i!=motion.morph_motions_.end();++i) {
+        Track track;
+        __::AppendName(names, i->first, track);
+        track.first_key = (std::uint32_t)morph_keys.size();
+        track.key_num = (std::uint32_t)i->second.size();
+        morph_tracks.push_back(track);
+        for(Motion::MorphTrack::const_iterator j=i->second.begin();j!=i->second.end();++j) {
+            MorphKey key;
+            key.weight = j->second.GetWeight();
+            key.curve = (std::uint32_t)j->second.GetWeightInterpolator();
+            morph_frames.push_back((std::uint32_t)j->first);
+            morph_keys.push_back(key);
+        }
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, compiled_motion_magic, sizeof(compiled_motion_magic));
+    header.version = compiled_motion_version;
+    header.length = (std::uint32_t)motion.GetLength();
+    header.source_hash = source_hash;
+    header.bone_track_num = (std::uint32_t)bone_tracks.size();
+    header.morph_track_num = (std::uint32_t)morph_tracks.size();
+    header.bone_key_num = (std::uint32_t)bone_keys.size();
+    header.morph_key_num = (std::uint32_t)morph_keys.size();
+    header.curve_num = (std::uint32_t)motion.GetInterpolatorNum();
+    header.name_length = (std::uint32_t)names.size();
+    header.motion_name_length = (std::uint32_t)motion.GetName().size();
+
+    image.assign(sizeof(Header), 0);
+    header.bone_track_offset = __::Append(image, bone_tracks.data(), bone_tracks.size()*sizeof(bone_tracks[0]));
+    header.morph_track_offset = __::Append(image, morph_tracks.data(), morph_tracks.size()*sizeof(morph_tracks[0]));
+    header.bone_frame_offset = __::Append(image, bone_frames.data(), bone_frames.size()*sizeof(bone_frames[0]));
+    header.bone_key_offset = __::Append(image, bone_keys.data(), bone_keys.size()*sizeof(bone_keys[0]));
+    header.morph_frame_offset = __::Append(image, morph_frames.data(), morph_frames.size()*sizeof(morph_frames[0]));
+    header.morph_key_offset = __::Append(image, morph_keys.data(), morph_keys.size()*sizeof(morph_keys[0]));
+    header.curve_offset = __::Append(image, motion.interpolator_samples_.data(), motion.interpolator_samples_.size()*sizeof(motion.interpolator_samples_[0]));
+    header.name_offset = __::Append(image, names.data(), names.size()*sizeof(names[0]));
+    image.resize((image.size()+3)&~size_t(3), 0);
+    header.image_size = (std::uint32_t)image.size();
+    std::memcpy(&image[0], &header, sizeof(header));
+}
+
+template <typename T> inline const T *CompiledMotion::At(std::uint32_t offset) const {
+    return reinterpret_cast<const T*>(image_+offset);
+}
+
+inline std::wstring CompiledMotion::GetString(std::uint32_t offset, std::uint32_t length) const {
+    const std::uint16_t *s = At<std::uint16_t>(header_->name_offset)+offset;
+    return std::wstring(s, s+length);
+}
+
+inline size_t CompiledMotion::FindTrack(
+    const Track *tracks, size_t track_num, const std::wstring &name
+) const {
+    const std::uint16_t *names = At<std::uint16_t>(header_->name_offset);
+    size_t l = 0;
+    size_t r = track_num;
+    while(l<r) {
+        size_t m = (l+r)/2;
+        const std::uint16_t *s = names+tracks[m].name_offset;
+        size_t n = tracks[m].name_length;
+        // Lexicographic compare of the stored name against the key.
+        int order = 0;
+        for(size_t i=0;(order==0)&&(i<n)&&(i<name.size());++i) {
+            if(s[i]!=(std::uint32_t)name[i]) {
+                order = (s[i]<(std::uint32_t)name[i])?-1:1;
+            }
+        }
+        if(order==0) {
+            order = (n<name.size())?-1:((n>name.size())?1:0);
+        }
+        if(order==0) {
+            return m;
+        } else if(order<0) {
+            l = m+1;
+        } else {
+            r = m;
+        }
+    }
+    return nil;
+}
+
+inline std::uint64_t CompiledMotion::GetSourceHash() const {
+    return header_->source_hash;
+}
+
+inline std::wstring CompiledMotion::GetName() const {
+    return GetString(0, header_->motion_name_length);
+}
+
+inline size_t CompiledMotion::GetLength() const {
+    return header_->length;
+}
+
+inline size_t CompiledMotion::GetImageSize() const {
+    return header_->image_size;
+}
+
+inline size_t CompiledMotion::GetBoneTrackNum() const {
+    return header_->bone_track_num;
+}
+
+inline std::wstring CompiledMotion::GetBoneTrackName(size_t track) const {
+    const Track &t = At<Track>(header_->bone_track_offset)[track];
+    return GetString(t.name_offset, t.name_length);
+}
+
+inline size_t CompiledMotion::FindBoneTrack(const std::wstring &bone_name) const {
+    return FindTrack(At<Track>(header_->bone_track_offset), header_->bone_track_num, bone_name);
+}
+
+inline size_t CompiledMotion::GetBoneKeyNum(size_t track) const {
+    return At<Track>(header_->bone_track_offset)[track].key_num;
+}
+
+inline const std::uint32_t *CompiledMotion::GetBoneFrames(size_t track) const {
+    return At<std::uint32_t>(header_->bone_frame_offset)+At<Track>(header_->bone_track_offset)[track].first_key;
+}
+
+inline const CompiledMotion::BoneKey *CompiledMotion::GetBoneKeys(size_t track) const {
+    return At<BoneKey>(header_->bone_key_offset)+At<Track>(header_->bone_track_offset)[track].first_key;
+}
+
+inline size_t CompiledMotion::GetMorphTrackNum() const {
+    return header_->morph_track_num;
+}
+
+inline std::wstring CompiledMotion::GetMorphTrackName(size_t track) const {
+    const Track &t = At<Track>(header_->morph_track_offset)[track];
+    return GetString(t.name_offset, t.name_length);
+}
+
+inline size_t CompiledMotion::FindMorphTrack(const std::wstring &morph_name) const {
+    return FindTrack(At<Track>(header_->morph_track_offset), header_->morph_track_num, morph_name);
+}
+
+inline size_t CompiledMotion::GetMorphKeyNum(size_t track) const {
+    return At<Track>(header_->morph_track_offset)[track].key_num;
+}
+
+inline const std::uint32_t *CompiledMotion::GetMorphFrames(size_t track) const {
+    return At<std::uint32_t>(header_->morph_frame_offset)+At<Track>(header_->morph_track_offset)[track].first_key;
+}
+
+inline const CompiledMotion::MorphKey *CompiledMotion::GetMorphKeys(size_t track) const {
+    return At<MorphKey>(header_->morph_key_offset)+At<Track>(header_->morph_track_offset)[track].first_key;
+}
+
+inline size_t CompiledMotion::GetInterpolatorNum() const {
+    return header_->curve_num;
+}
+
+inline const float *CompiledMotion::GetInterpolatorSamples() const {
+    return At<float>(header_->curve_offset);
+}
+
+inline Motion::BonePose CompiledMotion::GetBonePose(size_t track, size_t frame) const {
+    size_t key_num = GetBoneKeyNum(track);
+    if(key_num==0) {
+        Vector4f rotation;
+        rotation.q.MakeIdentity();
+        return Motion::BonePose(Vector3f(), rotation);
+    }
+    const std::uint32_t *frames = GetBoneFrames(track);
+    const BoneKey *keys = GetBoneKeys(track);
+    size_t right = std::upper_bound(frames, frames+key_num, frame)-frames;
+    size_t left = (right==0)?0:right-1;
+    if(right==key_num) {
+        right = left;
+    }
+
+    Vector3f l_translation, r_translation;
+    Vector4f l_rotation, r_rotation;
+    float l_packed[4], r_packed[4];
+    UnpackRotation(keys[left].rotation, l_packed);
+    UnpackRotation(keys[right].rotation, r_packed);
+    for(size_t c=0;c<3;++c) {
+        l_translation.v[c] = keys[left].translation[c];
+        r_translation.v[c] = keys[right].translation[c];
+    }
+    for(size_t c=0;c<4;++c) {
+        l_rotation.v[c] = l_packed[c];
+        r_rotation.v[c] = r_packed[c];
+    }
+    if(left==right) {
+        return Motion::BonePose(l_translation, l_rotation);
+    }
+
+    float x[4], lambda[4];
+    std::fill(x, x+4, (float)(frame-frames[left])/(float)(frames[right]-frames[left]));
+    Motion::SampleInterpolators(GetInterpolatorSamples(), keys[left].curves, x, lambda, 4);
+    Vector3f translation;
+    for(size_t c=0;c<3;++c) {
+        translation.v[c] = l_translation.v[c]*(1-lambda[c])+r_translation.v[c]*lambda[c];
+    }
+    return Motion::BonePose(translation, NLerp(l_rotation, r_rotation)[lambda[3]]);
+}
+
+inline Motion::MorphPose CompiledMotion::GetMorphPose(size_t track, size_t frame) const {
+    size_t key_num = GetMorphKeyNum(track);
+    if(key_num==0) {
+        return Motion::MorphPose(0.0f);
+    }
+    const std::uint32_t *frames = GetMorphFrames(track);
+    const MorphKey *keys = GetMorphKeys(track);
+    size_t right = std::upper_bound(frames, frames+key_num, frame)-frames;
+    size_t left = (right==0)?0:right-1;
+    if(right==key_num) {
+        right = left;
+    }
+    if(left==right) {
+        return Motion::MorphPose(keys[left].weight);
+    }
+
+    float x = (float)(frame-frames[left])/(float)(frames[right]-frames[left]);
+    float lambda;
+    Motion::SampleInterpolators(GetInterpolatorSamples(), &keys[left].curve, &x, &lambda, 1);
+    return Motion::MorphPose(keys[left].weight*(1-lambda)+keys[right].weight*lambda);
+}
+
+inline void CompiledMotion::PackRotation(const float *rotation, std::uint32_t *packed) {
+    const float range = 0.70710678f;
+    const std::uint32_t max_code = (1u<<rotation_bits)-1;
+    size_t largest = 0;
+    for(size_t c=1;c<4;++c) {
+        if(std::fabs(rotation[c])>std::fabs(rotation[largest])) {
+            largest = c;
+        }
+    }
+    float sign = (rotation[largest]<0.0f)?-1.0f:1.0f;
+    std::uint64_t bits = largest;
+    for(size_t c=0;c<4;++c) {
+        if(c==largest) {
+            continue;
+        }
+        float v = math::clamp((sign*rotation[c]+range)/(2.0f*range), 0.0f, 1.0f);
+        bits = (bits<<rotation_bits)|(std::uint32_t)(v*max_code+0.5f);
+    }
+    packed[0] = (std::uint32_t)bits;
+    packed[1] = (std::uint32_t)(bits>>32);
+}
+
+inline void CompiledMotion::UnpackRotation(const std::uint32_t *packed, float *rotation) {
+    const float range = 0.70710678f;
+    const std::uint32_t max_code = (1u<<rotation_bits)-1;
+    std::uint64_t bits = (std::uint64_t(packed[1])<<32)|packed[0];
+    size_t largest = (size_t)(bits>>(3*rotation_bits));
+    float norm = 0.0f;
+    for(size_t c=4;c-->0;) {
+        if(c==largest) {
+            continue;
+        }
+        rotation[c] = (float)(bits&max_code)*(2.0f*range/max_code)-range;
+        norm += rotation[c]*rotation[c];
+        bits >>= rotation_bits;
+    }
+    rotation[largest] = math::sqrt(std::max(1.0f-norm, 0.0f));
+}
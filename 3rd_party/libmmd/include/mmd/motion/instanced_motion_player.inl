@@ -0,0 +1,115 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __INSTANCED_MOTION_PLAYER_HXX_8F103AC32234521A3D23C90177078E7B_INCLUDED__
+#define __INSTANCED_MOTION_PLAYER_HXX_8F103AC32234521A3D23C90177078E7B_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Sampled local poses of compiled motions, keyed by (motion, frame).
+      An entry holds every track of the motion, so it serves any model;
+      the least recently used entry is replaced once capacity is reached.
+      Track to bone bindings are kept per (motion, model) and shared by
+      all players of that pair.
+
+      Motions and models are identified by address: they must outlive the
+      cache, or the cache must be cleared before one is replaced.
+    **/
+    class MotionEvaluationCache {
+    public:
+        // Model bone or morph index per motion track, nil where unbound.
+        struct Binding {
+            std::vector<size_t> bones;
+            std::vector<size_t> morphs;
+        };
+
+        MotionEvaluationCache(size_t capacity = 8);
+
+        size_t GetCapacity() const;
+        void SetCapacity(size_t capacity);
+
+        /**
+          Poses of all tracks at the frame, valid until the next Evaluate:
+          blocks tx, ty, tz, qi, qj, qk, qe of GetBoneTrackNum() entries,
+          then GetMorphTrackNum() morph weights.
+        **/
+        const float *Evaluate(const CompiledMotion &motion, double frame);
+
+        const Binding &Bind(const CompiledMotion &motion, const Model &model);
+
+        size_t GetHitNum() const;
+        size_t GetMissNum() const;
+
+        // Drops poses and bindings; players built on this cache must be rebuilt.
+        void Clear();
+
+    private:
+        MotionEvaluationCache &operator=(const MotionEvaluationCache&);
+
+        struct Entry {
+            const CompiledMotion *motion;
+            double frame;
+            size_t stamp;
+            std::vector<float> poses;
+        };
+
+        void Sample(const CompiledMotion &motion, double frame, std::vector<float> &poses);
+
+        size_t capacity_;
+        std::vector<Entry> entries_;
+        std::map<std::pair<const CompiledMotion*, const Model*>, Binding> bindings_;
+        size_t clock_;
+        size_t hit_num_;
+        size_t miss_num_;
+
+        // Sampling scratch, MotionPlayer layout over all tracks of a motion.
+        std::vector<std::uint32_t> curves_;
+        std::vector<float> positions_;
+        std::vector<float> lambdas_;
+        std::vector<float> l_values_;
+        std::vector<float> r_values_;
+    };
+
+    /**
+      Plays a compiled motion on one poser through a shared evaluation
+      cache. Instances of a crowd seeking the same frame of the same motion
+      sample it once and only scatter the result; an instance with a time
+      offset lands on its own cache entry and is sampled separately.
+
+      The cache and the motion must outlive the player.
+    **/
+    class InstancedMotionPlayer {
+    public:
+        InstancedMotionPlayer(
+            MotionEvaluationCache &cache, const CompiledMotion &motion, Poser &poser
+        );
+
+        // The player shows frame - offset of its motion at a given frame.
+        double GetOffset() const;
+        void SetOffset(double offset);
+
+        void SeekFrame(size_t frame);
+        void SeekTime(double time);
+
+    private:
+        InstancedMotionPlayer &operator=(const InstancedMotionPlayer&);
+
+        void Sample(double frame);
+
+        MotionEvaluationCache &cache_;
+        const CompiledMotion &motion_;
+        Poser &poser_;
+        const MotionEvaluationCache::Binding &binding_;
+        double offset_;
+    };
+
+#include "instanced_motion_player_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __INSTANCED_MOTION_PLAYER_HXX_8F103AC32234521A3D23C90177078E7B_INCLUDED__ */
@@ -0,0 +1,237 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+inline MotionEvaluationCache::MotionEvaluationCache(size_t capacity)
+  : capacity_(capacity>0 ? capacity : 1), clock_(0), hit_num_(0), miss_num_(0) {}
+
+inline size_t MotionEvaluationCache::GetCapacity() const {
+    return capacity_;
+}
+
+inline void MotionEvaluationCache::SetCapacity(size_t capacity) {
+    capacity_ = capacity>0 ? capacity : 1;
+    if(entries_.size()>capacity_) {
+        entries_.resize(capacity_);
+    }
+}
+
+inline const float *MotionEvaluationCache::Evaluate(const CompiledMotion &motion, double frame) {
+    ++clock_;
+    size_t victim = 0;
+    for(size_t i=0;i<entries_.size();++i) {
+        Entry &entry = entries_[i];
+        if(entry.motion==&motion&&entry.frame==frame) {
+            entry.stamp = clock_;
+            ++hit_num_;
+            return entry.poses.empty() ? NULL : &entry.poses[0];
+        }
+        if(entry.stamp<entries_[victim].stamp) {
+            victim = i;
+        }
+    }
+    ++miss_num_;
+    if(entries_.size()<capacity_) {
+        victim = entries_.size();
+        entries_.push_back(Entry());
+    }
+    Entry &entry = entries_[victim];
+    entry.motion = &motion;
+    entry.frame = frame;
+    entry.stamp = clock_;
+    Sample(motion, frame, entry.poses);
+    return entry.poses.empty() ? NULL : &entry.poses[0];
+}
+
+inline const MotionEvaluationCache::Binding&
+MotionEvaluationCache::Bind(const CompiledMotion &motion, const Model &model) {
+    std::pair<const CompiledMotion*, const Model*> key(&motion, &model);
+    std::map<std::pair<const CompiledMotion*, const Model*>, Binding>::iterator i = bindings_.find(key);
+    if(i!=bindings_.end()) {
+        return i->second;
+    }
+    Binding &binding = bindings_[key];
+    binding.bones.assign(motion.GetBoneTrackNum(), nil);
+    binding.morphs.assign(motion.GetMorphTrackNum(), nil);
+    for(size_t b=0;b<model.GetBoneNum();++b) {
+        size_t track = motion.FindBoneTrack(model.GetBone(b).GetName());
+        if(track!=nil) {
+            binding.bones[track] = b;
+        }
+    }
+    for(size_t m=0;m<model.GetMorphNum();++m) {
+        size_t track = motion.FindMorphTrack(model.GetMorph(m).GetName());
+        if(track!=nil) {
+            binding.morphs[track] = m;
+        }
+    }
+    return binding;
+}
+
+inline size_t MotionEvaluationCache::GetHitNum() const {
+    return hit_num_;
+}
+
+inline size_t MotionEvaluationCache::GetMissNum() const {
+    return miss_num_;
+}
+
+inline void MotionEvaluationCache::Clear() {
+    entries_.clear();
+    bindings_.clear();
+}
+
+// Same gather as MotionPlayer::GatherCompiledMotion, over every track.
+inline void MotionEvaluationCache::Sample(
+    const CompiledMotion &motion, double frame, std::vector<float> &poses
+) {
+    static const std::uint32_t linear[4] = {0, 0, 0, 0};
+    static const float zero[3] = {0.0f, 0.0f, 0.0f};
+    static const float identity[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+    const size_t n = motion.GetBoneTrackNum();
+    const size_t m = motion.GetMorphTrackNum();
+    const size_t key_frame = (frame>0.0)?size_t(frame):0;
+    poses.resize(7*n+m);
+    if(n+m==0) {
+        return;
+    }
+    curves_.resize(4*n+m);
+    positions_.resize(4*n+m);
+    lambdas_.resize(4*n+m);
+    l_values_.resize(7*n+m);
+    r_values_.resize(7*n+m);
+
+    for(size_t k=0;k<n;++k) {
+        size_t key_num = motion.GetBoneKeyNum(k);
+        float position = 0.0f;
+        const std::uint32_t *curves = linear;
+        float l_rotation[4], r_rotation[4];
+        const float *l_translation = zero;
+        const float *r_translation = zero;
+        if(key_num==0) {
+            std::copy(identity, identity+4, l_rotation);
+            std::copy(identity, identity+4, r_rotation);
+        } else {
+            const std::uint32_t *frames = motion.GetBoneFrames(k);
+            const CompiledMotion::BoneKey *keys = motion.GetBoneKeys(k);
+            size_t right = std::upper_bound(frames, frames+key_num, key_frame)-frames;
+            size_t left = right;
+            if(right==key_num) {
+                right = --left;
+            } else if(right>0) {
+                --left;
+                position = (float)((frame-frames[left])/(frames[right]-frames[left]));
+                curves = keys[left].curves;
+            }
+            CompiledMotion::UnpackRotation(keys[left].rotation, l_rotation);
+            CompiledMotion::UnpackRotation(keys[right].rotation, r_rotation);
+            l_translation = keys[left].translation;
+            r_translation = keys[right].translation;
+        }
+        for(size_t c=0;c<4;++c) {
+            curves_[c*n+k] = curves[c];
+            positions_[c*n+k] = position;
+        }
+        for(size_t c=0;c<3;++c) {
+            l_values_[c*n+k] = l_translation[c];
+            r_values_[c*n+k] = r_translation[c];
+        }
+        for(size_t c=0;c<4;++c) {
+            l_values_[(3+c)*n+k] = l_rotation[c];
+            r_values_[(3+c)*n+k] = r_rotation[c];
+        }
+    }
+
+    for(size_t k=0;k<m;++k) {
+        size_t key_num = motion.GetMorphKeyNum(k);
+        float position = 0.0f;
+        std::uint32_t curve = 0;
+        float l_weight = 0.0f;
+        float r_weight = 0.0f;
+        if(key_num>0) {
+            const std::uint32_t *frames = motion.GetMorphFrames(k);
+            const CompiledMotion::MorphKey *keys = motion.GetMorphKeys(k);
+            size_t right = std::upper_bound(frames, frames+key_num, key_frame)-frames;
+            size_t left = right;
+            if(right==key_num) {
+                right = --left;
+            } else if(right>0) {
+                --left;
+                position = (float)((frame-frames[left])/(frames[right]-frames[left]));
+                curve = keys[left].curve;
+            }
+            l_weight = keys[left].weight;
+            r_weight = keys[right].weight;
+        }
+        curves_[4*n+k] = curve;
+        positions_[4*n+k] = position;
+        l_values_[7*n+k] = l_weight;
+        r_values_[7*n+k] = r_weight;
+    }
+
+    Motion::SampleInterpolators(
+        motion.GetInterpolatorSamples(), &curves_[0], &positions_[0], &lambdas_[0], 4*n+m
+    );
+    MotionPlayer::LerpBatch(&l_values_[0], &r_values_[0], &lambdas_[0], &poses[0], 3*n);
+    MotionPlayer::NLerpBatch(&l_values_[3*n], &r_values_[3*n], &lambdas_[3*n], &poses[3*n], n);
+    MotionPlayer::LerpBatch(&l_values_[7*n], &r_values_[7*n], &lambdas_[4*n], &poses[7*n], m);
+}
+
+inline InstancedMotionPlayer::InstancedMotionPlayer(
+    MotionEvaluationCache &cache, const CompiledMotion &motion, Poser &poser
+) : cache_(cache), motion_(motion), poser_(poser),
+    binding_(cache.Bind(motion, poser.GetModel())), offset_(0.0) {}
+
+inline double InstancedMotionPlayer::GetOffset() const {
+    return offset_;
+}
+
+inline void InstancedMotionPlayer::SetOffset(double offset) {
+    offset_ = offset;
+}
+
+inline void InstancedMotionPlayer::SeekFrame(size_t frame) {
+    Sample(double(frame));
+}
+
+inline void InstancedMotionPlayer::SeekTime(double time) {
+    Sample(time*30.0);
+}
+
+inline void InstancedMotionPlayer::Sample(double frame) {
+    // Poses are constant outside the motion; clamping lets those share entries.
+    frame -= offset_;
+    if(frame<0.0) {
+        frame = 0.0;
+    } else if(frame>double(motion_.GetLength())) {
+        frame = double(motion_.GetLength());
+    }
+    const float *poses = cache_.Evaluate(motion_, frame);
+    if(poses==NULL) {
+        return;
+    }
+    const size_t n = binding_.bones.size();
+    for(size_t k=0;k<binding_.morphs.size();++k) {
+        if(binding_.morphs[k]!=nil) {
+            poser_.SetMorphPose(binding_.morphs[k], Motion::MorphPose(poses[7*n+k]));
+        }
+    }
+    for(size_t k=0;k<n;++k) {
+        if(binding_.bones[k]==nil) {
+            continue;
+        }
+        Vector3f translation;
+        Vector4f rotation;
+        for(size_t c=0;c<3;++c) {
+            translation.v[c] = poses[c*n+k];
+        }
+        for(size_t c=0;c<4;++c) {
+            rotation.v[c] = poses[(3+c)*n+k];
+        }
+        poser_.SetBonePose(binding_.bones[k], Motion::BonePose(translation, rotation));
+    }
+}
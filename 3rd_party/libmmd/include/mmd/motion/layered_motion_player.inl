@@ -0,0 +1,140 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __LAYERED_MOTION_PLAYER_HXX_8FCD1A4C423240F9E98AD5FFCC9BA1DD_INCLUDED__
+#define __LAYERED_MOTION_PLAYER_HXX_8FCD1A4C423240F9E98AD5FFCC9BA1DD_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Blends a stack of compiled motions into one poser, bottom layer first.
+      Each layer overrides the blend below it by its weight, scaled per bone
+      and per morph by its mask, starting from the rest pose. A layer only
+      affects the tracks its motion has, so a facial motion stacked over a
+      dance moves the face alone. Weights fade linearly over frame ranges,
+      which also gives crossfades; fades are functions of the frame, so
+      seeking backwards replays them.
+
+      A seek gathers the tracks of every active layer, solves all their
+      curves in one batch and blends layer by layer in structure-of-arrays
+      form; every driven bone and morph is then written to the poser once.
+      Layers at zero weight and masked out tracks cost nothing.
+
+      Motions must outlive the player.
+    **/
+    class LayeredMotionPlayer {
+    public:
+        LayeredMotionPlayer(Poser &poser);
+
+        size_t AddLayer(const CompiledMotion &motion, float weight = 1.0f);
+        size_t GetLayerNum() const;
+        void ClearLayers();
+
+        // Weight at the given frame, fades included.
+        float GetLayerWeight(size_t layer, double frame) const;
+        // Sets a constant weight, cancelling any fade.
+        void SetLayerWeight(size_t layer, float weight);
+        // Fades from the weight at start_frame to weight over duration frames.
+        void FadeLayer(
+            size_t layer, float weight, double start_frame, double duration
+        );
+        void CrossFade(
+            size_t from_layer, size_t to_layer,
+            double start_frame, double duration
+        );
+
+        // The layer plays frame 0 of its motion at frame offset.
+        void SetLayerOffset(size_t layer, double offset);
+
+        // Masks default to 1; names the layer's motion lacks are ignored.
+        void SetBoneMask(size_t layer, const std::wstring &bone_name, float mask);
+        void SetMorphMask(size_t layer, const std::wstring &morph_name, float mask);
+
+        void SeekFrame(size_t frame);
+        void SeekTime(double time);
+
+    private:
+        LayeredMotionPlayer &operator=(const LayeredMotionPlayer&);
+
+        struct Layer {
+            const CompiledMotion *motion;
+            std::uint32_t curve_base;
+
+            float weight_from;
+            float weight_to;
+            double fade_start;
+            double fade_duration;
+            double offset;
+
+            // Bound tracks: model index, track index and mask.
+            std::vector<size_t> bones;
+            std::vector<size_t> bone_tracks;
+            std::vector<float> bone_masks;
+            std::vector<size_t> morphs;
+            std::vector<size_t> morph_tracks;
+            std::vector<float> morph_masks;
+        };
+
+        /**
+          Active tracks of one layer for the current seek. Its scratch uses
+          the MotionPlayer layout (see MotionPlayer::curves_) for its own n
+          bones and m morphs, at curve_offset in curves_/positions_/lambdas_
+          and at value_offset in l_values_/r_values_/results_.
+        **/
+        struct Chunk {
+            size_t layer;
+            double frame;
+            size_t bone_begin;
+            size_t bone_num;
+            size_t morph_begin;
+            size_t morph_num;
+            size_t curve_offset;
+            size_t value_offset;
+        };
+
+        void Sample(double frame);
+        void Gather(const Chunk &chunk);
+        void Blend(const Chunk &chunk);
+
+        Poser &poser_;
+        std::vector<Layer> layers_;
+
+        // Curve samples of all layers, each layer's curves from curve_base.
+        std::vector<float> samples_;
+
+        std::vector<Chunk> chunks_;
+        // Active entries (indices into Layer::bones/morphs) and their weights.
+        std::vector<size_t> active_bones_;
+        std::vector<float> bone_weights_;
+        std::vector<size_t> active_morphs_;
+        std::vector<float> morph_weights_;
+
+        std::vector<std::uint32_t> curves_;
+        std::vector<float> positions_;
+        std::vector<float> lambdas_;
+        std::vector<float> l_values_;
+        std::vector<float> r_values_;
+        std::vector<float> results_;
+        std::vector<float> blend_values_;
+        std::vector<float> blend_weights_;
+
+        // Blended pose per model bone (tx, ty, tz, qi, qj, qk, qe) and morph,
+        // valid where the stamp matches the current seek.
+        std::vector<float> bone_poses_;
+        std::vector<float> morph_poses_;
+        std::vector<size_t> bone_stamps_;
+        std::vector<size_t> morph_stamps_;
+        size_t stamp_;
+        std::vector<size_t> touched_bones_;
+        std::vector<size_t> touched_morphs_;
+    };
+
+#include "layered_motion_player_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __LAYERED_MOTION_PLAYER_HXX_8FCD1A4C423240F9E98AD5FFCC9BA1DD_INCLUDED__ */
@@ -0,0 +1,362 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+inline LayeredMotionPlayer::LayeredMotionPlayer(Poser &poser)
+  : poser_(poser), stamp_(0) {
+    const Model &model = poser_.GetModel();
+    bone_poses_.resize(7*model.GetBoneNum());
+    morph_poses_.resize(model.GetMorphNum());
+    bone_stamps_.assign(model.GetBoneNum(), 0);
+    morph_stamps_.assign(model.GetMorphNum(), 0);
+}
+
+inline size_t LayeredMotionPlayer::AddLayer(const CompiledMotion &motion, float weight) {
+    Layer layer;
+    layer.motion = &motion;
+    layer.curve_base = (std::uint32_t)(samples_.size()/Motion::interpolator_sample_num);
+    layer.weight_from = layer.weight_to = weight;
+    layer.fade_start = 0.0;
+    layer.fade_duration = 0.0;
+    layer.offset = 0.0;
+
+    const Model &model = poser_.GetModel();
+    for(size_t i=0;i<model.GetBoneNum();++i) {
+        size_t track = motion.FindBoneTrack(model.GetBone(i).GetName());
+        if(track!=nil) {
+            layer.bones.push_back(i);
+            layer.bone_tracks.push_back(track);
+            layer.bone_masks.push_back(1.0f);
+        }
+    }
+    for(size_t i=0;i<model.GetMorphNum();++i) {
+        size_t track = motion.FindMorphTrack(model.GetMorph(i).GetName());
+        if(track!=nil) {
+            layer.morphs.push_back(i);
+            layer.morph_tracks.push_back(track);
+            layer.morph_masks.push_back(1.0f);
+        }
+    }
+
+    const float *samples = motion.GetInterpolatorSamples();
+    samples_.insert(
+        samples_.end(), samples,
+        samples+motion.GetInterpolatorNum()*Motion::interpolator_sample_num
+    );
+    layers_.push_back(layer);
+    return layers_.size()-1;
+}
+
+inline size_t LayeredMotionPlayer::GetLayerNum() const {
+    return layers_.size();
+}
+
+inline void LayeredMotionPlayer::ClearLayers() {
+    layers_.clear();
+    samples_.clear();
+}
+
+inline float LayeredMotionPlayer::GetLayerWeight(size_t layer, double frame) const {
+    const Layer &l = layers_[layer];
+    if(frame>=l.fade_start+l.fade_duration) {
+        return l.weight_to;
+    } else if(frame<=l.fade_start) {
+        return l.weight_from;
+    }
+    float t = (float)((frame-l.fade_start)/l.fade_duration);
+    return l.weight_from+(l.weight_to-l.weight_from)*t;
+}
+
+inline void LayeredMotionPlayer::SetLayerWeight(size_t layer, float weight) {
+    Layer &l = layers_[layer];
+    l.weight_from = l.weight_to = weight;
+    l.fade_duration = 0.0;
+}
+
+inline void LayeredMotionPlayer::FadeLayer(
+    size_t layer, float weight, double start_frame, double duration
+) {
+    Layer &l = layers_[layer];
+    l.weight_from = GetLayerWeight(layer, start_frame);
+    l.weight_to = weight;
+    l.fade_start = start_frame;
+    l.fade_duration = std::max(duration, 0.0);
+}
+
+inline void LayeredMotionPlayer::CrossFade(
+    size_t from_layer, size_t to_layer, double start_frame, double duration
+) {
+    FadeLayer(from_layer, 0.0f, start_frame, duration);
+    FadeLayer(to_layer, 1.0f, start_frame, duration);
+}
+
+inline void LayeredMotionPlayer::SetLayerOffset(size_t layer, double offset) {
+    layers_[layer].offset = offset;
+}
+
+inline void LayeredMotionPlayer::SetBoneMask(
+    size_t layer, const std::wstring &bone_name, float mask
+) {
+    Layer &l = layers_[layer];
+    const Model &model = poser_.GetModel();
+    for(size_t k=0;k<l.bones.size();++k) {
+        if(model.GetBone(l.bones[k]).GetName()==bone_name) {
+            l.bone_masks[k] = mask;
+        }
+    }
+}
+
+inline void LayeredMotionPlayer::SetMorphMask(
+    size_t layer, const std::wstring &morph_name, float mask
+) {
+    Layer &l = layers_[layer];
+    const Model &model = poser_.GetModel();
+    for(size_t k=0;k<l.morphs.size();++k) {
+        if(model.GetMorph(l.morphs[k]).GetName()==morph_name) {
+            l.morph_masks[k] = mask;
+        }
+    }
+}
+
+inline void LayeredMotionPlayer::SeekFrame(size_t frame) {
+    Sample(double(frame));
+}
+
+inline void LayeredMotionPlayer::SeekTime(double time) {
+    Sample(time*30.0);
+}
+
+inline void LayeredMotionPlayer::Gather(const Chunk &chunk) {
+    const Layer &layer = layers_[chunk.layer];
+    const CompiledMotion &motion = *layer.motion;
+    const size_t n = chunk.bone_num;
+    const size_t m = chunk.morph_num;
+    const size_t key_frame = (chunk.frame>0.0)?size_t(chunk.frame):0;
+    std::uint32_t *curves = &curves_[chunk.curve_offset];
+    float *positions = &positions_[chunk.curve_offset];
+    float *l_values = &l_values_[chunk.value_offset];
+    float *r_values = &r_values_[chunk.value_offset];
+
+    // As MotionPlayer::GatherCompiledMotion; tracks bound here are never empty.
+    for(size_t k=0;k<n;++k) {
+        size_t track = layer.bone_tracks[active_bones_[chunk.bone_begin+k]];
+        size_t key_num = motion.GetBoneKeyNum(track);
+        const std::uint32_t *frames = motion.GetBoneFrames(track);
+        const CompiledMotion::BoneKey *keys = motion.GetBoneKeys(track);
+        size_t right = std::upper_bound(frames, frames+key_num, key_frame)-frames;
+        size_t left = right;
+        float position = 0.0f;
+        std::uint32_t curve[4] = {0, 0, 0, 0};
+        if(right==0) {
+            left = right;
+        } else if(right==key_num) {
+            right = --left;
+        } else {
+            --left;
+            position = (float)((chunk.frame-frames[left])/(frames[right]-frames[left]));
+            for(size_t c=0;c<4;++c) {
+                curve[c] = keys[left].curves[c]+layer.curve_base;
+            }
+        }
+        for(size_t c=0;c<4;++c) {
+            curves[c*n+k] = curve[c];
+            positions[c*n+k] = position;
+        }
+        for(size_t c=0;c<3;++c) {
+            l_values[c*n+k] = keys[left].translation[c];
+            r_values[c*n+k] = keys[right].translation[c];
+        }
+        float l_rotation[4], r_rotation[4];
+        CompiledMotion::UnpackRotation(keys[left].rotation, l_rotation);
+        CompiledMotion::UnpackRotation(keys[right].rotation, r_rotation);
+        for(size_t c=0;c<4;++c) {
+            l_values[(3+c)*n+k] = l_rotation[c];
+            r_values[(3+c)*n+k] = r_rotation[c];
+        }
+    }
+
+    for(size_t k=0;k<m;++k) {
+        size_t track = layer.morph_tracks[active_morphs_[chunk.morph_begin+k]];
+        size_t key_num = motion.GetMorphKeyNum(track);
+        const std::uint32_t *frames = motion.GetMorphFrames(track);
+        const CompiledMotion::MorphKey *keys = motion.GetMorphKeys(track);
+        size_t right = std::upper_bound(frames, frames+key_num, key_frame)-frames;
+        size_t left = right;
+        float position = 0.0f;
+        std::uint32_t curve = 0;
+        if(right==0) {
+            left = right;
+        } else if(right==key_num) {
+            right = --left;
+        } else {
+            --left;
+            position = (float)((chunk.frame-frames[left])/(frames[right]-frames[left]));
+            curve = keys[left].curve+layer.curve_base;
+        }
+        curves[4*n+k] = curve;
+        positions[4*n+k] = position;
+        l_values[7*n+k] = keys[left].weight;
+        r_values[7*n+k] = keys[right].weight;
+    }
+}
+
+/**
+  Blends the sampled chunk over the pose so far: the driven bones and
+  morphs are gathered into blend_values_ (rest pose when first touched),
+  blended in place with the same batches MotionPlayer solves with, and
+  scattered back.
+**/
+inline void LayeredMotionPlayer::Blend(const Chunk &chunk) {
+    const Layer &layer = layers_[chunk.layer];
+    const size_t n = chunk.bone_num;
+    const size_t m = chunk.morph_num;
+    blend_values_.resize(7*n+m);
+    blend_weights_.resize(4*n+m);
+    float *values = &blend_values_[0];
+    float *weights = &blend_weights_[0];
+
+    for(size_t k=0;k<n;++k) {
+        size_t bone = layer.bones[active_bones_[chunk.bone_begin+k]];
+        float *pose = &bone_poses_[7*bone];
+        if(bone_stamps_[bone]!=stamp_) {
+            bone_stamps_[bone] = stamp_;
+            touched_bones_.push_back(bone);
+            std::fill(pose, pose+6, 0.0f);
+            pose[6] = 1.0f;
+        }
+        for(size_t c=0;c<7;++c) {
+            values[c*n+k] = pose[c];
+        }
+        float weight = bone_weights_[chunk.bone_begin+k];
+        for(size_t c=0;c<4;++c) {
+            weights[c*n+k] = weight;
+        }
+    }
+    for(size_t k=0;k<m;++k) {
+        size_t morph = layer.morphs[active_morphs_[chunk.morph_begin+k]];
+        if(morph_stamps_[morph]!=stamp_) {
+            morph_stamps_[morph] = stamp_;
+            touched_morphs_.push_back(morph);
+            morph_poses_[morph] = 0.0f;
+        }
+        values[7*n+k] = morph_poses_[morph];
+        weights[4*n+k] = morph_weights_[chunk.morph_begin+k];
+    }
+
+    const float *sampled = &results_[chunk.value_offset];
+    MotionPlayer::LerpBatch(values, sampled, weights, values, 3*n);
+    MotionPlayer::NLerpBatch(values+3*n, sampled+3*n, weights+3*n, values+3*n, n);
+    MotionPlayer::LerpBatch(values+7*n, sampled+7*n, weights+4*n, values+7*n, m);
+
+    for(size_t k=0;k<n;++k) {
+        float *pose = &bone_poses_[7*layer.bones[active_bones_[chunk.bone_begin+k]]];
+        for(size_t c=0;c<7;++c) {
+            pose[c] = values[c*n+k];
+        }
+    }
+    for(size_t k=0;k<m;++k) {
+        morph_poses_[layer.morphs[active_morphs_[chunk.morph_begin+k]]] = values[7*n+k];
+    }
+}
+
+inline void LayeredMotionPlayer::Sample(double frame) {
+    // Plan: the active tracks of every layer, and where their scratch goes.
+    chunks_.clear();
+    active_bones_.clear();
+    bone_weights_.clear();
+    active_morphs_.clear();
+    morph_weights_.clear();
+    size_t curve_num = 0;
+    size_t value_num = 0;
+    for(size_t i=0;i<layers_.size();++i) {
+        const Layer &layer = layers_[i];
+        float weight = GetLayerWeight(i, frame);
+        if(weight<=0.0f) {
+            continue;
+        }
+        Chunk chunk;
+        chunk.layer = i;
+        chunk.frame = frame-layer.offset;
+        chunk.bone_begin = active_bones_.size();
+        chunk.morph_begin = active_morphs_.size();
+        for(size_t k=0;k<layer.bones.size();++k) {
+            float w = weight*layer.bone_masks[k];
+            if((w>0.0f)&&(layer.motion->GetBoneKeyNum(layer.bone_tracks[k])>0)) {
+                active_bones_.push_back(k);
+                bone_weights_.push_back(std::min(w, 1.0f));
+            }
+        }
+        for(size_t k=0;k<layer.morphs.size();++k) {
+            float w = weight*layer.morph_masks[k];
+            if((w>0.0f)&&(layer.motion->GetMorphKeyNum(layer.morph_tracks[k])>0)) {
+                active_morphs_.push_back(k);
+                morph_weights_.push_back(std::min(w, 1.0f));
+            }
+        }
+        chunk.bone_num = active_bones_.size()-chunk.bone_begin;
+        chunk.morph_num = active_morphs_.size()-chunk.morph_begin;
+        if(chunk.bone_num+chunk.morph_num==0) {
+            continue;
+        }
+        chunk.curve_offset = curve_num;
+        chunk.value_offset = value_num;
+        curve_num += 4*chunk.bone_num+chunk.morph_num;
+        value_num += 7*chunk.bone_num+chunk.morph_num;
+        chunks_.push_back(chunk);
+    }
+    if(chunks_.empty()) {
+        return;
+    }
+
+    curves_.resize(curve_num);
+    positions_.resize(curve_num);
+    lambdas_.resize(curve_num);
+    l_values_.resize(value_num);
+    r_values_.resize(value_num);
+    results_.resize(value_num);
+
+    // Gather and solve the curves of all layers at once.
+    for(size_t i=0;i<chunks_.size();++i) {
+        Gather(chunks_[i]);
+    }
+    Motion::SampleInterpolators(&samples_[0], &curves_[0], &positions_[0], &lambdas_[0], curve_num);
+
+    // Sample each layer, then blend it over the layers below.
+    ++stamp_;
+    touched_bones_.clear();
+    touched_morphs_.clear();
+    for(size_t i=0;i<chunks_.size();++i) {
+        const Chunk &chunk = chunks_[i];
+        const size_t n = chunk.bone_num;
+        const size_t m = chunk.morph_num;
+        const float *l = &l_values_[chunk.value_offset];
+        const float *r = &r_values_[chunk.value_offset];
+        const float *lambda = &lambdas_[chunk.curve_offset];
+        float *result = &results_[chunk.value_offset];
+        MotionPlayer::LerpBatch(l, r, lambda, result, 3*n);
+        MotionPlayer::NLerpBatch(l+3*n, r+3*n, lambda+3*n, result+3*n, n);
+        MotionPlayer::LerpBatch(l+7*n, r+7*n, lambda+4*n, result+7*n, m);
+        Blend(chunk);
+    }
+
+    // Scatter.
+    for(size_t i=0;i<touched_morphs_.size();++i) {
+        size_t morph = touched_morphs_[i];
+        poser_.SetMorphPose(morph, Motion::MorphPose(morph_poses_[morph]));
+    }
+    for(size_t i=0;i<touched_bones_.size();++i) {
+        const float *pose = &bone_poses_[7*touched_bones_[i]];
+        Vector3f translation;
+        Vector4f rotation;
+        for(size_t c=0;c<3;++c) {
+            translation.v[c] = pose[c];
+        }
+        for(size_t c=0;c<4;++c) {
+            rotation.v[c] = pose[3+c];
+        }
+        poser_.SetBonePose(touched_bones_[i], Motion::BonePose(translation, rotation));
+    }
+}
@@ -12,6 +12,8 @@
 namespace mmd {
 
     class Motion {
+        friend class CompiledMotion;
+        friend class MotionCompressor;
     public:
         class BonePose {
         public:
@@ -31,46 +33,58 @@ namespace mmd {
             float weight_;
         };
 
+        /**
+          Keyframes do not own their interpolation curves. Curves are interned
+          in the owning Motion (see Motion::InternInterpolator) and referenced
+          by index, index 0 being the linear curve.
+        **/
         class BoneKeyframe {
         public:
+            BoneKeyframe();
+
             const Vector3f &GetTranslation() const;
             void SetTranslation(const Vector3f &translation);
 
             const Vector4f &GetRotation() const;
             void SetRotation(const Vector4f &rotation);
 
-            const interpolator &GetXInterpolator() const;
-            interpolator &GetXInterpolator();
-            const interpolator &GetYInterpolator() const;
-            interpolator &GetYInterpolator();
-            const interpolator &GetZInterpolator() const;
-            interpolator &GetZInterpolator();
-            const interpolator &GetRInterpolator() const;
-            interpolator &GetRInterpolator();
+            size_t GetXInterpolator() const;
+            void SetXInterpolator(size_t index);
+            size_t GetYInterpolator() const;
+            void SetYInterpolator(size_t index);
+            size_t GetZInterpolator() const;
+            void SetZInterpolator(size_t index);
+            size_t GetRInterpolator() const;
+            void SetRInterpolator(size_t index);
 
         private:
             Vector3f translation_;
             Vector4f rotation_;
 
-            interpolator x_interpolator_;
-            interpolator y_interpolator_;
-            interpolator z_interpolator_;
-            interpolator r_interpolator_;
+            std::uint32_t x_interpolator_;
+            std::uint32_t y_interpolator_;
+            std::uint32_t z_interpolator_;
+            std::uint32_t r_interpolator_;
         };
 
         class MorphKeyframe {
         public:
+            MorphKeyframe();
+
             float GetWeight() const;
             void SetWeight(float weight);
 
-            const interpolator &GetWeightInterpolator() const;
-            interpolator &GetWeightInterpolator();
+            size_t GetWeightInterpolator() const;
+            void SetWeightInterpolator(size_t index);
 
         private:
             float weight_;
-            interpolator w_interpolator_;
+            std::uint32_t w_interpolator_;
         };
 
+        typedef std::map<size_t, BoneKeyframe> BoneTrack;
+        typedef std::map<size_t, MorphKeyframe> MorphTrack;
+
         Motion();
 
         const std::wstring &GetName() const;
@@ -119,14 +133,54 @@ namespace mmd {
         size_t QueryMorphKeyframeForward(const std::wstring &morph_name, size_t frame) const;
         size_t QueryMorphKeyframeBackward(const std::wstring &morph_name, size_t frame) const;
 
+        // NULL when the bone/morph is not registered.
+        const BoneTrack *GetBoneTrack(const std::wstring &bone_name) const;
+        const MorphTrack *GetMorphTrack(const std::wstring &morph_name) const;
+
+        size_t InternInterpolator(
+            std::uint8_t c0_x, std::uint8_t c0_y,
+            std::uint8_t c1_x, std::uint8_t c1_y
+        );
+        const interpolator &GetInterpolator(size_t index) const;
+        size_t GetInterpolatorNum() const;
+
+        /**
+          Batched form of GetInterpolator(curves[i])[x[i]] for i in [0, n).
+          All curves are evaluated from one flat presample table, holding
+          interpolator_sample_num samples per curve, so the lookups need no
+          per-curve branching and vectorize.
+        **/
+        static const size_t interpolator_sample_num = 32;
+
+        void SampleInterpolators(
+            const std::uint32_t *curves, const float *x, float *lambda, size_t n
+        ) const;
+        static void SampleInterpolators(
+            const float *samples,
+            const std::uint32_t *curves, const float *x, float *lambda, size_t n
+        );
+        const float *GetInterpolatorSamples() const;
+
+        size_t GetBoneKeyframeNum() const;
+        size_t GetMorphKeyframeNum() const;
+
+        // Approximate heap footprint in bytes, keyframe containers included.
+        size_t GetResidentSize() const;
+
         size_t GetLength() const;
         void Clear();
 
     private:
+        void AppendInterpolatorSamples(const interpolator &curve);
+
         std::wstring name_;
         size_t length_;
-        std::map<std::wstring, std::map<size_t, BoneKeyframe>> bone_motions_;
-        std::map<std::wstring, std::map<size_t, MorphKeyframe>> morph_motions_;
+        std::map<std::wstring, BoneTrack> bone_motions_;
+        std::map<std::wstring, MorphTrack> morph_motions_;
+
+        std::vector<interpolator> interpolators_;
+        std::map<std::uint32_t, std::uint32_t> interpolator_index_;
+        std::vector<float> interpolator_samples_;
     };
 
     class Pose {
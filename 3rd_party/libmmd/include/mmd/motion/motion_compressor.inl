@@ -0,0 +1,86 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __MOTION_COMPRESSOR_HXX_3DCBDAC9733677E15A0722480BF6F559_INCLUDED__
+#define __MOTION_COMPRESSOR_HXX_3DCBDAC9733677E15A0722480BF6F559_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Lossy keyframe reduction. Compress drops every keyframe the remaining
+      ones reproduce within the tolerances at all integer frames, refitting
+      the Bezier handles of the segments it merges, so densely keyed
+      (motion capture) tracks shrink to the keys their curves need. The
+      first and last keyframe of a track are always kept.
+
+      Rotations are further quantized when the result is compiled (see
+      CompiledMotion::PackRotation); Measure reports the error of the
+      compiled result against the source.
+    **/
+    class MotionCompressor {
+    public:
+        struct Deviation {
+            Deviation();
+
+            float rotation;     // radians
+            float translation;
+            float morph;
+        };
+
+        MotionCompressor();
+
+        float GetRotationTolerance() const;
+        void SetRotationTolerance(float radians);
+
+        float GetTranslationTolerance() const;
+        void SetTranslationTolerance(float distance);
+
+        float GetMorphTolerance() const;
+        void SetMorphTolerance(float weight);
+
+        bool IsCurveRefitEnabled() const;
+        void SetCurveRefitEnabled(bool enabled);
+
+        void Compress(const Motion &source, Motion &target) const;
+
+        // Largest difference over all tracks at frames [0, source length].
+        static Deviation Measure(const Motion &source, const CompiledMotion &target);
+
+    private:
+        // Curve control points in VMD units, c0_x, c0_y, c1_x, c1_y.
+        struct Curve {
+            std::uint8_t c[4];
+        };
+
+        static Curve FitCurve(
+            const std::vector<float> &x, const std::vector<float> &y
+        );
+        static interpolator MakeInterpolator(const Curve &curve);
+        static float RotationAngle(const Vector4f &a, const Vector4f &b);
+
+        void CompressBoneTrack(
+            const Motion &source, const std::vector<Curve> &curves,
+            const std::wstring &name, const Motion::BoneTrack &track,
+            Motion &target
+        ) const;
+        void CompressMorphTrack(
+            const Motion &source, const std::vector<Curve> &curves,
+            const std::wstring &name, const Motion::MorphTrack &track,
+            Motion &target
+        ) const;
+
+        float rotation_tolerance_;
+        float translation_tolerance_;
+        float morph_tolerance_;
+        bool curve_refit_enabled_;
+    };
+
+#include "motion_compressor_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __MOTION_COMPRESSOR_HXX_3DCBDAC9733677E15A0722480BF6F559_INCLUDED__ */
@@ -0,0 +1,510 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+inline MotionCompressor::Deviation::Deviation()
+  : rotation(0.0f), translation(0.0f), morph(0.0f) {}
+
+inline MotionCompressor::MotionCompressor()
+  : rotation_tolerance_(0.0044f), // 0.25 degrees
+    translation_tolerance_(0.005f),
+    morph_tolerance_(1.0f/256.0f),
+    curve_refit_enabled_(true) {}
+
+inline float MotionCompressor::GetRotationTolerance() const {
+    return rotation_tolerance_;
+}
+
+inline void MotionCompressor::SetRotationTolerance(float radians) {
+    rotation_tolerance_ = radians;
+}
+
+inline float MotionCompressor::GetTranslationTolerance() const {
+    return translation_tolerance_;
+}
+
+inline void MotionCompressor::SetTranslationTolerance(float distance) {
+    translation_tolerance_ = distance;
+}
+
+inline float MotionCompressor::GetMorphTolerance() const {
+    return morph_tolerance_;
+}
+
+inline void MotionCompressor::SetMorphTolerance(float weight) {
+    morph_tolerance_ = weight;
+}
+
+inline bool MotionCompressor::IsCurveRefitEnabled() const {
+    return curve_refit_enabled_;
+}
+
+inline void MotionCompressor::SetCurveRefitEnabled(bool enabled) {
+    curve_refit_enabled_ = enabled;
+}
+
+inline void MotionCompressor::Compress(const Motion &source, Motion &target) const {
+    target.Clear();
+    target.SetName(source.GetName());
+
+    // Control points of the source curves, by index.
+    std::vector<Curve> curves(source.GetInterpolatorNum());
+    Curve linear = {{0, 0, 127, 127}};
+    curves[0] = linear;
+    for(std::map<std::uint32_t, std::uint32_t>::const_iterator i=source.interpolator_index_.begin();i!=source.interpolator_index_.end();++i) {
+        Curve curve = {{
+            (std::uint8_t)(i->first>>24), (std::uint8_t)(i->first>>16),
+            (std::uint8_t)(i->first>>8), (std::uint8_t)i->first
+        }};
+        curves[i->second] = curve;
+    }
+
+    for(std::map<std::wstring, Motion::BoneTrack>::const_iterator i=source.bone_motions_.begin();i!=source.bone_motions_.end();++i) {
+        CompressBoneTrack(source, curves, i->first, i->second, target);
+    }
+    for(std::map<std::wstring, Motion::MorphTrack>::const_iterator i=source.morph_motions_.begin();i!=source.morph_motions_.end();++i) {
+        CompressMorphTrack(source, curves, i->first, i->second, target);
+    }
+}
+
+inline MotionCompressor::Deviation
+MotionCompressor::Measure(const Motion &source, const CompiledMotion &target) {
+    Deviation deviation;
+    for(std::map<std::wstring, Motion::BoneTrack>::const_iterator i=source.bone_motions_.begin();i!=source.bone_motions_.end();++i) {
+        size_t track = target.FindBoneTrack(i->first);
+        if(track==nil) {
+            throw exception(std::string("MotionCompressor: Bone track is missing."));
+        }
+        for(size_t frame=0;frame<=source.GetLength();++frame) {
+            Motion::BonePose expected = source.GetBonePose(i->first, frame);
+            Motion::BonePose actual = target.GetBonePose(track, frame);
+            deviation.rotation = std::max(
+                deviation.rotation,
+                RotationAngle(expected.GetRotation(), actual.GetRotation())
+            );
+            deviation.translation = std::max(
+                deviation.translation,
+                (expected.GetTranslation()-actual.GetTranslation()).Norm()
+            );
+        }
+    }
+    for(std::map<std::wstring, Motion::MorphTrack>::const_iterator i=source.morph_motions_.begin();i!=source.morph_motions_.end();++i) {
+        size_t track = target.FindMorphTrack(i->first);
+        if(track==nil) {
+            throw exception(std::string("MotionCompressor: Morph track is missing."));
+        }
+        for(size_t frame=0;frame<=source.GetLength();++frame) {
+            float expected = source.GetMorphPose(i->first, frame).GetWeight();
+            float actual = target.GetMorphPose(track, frame).GetWeight();
+            deviation.morph = std::max(deviation.morph, std::fabs(expected-actual));
+        }
+    }
+    return deviation;
+}
+
+// 4*asin(|a-b|/2) equals 2*acos(|a*b|) but keeps its precision near zero.
+inline float MotionCompressor::RotationAngle(const Vector4f &a, const Vector4f &b) {
+    float chord = ((a*b<0.0f)?(a+b):(a-b)).Norm();
+    return 4.0f*math::asin(std::min(chord*0.5f, 1.0f));
+}
+
+inline interpolator MotionCompressor::MakeInterpolator(const Curve &curve) {
+    // Diagonal control points make the linear curve, as in InternInterpolator.
+    if((curve.c[0]==curve.c[1])&&(curve.c[2]==curve.c[3])) {
+        return interpolator();
+    }
+    Vector2f c_0, c_1;
+    const float r = 1.0f/127.0f;
+    c_0.p.x = curve.c[0]*r;
+    c_0.p.y = curve.c[1]*r;
+    c_1.p.x = curve.c[2]*r;
+    c_1.p.y = curve.c[3]*r;
+    return interpolator(c_0, c_1);
+}
+
+/**
+  Least squares fit of y = B(x) through (x[k], y[k]). With the handles' x
+  fixed at 1/3 and 2/3 the curve's x is its parameter, so B is linear in
+  the handles' y:
+    B(t) = 3(1-t)^2 t y_0 + 3(1-t) t^2 y_1 + t^3
+**/
+inline MotionCompressor::Curve MotionCompressor::FitCurve(
+    const std::vector<float> &x, const std::vector<float> &y
+) {
+    double a00 = 0.0, a01 = 0.0, a11 = 0.0, b0 = 0.0, b1 = 0.0;
+    for(size_t k=0;k<x.size();++k) {
+        double t = x[k];
+        double u = 1.0-t;
+        double p = 3.0*u*u*t;
+        double q = 3.0*u*t*t;
+        double d = y[k]-t*t*t;
+        a00 += p*p;
+        a01 += p*q;
+        a11 += q*q;
+        b0 += p*d;
+        b1 += q*d;
+    }
+    double det = a00*a11-a01*a01;
+    double y_0 = 1.0/3.0;
+    double y_1 = 2.0/3.0;
+    if(std::fabs(det)>1e-12) {
+        y_0 = (b0*a11-b1*a01)/det;
+        y_1 = (a00*b1-a01*b0)/det;
+    }
+    Curve curve = {{
+        42, (std::uint8_t)(math::clamp(y_0, 0.0, 1.0)*127.0+0.5),
+        85, (std::uint8_t)(math::clamp(y_1, 0.0, 1.0)*127.0+0.5)
+    }};
+    return curve;
+}
+
+/**
+  Keys are merged greedily: from each kept key, the next kept key is the
+  farthest one whose segment still fits. The search gallops and then
+  bisects, so long holds cost a logarithmic number of fits.
+
+  A segment fits when some curve per channel - the left key's own, the
+  linear one or a refit one - keeps every frame it spans within the
+  tolerance of the source. Rotation progress along a segment is recovered
+  by projecting the source rotation on the plane of its end rotations,
+  which NLerp follows exactly.
+**/
+inline void MotionCompressor::CompressBoneTrack(
+    const Motion &source, const std::vector<Curve> &curves,
+    const std::wstring &name, const Motion::BoneTrack &track, Motion &target
+) const {
+    target.RegisterBone(name);
+    if(track.empty()) {
+        return;
+    }
+
+    std::vector<size_t> frames;
+    std::vector<const Motion::BoneKeyframe*> keys;
+    for(Motion::BoneTrack::const_iterator i=track.begin();i!=track.end();++i) {
+        frames.push_back(i->first);
+        keys.push_back(&i->second);
+    }
+    const size_t first_frame = frames.front();
+    std::vector<Vector3f> translations;
+    std::vector<Vector4f> rotations;
+    for(size_t frame=first_frame;frame<=frames.back();++frame) {
+        Motion::BonePose pose = source.GetBonePose(name, frame);
+        translations.push_back(pose.GetTranslation());
+        rotations.push_back(pose.GetRotation());
+    }
+
+    struct __ {
+        static float ChannelError(
+            const interpolator &curve, float l, float r,
+            const std::vector<float> &x, const std::vector<float> &y
+        ) {
+            float error = 0.0f;
+            for(size_t k=0;k<x.size();++k) {
+                float lambda = curve[x[k]];
+                error = std::max(error, std::fabs(l*(1-lambda)+r*lambda-y[k]));
+            }
+            return error;
+        }
+        static float RotationError(
+            const interpolator &curve, const Vector4f &l, const Vector4f &r,
+            const std::vector<float> &x, const Vector4f *y
+        ) {
+            float error = 0.0f;
+            for(size_t k=0;k<x.size();++k) {
+                error = std::max(error, RotationAngle(NLerp(l, r)[curve[x[k]]], y[k]));
+            }
+            return error;
+        }
+    };
+
+    // Fits keys[i]..keys[j], returning the left key's curves on success.
+    const bool refit = curve_refit_enabled_;
+    const float rotation_tolerance = rotation_tolerance_;
+    const float translation_tolerance = translation_tolerance_;
+    struct Fit {
+        static bool Segment(
+            size_t i, size_t j, const std::vector<size_t> &frames,
+            const std::vector<const Motion::BoneKeyframe*> &keys,
+            const std::vector<Curve> &curves, size_t first_frame,
+            const std::vector<Vector3f> &translations,
+            const std::vector<Vector4f> &rotations,
+            bool refit, float rotation_tolerance, float translation_tolerance,
+            Curve *result
+        ) {
+            const Motion::BoneKeyframe &left = *keys[i];
+            const Motion::BoneKeyframe &right = *keys[j];
+            const size_t own[4] = {
+                left.GetXInterpolator(), left.GetYInterpolator(),
+                left.GetZInterpolator(), left.GetRInterpolator()
+            };
+            if(j==i+1) {
+                for(size_t c=0;c<4;++c) {
+                    result[c] = curves[own[c]];
+                }
+                return true;
+            }
+
+            const size_t span = frames[j]-frames[i];
+            const size_t offset = frames[i]-first_frame;
+            std::vector<float> x(span-1), y(span-1), progress;
+            std::vector<float> fit_x;
+            for(size_t k=1;k<span;++k) {
+                x[k-1] = (float)k/(float)span;
+            }
+
+            Curve linear = {{0, 0, 127, 127}};
+            Vector3f error;
+            for(size_t c=0;c<3;++c) {
+                float l = left.GetTranslation().v[c];
+                float r = right.GetTranslation().v[c];
+                for(size_t k=1;k<span;++k) {
+                    y[k-1] = translations[offset+k].v[c];
+                }
+                Curve candidates[3] = {curves[own[c]], linear, linear};
+                size_t candidate_num = 2;
+                if(refit&&(std::fabs(r-l)>1e-6f)) {
+                    progress.resize(span-1);
+                    for(size_t k=0;k<span-1;++k) {
+                        progress[k] = (y[k]-l)/(r-l);
+                    }
+                    candidates[candidate_num++] = FitCurve(x, progress);
+                }
+                error.v[c] = std::numeric_limits<float>::max();
+                for(size_t n=0;n<candidate_num;++n) {
+                    float e = __::ChannelError(MakeInterpolator(candidates[n]), l, r, x, y);
+                    if(e<error.v[c]) {
+                        error.v[c] = e;
+                        result[c] = candidates[n];
+                    }
+                }
+            }
+            if(error.Norm()>translation_tolerance) {
+                return false;
+            }
+
+            const Vector4f &l = left.GetRotation();
+            Vector4f r = right.GetRotation();
+            if(l*r<0.0f) {
+                r = -r;
+            }
+            Curve candidates[3] = {curves[own[3]], linear, linear};
+            size_t candidate_num = 2;
+            float c = l*r;
+            if(refit&&(c<1.0f-1e-6f)) {
+                fit_x.clear();
+                progress.clear();
+                for(size_t k=1;k<span;++k) {
+                    // q ~ a*l+b*r solved in the plane of l and r.
+                    const Vector4f &q = rotations[offset+k];
+                    float ql = q*l;
+                    float qr = q*r;
+                    if(ql<0.0f) {
+                        ql = -ql;
+                        qr = -qr;
+                    }
+                    float a = ql-c*qr;
+                    float b = qr-c*ql;
+                    if(a+b>1e-6f) {
+                        fit_x.push_back(x[k-1]);
+                        progress.push_back(b/(a+b));
+                    }
+                }
+                if(!fit_x.empty()) {
+                    candidates[candidate_num++] = FitCurve(fit_x, progress);
+                }
+            }
+            float rotation_error = std::numeric_limits<float>::max();
+            for(size_t n=0;n<candidate_num;++n) {
+                float e = __::RotationError(
+                    MakeInterpolator(candidates[n]), l, right.GetRotation(),
+                    x, &rotations[offset+1]
+                );
+                if(e<rotation_error) {
+                    rotation_error = e;
+                    result[3] = candidates[n];
+                }
+            }
+            return rotation_error<=rotation_tolerance;
+        }
+    };
+
+    size_t i = 0;
+    while(i+1<keys.size()) {
+        Curve best[4], fit[4];
+        Fit::Segment(
+            i, i+1, frames, keys, curves, first_frame, translations, rotations,
+            refit, rotation_tolerance, translation_tolerance, best
+        );
+        size_t good = i+1;
+        size_t bad = keys.size();
+        for(size_t step=1;good+step<bad;step*=2) {
+            size_t j = good+step;
+            if(Fit::Segment(
+                i, j, frames, keys, curves, first_frame, translations, rotations,
+                refit, rotation_tolerance, translation_tolerance, fit
+            )) {
+                good = j;
+                std::copy(fit, fit+4, best);
+            } else {
+                bad = j;
+                break;
+            }
+        }
+        while(good+1<bad) {
+            size_t j = (good+bad)/2;
+            if(Fit::Segment(
+                i, j, frames, keys, curves, first_frame, translations, rotations,
+                refit, rotation_tolerance, translation_tolerance, fit
+            )) {
+                good = j;
+                std::copy(fit, fit+4, best);
+            } else {
+                bad = j;
+            }
+        }
+
+        Motion::BoneKeyframe &key = target.GetBoneKeyframe(name, frames[i]);
+        key.SetTranslation(keys[i]->GetTranslation());
+        key.SetRotation(keys[i]->GetRotation());
+        key.SetXInterpolator(target.InternInterpolator(best[0].c[0], best[0].c[1], best[0].c[2], best[0].c[3]));
+        key.SetYInterpolator(target.InternInterpolator(best[1].c[0], best[1].c[1], best[1].c[2], best[1].c[3]));
+        key.SetZInterpolator(target.InternInterpolator(best[2].c[0], best[2].c[1], best[2].c[2], best[2].c[3]));
+        key.SetRInterpolator(target.InternInterpolator(best[3].c[0], best[3].c[1], best[3].c[2], best[3].c[3]));
+        i = good;
+    }
+
+    // The last key's curves are never used, keep them as they are.
+    const Motion::BoneKeyframe &last = *keys.back();
+    Motion::BoneKeyframe &key = target.GetBoneKeyframe(name, frames.back());
+    key.SetTranslation(last.GetTranslation());
+    key.SetRotation(last.GetRotation());
+    const size_t own[4] = {
+        last.GetXInterpolator(), last.GetYInterpolator(),
+        last.GetZInterpolator(), last.GetRInterpolator()
+    };
+    size_t interned[4];
+    for(size_t c=0;c<4;++c) {
+        const Curve &curve = curves[own[c]];
+        interned[c] = target.InternInterpolator(curve.c[0], curve.c[1], curve.c[2], curve.c[3]);
+    }
+    key.SetXInterpolator(interned[0]);
+    key.SetYInterpolator(interned[1]);
+    key.SetZInterpolator(interned[2]);
+    key.SetRInterpolator(interned[3]);
+}
+
+inline void MotionCompressor::CompressMorphTrack(
+    const Motion &source, const std::vector<Curve> &curves,
+    const std::wstring &name, const Motion::MorphTrack &track, Motion &target
+) const {
+    target.RegisterMorph(name);
+    if(track.empty()) {
+        return;
+    }
+
+    std::vector<size_t> frames;
+    std::vector<const Motion::MorphKeyframe*> keys;
+    for(Motion::MorphTrack::const_iterator i=track.begin();i!=track.end();++i) {
+        frames.push_back(i->first);
+        keys.push_back(&i->second);
+    }
+    const size_t first_frame = frames.front();
+    std::vector<float> weights;
+    for(size_t frame=first_frame;frame<=frames.back();++frame) {
+        weights.push_back(source.GetMorphPose(name, frame).GetWeight());
+    }
+
+    const bool refit = curve_refit_enabled_;
+    const float morph_tolerance = morph_tolerance_;
+    struct Fit {
+        static bool Segment(
+            size_t i, size_t j, const std::vector<size_t> &frames,
+            const std::vector<const Motion::MorphKeyframe*> &keys,
+            const std::vector<Curve> &curves, size_t first_frame,
+            const std::vector<float> &weights,
+            bool refit, float morph_tolerance, Curve &result
+        ) {
+            const Motion::MorphKeyframe &left = *keys[i];
+            const Motion::MorphKeyframe &right = *keys[j];
+            result = curves[left.GetWeightInterpolator()];
+            if(j==i+1) {
+                return true;
+            }
+
+            const size_t span = frames[j]-frames[i];
+            const size_t offset = frames[i]-first_frame;
+            const float l = left.GetWeight();
+            const float r = right.GetWeight();
+            std::vector<float> x(span-1), y(span-1);
+            for(size_t k=1;k<span;++k) {
+                x[k-1] = (float)k/(float)span;
+                y[k-1] = weights[offset+k];
+            }
+
+            Curve linear = {{0, 0, 127, 127}};
+            Curve candidates[3] = {result, linear, linear};
+            size_t candidate_num = 2;
+            if(refit&&(std::fabs(r-l)>1e-6f)) {
+                std::vector<float> progress(span-1);
+                for(size_t k=0;k<span-1;++k) {
+                    progress[k] = (y[k]-l)/(r-l);
+                }
+                candidates[candidate_num++] = FitCurve(x, progress);
+            }
+            for(size_t n=0;n<candidate_num;++n) {
+                interpolator curve = MakeInterpolator(candidates[n]);
+                float error = 0.0f;
+                for(size_t k=0;k<x.size();++k) {
+                    float lambda = curve[x[k]];
+                    error = std::max(error, std::fabs(l*(1-lambda)+r*lambda-y[k]));
+                }
+                if(error<=morph_tolerance) {
+                    result = candidates[n];
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    size_t i = 0;
+    while(i+1<keys.size()) {
+        Curve best, fit;
+        Fit::Segment(i, i+1, frames, keys, curves, first_frame, weights, refit, morph_tolerance, best);
+        size_t good = i+1;
+        size_t bad = keys.size();
+        for(size_t step=1;good+step<bad;step*=2) {
+            size_t j = good+step;
+            if(Fit::Segment(i, j, frames, keys, curves, first_frame, weights, refit, morph_tolerance, fit)) {
+                good = j;
+                best = fit;
+            } else {
+                bad = j;
+                break;
+            }
+        }
+        while(good+1<bad) {
+            size_t j = (good+bad)/2;
+            if(Fit::Segment(i, j, frames, keys, curves, first_frame, weights, refit, morph_tolerance, fit)) {
+                good = j;
+                best = fit;
+            } else {
+                bad = j;
+            }
+        }
+
+        Motion::MorphKeyframe &key = target.GetMorphKeyframe(name, frames[i]);
+        key.SetWeight(keys[i]->GetWeight());
+        key.SetWeightInterpolator(target.InternInterpolator(best.c[0], best.c[1], best.c[2], best.c[3]));
+        i = good;
+    }
+
+    const Motion::MorphKeyframe &last = *keys.back();
+    const Curve &curve = curves[last.GetWeightInterpolator()];
+    Motion::MorphKeyframe &key = target.GetMorphKeyframe(name, frames.back());
+    key.SetWeight(last.GetWeight());
+    key.SetWeightInterpolator(target.InternInterpolator(curve.c[0], curve.c[1], curve.c[2], curve.c[3]));
+}
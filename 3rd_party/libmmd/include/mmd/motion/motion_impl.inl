@@ -30,6 +30,10 @@ Motion::MorphPose::GetWeight() const {
     return weight_;
 }
 
+inline
+Motion::BoneKeyframe::BoneKeyframe()
+  : x_interpolator_(0), y_interpolator_(0), z_interpolator_(0), r_interpolator_(0) {}
+
 inline const Vector3f&
 Motion::BoneKeyframe::GetTranslation() const {
     return translation_;
@@ -50,46 +54,50 @@ Motion::BoneKeyframe::SetRotation(const Vector4f &rotation) {
     rotation_ = rotation;
 }
 
-inline const interpolator&
+inline size_t
 Motion::BoneKeyframe::GetXInterpolator() const {
     return x_interpolator_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetXInterpolator() {
-    return x_interpolator_;
+inline void
+Motion::BoneKeyframe::SetXInterpolator(size_t index) {
+    x_interpolator_ = (std::uint32_t)index;
 }
 
-inline const interpolator&
+inline size_t
 Motion::BoneKeyframe::GetYInterpolator() const {
     return y_interpolator_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetYInterpolator() {
-    return y_interpolator_;
+inline void
+Motion::BoneKeyframe::SetYInterpolator(size_t index) {
+    y_interpolator_ = (std::uint32_t)index;
 }
 
-inline const interpolator&
+inline size_t
 Motion::BoneKeyframe::GetZInterpolator() const {
     return z_interpolator_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetZInterpolator() {
-    return z_interpolator_;
+inline void
+Motion::BoneKeyframe::SetZInterpolator(size_t index) {
+    z_interpolator_ = (std::uint32_t)index;
 }
 
-inline const interpolator&
+inline size_t
 Motion::BoneKeyframe::GetRInterpolator() const {
     return r_interpolator_;
 }
 
-inline interpolator&
-Motion::BoneKeyframe::GetRInterpolator() {
-    return r_interpolator_;
+inline void
+Motion::BoneKeyframe::SetRInterpolator(size_t index) {
+    r_interpolator_ = (std::uint32_t)index;
 }
 
+inline
+Motion::MorphKeyframe::MorphKeyframe()
+  : weight_(0.0f), w_interpolator_(0) {}
+
 inline float
 Motion::MorphKeyframe::GetWeight() const {
     return weight_;
@@ -100,14 +108,14 @@ Motion::MorphKeyframe::SetWeight(float weight) {
     weight_ = weight;
 }
 
-inline const interpolator&
+inline size_t
 Motion::MorphKeyframe::GetWeightInterpolator() const {
     return w_interpolator_;
 }
 
-inline interpolator&
-Motion::MorphKeyframe::GetWeightInterpolator() {
-    return w_interpolator_;
+inline void
+Motion::MorphKeyframe::SetWeightInterpolator(size_t index) {
+    w_interpolator_ = (std::uint32_t)index;
 }
 
 inline void
@@ -200,8 +208,23 @@ Motion::QueryMorphKeyframeBackward(const std::wstring &morph_name, size_t frame)
     }
 }
 
+inline const Motion::BoneTrack*
+Motion::GetBoneTrack(const std::wstring &bone_name) const {
+    std::map<std::wstring, BoneTrack>::const_iterator i = bone_motions_.find(bone_name);
+    return (i!=bone_motions_.end())?&i->second:NULL;
+}
+
+inline const Motion::MorphTrack*
+Motion::GetMorphTrack(const std::wstring &morph_name) const {
+    std::map<std::wstring, MorphTrack>::const_iterator i = morph_motions_.find(morph_name);
+    return (i!=morph_motions_.end())?&i->second:NULL;
+}
+
 inline 
-Motion::Motion() : length_(0) {}
+Motion::Motion() : length_(0) {
+    interpolators_.push_back(interpolator());
+    AppendInterpolatorSamples(interpolators_.back());
+}
 
 inline const std::wstring&
 Motion::GetName() const {
@@ -239,6 +262,140 @@ Motion::GetMorphKeyframe(const std::wstring &morph_name, size_t frame) {
     return morph_motions_[morph_name][frame];
 }
 
+inline size_t
+Motion::InternInterpolator(
+    std::uint8_t c0_x, std::uint8_t c0_y, std::uint8_t c1_x, std::uint8_t c1_y
+) {
+    // Every curve with both control points on the diagonal is the identity.
+    if((c0_x==c0_y)&&(c1_x==c1_y)) {
+        return 0;
+    }
+    std::uint32_t key
+        = (std::uint32_t(c0_x)<<24)|(std::uint32_t(c0_y)<<16)
+        | (std::uint32_t(c1_x)<<8)|std::uint32_t(c1_y);
+    std::map<std::uint32_t, std::uint32_t>::const_iterator i = interpolator_index_.find(key);
+    if(i!=interpolator_index_.end()) {
+        return i->second;
+    }
+
+    Vector2f c_0, c_1;
+    const float r = 1.0f/127.0f;
+    c_0.p.x = c0_x*r;
+    c_0.p.y = c0_y*r;
+    c_1.p.x = c1_x*r;
+    c_1.p.y = c1_y*r;
+
+    std::uint32_t index = (std::uint32_t)interpolators_.size();
+    interpolators_.push_back(interpolator(c_0, c_1));
+    AppendInterpolatorSamples(interpolators_.back());
+    interpolator_index_.insert(std::make_pair(key, index));
+    return index;
+}
+
+inline void
+Motion::AppendInterpolatorSamples(const interpolator &curve) {
+    // The linear curve gets a row too (samples i/(n-1)), so that sampling
+    // never has to special-case it.
+    for(size_t i=0;i<interpolator_sample_num;++i) {
+        interpolator_samples_.push_back(curve[float(i)/float(interpolator_sample_num-1)]);
+    }
+}
+
+inline void
+Motion::SampleInterpolators(
+    const std::uint32_t *curves, const float *x, float *lambda, size_t n
+) const {
+    SampleInterpolators(&interpolator_samples_[0], curves, x, lambda, n);
+}
+
+inline const float*
+Motion::GetInterpolatorSamples() const {
+    return &interpolator_samples_[0];
+}
+
+inline void
+Motion::SampleInterpolators(
+    const float *samples,
+    const std::uint32_t *curves, const float *x, float *lambda, size_t n
+) {
+    const float scale = float(interpolator_sample_num-1);
+    size_t i = 0;
+#ifdef MMD_HAS_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 last = _mm_set1_ps(scale-1.0f);
+    for(;i+4<=n;i+=4) {
+        __m128 s = _mm_mul_ps(
+            _mm_min_ps(_mm_max_ps(_mm_loadu_ps(x+i), zero), one), _mm_set1_ps(scale)
+        );
+        // Segment index clamped to the last segment, so x==1 reads its right end.
+        __m128 s_floor = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(s)), last);
+        __m128 r = _mm_sub_ps(s, s_floor);
+
+        int ix[4];
+        _mm_storeu_si128((__m128i*)ix, _mm_cvttps_epi32(s_floor));
+        float a[4], b[4];
+        for(size_t j=0;j<4;++j) {
+            const float *row = samples+curves[i+j]*interpolator_sample_num+ix[j];
+            a[j] = row[0];
+            b[j] = row[1];
+        }
+        __m128 va = _mm_loadu_ps(a);
+        _mm_storeu_ps(lambda+i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b), va), r)));
+    }
+#endif
+    for(;i<n;++i) {
+        float s = std::min(std::max(x[i], 0.0f), 1.0f)*scale;
+        size_t ix = std::min((size_t)s, interpolator_sample_num-2);
+        float r = s-ix;
+        const float *row = samples+curves[i]*interpolator_sample_num+ix;
+        lambda[i] = row[0]+(row[1]-row[0])*r;
+    }
+}
+
+inline const interpolator&
+Motion::GetInterpolator(size_t index) const {
+    return interpolators_[index];
+}
+
+inline size_t
+Motion::GetInterpolatorNum() const {
+    return interpolators_.size();
+}
+
+inline size_t
+Motion::GetBoneKeyframeNum() const {
+    size_t num = 0;
+    for(std::map<std::wstring, std::map<size_t, BoneKeyframe>>::const_iterator i=bone_motions_.begin();i!=bone_motions_.end();++i) {
+        num += i->second.size();
+    }
+    return num;
+}
+
+inline size_t
+Motion::GetMorphKeyframeNum() const {
+    size_t num = 0;
+    for(std::map<std::wstring, std::map<size_t, MorphKeyframe>>::const_iterator i=morph_motions_.begin();i!=morph_motions_.end();++i) {
+        num += i->second.size();
+    }
+    return num;
+}
+
+inline size_t
+Motion::GetResidentSize() const {
+    // A red-black tree node carries a color word and three links besides its value.
+    const size_t node_overhead = 4*sizeof(void*);
+    size_t size = sizeof(Motion);
+    size += bone_motions_.size()*(node_overhead+sizeof(std::wstring)+sizeof(std::map<size_t, BoneKeyframe>));
+    size += GetBoneKeyframeNum()*(node_overhead+sizeof(size_t)+sizeof(BoneKeyframe));
+    size += morph_motions_.size()*(node_overhead+sizeof(std::wstring)+sizeof(std::map<size_t, MorphKeyframe>));
+    size += GetMorphKeyframeNum()*(node_overhead+sizeof(size_t)+sizeof(MorphKeyframe));
+    size += interpolators_.capacity()*sizeof(interpolator);
+    size += interpolator_index_.size()*(node_overhead+2*sizeof(std::uint32_t));
+    size += interpolator_samples_.capacity()*sizeof(float);
+    return size;
+}
+
 inline size_t
 Motion::GetLength() const {
     return length_;
@@ -250,6 +407,11 @@ Motion::Clear() {
     length_ = 0;
     bone_motions_.clear();
     morph_motions_.clear();
+    interpolators_.clear();
+    interpolator_index_.clear();
+    interpolator_samples_.clear();
+    interpolators_.push_back(interpolator());
+    AppendInterpolatorSamples(interpolators_.back());
 }
 
 inline Motion::BonePose
@@ -299,17 +461,17 @@ Motion::GetBonePose(const std::wstring &bone_name, size_t frame) const {
                 Vector3f translation;
                 Vector4f rotation;
 
-                lambda = left_key.GetXInterpolator()[bary_pos];
+                lambda = interpolators_[left_key.GetXInterpolator()][bary_pos];
                 translation.p.x
                     = l_translation.p.x*(1-lambda)+r_translation.p.x*lambda;
-                lambda = left_key.GetYInterpolator()[bary_pos];
+                lambda = interpolators_[left_key.GetYInterpolator()][bary_pos];
                 translation.p.y
                     = l_translation.p.y*(1-lambda)+r_translation.p.y*lambda;
-                lambda = left_key.GetZInterpolator()[bary_pos];
+                lambda = interpolators_[left_key.GetZInterpolator()][bary_pos];
                 translation.p.z
                     = l_translation.p.z*(1-lambda)+r_translation.p.z*lambda;
 
-                lambda = left_key.GetRInterpolator()[bary_pos];
+                lambda = interpolators_[left_key.GetRInterpolator()][bary_pos];
                 rotation = NLerp(l_rotation, r_rotation)[lambda];
 
                 return BonePose(translation, rotation);
@@ -361,17 +523,17 @@ Motion::GetBonePose(const std::wstring &bone_name, double time) const {
             Vector3f translation;
             Vector4f rotation;
 
-            lambda = left_key.GetXInterpolator()[bary_pos];
+            lambda = interpolators_[left_key.GetXInterpolator()][bary_pos];
             translation.p.x
                 = l_translation.p.x*(1-lambda)+r_translation.p.x*lambda;
-            lambda = left_key.GetYInterpolator()[bary_pos];
+            lambda = interpolators_[left_key.GetYInterpolator()][bary_pos];
             translation.p.y
                 = l_translation.p.y*(1-lambda)+r_translation.p.y*lambda;
-            lambda = left_key.GetZInterpolator()[bary_pos];
+            lambda = interpolators_[left_key.GetZInterpolator()][bary_pos];
             translation.p.z
                 = l_translation.p.z*(1-lambda)+r_translation.p.z*lambda;
 
-            lambda = left_key.GetRInterpolator()[bary_pos];
+            lambda = interpolators_[left_key.GetRInterpolator()][bary_pos];
             rotation = NLerp(l_rotation, r_rotation)[lambda];
 
             return BonePose(translation, rotation);
@@ -415,7 +577,7 @@ Motion::GetMorphPose(const std::wstring &morph_name, size_t frame) const {
 
                 float l_weight = left_key.GetWeight();
                 float r_weight = right_key.GetWeight();
-                float lambda = left_key.GetWeightInterpolator()[bary_pos];
+                float lambda = interpolators_[left_key.GetWeightInterpolator()][bary_pos];
 
                 return MorphPose(l_weight*(1-lambda)+r_weight*lambda);
             }
@@ -457,7 +619,7 @@ Motion::GetMorphPose(const std::wstring &morph_name, double time) const {
 
             float l_weight = left_key.GetWeight();
             float r_weight = right_key.GetWeight();
-            float lambda = left_key.GetWeightInterpolator()[bary_pos];
+            float lambda = interpolators_[left_key.GetWeightInterpolator()][bary_pos];
 
             return MorphPose(l_weight*(1-lambda)+r_weight*lambda);
         }
@@ -0,0 +1,110 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __PHYSICS_CACHE_HXX_248E322950B83D98882D6CAE3BAC6B4E_INCLUDED__
+#define __PHYSICS_CACHE_HXX_248E322950B83D98882D6CAE3BAC6B4E_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Recorded physics of one motion on one model: per frame, the skinning
+      matrices of the bones physics poses, and the local matrices of those
+      it fixes in length (see BulletPhysicsReactor::GetPhysicsBones).
+      Applying a frame in place of React poses those bones with the exact
+      bits the recorded run produced, at any frame and in any order.
+
+      Storage is lossless. Each frame is XORed with the frame before it,
+      word by word, and only the low bytes that differ are kept, behind a
+      4-bit byte count per word; unchanged words cost half a byte. Every
+      key_interval-th frame is stored against zero, so applying a frame
+      decodes at most key_interval frames, and one when frames are
+      applied in order.
+
+      An image written by Save records a hash of what the physics was
+      computed from, so a cache can tell when it went stale:
+
+        Header
+        uint32      bones[bone_num]
+        uint32      fixed_bones[fixed_bone_num]
+        uint32      frame_offsets[frame_num+1]      into frame data
+        uint8       frame_data[]
+
+      Everything is little endian.
+    **/
+    class PhysicsCache {
+    public:
+        static const size_t default_key_interval = 32;
+
+        PhysicsCache(
+            const Model &model, const std::vector<size_t> &bones,
+            const std::vector<size_t> &fixed_bones, std::uint64_t source_hash,
+            size_t key_interval = default_key_interval
+        );
+        // Reads an image written by Save.
+        PhysicsCache(const std::wstring &filename);
+
+        void Save(buffer_type &image) const;
+
+        std::uint64_t GetSourceHash() const;
+        size_t GetFrameNum() const;
+        size_t GetBoneNum() const;
+        // Compressed frame data, in bytes.
+        size_t GetDataSize() const;
+
+        // Appends the physics posing of the next frame, after React.
+        void Capture(size_t frame, const Poser &poser);
+
+        /**
+          Replaces React for a captured frame: call it between
+          PrePhysicsPosing and PostPhysicsPosing. Returns false, leaving
+          the poser untouched, when the frame was not captured.
+        **/
+        bool Apply(size_t frame, Poser &poser);
+
+    private:
+        struct Header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t model_bone_num;
+            std::uint64_t source_hash;
+            std::uint32_t image_size;
+            std::uint32_t bone_num;
+            std::uint32_t fixed_bone_num;
+            std::uint32_t frame_num;
+            std::uint32_t key_interval;
+            std::uint32_t data_size;
+        };
+
+        PhysicsCache(const PhysicsCache&);
+        PhysicsCache &operator=(const PhysicsCache&);
+
+        size_t GetWordNum() const;
+        void Decode(size_t frame);
+
+        static void StoreMatrix(const Matrix4f &m, std::uint32_t *words);
+        static Matrix4f LoadMatrix(const std::uint32_t *words);
+
+        size_t model_bone_num_;
+        std::uint64_t source_hash_;
+        size_t key_interval_;
+        std::vector<size_t> bones_;
+        std::vector<size_t> fixed_bones_;
+
+        std::vector<std::uint32_t> frame_offsets_;
+        buffer_type frame_data_;
+
+        // The last frame captured, and the last frame decoded.
+        std::vector<std::uint32_t> captured_words_;
+        std::vector<std::uint32_t> decoded_words_;
+        size_t decoded_frame_;
+    };
+
+#include "physics_cache_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __PHYSICS_CACHE_HXX_248E322950B83D98882D6CAE3BAC6B4E_INCLUDED__ */
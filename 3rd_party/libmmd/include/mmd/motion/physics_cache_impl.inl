@@ -0,0 +1,268 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+namespace {
+    const char physics_cache_magic[8] = {'M', 'M', 'D', 'P', 'H', 'Y', 'S', '\0'};
+    const std::uint32_t physics_cache_version = 1;
+}
+
+inline PhysicsCache::PhysicsCache(
+    const Model &model, const std::vector<size_t> &bones,
+    const std::vector<size_t> &fixed_bones, std::uint64_t source_hash,
+    size_t key_interval
+) : model_bone_num_(model.GetBoneNum()),
+    source_hash_(source_hash),
+    key_interval_(key_interval>0 ? key_interval : 1),
+    bones_(bones),
+    fixed_bones_(fixed_bones),
+    frame_offsets_(1, 0),
+    decoded_frame_(nil)
+{
+    for(size_t i=0;i<bones_.size();++i) {
+        if(bones_[i]>=model_bone_num_) {
+            throw exception(std::string("PhysicsCache: Bone index out of range."));
+        }
+    }
+    for(size_t i=0;i<fixed_bones_.size();++i) {
+        if(fixed_bones_[i]>=model_bone_num_) {
+            throw exception(std::string("PhysicsCache: Bone index out of range."));
+        }
+    }
+}
+
+inline PhysicsCache::PhysicsCache(const std::wstring &filename) : decoded_frame_(nil) {
+    MappedFile file(filename);
+    const std::uint8_t *image = file.GetData();
+    size_t size = file.GetLength();
+
+    if(size<sizeof(Header)) {
+        throw exception(std::string("PhysicsCache: Image is truncated."));
+    }
+    Header header;
+    std::memcpy(&header, image, sizeof(Header));
+    if(std::memcmp(header.magic, physics_cache_magic, sizeof(physics_cache_magic))!=0) {
+        throw exception(std::string("PhysicsCache: Not a physics cache."));
+    }
+    if(header.version!=physics_cache_version) {
+        throw exception(std::string("PhysicsCache: Unsupported version."));
+    }
+    if(header.image_size!=size) {
+        throw exception(std::string("PhysicsCache: Image is truncated."));
+    }
+    std::uint64_t table_size = (std::uint64_t(header.bone_num)+header.fixed_bone_num+header.frame_num+1)*sizeof(std::uint32_t);
+    if(sizeof(Header)+table_size+header.data_size!=size||header.key_interval==0) {
+        throw exception(std::string("PhysicsCache: Corrupted image."));
+    }
+
+    model_bone_num_ = header.model_bone_num;
+    source_hash_ = header.source_hash;
+    key_interval_ = header.key_interval;
+
+    const std::uint8_t *p = image+sizeof(Header);
+    std::vector<std::uint32_t> table(size_t(table_size/sizeof(std::uint32_t)));
+    std::memcpy(&table[0], p, size_t(table_size));
+    p += table_size;
+
+    std::vector<std::uint32_t>::iterator t = table.begin();
+    bones_.assign(t, t+header.bone_num);
+    t += header.bone_num;
+    fixed_bones_.assign(t, t+header.fixed_bone_num);
+    t += header.fixed_bone_num;
+    frame_offsets_.assign(t, table.end());
+    frame_data_.assign(p, p+header.data_size);
+
+    for(size_t i=0;i<bones_.size();++i) {
+        if(bones_[i]>=model_bone_num_) {
+            throw exception(std::string("PhysicsCache: Corrupted image."));
+        }
+    }
+    for(size_t i=0;i<fixed_bones_.size();++i) {
+        if(fixed_bones_[i]>=model_bone_num_) {
+            throw exception(std::string("PhysicsCache: Corrupted image."));
+        }
+    }
+    for(size_t i=0;i+1<frame_offsets_.size();++i) {
+        if(frame_offsets_[i]>frame_offsets_[i+1]) {
+            throw exception(std::string("PhysicsCache: Corrupted image."));
+        }
+    }
+    if(frame_offsets_.front()!=0||frame_offsets_.back()!=header.data_size) {
+        throw exception(std::string("PhysicsCache: Corrupted image."));
+    }
+
+    // Decode trusts the byte counts: each is at most a word, and together
+    // with the counts they fill the frame exactly.
+    size_t word_num = GetWordNum();
+    size_t control_size = (word_num+1)/2;
+    for(size_t frame=0;frame<GetFrameNum();++frame) {
+        size_t frame_size = frame_offsets_[frame+1]-frame_offsets_[frame];
+        if(frame_size<control_size) {
+            throw exception(std::string("PhysicsCache: Corrupted image."));
+        }
+        size_t control = frame_offsets_[frame];
+        size_t byte_num = 0;
+        for(size_t i=0;i<word_num;++i) {
+            std::uint8_t length = std::uint8_t((frame_data_[control+i/2]>>((i%2)*4))&0xf);
+            if(length>sizeof(std::uint32_t)) {
+                throw exception(std::string("PhysicsCache: Corrupted image."));
+            }
+            byte_num += length;
+        }
+        if(control_size+byte_num!=frame_size) {
+            throw exception(std::string("PhysicsCache: Corrupted image."));
+        }
+    }
+}
+
+inline void PhysicsCache::Save(buffer_type &image) const {
+    Header header;
+    std::memcpy(header.magic, physics_cache_magic, sizeof(physics_cache_magic));
+    header.version = physics_cache_version;
+    header.model_bone_num = (std::uint32_t)model_bone_num_;
+    header.source_hash = source_hash_;
+    header.bone_num = (std::uint32_t)bones_.size();
+    header.fixed_bone_num = (std::uint32_t)fixed_bones_.size();
+    header.frame_num = (std::uint32_t)GetFrameNum();
+    header.key_interval = (std::uint32_t)key_interval_;
+    header.data_size = (std::uint32_t)frame_data_.size();
+
+    std::vector<std::uint32_t> table;
+    table.insert(table.end(), bones_.begin(), bones_.end());
+    table.insert(table.end(), fixed_bones_.begin(), fixed_bones_.end());
+    table.insert(table.end(), frame_offsets_.begin(), frame_offsets_.end());
+
+    size_t table_size = table.size()*sizeof(std::uint32_t);
+    header.image_size = (std::uint32_t)(sizeof(Header)+table_size+frame_data_.size());
+
+    image.resize(header.image_size);
+    std::memcpy(&image[0], &header, sizeof(Header));
+    std::memcpy(&image[sizeof(Header)], &table[0], table_size);
+    if(!frame_data_.empty()) {
+        std::memcpy(&image[sizeof(Header)+table_size], &frame_data_[0], frame_data_.size());
+    }
+}
+
+inline std::uint64_t PhysicsCache::GetSourceHash() const {
+    return source_hash_;
+}
+
+inline size_t PhysicsCache::GetFrameNum() const {
+    return frame_offsets_.size()-1;
+}
+
+inline size_t PhysicsCache::GetBoneNum() const {
+    return bones_.size();
+}
+
+inline size_t PhysicsCache::GetDataSize() const {
+    return frame_data_.size();
+}
+
+inline size_t PhysicsCache::GetWordNum() const {
+    return (bones_.size()+fixed_bones_.size())*12;
+}
+
+inline void PhysicsCache::Capture(size_t frame, const Poser &poser) {
+    if(poser.GetModel().GetBoneNum()!=model_bone_num_) {
+        throw exception(std::string("PhysicsCache: Poser does not match the cached model."));
+    }
+    if(frame!=GetFrameNum()) {
+        throw exception(std::string("PhysicsCache: Frames must be captured in order."));
+    }
+
+    size_t word_num = GetWordNum();
+    std::vector<std::uint32_t> words(word_num);
+    for(size_t i=0;i<bones_.size();++i) {
+        StoreMatrix(poser.GetSkinningMatrix(bones_[i]), &words[i*12]);
+    }
+    for(size_t i=0;i<fixed_bones_.size();++i) {
+        StoreMatrix(poser.GetLocalMatrix(fixed_bones_[i]), &words[(bones_.size()+i)*12]);
+    }
+    if(frame%key_interval_==0) {
+        captured_words_.assign(word_num, 0);
+    }
+
+    // Byte counts, two to a byte, then the kept low bytes of each word.
+    size_t control = frame_data_.size();
+    frame_data_.resize(control+(word_num+1)/2, 0);
+    for(size_t i=0;i<word_num;++i) {
+        std::uint32_t x = words[i]^captured_words_[i];
+        std::uint8_t length = 0;
+        while(x!=0) {
+            frame_data_.push_back(std::uint8_t(x&0xff));
+            x >>= 8;
+            ++length;
+        }
+        frame_data_[control+i/2] |= std::uint8_t(length<<((i%2)*4));
+    }
+    frame_offsets_.push_back((std::uint32_t)frame_data_.size());
+    captured_words_.swap(words);
+}
+
+inline void PhysicsCache::Decode(size_t frame) {
+    size_t word_num = GetWordNum();
+    if(word_num==0) {
+        return;
+    }
+    size_t key_frame = frame-frame%key_interval_;
+    size_t next = key_frame;
+    if(decoded_frame_!=nil&&decoded_frame_>=key_frame&&decoded_frame_<=frame) {
+        next = decoded_frame_+1;
+    } else {
+        decoded_words_.assign(word_num, 0);
+    }
+    for(;next<=frame;++next) {
+        const std::uint8_t *control = &frame_data_[0]+frame_offsets_[next];
+        const std::uint8_t *p = control+(word_num+1)/2;
+        for(size_t i=0;i<word_num;++i) {
+            std::uint8_t length = std::uint8_t((control[i/2]>>((i%2)*4))&0xf);
+            std::uint32_t x = 0;
+            for(std::uint8_t b=0;b<length;++b) {
+                x |= std::uint32_t(*p++)<<(b*8);
+            }
+            decoded_words_[i] ^= x;
+        }
+    }
+    decoded_frame_ = frame;
+}
+
+inline bool PhysicsCache::Apply(size_t frame, Poser &poser) {
+    if(frame>=GetFrameNum()) {
+        return false;
+    }
+    if(poser.GetModel().GetBoneNum()!=model_bone_num_) {
+        throw exception(std::string("PhysicsCache: Poser does not match the cached model."));
+    }
+    Decode(frame);
+    for(size_t i=0;i<bones_.size();++i) {
+        poser.SetSkinningMatrix(bones_[i], LoadMatrix(&decoded_words_[i*12]));
+    }
+    for(size_t i=0;i<fixed_bones_.size();++i) {
+        poser.SetLocalMatrix(fixed_bones_[i], LoadMatrix(&decoded_words_[(bones_.size()+i)*12]));
+    }
+    return true;
+}
+
+// Physics only writes affine matrices; the constant column is not stored.
+inline void PhysicsCache::StoreMatrix(const Matrix4f &m, std::uint32_t *words) {
+    for(size_t r=0;r<4;++r) {
+        for(size_t c=0;c<3;++c) {
+            std::memcpy(&words[r*3+c], &m.v[r*4+c], sizeof(std::uint32_t));
+        }
+    }
+}
+
+inline Matrix4f PhysicsCache::LoadMatrix(const std::uint32_t *words) {
+    Matrix4f m;
+    for(size_t r=0;r<4;++r) {
+        for(size_t c=0;c<3;++c) {
+            std::memcpy(&m.v[r*4+c], &words[r*3+c], sizeof(float));
+        }
+        m.v[r*4+3] = (r==3) ? 1.0f : 0.0f;
+    }
+    return m;
+}
@@ -0,0 +1,78 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __POSE_CACHE_HXX_3F0AE088921CCDD89B668300903D3545_INCLUDED__
+#define __POSE_CACHE_HXX_3F0AE088921CCDD89B668300903D3545_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Fully evaluated poses of one poser by frame: the skinning matrices
+      PostPhysicsPosing left, the morph rates and optionally a physics
+      state (see BulletPhysicsReactor::SaveState). Restoring a frame skips
+      motion sampling, IK and physics, so scrubbing over frames seen before
+      costs a copy and Deform.
+
+      Least recently used frames are dropped to stay within the memory
+      budget. The cache does not know what produced a pose: clear it when
+      the model, motion or anything else affecting the pose changes.
+    **/
+    class PoseCache {
+    public:
+        PoseCache(size_t memory_budget);
+
+        size_t GetMemoryBudget() const;
+        void SetMemoryBudget(size_t memory_budget);
+
+        bool Contains(size_t frame) const;
+
+        /**
+          On a hit, poses the poser as stored (see Poser::SkinnedPosing) and
+          fills physics_state, when given, with the stored state (empty when
+          none was stored).
+        **/
+        bool Restore(
+            size_t frame, Poser &poser, std::vector<float> *physics_state = NULL
+        );
+        void Store(
+            size_t frame, const Poser &poser,
+            const std::vector<float> *physics_state = NULL
+        );
+
+        size_t GetFrameNum() const;
+        size_t GetResidentSize() const;
+        size_t GetHitNum() const;
+        size_t GetMissNum() const;
+
+        void Clear();
+
+    private:
+        struct Entry {
+            std::vector<float> matrices;        // 3x4 per bone, rows
+            std::vector<float> morph_rates;
+            std::vector<float> physics_state;
+            std::list<size_t>::iterator use;
+        };
+
+        static size_t GetEntrySize(const Entry &entry);
+        void Evict(size_t memory_budget);
+
+        size_t memory_budget_;
+        size_t resident_size_;
+        size_t hit_num_;
+        size_t miss_num_;
+
+        std::map<size_t, Entry> entries_;
+        // Frames from most to least recently used.
+        std::list<size_t> uses_;
+    };
+
+#include "pose_cache_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __POSE_CACHE_HXX_3F0AE088921CCDD89B668300903D3545_INCLUDED__ */
@@ -0,0 +1,142 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+inline PoseCache::PoseCache(size_t memory_budget)
+  : memory_budget_(memory_budget), resident_size_(0), hit_num_(0), miss_num_(0) {}
+
+inline size_t PoseCache::GetMemoryBudget() const {
+    return memory_budget_;
+}
+
+inline void PoseCache::SetMemoryBudget(size_t memory_budget) {
+    memory_budget_ = memory_budget;
+    Evict(memory_budget_);
+}
+
+inline bool PoseCache::Contains(size_t frame) const {
+    return entries_.find(frame)!=entries_.end();
+}
+
+inline bool PoseCache::Restore(
+    size_t frame, Poser &poser, std::vector<float> *physics_state
+) {
+    std::map<size_t, Entry>::iterator i = entries_.find(frame);
+    size_t bone_num = poser.GetModel().GetBoneNum();
+    size_t morph_num = poser.GetModel().GetMorphNum();
+    if(i==entries_.end()
+        ||i->second.matrices.size()!=bone_num*12
+        ||i->second.morph_rates.size()!=morph_num) {
+        ++miss_num_;
+        return false;
+    }
+    ++hit_num_;
+    Entry &entry = i->second;
+    uses_.splice(uses_.begin(), uses_, entry.use);
+
+    for(size_t k=0;k<morph_num;++k) {
+        poser.SetMorphPose(k, Motion::MorphPose(entry.morph_rates[k]));
+    }
+    const float *matrix = entry.matrices.empty() ? NULL : &entry.matrices[0];
+    for(size_t k=0;k<bone_num;++k, matrix+=12) {
+        Matrix4f m;
+        for(size_t r=0;r<4;++r) {
+            for(size_t c=0;c<3;++c) {
+                m.v[r*4+c] = matrix[r*3+c];
+            }
+            m.v[r*4+3] = (r==3) ? 1.0f : 0.0f;
+        }
+        poser.SetSkinningMatrix(k, m);
+    }
+    poser.SkinnedPosing();
+
+    if(physics_state) {
+        *physics_state = entry.physics_state;
+    }
+    return true;
+}
+
+inline void PoseCache::Store(
+    size_t frame, const Poser &poser, const std::vector<float> *physics_state
+) {
+    size_t bone_num = poser.GetModel().GetBoneNum();
+    size_t morph_num = poser.GetModel().GetMorphNum();
+    size_t size = sizeof(Entry)+sizeof(float)*(bone_num*12+morph_num);
+    if(physics_state) {
+        size += sizeof(float)*physics_state->size();
+    }
+    if(size>memory_budget_) {
+        return;
+    }
+
+    std::map<size_t, Entry>::iterator i = entries_.find(frame);
+    if(i!=entries_.end()) {
+        resident_size_ -= GetEntrySize(i->second);
+        uses_.erase(i->second.use);
+        entries_.erase(i);
+    }
+    Evict(memory_budget_-size);
+
+    Entry &entry = entries_[frame];
+    uses_.push_front(frame);
+    entry.use = uses_.begin();
+
+    entry.matrices.resize(bone_num*12);
+    float *matrix = entry.matrices.empty() ? NULL : &entry.matrices[0];
+    for(size_t k=0;k<bone_num;++k, matrix+=12) {
+        const Matrix4f &m = poser.GetSkinningMatrix(k);
+        for(size_t r=0;r<4;++r) {
+            for(size_t c=0;c<3;++c) {
+                matrix[r*3+c] = m.v[r*4+c];
+            }
+        }
+    }
+    entry.morph_rates.resize(morph_num);
+    for(size_t k=0;k<morph_num;++k) {
+        entry.morph_rates[k] = poser.GetMorphPose(k).GetWeight();
+    }
+    if(physics_state) {
+        entry.physics_state = *physics_state;
+    }
+    resident_size_ += GetEntrySize(entry);
+}
+
+inline size_t PoseCache::GetFrameNum() const {
+    return entries_.size();
+}
+
+inline size_t PoseCache::GetResidentSize() const {
+    return resident_size_;
+}
+
+inline size_t PoseCache::GetHitNum() const {
+    return hit_num_;
+}
+
+inline size_t PoseCache::GetMissNum() const {
+    return miss_num_;
+}
+
+inline void PoseCache::Clear() {
+    entries_.clear();
+    uses_.clear();
+    resident_size_ = 0;
+}
+
+inline size_t PoseCache::GetEntrySize(const Entry &entry) {
+    return sizeof(Entry)+sizeof(float)*(
+        entry.matrices.size()+entry.morph_rates.size()+entry.physics_state.size()
+    );
+}
+
+inline void PoseCache::Evict(size_t memory_budget) {
+    while(resident_size_>memory_budget&&!uses_.empty()) {
+        std::map<size_t, Entry>::iterator i = entries_.find(uses_.back());
+        resident_size_ -= GetEntrySize(i->second);
+        entries_.erase(i);
+        uses_.pop_back();
+    }
+}
@@ -34,9 +34,45 @@ namespace mmd {
             const std::wstring &name, const Motion::MorphPose &morph_pose
         );
 
+        Motion::MorphPose GetMorphPose(size_t index) const;
+
         void PrePhysicsPosing();
         void PostPhysicsPosing();
 
+        /**
+          Baked posing (see BakedMotion). After PrePhysicsPosing, the baked
+          pose of a pre-physics bone is its resolved local transform, with
+          bone morphs, append and IK applied; for a post-physics bone it is
+          the plain motion pose, which PostPhysicsPosing resolves as usual.
+          BakedPrePhysicsPosing replaces PrePhysicsPosing after the baked
+          poses and morph rates have been set.
+        **/
+        Motion::BonePose GetBakedBonePose(size_t index) const;
+        void SetBakedBonePose(size_t index, const Motion::BonePose &bone_pose);
+        void BakedPrePhysicsPosing();
+
+        /**
+          Skinned posing (see PoseCache). After PostPhysicsPosing, the
+          skinning matrix of every bone is final. SkinnedPosing replaces the
+          whole posing pass, physics included, once the skinning matrices
+          and morph rates have been set; only morphs are applied again.
+        **/
+        const Matrix4f &GetSkinningMatrix(size_t index) const;
+        void SetSkinningMatrix(size_t index, const Matrix4f &matrix);
+        void SkinnedPosing();
+
+        // Physics fixes the local matrices of strict bones (see PhysicsCache).
+        const Matrix4f &GetLocalMatrix(size_t index) const;
+        void SetLocalMatrix(size_t index, const Matrix4f &matrix);
+
+        /**
+          Copies the bone and morph posing state of a poser of the same
+          model, e.g. to hand a PrePhysicsPosing result to a physics thread
+          that continues with PostPhysicsPosing. Vertex and material images
+          are not copied.
+        **/
+        void CopyPosing(const Poser &poser);
+
         void Deform();
 
         const Model &GetModel() const;
@@ -170,6 +206,8 @@ namespace mmd {
 
         void UpdateMorphTransform(size_t index, float rate);
 
+        void ResetPosingImages();
+
         Model &model_;
 
         std::map<std::wstring, size_t> bone_name_map_;
@@ -181,19 +219,71 @@ namespace mmd {
         Poser &operator=(Poser&);
     };
 
+    /**
+      Samples a motion into a poser. Plays either a Motion or a
+      CompiledMotion, which must outlive the player.
+    **/
     class MotionPlayer {
+        friend class LayeredMotionPlayer;
+        friend class MotionEvaluationCache;
     public:
         MotionPlayer(const Motion &motion, Poser &poser);
+        MotionPlayer(const CompiledMotion &motion, Poser &poser);
         void SeekFrame(size_t frame);
         void SeekTime(double time);
 
     private:
         MotionPlayer &operator=(const MotionPlayer&);
 
+        void Bind();
+        void Sample(double frame);
+        void GatherMotion(double frame, size_t key_frame);
+        void GatherCompiledMotion(double frame, size_t key_frame);
+
+        void SetBoneSlot(
+            size_t k, float position, const std::uint32_t *curves,
+            const float *l_translation, const float *l_rotation,
+            const float *r_translation, const float *r_rotation
+        );
+        void SetMorphSlot(
+            size_t k, float position, std::uint32_t curve,
+            float l_weight, float r_weight
+        );
+
+        static void LerpBatch(
+            const float *l, const float *r, const float *lambda,
+            float *result, size_t n
+        );
+        static void NLerpBatch(
+            const float *l, const float *r, const float *lambda,
+            float *result, size_t n
+        );
+
         std::vector<std::pair<std::wstring, size_t>> bone_map_;
         std::vector<std::pair<std::wstring, size_t>> morph_map_;
 
-        const Motion &motion_;
+        // Tracks bound to bone_map_/morph_map_ entries, per motion kind.
+        std::vector<const Motion::BoneTrack*> bone_tracks_;
+        std::vector<const Motion::MorphTrack*> morph_tracks_;
+        std::vector<size_t> compiled_bone_tracks_;
+        std::vector<size_t> compiled_morph_tracks_;
+
+        /**
+          Per-seek scratch in structure-of-arrays layout. For n bones and m
+          morphs, curves_/positions_/lambdas_ hold blocks X, Y, Z, R of n
+          entries followed by m morph entries; l_values_/r_values_/results_
+          hold blocks tx, ty, tz, qi, qj, qk, qe of n entries followed by m
+          morph weights.
+        **/
+        std::vector<std::uint32_t> curves_;
+        std::vector<float> positions_;
+        std::vector<float> lambdas_;
+        std::vector<float> l_values_;
+        std::vector<float> r_values_;
+        std::vector<float> results_;
+
+        const Motion *motion_;
+        const CompiledMotion *compiled_motion_;
         Poser &poser_;
     };
 
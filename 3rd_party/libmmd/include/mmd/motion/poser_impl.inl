@@ -359,7 +359,7 @@ inline void Poser::UpdateMorphTransform(size_t index, float rate) {
     }
 }
 
-inline void Poser::PrePhysicsPosing() {
+inline void Poser::ResetPosingImages() {
     for(std::vector<Vector3f>::iterator i = vertex_images_.begin();i!=vertex_images_.end();++i) {
         i->MakeZero();
     }
@@ -371,9 +371,6 @@ inline void Poser::PrePhysicsPosing() {
 
         i->pre_ik_rotation_.q.MakeIdentity();
         i->ik_rotation_.q.MakeIdentity();
-
-        i->total_rotation_.q.MakeIdentity();
-        i->total_translation_.MakeZero();
     }
     for(std::vector<MaterialImage>::iterator i = material_mul_images_.begin();i!=material_mul_images_.end();++i) {
         i->Init(1.0f);
@@ -381,6 +378,14 @@ inline void Poser::PrePhysicsPosing() {
     for(std::vector<MaterialImage>::iterator i = material_add_images_.begin();i!=material_add_images_.end();++i) {
         i->Init(0.0f);
     }
+}
+
+inline void Poser::PrePhysicsPosing() {
+    ResetPosingImages();
+    for(std::vector<BoneImage>::iterator i = bone_images_.begin();i!=bone_images_.end();++i) {
+        i->total_rotation_.q.MakeIdentity();
+        i->total_translation_.MakeZero();
+    }
     for(size_t i=0;i<morph_rates_.size();++i) {
         UpdateMorphTransform(i, morph_rates_[i]);
     }
@@ -388,6 +393,101 @@ inline void Poser::PrePhysicsPosing() {
     UpdateBoneSkinningMatrix(pre_physics_bones_);
 }
 
+inline void Poser::BakedPrePhysicsPosing() {
+    ResetPosingImages();
+    // Bone morphs are already part of the baked transforms of pre-physics
+    // bones, but post-physics bones and vertex morphs still need them.
+    for(size_t i=0;i<morph_rates_.size();++i) {
+        UpdateMorphTransform(i, morph_rates_[i]);
+    }
+    size_t n = pre_physics_bones_.size();
+    for(size_t i=0;i<n;++i) {
+        BoneImage& image = bone_images_[pre_physics_bones_[i]];
+        image.local_matrix_ = image.total_rotation_.q.ToRotateMatrix();
+        image.local_matrix_.r.v[3].downgrade.vector3d = image.total_translation_+image.local_offset_;
+        if(image.has_parent_) {
+            image.local_matrix_ = image.local_matrix_*bone_images_[image.parent_].local_matrix_;
+        }
+    }
+    UpdateBoneSkinningMatrix(pre_physics_bones_);
+}
+
+inline Motion::BonePose Poser::GetBakedBonePose(size_t index) const {
+    const BoneImage& image = bone_images_[index];
+    if(model_.GetBone(index).IsPostPhysics()) {
+        return Motion::BonePose(image.translation_, image.rotation_);
+    }
+    // Taken relative to the parent's final matrix rather than from the total
+    // transforms, so that bones posed before an IK solve moved their parent
+    // replay exactly as PrePhysicsPosing left them.
+    Matrix4f local_matrix = image.local_matrix_;
+    if(image.has_parent_) {
+        local_matrix = local_matrix*bone_images_[image.parent_].local_matrix_.Inverse();
+    }
+    Vector4f rotation;
+    rotation.q = RotateMatrixToQuaternion(local_matrix).Normalize();
+    return Motion::BonePose(local_matrix.r.v[3].downgrade.vector3d-image.local_offset_, rotation);
+}
+
+inline void Poser::SetBakedBonePose(size_t index, const Motion::BonePose &bone_pose) {
+    BoneImage& image = bone_images_[index];
+    if(model_.GetBone(index).IsPostPhysics()) {
+        image.translation_ = bone_pose.GetTranslation();
+        image.rotation_ = bone_pose.GetRotation();
+    } else {
+        image.total_translation_ = bone_pose.GetTranslation();
+        image.total_rotation_ = bone_pose.GetRotation();
+    }
+}
+
+inline const Matrix4f &Poser::GetSkinningMatrix(size_t index) const {
+    return bone_images_[index].skinning_matrix_;
+}
+
+inline void Poser::SetSkinningMatrix(size_t index, const Matrix4f &matrix) {
+    bone_images_[index].skinning_matrix_ = matrix;
+}
+
+inline const Matrix4f &Poser::GetLocalMatrix(size_t index) const {
+    return bone_images_[index].local_matrix_;
+}
+
+inline void Poser::SetLocalMatrix(size_t index, const Matrix4f &matrix) {
+    bone_images_[index].local_matrix_ = matrix;
+}
+
+inline void Poser::SkinnedPosing() {
+    ResetPosingImages();
+    for(size_t i=0;i<morph_rates_.size();++i) {
+        UpdateMorphTransform(i, morph_rates_[i]);
+    }
+    // Physics fixes strict bones against their parents' local matrices.
+    for(std::vector<BoneImage>::iterator i = bone_images_.begin();i!=bone_images_.end();++i) {
+        i->local_matrix_ = i->global_offset_matrix_inv_*i->skinning_matrix_;
+    }
+}
+
+inline void Poser::CopyPosing(const Poser &poser) {
+    if(&poser.model_!=&model_) {
+        throw exception(std::string("Poser: Cannot copy posing of another model."));
+    }
+    for(size_t i=0;i<bone_images_.size();++i) {
+        BoneImage &image = bone_images_[i];
+        const BoneImage &source = poser.bone_images_[i];
+        image.rotation_ = source.rotation_;
+        image.translation_ = source.translation_;
+        image.morph_rotation_ = source.morph_rotation_;
+        image.morph_translation_ = source.morph_translation_;
+        image.pre_ik_rotation_ = source.pre_ik_rotation_;
+        image.ik_rotation_ = source.ik_rotation_;
+        image.total_rotation_ = source.total_rotation_;
+        image.total_translation_ = source.total_translation_;
+        image.local_matrix_ = source.local_matrix_;
+        image.skinning_matrix_ = source.skinning_matrix_;
+    }
+    morph_rates_ = poser.morph_rates_;
+}
+
 inline void Poser::PostPhysicsPosing() {
     UpdateBoneTransform(post_physics_bones_);
     UpdateBoneSkinningMatrix(post_physics_bones_);
@@ -479,6 +579,10 @@ inline void Poser::SetMorphPose(size_t index, const Motion::MorphPose &morph_pos
     morph_rates_[index] = morph_pose.GetWeight();
 }
 
+inline Motion::MorphPose Poser::GetMorphPose(size_t index) const {
+    return Motion::MorphPose(morph_rates_[index]);
+}
+
 inline void Poser::SetMorphPose(const std::wstring &name, const Motion::MorphPose &morph_pose) {
     std::map<std::wstring, size_t>::iterator i = morph_name_map_.find(name);
     if(i!=morph_name_map_.end()) {
@@ -519,37 +623,334 @@ inline void Poser::MaterialImage::Init(float value) {
     diffuse_ = specular_ = ambient_ = edge_color_ = texture_ = sub_texture_ = toon_texture_ = seed;
 }
 
-inline MotionPlayer::MotionPlayer(const Motion& motion, Poser& poser) : motion_(motion), poser_(poser) {
+inline MotionPlayer::MotionPlayer(const Motion& motion, Poser& poser)
+  : motion_(&motion), compiled_motion_(NULL), poser_(poser) {
+    Bind();
+}
+
+inline MotionPlayer::MotionPlayer(const CompiledMotion& motion, Poser& poser)
+  : motion_(NULL), compiled_motion_(&motion), poser_(poser) {
+    Bind();
+}
+
+inline void MotionPlayer::Bind() {
     const Model& model = poser_.GetModel();
     for(size_t i=0;i<model.GetBoneNum();++i) {
         const std::wstring &name = model.GetBone(i).GetName();
-        if(motion_.IsBoneRegistered(name)) {
-            bone_map_.push_back(std::make_pair(name, i));
+        if(motion_) {
+            if(motion_->IsBoneRegistered(name)) {
+                bone_map_.push_back(std::make_pair(name, i));
+                bone_tracks_.push_back(motion_->GetBoneTrack(name));
+            }
+        } else {
+            size_t track = compiled_motion_->FindBoneTrack(name);
+            if(track!=nil) {
+                bone_map_.push_back(std::make_pair(name, i));
+                compiled_bone_tracks_.push_back(track);
+            }
         }
     }
 
     for(size_t i=0;i<model.GetMorphNum();++i) {
         const std::wstring &name = model.GetMorph(i).GetName();
-        if(motion_.IsMorphRegistered(name)) {
-            morph_map_.push_back(std::make_pair(name, i));
+        if(motion_) {
+            if(motion_->IsMorphRegistered(name)) {
+                morph_map_.push_back(std::make_pair(name, i));
+                morph_tracks_.push_back(motion_->GetMorphTrack(name));
+            }
+        } else {
+            size_t track = compiled_motion_->FindMorphTrack(name);
+            if(track!=nil) {
+                morph_map_.push_back(std::make_pair(name, i));
+                compiled_morph_tracks_.push_back(track);
+            }
         }
     }
+
+    size_t n = bone_map_.size();
+    size_t m = morph_map_.size();
+    curves_.resize(4*n+m);
+    positions_.resize(4*n+m);
+    lambdas_.resize(4*n+m);
+    l_values_.resize(7*n+m);
+    r_values_.resize(7*n+m);
+    results_.resize(7*n+m);
 }
 
 inline void MotionPlayer::SeekFrame(size_t frame) {
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
-        poser_.SetMorphPose(i->second, motion_.GetMorphPose(i->first, frame));
+    Sample(double(frame));
+}
+
+inline void MotionPlayer::SeekTime(double time) {
+    Sample(time*30.0);
+}
+
+inline void MotionPlayer::SetBoneSlot(
+    size_t k, float position, const std::uint32_t *curves,
+    const float *l_translation, const float *l_rotation,
+    const float *r_translation, const float *r_rotation
+) {
+    const size_t n = bone_map_.size();
+    for(size_t c=0;c<4;++c) {
+        curves_[c*n+k] = curves[c];
+        positions_[c*n+k] = position;
+    }
+    for(size_t c=0;c<3;++c) {
+        l_values_[c*n+k] = l_translation[c];
+        r_values_[c*n+k] = r_translation[c];
     }
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
-        poser_.SetBonePose(i->second, motion_.GetBonePose(i->first, frame));
+    for(size_t c=0;c<4;++c) {
+        l_values_[(3+c)*n+k] = l_rotation[c];
+        r_values_[(3+c)*n+k] = r_rotation[c];
     }
 }
 
-inline void MotionPlayer::SeekTime(double time) {
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
-        poser_.SetMorphPose(i->second, motion_.GetMorphPose(i->first, time));
+inline void MotionPlayer::SetMorphSlot(
+    size_t k, float position, std::uint32_t curve, float l_weight, float r_weight
+) {
+    const size_t n = bone_map_.size();
+    curves_[4*n+k] = curve;
+    positions_[4*n+k] = position;
+    l_values_[7*n+k] = l_weight;
+    r_values_[7*n+k] = r_weight;
+}
+
+// Clamped and exact hits use the same key on both sides, so the blend is a no-op.
+inline void MotionPlayer::GatherMotion(double frame, size_t key_frame) {
+    static const std::uint32_t linear[4] = {0, 0, 0, 0};
+    for(size_t k=0;k<bone_tracks_.size();++k) {
+        const Motion::BoneTrack &keyframes = *bone_tracks_[k];
+        if(keyframes.empty()) {
+            static const float zero[3] = {0.0f, 0.0f, 0.0f};
+            static const float identity[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+            SetBoneSlot(k, 0.0f, linear, zero, identity, zero, identity);
+            continue;
+        }
+        Motion::BoneTrack::const_iterator right = keyframes.upper_bound(key_frame);
+        Motion::BoneTrack::const_iterator left = right;
+        float position = 0.0f;
+        std::uint32_t curves[4] = {0, 0, 0, 0};
+        if(right==keyframes.begin()) {
+            left = right;
+        } else if(right==keyframes.end()) {
+            right = --left;
+        } else {
+            --left;
+            position = (float)((frame-left->first)/(right->first-left->first));
+            curves[0] = (std::uint32_t)left->second.GetXInterpolator();
+            curves[1] = (std::uint32_t)left->second.GetYInterpolator();
+            curves[2] = (std::uint32_t)left->second.GetZInterpolator();
+            curves[3] = (std::uint32_t)left->second.GetRInterpolator();
+        }
+        float l_translation[3], l_rotation[4], r_translation[3], r_rotation[4];
+        for(size_t c=0;c<3;++c) {
+            l_translation[c] = left->second.GetTranslation().v[c];
+            r_translation[c] = right->second.GetTranslation().v[c];
+        }
+        for(size_t c=0;c<4;++c) {
+            l_rotation[c] = left->second.GetRotation().v[c];
+            r_rotation[c] = right->second.GetRotation().v[c];
+        }
+        SetBoneSlot(
+            k, position, curves,
+            l_translation, l_rotation, r_translation, r_rotation
+        );
+    }
+
+    for(size_t k=0;k<morph_tracks_.size();++k) {
+        const Motion::MorphTrack &keyframes = *morph_tracks_[k];
+        if(keyframes.empty()) {
+            SetMorphSlot(k, 0.0f, 0, 0.0f, 0.0f);
+            continue;
+        }
+        Motion::MorphTrack::const_iterator right = keyframes.upper_bound(key_frame);
+        Motion::MorphTrack::const_iterator left = right;
+        float position = 0.0f;
+        std::uint32_t curve = 0;
+        if(right==keyframes.begin()) {
+            left = right;
+        } else if(right==keyframes.end()) {
+            right = --left;
+        } else {
+            --left;
+            position = (float)((frame-left->first)/(right->first-left->first));
+            curve = (std::uint32_t)left->second.GetWeightInterpolator();
+        }
+        SetMorphSlot(k, position, curve, left->second.GetWeight(), right->second.GetWeight());
+    }
+}
+
+inline void MotionPlayer::GatherCompiledMotion(double frame, size_t key_frame) {
+    static const std::uint32_t linear[4] = {0, 0, 0, 0};
+    for(size_t k=0;k<compiled_bone_tracks_.size();++k) {
+        size_t track = compiled_bone_tracks_[k];
+        size_t key_num = compiled_motion_->GetBoneKeyNum(track);
+        if(key_num==0) {
+            static const float zero[3] = {0.0f, 0.0f, 0.0f};
+            static const float identity[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+            SetBoneSlot(k, 0.0f, linear, zero, identity, zero, identity);
+            continue;
+        }
+        const std::uint32_t *frames = compiled_motion_->GetBoneFrames(track);
+        const CompiledMotion::BoneKey *keys = compiled_motion_->GetBoneKeys(track);
+        size_t right = std::upper_bound(frames, frames+key_num, key_frame)-frames;
+        size_t left = right;
+        float position = 0.0f;
+        const std::uint32_t *curves = linear;
+        if(right==0) {
+            left = right;
+        } else if(right==key_num) {
+            right = --left;
+        } else {
+            --left;
+            position = (float)((frame-frames[left])/(frames[right]-frames[left]));
+            curves = keys[left].curves;
+        }
+        float l_rotation[4], r_rotation[4];
+        CompiledMotion::UnpackRotation(keys[left].rotation, l_rotation);
+        CompiledMotion::UnpackRotation(keys[right].rotation, r_rotation);
+        SetBoneSlot(
+            k, position, curves,
+            keys[left].translation, l_rotation,
+            keys[right].translation, r_rotation
+        );
+    }
+
+    for(size_t k=0;k<compiled_morph_tracks_.size();++k) {
+        size_t track = compiled_morph_tracks_[k];
+        size_t key_num = compiled_motion_->GetMorphKeyNum(track);
+        if(key_num==0) {
+            SetMorphSlot(k, 0.0f, 0, 0.0f, 0.0f);
+            continue;
+        }
+        const std::uint32_t *frames = compiled_motion_->GetMorphFrames(track);
+        const CompiledMotion::MorphKey *keys = compiled_motion_->GetMorphKeys(track);
+        size_t right = std::upper_bound(frames, frames+key_num, key_frame)-frames;
+        size_t left = right;
+        float position = 0.0f;
+        std::uint32_t curve = 0;
+        if(right==0) {
+            left = right;
+        } else if(right==key_num) {
+            right = --left;
+        } else {
+            --left;
+            position = (float)((frame-frames[left])/(frames[right]-frames[left]));
+            curve = keys[left].curve;
+        }
+        SetMorphSlot(k, position, curve, keys[left].weight, keys[right].weight);
+    }
+}
+
+inline void MotionPlayer::Sample(double frame) {
+    const size_t n = bone_map_.size();
+    const size_t m = morph_map_.size();
+    const size_t key_frame = (frame>0.0)?size_t(frame):0;
+
+    // Gather: locate the surrounding keyframes of every track.
+    const float *samples;
+    if(motion_) {
+        GatherMotion(frame, key_frame);
+        samples = motion_->GetInterpolatorSamples();
+    } else {
+        GatherCompiledMotion(frame, key_frame);
+        samples = compiled_motion_->GetInterpolatorSamples();
+    }
+
+    if(n+m==0) {
+        return;
+    }
+
+    // Solve: every curve of every track in one pass, then blend in bulk.
+    Motion::SampleInterpolators(samples, &curves_[0], &positions_[0], &lambdas_[0], 4*n+m);
+    LerpBatch(&l_values_[0], &r_values_[0], &lambdas_[0], &results_[0], 3*n);
+    NLerpBatch(&l_values_[3*n], &r_values_[3*n], &lambdas_[3*n], &results_[3*n], n);
+    LerpBatch(&l_values_[7*n], &r_values_[7*n], &lambdas_[4*n], &results_[7*n], m);
+
+    // Scatter.
+    for(size_t k=0;k<m;++k) {
+        poser_.SetMorphPose(morph_map_[k].second, Motion::MorphPose(results_[7*n+k]));
+    }
+    for(size_t k=0;k<n;++k) {
+        Vector3f translation;
+        Vector4f rotation;
+        for(size_t c=0;c<3;++c) {
+            translation.v[c] = results_[c*n+k];
+        }
+        for(size_t c=0;c<4;++c) {
+            rotation.v[c] = results_[(3+c)*n+k];
+        }
+        poser_.SetBonePose(bone_map_[k].second, Motion::BonePose(translation, rotation));
+    }
+}
+
+inline void MotionPlayer::LerpBatch(
+    const float *l, const float *r, const float *lambda, float *result, size_t n
+) {
+    size_t i = 0;
+#ifdef MMD_HAS_SSE2
+    for(;i+4<=n;i+=4) {
+        __m128 a = _mm_loadu_ps(l+i);
+        __m128 t = _mm_loadu_ps(lambda+i);
+        _mm_storeu_ps(result+i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(r+i), a), t)));
     }
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
-        poser_.SetBonePose(i->second, motion_.GetBonePose(i->first, time));
+#endif
+    for(;i<n;++i) {
+        result[i] = l[i]+(r[i]-l[i])*lambda[i];
+    }
+}
+
+/**
+  NLerp over n quaternions stored as four component blocks of n floats
+  (l, r and result alike). Blends along the shorter arc, as NLerp() does.
+**/
+inline void MotionPlayer::NLerpBatch(
+    const float *l, const float *r, const float *lambda, float *result, size_t n
+) {
+    size_t i = 0;
+#ifdef MMD_HAS_SSE2
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for(;i+4<=n;i+=4) {
+        __m128 a[4], b[4];
+        for(size_t c=0;c<4;++c) {
+            a[c] = _mm_loadu_ps(l+c*n+i);
+            b[c] = _mm_loadu_ps(r+c*n+i);
+        }
+        __m128 dot = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])),
+            _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3]))
+        );
+        __m128 t = _mm_loadu_ps(lambda+i);
+        __m128 s = _mm_sub_ps(one, t);
+        t = _mm_xor_ps(t, _mm_and_ps(dot, sign_mask));
+
+        __m128 q[4];
+        for(size_t c=0;c<4;++c) {
+            q[c] = _mm_add_ps(_mm_mul_ps(a[c], s), _mm_mul_ps(b[c], t));
+        }
+        __m128 norm = _mm_sqrt_ps(_mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(q[0], q[0]), _mm_mul_ps(q[1], q[1])),
+            _mm_add_ps(_mm_mul_ps(q[2], q[2]), _mm_mul_ps(q[3], q[3]))
+        ));
+        for(size_t c=0;c<4;++c) {
+            _mm_storeu_ps(result+c*n+i, _mm_div_ps(q[c], norm));
+        }
+    }
+#endif
+    for(;i<n;++i) {
+        float dot = l[i]*r[i]+l[n+i]*r[n+i]+l[2*n+i]*r[2*n+i]+l[3*n+i]*r[3*n+i];
+        float s = 1.0f-lambda[i];
+        float t = (dot<0.0f)?-lambda[i]:lambda[i];
+        float q[4];
+        float norm = 0.0f;
+        for(size_t c=0;c<4;++c) {
+            q[c] = l[c*n+i]*s+r[c*n+i]*t;
+            norm += q[c]*q[c];
+        }
+        norm = std::sqrt(norm);
+        for(size_t c=0;c<4;++c) {
+            result[c*n+i] = q[c]/norm;
+        }
     }
 }
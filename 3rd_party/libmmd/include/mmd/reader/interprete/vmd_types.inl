@@ -42,7 +42,7 @@ namespace mmd {
             Vector3f position;
             Vector3f rotation;
             std::int8_t interpolator[24];
-            float fov;
+            std::uint32_t fov;
             std::uint8_t orthographic;
         };
 
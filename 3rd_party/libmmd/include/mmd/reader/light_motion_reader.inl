@@ -13,7 +13,7 @@ namespace mmd {
 
     class LightMotionReader {
     public:
-        //virtual void ReadLightMotion(LightMotion &light_motion) = 0;
+        virtual void ReadLightMotion(LightMotion &light_motion) = 0;
     };
 
 } /* End of namespace mmd */
@@ -499,6 +499,12 @@ PmdReader::ReadModel(Model &model) {
                         rigid_body.SetAssociatedBoneIndex(center_bone_index);
                     }
                 }
+                // Groups index a 16-bit collision mask.
+                if(rb.collision_group>=16) {
+                    throw exception(
+                        std::string("PmdReader: Invalid collision group.")
+                    );
+                }
                 rigid_body.SetCollisionGroup(rb.collision_group);
                 rigid_body.GetCollisionMask() = rb.collision_mask;
                 rigid_body.SetShape((Model::RigidBody::RigidBodyShape)rb.shape);
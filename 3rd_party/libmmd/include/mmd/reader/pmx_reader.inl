@@ -18,6 +18,27 @@ namespace mmd {
         PmxReader(FileReader &file);
         /*virtual*/ void ReadModel(Model &model);
     private:
+        /**
+          Vertices, triangles and most morph data are arrays of records,
+          their indices 1, 2 or 4 bytes wide as the header says. These are
+          read a record (or section) at a time, checked against the file
+          length once, and decoded with the index width fixed at compile
+          time straight into arrays sized up front.
+        **/
+        template<typename Index>
+        static size_t LoadIndex(const std::uint8_t *p);
+        template<typename T>
+        static T Load(const std::uint8_t *p);
+
+        const std::uint8_t *ReadRecords(size_t record_num, size_t record_size);
+
+        template<typename BoneIndex>
+        void ReadVertices(Model &model, size_t vertex_num);
+        template<typename VertexIndex>
+        void ReadTriangles(Model &model, size_t triangle_num);
+        template<typename Index>
+        void ReadMorphData(Model::Morph &morph, size_t morph_data_num);
+
         FileReader &file_;
     };
 
@@ -42,71 +42,45 @@ PmxReader::ReadModel(Model &model) {
         size_t morph_index_size = file_.Read<std::uint8_t>();
         size_t rigid_body_index_size = file_.Read<std::uint8_t>();
 
+        size_t index_sizes[] = {
+            vertex_index_size, texture_index_size, material_index_size,
+            bone_index_size, morph_index_size, rigid_body_index_size
+        };
+        for(size_t i=0;i<sizeof(index_sizes)/sizeof(index_sizes[0]);++i) {
+            if(index_sizes[i]!=1&&index_sizes[i]!=2&&index_sizes[i]!=4) {
+                throw exception(std::string("PmxReader: Invalid index size."));
+            }
+        }
+
         model.SetName(file_.ReadString(utf8_encoding));
         model.SetNameEn(file_.ReadString(utf8_encoding));
         model.SetDescription(file_.ReadString(utf8_encoding));
         model.SetDescriptionEn(file_.ReadString(utf8_encoding));
 
         size_t vertex_num = (size_t)file_.Read<std::int32_t>();
-        for(size_t i=0;i<vertex_num;++i) {
-            interprete::pmx_vertex_basic pv
-                = file_.Read<interprete::pmx_vertex_basic>();
-
-            Model::Vertex<ref> vertex = model.NewVertex();
-            Model::SkinningOperator &op = vertex.GetSkinningOperator();
-
-            vertex.SetCoordinate(pv.coordinate);
-            vertex.SetNormal(pv.normal);
-            vertex.SetUVCoordinate(pv.uv_coordinate);
-
-            for(size_t ei=0;ei<extra_UV_number;++ei) {
-                Vector4f euv = file_.Read<Vector4f>();
-                vertex.SetExtraUVCoordinate(ei, euv);
-            }
-
-            op.SetSkinningType(
-                (Model::SkinningOperator::SkinningType)file_.Read<std::int8_t>()
-            );
-            switch(op.GetSkinningType()) {
-            case Model::SkinningOperator::SKINNING_BDEF1:
-                op.GetBDEF1().SetBoneID(file_.ReadIndex(bone_index_size));
-                break;
-            case Model::SkinningOperator::SKINNING_BDEF2:
-                op.GetBDEF2().SetBoneID(0, file_.ReadIndex(bone_index_size));
-                op.GetBDEF2().SetBoneID(1, file_.ReadIndex(bone_index_size));
-                op.GetBDEF2().SetBoneWeight(file_.Read<float>());
-                break;
-            case Model::SkinningOperator::SKINNING_BDEF4:
-                for(size_t j=0;j<4;++j) {
-                    op.GetBDEF4().SetBoneID(j, file_.ReadIndex(bone_index_size));
-                }
-                for(size_t j=0;j<4;++j) {
-                    op.GetBDEF4().SetBoneWeight(j, file_.Read<float>());
-                }
-                break;
-            case Model::SkinningOperator::SKINNING_SDEF:
-                op.GetSDEF().SetBoneID(0, file_.ReadIndex(bone_index_size));
-                op.GetSDEF().SetBoneID(1, file_.ReadIndex(bone_index_size));
-                op.GetSDEF().SetBoneWeight(file_.Read<float>());
-                op.GetSDEF().SetC(file_.Read<Vector3f>());
-                op.GetSDEF().SetR0(file_.Read<Vector3f>());
-                op.GetSDEF().SetR1(file_.Read<Vector3f>());
-                break;
-            default:
-                throw exception(
-                    std::string("PmxReader: Invalid skinning specification")
-                );
-            }
-
-            vertex.SetEdgeScale(file_.Read<float>());
+        switch(bone_index_size) {
+        case 1:
+            ReadVertices<std::uint8_t>(model, vertex_num);
+            break;
+        case 2:
+            ReadVertices<std::uint16_t>(model, vertex_num);
+            break;
+        default:
+            ReadVertices<std::int32_t>(model, vertex_num);
+            break;
         }
 
         size_t triangle_num = (size_t)file_.Read<std::int32_t>()/3;
-        for(size_t i=0;i<triangle_num;++i) {
-            Vector3D<std::uint32_t> &triangle = model.NewTriangle();
-            for(size_t j=0;j<3;++j) {
-                triangle.v[j] = (std::uint32_t)file_.ReadIndex(vertex_index_size);
-            }
+        switch(vertex_index_size) {
+        case 1:
+            ReadTriangles<std::uint8_t>(model, triangle_num);
+            break;
+        case 2:
+            ReadTriangles<std::uint16_t>(model, triangle_num);
+            break;
+        default:
+            ReadTriangles<std::int32_t>(model, triangle_num);
+            break;
         }
 
         TextureRegistry &registry = MMD::GetMMD().GetTextureRegistry();
@@ -277,49 +251,21 @@ PmxReader::ReadModel(Model &model) {
             }
             morph.SetType((Model::Morph::MorphType)file_.Read<std::uint8_t>());
             size_t morph_data_num = (size_t)file_.Read<std::int32_t>();
+            size_t morph_data_index_size = 0;
             switch(morph.GetType()) {
             case Model::Morph::MORPH_TYPE_GROUP:
-                for(size_t j=0;j<morph_data_num;++j) {
-                    Model::Morph::MorphData &morph_data = morph.NewMorphData();
-                    morph_data.GetGroupMorph().SetMorphIndex(
-                        file_.ReadIndex(morph_index_size)
-                    );
-                    morph_data.GetGroupMorph().SetMorphRate(file_.Read<float>());
-                }
+                morph_data_index_size = morph_index_size;
                 break;
             case Model::Morph::MORPH_TYPE_VERTEX:
-                for(size_t j=0;j<morph_data_num;++j) {
-                    Model::Morph::MorphData &morph_data = morph.NewMorphData();
-                    morph_data.GetVertexMorph().SetVertexIndex(
-                        file_.ReadIndex(vertex_index_size)
-                    );
-                    morph_data.GetVertexMorph().SetOffset(file_.Read<Vector3f>());
-                }
-                break;
-            case Model::Morph::MORPH_TYPE_BONE:
-                for(size_t j=0;j<morph_data_num;++j) {
-                    Model::Morph::MorphData &morph_data = morph.NewMorphData();
-                    morph_data.GetBoneMorph().SetBoneIndex(
-                        file_.ReadIndex(bone_index_size)
-                    );
-                    morph_data.GetBoneMorph().SetTranslation(
-                        file_.Read<Vector3f>()
-                    );
-                    morph_data.GetBoneMorph().SetRotation(file_.Read<Vector4f>());
-                }
-                break;
             case Model::Morph::MORPH_TYPE_UV:
             case Model::Morph::MORPH_TYPE_EXT_UV_1:
             case Model::Morph::MORPH_TYPE_EXT_UV_2:
             case Model::Morph::MORPH_TYPE_EXT_UV_3:
             case Model::Morph::MORPH_TYPE_EXT_UV_4:
-                for(size_t j=0;j<morph_data_num;++j) {
-                    Model::Morph::MorphData &morph_data = morph.NewMorphData();
-                    morph_data.GetUVMorph().SetVertexIndex(
-                        file_.ReadIndex(vertex_index_size)
-                    );
-                    morph_data.GetUVMorph().SetOffset(file_.Read<Vector4f>());
-                }
+                morph_data_index_size = vertex_index_size;
+                break;
+            case Model::Morph::MORPH_TYPE_BONE:
+                morph_data_index_size = bone_index_size;
                 break;
             case Model::Morph::MORPH_TYPE_MATERIAL:
                 for(size_t j=0;j<morph_data_num;++j) {
@@ -354,6 +300,17 @@ PmxReader::ReadModel(Model &model) {
             default:
                 throw exception(std::string("PmxReader: Unknown morph type."));
             }
+            switch(morph_data_index_size) {
+            case 1:
+                ReadMorphData<std::uint8_t>(morph, morph_data_num);
+                break;
+            case 2:
+                ReadMorphData<std::uint16_t>(morph, morph_data_num);
+                break;
+            case 4:
+                ReadMorphData<std::int32_t>(morph, morph_data_num);
+                break;
+            }
         }
 
         if(base_morph_index!=nil) {
@@ -390,6 +347,12 @@ PmxReader::ReadModel(Model &model) {
             interprete::pmx_rigid_body rb
                 = file_.Read<interprete::pmx_rigid_body>();
 
+            // Groups index a 16-bit collision mask.
+            if(rb.collision_group>=16) {
+                throw exception(
+                    std::string("PmxReader: Invalid collision group.")
+                );
+            }
             rigid_body.SetCollisionGroup(rb.collision_group);
             rigid_body.GetCollisionMask() = rb.collision_mask;
             rigid_body.SetShape((Model::RigidBody::RigidBodyShape)rb.shape);
@@ -447,3 +410,191 @@ PmxReader::ReadModel(Model &model) {
         );
     }
 }
+
+// As FileReader::ReadIndex: 4-byte indices are signed, so -1 stays nil.
+template<typename Index>
+inline size_t
+PmxReader::LoadIndex(const std::uint8_t *p) {
+    Index index;
+    std::memcpy(&index, p, sizeof(Index));
+    return (size_t)index;
+}
+
+template<typename T>
+inline T
+PmxReader::Load(const std::uint8_t *p) {
+    T t;
+    std::memcpy(&t, p, sizeof(T));
+    return t;
+}
+
+inline const std::uint8_t*
+PmxReader::ReadRecords(size_t record_num, size_t record_size) {
+    if(record_num>(size_t)file_.GetRemainedLength()/record_size) {
+        throw exception(std::string("PmxReader: Section exceeds the file."));
+    }
+    return file_.ReadBytes(record_num*record_size);
+}
+
+template<typename BoneIndex>
+inline void
+PmxReader::ReadVertices(Model &model, size_t vertex_num) {
+    const size_t bone_index_size = sizeof(BoneIndex);
+    size_t extra_UV_number = model.GetExtraUVNumber();
+    // Up to and including the skinning type, which sizes the rest.
+    size_t head_size
+        = sizeof(interprete::pmx_vertex_basic)
+        + extra_UV_number*sizeof(Vector4f)
+        + sizeof(std::int8_t);
+    // No vertex is smaller than a BDEF1 one.
+    size_t min_vertex_size = head_size+bone_index_size+sizeof(float);
+    if(vertex_num>(size_t)file_.GetRemainedLength()/min_vertex_size) {
+        throw exception(std::string("PmxReader: Section exceeds the file."));
+    }
+    model.SetVertexNum(vertex_num);
+
+    for(size_t i=0;i<vertex_num;++i) {
+        const std::uint8_t *p = file_.ReadBytes(head_size);
+        Model::Vertex<ref> vertex = model.GetVertex(i);
+        Model::SkinningOperator &op = vertex.GetSkinningOperator();
+
+        interprete::pmx_vertex_basic pv
+            = Load<interprete::pmx_vertex_basic>(p);
+        vertex.SetCoordinate(pv.coordinate);
+        vertex.SetNormal(pv.normal);
+        vertex.SetUVCoordinate(pv.uv_coordinate);
+        p += sizeof(interprete::pmx_vertex_basic);
+
+        for(size_t ei=0;ei<extra_UV_number;++ei) {
+            vertex.SetExtraUVCoordinate(ei, Load<Vector4f>(p));
+            p += sizeof(Vector4f);
+        }
+
+        op.SetSkinningType(
+            (Model::SkinningOperator::SkinningType)Load<std::int8_t>(p)
+        );
+        size_t skinning_size;
+        switch(op.GetSkinningType()) {
+        case Model::SkinningOperator::SKINNING_BDEF1:
+            skinning_size = bone_index_size;
+            break;
+        case Model::SkinningOperator::SKINNING_BDEF2:
+            skinning_size = 2*bone_index_size+sizeof(float);
+            break;
+        case Model::SkinningOperator::SKINNING_BDEF4:
+            skinning_size = 4*bone_index_size+4*sizeof(float);
+            break;
+        case Model::SkinningOperator::SKINNING_SDEF:
+            skinning_size = 2*bone_index_size+sizeof(float)+3*sizeof(Vector3f);
+            break;
+        default:
+            throw exception(
+                std::string("PmxReader: Invalid skinning specification")
+            );
+        }
+
+        p = file_.ReadBytes(skinning_size+sizeof(float));
+        switch(op.GetSkinningType()) {
+        case Model::SkinningOperator::SKINNING_BDEF1:
+            op.GetBDEF1().SetBoneID(LoadIndex<BoneIndex>(p));
+            break;
+        case Model::SkinningOperator::SKINNING_BDEF2:
+            op.GetBDEF2().SetBoneID(0, LoadIndex<BoneIndex>(p));
+            op.GetBDEF2().SetBoneID(1, LoadIndex<BoneIndex>(p+bone_index_size));
+            op.GetBDEF2().SetBoneWeight(Load<float>(p+2*bone_index_size));
+            break;
+        case Model::SkinningOperator::SKINNING_BDEF4:
+            for(size_t j=0;j<4;++j) {
+                op.GetBDEF4().SetBoneID(j, LoadIndex<BoneIndex>(p+j*bone_index_size));
+            }
+            for(size_t j=0;j<4;++j) {
+                op.GetBDEF4().SetBoneWeight(
+                    j, Load<float>(p+4*bone_index_size+j*sizeof(float))
+                );
+            }
+            break;
+        default: /* SKINNING_SDEF */ {
+            const std::uint8_t *q = p+2*bone_index_size;
+            op.GetSDEF().SetBoneID(0, LoadIndex<BoneIndex>(p));
+            op.GetSDEF().SetBoneID(1, LoadIndex<BoneIndex>(p+bone_index_size));
+            op.GetSDEF().SetBoneWeight(Load<float>(q));
+            op.GetSDEF().SetC(Load<Vector3f>(q+sizeof(float)));
+            op.GetSDEF().SetR0(Load<Vector3f>(q+sizeof(float)+sizeof(Vector3f)));
+            op.GetSDEF().SetR1(Load<Vector3f>(q+sizeof(float)+2*sizeof(Vector3f)));
+            break;
+        }
+        }
+
+        vertex.SetEdgeScale(Load<float>(p+skinning_size));
+    }
+}
+
+template<typename VertexIndex>
+inline void
+PmxReader::ReadTriangles(Model &model, size_t triangle_num) {
+    const std::uint8_t *p = ReadRecords(triangle_num, 3*sizeof(VertexIndex));
+    model.SetTriangleNum(triangle_num);
+    if(triangle_num==0) {
+        return;
+    }
+    std::uint32_t *indices = model.GetTrianglePointer();
+    for(size_t i=0;i<3*triangle_num;++i) {
+        indices[i] = (std::uint32_t)LoadIndex<VertexIndex>(p+i*sizeof(VertexIndex));
+    }
+}
+
+template<typename Index>
+inline void
+PmxReader::ReadMorphData(Model::Morph &morph, size_t morph_data_num) {
+    const size_t index_size = sizeof(Index);
+    const std::uint8_t *p;
+    switch(morph.GetType()) {
+    case Model::Morph::MORPH_TYPE_GROUP:
+        p = ReadRecords(morph_data_num, index_size+sizeof(float));
+        morph.SetMorphDataNum(morph_data_num);
+        for(size_t j=0;j<morph_data_num;++j) {
+            Model::Morph::MorphData &morph_data = morph.GetMorphData(j);
+            morph_data.GetGroupMorph().SetMorphIndex(LoadIndex<Index>(p));
+            morph_data.GetGroupMorph().SetMorphRate(Load<float>(p+index_size));
+            p += index_size+sizeof(float);
+        }
+        break;
+    case Model::Morph::MORPH_TYPE_VERTEX:
+        p = ReadRecords(morph_data_num, index_size+sizeof(Vector3f));
+        morph.SetMorphDataNum(morph_data_num);
+        for(size_t j=0;j<morph_data_num;++j) {
+            Model::Morph::MorphData &morph_data = morph.GetMorphData(j);
+            morph_data.GetVertexMorph().SetVertexIndex(LoadIndex<Index>(p));
+            morph_data.GetVertexMorph().SetOffset(Load<Vector3f>(p+index_size));
+            p += index_size+sizeof(Vector3f);
+        }
+        break;
+    case Model::Morph::MORPH_TYPE_BONE:
+        p = ReadRecords(
+            morph_data_num, index_size+sizeof(Vector3f)+sizeof(Vector4f)
+        );
+        morph.SetMorphDataNum(morph_data_num);
+        for(size_t j=0;j<morph_data_num;++j) {
+            Model::Morph::MorphData &morph_data = morph.GetMorphData(j);
+            morph_data.GetBoneMorph().SetBoneIndex(LoadIndex<Index>(p));
+            morph_data.GetBoneMorph().SetTranslation(
+                Load<Vector3f>(p+index_size)
+            );
+            morph_data.GetBoneMorph().SetRotation(
+                Load<Vector4f>(p+index_size+sizeof(Vector3f))
+            );
+            p += index_size+sizeof(Vector3f)+sizeof(Vector4f);
+        }
+        break;
+    default: /* MORPH_TYPE_UV and MORPH_TYPE_EXT_UV_* */
+        p = ReadRecords(morph_data_num, index_size+sizeof(Vector4f));
+        morph.SetMorphDataNum(morph_data_num);
+        for(size_t j=0;j<morph_data_num;++j) {
+            Model::Morph::MorphData &morph_data = morph.GetMorphData(j);
+            morph_data.GetUVMorph().SetVertexIndex(LoadIndex<Index>(p));
+            morph_data.GetUVMorph().SetOffset(Load<Vector4f>(p+index_size));
+            p += index_size+sizeof(Vector4f);
+        }
+        break;
+    }
+}
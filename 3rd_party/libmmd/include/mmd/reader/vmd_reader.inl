@@ -18,8 +18,20 @@ namespace mmd {
         VmdReader(FileReader &file) : file_(file), camera_motion_shift_(nil), light_motion_shift_(nil) {}
         /*virtual*/ void ReadMotion(Motion &motion);
         /*virtual*/ void ReadCameraMotion(CameraMotion &camera_motion);
+        /*virtual*/ void ReadLightMotion(LightMotion &light_motion);
     private:
+        // Positions the file at the camera section without decoding motion.
+        void LocateCameraMotion();
+
+        /**
+          Every keyframe of a track repeats its name: a name is decoded
+          once per distinct raw field, padding included.
+        **/
+        template<size_t length>
+        const std::wstring &DecodeName(const mmd_string<length> &name);
+
         FileReader &file_;
+        std::map<std::string, std::wstring> names_;
         mutable size_t camera_motion_shift_;
         mutable size_t light_motion_shift_;
     };
@@ -25,47 +25,30 @@ inline void VmdReader::ReadMotion(Motion &motion) {
 
         for(size_t i=0;i<bone_motion_num;++i) {
             interprete::vmd_bone b = file_.Read<interprete::vmd_bone>();
-            Motion::BoneKeyframe &keyframe = motion.GetBoneKeyframe(ShiftJISToUTF16String(b.bone_name), b.nframe);
+            Motion::BoneKeyframe &keyframe = motion.GetBoneKeyframe(DecodeName(b.bone_name), b.nframe);
             keyframe.SetTranslation(b.translation);
             keyframe.SetRotation(b.rotation);
 
-            Vector2f c_0, c_1;
-            const float r = 1.0f/127.0f;
-
-            c_0.p.x = b.x_interpolator[0]*r;
-            c_0.p.y = b.x_interpolator[4]*r;
-            c_1.p.x = b.x_interpolator[8]*r;
-            c_1.p.y = b.x_interpolator[12]*r;
-            interpolator &x_interpolator = keyframe.GetXInterpolator();
-            x_interpolator.SetC(c_0, c_1);
-
-            c_0.p.x = b.y_interpolator[0]*r;
-            c_0.p.y = b.y_interpolator[4]*r;
-            c_1.p.x = b.y_interpolator[8]*r;
-            c_1.p.y = b.y_interpolator[12]*r;
-            interpolator &y_interpolator = keyframe.GetYInterpolator();
-            y_interpolator.SetC(c_0, c_1);
-
-            c_0.p.x = b.z_interpolator[0]*r;
-            c_0.p.y = b.z_interpolator[4]*r;
-            c_1.p.x = b.z_interpolator[8]*r;
-            c_1.p.y = b.z_interpolator[12]*r;
-            interpolator &z_interpolator = keyframe.GetZInterpolator();
-            z_interpolator.SetC(c_0, c_1);
-
-            c_0.p.x = b.r_interpolator[0]*r;
-            c_0.p.y = b.r_interpolator[4]*r;
-            c_1.p.x = b.r_interpolator[8]*r;
-            c_1.p.y = b.r_interpolator[12]*r;
-            interpolator &r_interpolator = keyframe.GetRInterpolator();
-            r_interpolator.SetC(c_0, c_1);
+            // Control bytes are laid out as x0, y0, x1, y1 with a stride of 4.
+            keyframe.SetXInterpolator(motion.InternInterpolator(
+                b.x_interpolator[0], b.x_interpolator[4], b.x_interpolator[8], b.x_interpolator[12]
+            ));
+            keyframe.SetYInterpolator(motion.InternInterpolator(
+                b.y_interpolator[0], b.y_interpolator[4], b.y_interpolator[8], b.y_interpolator[12]
+            ));
+            keyframe.SetZInterpolator(motion.InternInterpolator(
+                b.z_interpolator[0], b.z_interpolator[4], b.z_interpolator[8], b.z_interpolator[12]
+            ));
+            keyframe.SetRInterpolator(motion.InternInterpolator(
+                b.r_interpolator[0], b.r_interpolator[4], b.r_interpolator[8], b.r_interpolator[12]
+            ));
         }
 
         size_t morph_motion_num = file_.Read<std::uint32_t>();
         
         for(size_t i=0;i<morph_motion_num;++i) {
             interprete::vmd_morph m = file_.Read<interprete::vmd_morph>();
-            Motion::MorphKeyframe &keyframe = motion.GetMorphKeyframe(ShiftJISToUTF16String(m.morph_name), m.nframe);
+            Motion::MorphKeyframe &keyframe = motion.GetMorphKeyframe(DecodeName(m.morph_name), m.nframe);
             keyframe.SetWeight(m.weight);
         }
 
@@ -78,31 +61,114 @@ inline void VmdReader::ReadMotion(Motion &motion) {
     }
 }
 
-inline void VmdReader::ReadCameraMotion(CameraMotion &camera_motion) {
-    if(camera_motion_shift_==nil) {
-        Motion motion;
-        ReadMotion(motion);
-    } else if(file_.GetPosition()!=camera_motion_shift_) {
-        file_.Seek(camera_motion_shift_);
+template<size_t length>
+inline const std::wstring &VmdReader::DecodeName(const mmd_string<length> &name) {
+    std::string key((const char*)name.content_, length);
+    std::map<std::string, std::wstring>::iterator i = names_.find(key);
+    if(i==names_.end()) {
+        i = names_.insert(std::make_pair(key, ShiftJISToUTF16String(name))).first;
     }
-    camera_motion.Clear();
-    if(file_.GetRemainedLength()==0) {
+    return i->second;
+}
+
+inline void VmdReader::LocateCameraMotion() {
+    if(camera_motion_shift_!=nil) {
+        if(file_.GetPosition()!=camera_motion_shift_) {
+            file_.Seek(camera_motion_shift_);
+        }
         return;
     }
+    // Skip the bone and morph sections without decoding them.
+    file_.Reset();
+    interprete::vmd_header header = file_.Read<interprete::vmd_header>();
+    std::string magic = header.magic;
+    if(magic!="Vocaloid Motion Data 0002") {
+        throw exception(std::string("VmdReader::LocateCameraMotion: File is not a VMD file."));
+    }
+    size_t bone_motion_num = file_.Read<std::uint32_t>();
+    if(file_.GetRemainedLength()<ptrdiff_t(bone_motion_num*sizeof(interprete::vmd_bone))) {
+        throw exception(std::string("VmdReader::LocateCameraMotion: Bone motion is truncated."));
+    }
+    file_.Seek(file_.GetPosition()+bone_motion_num*sizeof(interprete::vmd_bone));
+    size_t morph_motion_num = file_.Read<std::uint32_t>();
+    if(file_.GetRemainedLength()<ptrdiff_t(morph_motion_num*sizeof(interprete::vmd_morph))) {
+        throw exception(std::string("VmdReader::LocateCameraMotion: Morph motion is truncated."));
+    }
+    file_.Seek(file_.GetPosition()+morph_motion_num*sizeof(interprete::vmd_morph));
+    camera_motion_shift_ = file_.GetPosition();
+}
+
+inline void VmdReader::ReadCameraMotion(CameraMotion &camera_motion) {
     try {
+        LocateCameraMotion();
+        camera_motion.Clear();
+        if(file_.GetRemainedLength()==0) {
+            return;
+        }
         size_t camera_motion_num = file_.Read<std::uint32_t>();
         for(size_t i=0;i<camera_motion_num;++i) {
             interprete::vmd_camera c = file_.Read<interprete::vmd_camera>();
             CameraMotion::CameraKeyframe &keyframe = camera_motion.GetCameraKeyframe(c.nframe);
-            keyframe.SetFOV(c.fov);
+            keyframe.SetFOV(float(c.fov));
             keyframe.SetFocalLength(c.focal_length);
             keyframe.SetOrthographic(c.orthographic!=0);
             keyframe.SetPosition(c.position);
             keyframe.SetRotation(c.rotation);
+
+            // Six curves (x, y, z, rotation, distance, fov) of 4 control
+            // bytes each, laid out as x0, x1, y0, y1.
+            for(size_t k=0;k<CameraMotion::CameraKeyframe::CURVE_NUM;++k) {
+                const std::int8_t *b = c.interpolator+k*4;
+                if(b[0]==b[2]&&b[1]==b[3]) {
+                    keyframe.SetInterpolator(CameraMotion::CameraKeyframe::Curve(k), interpolator());
+                    continue;
+                }
+                Vector2f c_0, c_1;
+                const float r = 1.0f/127.0f;
+                c_0.p.x = b[0]*r;
+                c_0.p.y = b[2]*r;
+                c_1.p.x = b[1]*r;
+                c_1.p.y = b[3]*r;
+                keyframe.SetInterpolator(CameraMotion::CameraKeyframe::Curve(k), interpolator(c_0, c_1));
+            }
         }
+        light_motion_shift_ = file_.GetPosition();
     } catch(std::exception& e) {
         throw exception(std::string("VmdReader::ReadCameraMotion: Exception caught."), e);
     } catch(...) {
         throw exception(std::string("VmdReader::ReadCameraMotion: Non-standard exception caught."));
     }
 }
+
+inline void VmdReader::ReadLightMotion(LightMotion &light_motion) {
+    try {
+        if(light_motion_shift_==nil) {
+            LocateCameraMotion();
+            if(file_.GetRemainedLength()!=0) {
+                size_t camera_motion_num = file_.Read<std::uint32_t>();
+                if(file_.GetRemainedLength()<ptrdiff_t(camera_motion_num*sizeof(interprete::vmd_camera))) {
+                    throw exception(std::string("VmdReader::ReadLightMotion: Camera motion is truncated."));
+                }
+                file_.Seek(file_.GetPosition()+camera_motion_num*sizeof(interprete::vmd_camera));
+            }
+            light_motion_shift_ = file_.GetPosition();
+        } else if(file_.GetPosition()!=light_motion_shift_) {
+            file_.Seek(light_motion_shift_);
+        }
+        light_motion.Clear();
+        if(file_.GetRemainedLength()==0) {
+            return;
+        }
+        size_t light_motion_num = file_.Read<std::uint32_t>();
+        for(size_t i=0;i<light_motion_num;++i) {
+            interprete::vmd_light l = file_.Read<interprete::vmd_light>();
+            LightMotion::LightKeyframe &keyframe = light_motion.GetLightKeyframe(l.nframe);
+            keyframe.SetColor(l.color);
+            keyframe.SetDirection(l.position);
+        }
+    } catch(std::exception& e) {
+        throw exception(std::string("VmdReader::ReadLightMotion: Exception caught."), e);
+    } catch(...) {
+        throw exception(std::string("VmdReader::ReadLightMotion: Non-standard exception caught."));
+    }
+}
@@ -13,8 +13,25 @@ namespace mmd {
     
     class CameraMotion {
     public:
+        /**
+          Camera state at one frame. Position is the point the camera looks
+          at and focal length is its signed distance from it along the view
+          axis (negative in front of the target, as stored in VMD). Rotation
+          is in radians; FOV is the vertical view angle in degrees.
+        **/
         class CameraPose {
+        public:
+            CameraPose();
+
+            float GetFOV() const;
+            float GetFocalLength() const;
+            bool IsOrthographic() const;
+            const Vector3f &GetPosition() const;
+            const Vector3f &GetRotation() const;
+
         private:
+            friend class CameraMotion;
+
             float fov_;
             float focal_length_;
             Vector3f position_;
@@ -24,6 +41,17 @@ namespace mmd {
 
         class CameraKeyframe {
         public:
+            // Curves of a VMD camera keyframe, in file order.
+            enum Curve {
+                CURVE_X,
+                CURVE_Y,
+                CURVE_Z,
+                CURVE_ROTATION,
+                CURVE_FOCAL_LENGTH,
+                CURVE_FOV,
+                CURVE_NUM
+            };
+
             float GetFOV() const;
             void SetFOV(float fov);
 
@@ -39,6 +67,9 @@ namespace mmd {
             const Vector3f &GetRotation() const;
             void SetRotation(const Vector3f &rotation);
 
+            const interpolator &GetInterpolator(Curve curve) const;
+            void SetInterpolator(Curve curve, const interpolator &i);
+
         private:
             float fov_;
             float focal_length_;
@@ -46,12 +77,7 @@ namespace mmd {
             Vector3f position_;
             Vector3f rotation_;
 
-            interpolator x_interpolator_;
-            interpolator y_interpolator_;
-            interpolator z_interpolator_;
-            interpolator rx_interpolator_;
-            interpolator ry_interpolator_;
-            interpolator rz_interpolator_;
+            interpolator interpolators_[CURVE_NUM];
 
             bool orthographic_;
         };
@@ -64,14 +90,67 @@ namespace mmd {
         CameraPose GetCameraPose(size_t frame) const;
         CameraPose GetCameraPose(double time) const;
 
+        // A keyframe one frame after the previous one is a cut: the camera
+        // holds the earlier key until it and then jumps.
+        bool IsCut(size_t frame) const;
+
+        size_t GetKeyframeNum() const;
         size_t GetLength() const;
         void Clear();
 
     private:
+        friend class CameraMotionPlayer;
+
+        typedef std::map<size_t, CameraKeyframe>::const_iterator const_iterator;
+
+        static CameraPose GetKeyframePose(const CameraKeyframe &keyframe);
+        static CameraPose Interpolate(
+            size_t l_frame, const CameraKeyframe &l_keyframe,
+            size_t r_frame, const CameraKeyframe &r_keyframe,
+            double frame
+        );
+
         size_t length_;
         std::map<size_t, CameraKeyframe> camera_motions_;
     };
 
+    /**
+      Sequential playback of a camera motion. Keyframes are flattened into
+      arrays and a cursor follows the playhead, so a seek near the previous
+      one costs a few comparisons; random seeks fall back to a binary search.
+
+      The motion must outlive the player; call Reset after changing it.
+    **/
+    class CameraMotionPlayer {
+    public:
+        CameraMotionPlayer(const CameraMotion &motion);
+
+        void Reset();
+
+        const CameraMotion::CameraPose &SeekFrame(double frame);
+        const CameraMotion::CameraPose &SeekTime(double time);
+
+        const CameraMotion::CameraPose &GetCameraPose() const;
+
+        // True when the camera did not move continuously since the previous
+        // seek: a cut was passed, playback jumped or this is the first seek.
+        bool IsCut() const;
+
+    private:
+        CameraMotionPlayer &operator=(const CameraMotionPlayer&);
+
+        const CameraMotion &motion_;
+
+        std::vector<size_t> frames_;
+        std::vector<const CameraMotion::CameraKeyframe*> keyframes_;
+
+        // Index of the last keyframe at or before the previous seek.
+        size_t cursor_;
+        double frame_;
+        bool cut_;
+        CameraMotion::CameraPose pose_;
+    };
+
 #include "camera_impl.inl"
 
 } /* End of namespace mmd */
@@ -6,6 +6,37 @@
             http://www.boost.org/LICENSE_1_0.txt)
 **/
 
+inline
+CameraMotion::CameraPose::CameraPose()
+  : fov_(30.0f), focal_length_(0.0f),
+    position_(Vector3f::Zero()), rotation_(Vector3f::Zero()),
+    orthographic_(false) {}
+
+inline float
+CameraMotion::CameraPose::GetFOV() const {
+    return fov_;
+}
+
+inline float
+CameraMotion::CameraPose::GetFocalLength() const {
+    return focal_length_;
+}
+
+inline bool
+CameraMotion::CameraPose::IsOrthographic() const {
+    return orthographic_;
+}
+
+inline const Vector3f&
+CameraMotion::CameraPose::GetPosition() const {
+    return position_;
+}
+
+inline const Vector3f&
+CameraMotion::CameraPose::GetRotation() const {
+    return rotation_;
+}
+
 inline float
 CameraMotion::CameraKeyframe::GetFOV() const {
     return fov_;
@@ -56,6 +87,16 @@ CameraMotion::CameraKeyframe::SetRotation(const Vector3f &rotation) {
     rotation_ = rotation;
 }
 
+inline const interpolator&
+CameraMotion::CameraKeyframe::GetInterpolator(Curve curve) const {
+    return interpolators_[curve];
+}
+
+inline void
+CameraMotion::CameraKeyframe::SetInterpolator(Curve curve, const interpolator &i) {
+    interpolators_[curve] = i;
+}
+
 inline
 CameraMotion::CameraMotion() : length_(0) {}
 
@@ -72,8 +113,52 @@ CameraMotion::GetCameraKeyframe(size_t frame) {
     return camera_motions_[frame];
 }
 
-//inline CameraPose CameraMotion::GetCameraPose(size_t frame) const;
-//inline CameraPose CameraMotion::GetCameraPose(double time) const;
+inline CameraMotion::CameraPose
+CameraMotion::GetCameraPose(size_t frame) const {
+    if(camera_motions_.empty()) {
+        return CameraPose();
+    }
+    const_iterator r = camera_motions_.upper_bound(frame);
+    if(r==camera_motions_.begin()) {
+        return GetKeyframePose(r->second);
+    }
+    const_iterator l = r;
+    --l;
+    if(r==camera_motions_.end()) {
+        return GetKeyframePose(l->second);
+    }
+    return Interpolate(l->first, l->second, r->first, r->second, double(frame));
+}
+
+inline CameraMotion::CameraPose
+CameraMotion::GetCameraPose(double time) const {
+    double frame = time*30.0;
+    if(camera_motions_.empty()) {
+        return CameraPose();
+    }
+    const_iterator r = camera_motions_.upper_bound(frame<0.0 ? 0 : size_t(frame));
+    if(r==camera_motions_.begin()) {
+        return GetKeyframePose(r->second);
+    }
+    const_iterator l = r;
+    --l;
+    if(r==camera_motions_.end()) {
+        return GetKeyframePose(l->second);
+    }
+    return Interpolate(l->first, l->second, r->first, r->second, frame);
+}
+
+inline bool
+CameraMotion::IsCut(size_t frame) const {
+    return frame>0
+        && camera_motions_.find(frame)!=camera_motions_.end()
+        && camera_motions_.find(frame-1)!=camera_motions_.end();
+}
+
+inline size_t
+CameraMotion::GetKeyframeNum() const {
+    return camera_motions_.size();
+}
 
 inline size_t
 CameraMotion::GetLength() const {
@@ -85,3 +170,130 @@ CameraMotion::Clear() {
     length_ = 0;
     camera_motions_.clear();
 }
+
+inline CameraMotion::CameraPose
+CameraMotion::GetKeyframePose(const CameraKeyframe &keyframe) {
+    CameraPose pose;
+    pose.fov_ = keyframe.GetFOV();
+    pose.focal_length_ = keyframe.GetFocalLength();
+    pose.position_ = keyframe.GetPosition();
+    pose.rotation_ = keyframe.GetRotation();
+    pose.orthographic_ = keyframe.IsOrthographic();
+    return pose;
+}
+
+inline CameraMotion::CameraPose
+CameraMotion::Interpolate(
+    size_t l_frame, const CameraKeyframe &l_keyframe,
+    size_t r_frame, const CameraKeyframe &r_keyframe,
+    double frame
+) {
+    // Keys one frame apart are a cut; never sweep between them.
+    if(r_frame-l_frame<=1||frame<=double(l_frame)) {
+        return GetKeyframePose(l_keyframe);
+    }
+    if(frame>=double(r_frame)) {
+        return GetKeyframePose(r_keyframe);
+    }
+    float lambda = float((frame-double(l_frame))/double(r_frame-l_frame));
+
+    // As in MMD, the curves of the later keyframe shape the segment.
+    const Vector3f &l_position = l_keyframe.GetPosition();
+    const Vector3f &r_position = r_keyframe.GetPosition();
+    const Vector3f &l_rotation = l_keyframe.GetRotation();
+    const Vector3f &r_rotation = r_keyframe.GetRotation();
+
+    CameraPose pose;
+    float t = r_keyframe.GetInterpolator(CameraKeyframe::CURVE_X)[lambda];
+    pose.position_.p.x = l_position.p.x+(r_position.p.x-l_position.p.x)*t;
+    t = r_keyframe.GetInterpolator(CameraKeyframe::CURVE_Y)[lambda];
+    pose.position_.p.y = l_position.p.y+(r_position.p.y-l_position.p.y)*t;
+    t = r_keyframe.GetInterpolator(CameraKeyframe::CURVE_Z)[lambda];
+    pose.position_.p.z = l_position.p.z+(r_position.p.z-l_position.p.z)*t;
+
+    // Euler angles are interpolated linearly, so turns beyond pi are kept.
+    t = r_keyframe.GetInterpolator(CameraKeyframe::CURVE_ROTATION)[lambda];
+    pose.rotation_ = l_rotation+(r_rotation-l_rotation)*t;
+
+    t = r_keyframe.GetInterpolator(CameraKeyframe::CURVE_FOCAL_LENGTH)[lambda];
+    pose.focal_length_ = l_keyframe.GetFocalLength()+(r_keyframe.GetFocalLength()-l_keyframe.GetFocalLength())*t;
+    t = r_keyframe.GetInterpolator(CameraKeyframe::CURVE_FOV)[lambda];
+    pose.fov_ = l_keyframe.GetFOV()+(r_keyframe.GetFOV()-l_keyframe.GetFOV())*t;
+
+    pose.orthographic_ = l_keyframe.IsOrthographic();
+    return pose;
+}
+
+inline
+CameraMotionPlayer::CameraMotionPlayer(const CameraMotion &motion)
+  : motion_(motion), cursor_(0), frame_(0.0), cut_(true) {
+    Reset();
+}
+
+inline void
+CameraMotionPlayer::Reset() {
+    frames_.clear();
+    keyframes_.clear();
+    frames_.reserve(motion_.camera_motions_.size());
+    keyframes_.reserve(motion_.camera_motions_.size());
+    for(CameraMotion::const_iterator i=motion_.camera_motions_.begin();i!=motion_.camera_motions_.end();++i) {
+        frames_.push_back(i->first);
+        keyframes_.push_back(&i->second);
+    }
+    cursor_ = 0;
+    frame_ = -1.0;
+    cut_ = true;
+    pose_ = CameraMotion::CameraPose();
+}
+
+inline const CameraMotion::CameraPose&
+CameraMotionPlayer::SeekFrame(double frame) {
+    if(frames_.empty()) {
+        cut_ = false;
+        return pose_;
+    }
+    size_t n = frames_.size();
+    if(frame_<0.0||frame<frame_) {
+        // Random access: the camera jumped.
+        std::vector<size_t>::const_iterator i = std::upper_bound(
+            frames_.begin(), frames_.end(), frame<0.0 ? size_t(0) : size_t(frame)
+        );
+        cursor_ = i==frames_.begin() ? 0 : size_t(i-frames_.begin())-1;
+        cut_ = true;
+    } else {
+        cut_ = false;
+        while(cursor_+1<n&&double(frames_[cursor_+1])<=frame) {
+            ++cursor_;
+            if(frames_[cursor_]-frames_[cursor_-1]<=1) {
+                cut_ = true;
+            }
+        }
+    }
+    frame_ = frame<0.0 ? 0.0 : frame;
+
+    if(cursor_+1>=n||frame<=double(frames_[cursor_])) {
+        pose_ = CameraMotion::GetKeyframePose(*keyframes_[cursor_]);
+    } else {
+        pose_ = CameraMotion::Interpolate(
+            frames_[cursor_], *keyframes_[cursor_],
+            frames_[cursor_+1], *keyframes_[cursor_+1],
+            frame
+        );
+    }
+    return pose_;
+}
+
+inline const CameraMotion::CameraPose&
+CameraMotionPlayer::SeekTime(double time) {
+    return SeekFrame(time*30.0);
+}
+
+inline const CameraMotion::CameraPose&
+CameraMotionPlayer::GetCameraPose() const {
+    return pose_;
+}
+
+inline bool
+CameraMotionPlayer::IsCut() const {
+    return cut_;
+}
@@ -0,0 +1,77 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+#ifndef __LIGHT_HXX_2AC43AA43BF473F9A9C09B4B608619D3_INCLUDED__
+#define __LIGHT_HXX_2AC43AA43BF473F9A9C09B4B608619D3_INCLUDED__
+
+namespace mmd {
+
+    /**
+      Directional light of a VMD motion. The direction points from the
+      light into the scene and need not be normalized; MMD defaults to
+      color (154, 154, 154)/255 and direction (-0.5, -1.0, 0.5). Light
+      keyframes have no curves: MMD interpolates them linearly.
+    **/
+    class LightMotion {
+    public:
+        class LightPose {
+        public:
+            LightPose();
+
+            const Vector3f &GetColor() const;
+            const Vector3f &GetDirection() const;
+
+            bool operator==(const LightPose &pose) const;
+            bool operator!=(const LightPose &pose) const;
+
+        private:
+            friend class LightMotion;
+
+            Vector3f color_;
+            Vector3f direction_;
+        };
+
+        class LightKeyframe {
+        public:
+            const Vector3f &GetColor() const;
+            void SetColor(const Vector3f &color);
+
+            const Vector3f &GetDirection() const;
+            void SetDirection(const Vector3f &direction);
+
+        private:
+            Vector3f color_;
+            Vector3f direction_;
+        };
+
+        LightMotion();
+
+        const LightKeyframe &GetLightKeyframe(size_t frame) const;
+        LightKeyframe &GetLightKeyframe(size_t frame);
+
+        LightPose GetLightPose(size_t frame) const;
+        LightPose GetLightPose(double time) const;
+
+        size_t GetKeyframeNum() const;
+        size_t GetLength() const;
+        void Clear();
+
+    private:
+        typedef std::map<size_t, LightKeyframe>::const_iterator const_iterator;
+
+        static LightPose GetKeyframePose(const LightKeyframe &keyframe);
+        LightPose Sample(double frame) const;
+
+        size_t length_;
+        std::map<size_t, LightKeyframe> light_motions_;
+    };
+
+#include "light_impl.inl"
+
+} /* End of namespace mmd */
+
+#endif /* __LIGHT_HXX_2AC43AA43BF473F9A9C09B4B608619D3_INCLUDED__ */
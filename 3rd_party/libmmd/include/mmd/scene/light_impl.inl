@@ -0,0 +1,129 @@
+/**
+             Copyright itsuhane@gmail.com, 2012.
+  Distributed under the Boost Software License, Version 1.0.
+      (See accompanying file LICENSE_1_0.txt or copy at
+            http://www.boost.org/LICENSE_1_0.txt)
+**/
+
+inline
+LightMotion::LightPose::LightPose() {
+    const float gray = 154.0f/255.0f;
+    color_.p.x = color_.p.y = color_.p.z = gray;
+    direction_.p.x = -0.5f;
+    direction_.p.y = -1.0f;
+    direction_.p.z = 0.5f;
+}
+
+inline const Vector3f&
+LightMotion::LightPose::GetColor() const {
+    return color_;
+}
+
+inline const Vector3f&
+LightMotion::LightPose::GetDirection() const {
+    return direction_;
+}
+
+inline bool
+LightMotion::LightPose::operator==(const LightPose &pose) const {
+    return color_==pose.color_&&direction_==pose.direction_;
+}
+
+inline bool
+LightMotion::LightPose::operator!=(const LightPose &pose) const {
+    return !(*this==pose);
+}
+
+inline const Vector3f&
+LightMotion::LightKeyframe::GetColor() const {
+    return color_;
+}
+
+inline void
+LightMotion::LightKeyframe::SetColor(const Vector3f &color) {
+    color_ = color;
+}
+
+inline const Vector3f&
+LightMotion::LightKeyframe::GetDirection() const {
+    return direction_;
+}
+
+inline void
+LightMotion::LightKeyframe::SetDirection(const Vector3f &direction) {
+    direction_ = direction;
+}
+
+inline
+LightMotion::LightMotion() : length_(0) {}
+
+inline const LightMotion::LightKeyframe&
+LightMotion::GetLightKeyframe(size_t frame) const {
+    return light_motions_.find(frame)->second;
+}
+
+inline LightMotion::LightKeyframe&
+LightMotion::GetLightKeyframe(size_t frame) {
+    if(frame>length_) {
+        length_ = frame;
+    }
+    return light_motions_[frame];
+}
+
+inline LightMotion::LightPose
+LightMotion::GetLightPose(size_t frame) const {
+    return Sample(double(frame));
+}
+
+inline LightMotion::LightPose
+LightMotion::GetLightPose(double time) const {
+    return Sample(time*30.0);
+}
+
+inline size_t
+LightMotion::GetKeyframeNum() const {
+    return light_motions_.size();
+}
+
+inline size_t
+LightMotion::GetLength() const {
+    return length_;
+}
+
+inline void
+LightMotion::Clear() {
+    length_ = 0;
+    light_motions_.clear();
+}
+
+inline LightMotion::LightPose
+LightMotion::GetKeyframePose(const LightKeyframe &keyframe) {
+    LightPose pose;
+    pose.color_ = keyframe.GetColor();
+    pose.direction_ = keyframe.GetDirection();
+    return pose;
+}
+
+inline LightMotion::LightPose
+LightMotion::Sample(double frame) const {
+    if(light_motions_.empty()) {
+        return LightPose();
+    }
+    const_iterator r = light_motions_.upper_bound(frame<0.0 ? 0 : size_t(frame));
+    if(r==light_motions_.begin()) {
+        return GetKeyframePose(r->second);
+    }
+    const_iterator l = r;
+    --l;
+    if(r==light_motions_.end()||frame<=double(l->first)) {
+        return GetKeyframePose(l->second);
+    }
+    float lambda = float((frame-double(l->first))/double(r->first-l->first));
+    const LightKeyframe &l_keyframe = l->second;
+    const LightKeyframe &r_keyframe = r->second;
+
+    LightPose pose;
+    pose.color_ = l_keyframe.GetColor()+(r_keyframe.GetColor()-l_keyframe.GetColor())*lambda;
+    pose.direction_ = l_keyframe.GetDirection()+(r_keyframe.GetDirection()-l_keyframe.GetDirection())*lambda;
+    return pose;
+}
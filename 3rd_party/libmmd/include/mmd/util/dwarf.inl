@@ -19,6 +19,8 @@ namespace std {
     typedef __int8 int8_t;
     typedef __int16 int16_t;
     typedef __int32 int32_t;
+    typedef unsigned __int64 uint64_t;
+    typedef __int64 int64_t;
 #endif
 
 } /* End of namespace std */
@@ -68,13 +70,49 @@ namespace mmd {
     };
 #include "unpack.inc"
 
+    /**
+      Read-only memory mapping of a whole file. Pages are loaded on first
+      access, so opening a large file costs next to nothing. A file opened
+      for sequential access is read ahead aggressively and its pages are
+      dropped soon after use.
+    **/
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        MappedFile(const std::wstring &filename, bool sequential = false);
+        ~MappedFile();
+
+        void Open(const std::wstring &filename, bool sequential = false);
+        void Close();
+
+        bool IsOpen() const;
+        const std::uint8_t *GetData() const;
+        size_t GetLength() const;
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile &operator=(const MappedFile&);
+
+        const std::uint8_t *data_;
+        size_t length_;
+#ifdef MMD_WINDOWS
+        HANDLE file_;
+        HANDLE mapping_;
+#endif
+    };
+
+    /**
+      Reads a file from start to end. By default the whole file is read into
+      a buffer; a mapped reader reads from a sequential memory mapping of it
+      instead, without a copy, and GetBuffer stays empty.
+    **/
     class FileReader
     {
     public:
         FileReader();
 
-        FileReader(const std::string &filename);
-        FileReader(const std::wstring &filename);
+        FileReader(const std::string &filename, bool mapped = false);
+        FileReader(const std::wstring &filename, bool mapped = false);
 
         static bool FileExists(const std::wstring &filename);
 
@@ -82,9 +120,14 @@ namespace mmd {
         size_t ReadIndex(size_t byte_size);
         std::string ReadAnsiString();
         std::wstring ReadString(bool utf8 = false);
+        // The next length bytes, in place; valid as long as the reader.
+        const std::uint8_t *ReadBytes(size_t length);
 
         buffer_type& GetBuffer();
         const buffer_type& GetBuffer() const;
+        bool IsMapped() const;
+        // The file contents, mapped or buffered.
+        const std::uint8_t *GetData() const;
         void Reset();
 
         const std::wstring& GetPath() const;
@@ -97,12 +140,19 @@ namespace mmd {
         size_t GetPosition() const;
         ptrdiff_t GetRemainedLength() const;
     private:
-        void Initialize();
+        FileReader(const FileReader&);
+        FileReader &operator=(const FileReader&);
+
+        void Initialize(bool mapped);
         std::wstring path_;
         buffer_type buffer_;
+        MappedFile mapping_;
         size_t cursor_;
     };
 
+    // 64-bit FNV-1a, used to key caches derived from file contents.
+    std::uint64_t HashFNV1a(const void *data, size_t length);
+
     std::string UTF16ToNativeString(const std::wstring &ws);
     std::wstring NativeToUTF16String(const std::string &s);
     std::wstring UTF8ToUTF16String(const std::string &s);
@@ -26,7 +26,11 @@ template<size_t length> inline mmd_string<length>::operator std::string () const
     return std::string(buffer);
 }
 
-inline void FileReader::Initialize() {
+inline void FileReader::Initialize(bool mapped) {
+    if(mapped) {
+        mapping_.Open(path_, true);
+        return;
+    }
 #ifdef MMD_WINDOWS
     FILE *f = _wfopen(path_.c_str(), L"rb");
 #else
@@ -49,14 +53,14 @@ inline void FileReader::Initialize() {
 
 inline FileReader::FileReader() : cursor_(0) {}
 
-inline FileReader::FileReader(const std::string &filename) : path_(NativeToUTF16String(filename)), cursor_(0)
+inline FileReader::FileReader(const std::string &filename, bool mapped) : path_(NativeToUTF16String(filename)), cursor_(0)
 {
-    Initialize();
+    Initialize(mapped);
 }
 
-inline FileReader::FileReader(const std::wstring &filename) : path_(filename), cursor_(0)
+inline FileReader::FileReader(const std::wstring &filename, bool mapped) : path_(filename), cursor_(0)
 {
-    Initialize();
+    Initialize(mapped);
 }
 
 inline bool FileReader::FileExists(const std::wstring &filename) {
@@ -73,28 +77,29 @@ inline bool FileReader::FileExists(const std::wstring &filename) {
 }
 
 template<typename T> inline T FileReader::Read() {
-    if(cursor_+sizeof(T)>buffer_.size()) {
+    if(cursor_+sizeof(T)>GetLength()) {
         throw exception(std::string("FileReader: Buffer length exceeded"));
     }
-    T t = *reinterpret_cast<T*>(&buffer_[cursor_]);
+    T t = *reinterpret_cast<const T*>(GetData()+cursor_);
     cursor_ += sizeof(T);
     return t;
 }
 
 inline size_t FileReader::ReadIndex(size_t byte_size) {
-    if(cursor_+byte_size>buffer_.size()) {
+    if(cursor_+byte_size>GetLength()) {
         throw exception(std::string("FileReader: Buffer length exceeded"));
     }
+    const std::uint8_t *p = GetData()+cursor_;
     size_t result;
     switch(byte_size) {
     case 1:
-        result = (size_t)(*reinterpret_cast<std::uint8_t*>(&buffer_[cursor_]));
+        result = (size_t)(*p);
         break;
     case 2:
-        result = (size_t)(*reinterpret_cast<std::uint16_t*>(&buffer_[cursor_]));
+        result = (size_t)(*reinterpret_cast<const std::uint16_t*>(p));
         break;
     case 4:
-        result = (size_t)(*reinterpret_cast<std::int32_t*>(&buffer_[cursor_]));
+        result = (size_t)(*reinterpret_cast<const std::int32_t*>(p));
         break;
     default:
         throw exception(std::string("FileReader: Invalid byte size"));
@@ -105,32 +110,43 @@ inline size_t FileReader::ReadIndex(size_t byte_size) {
 
 inline std::string FileReader::ReadAnsiString() {
     size_t length = (size_t)Read<std::int32_t>();
-    if(cursor_+length>buffer_.size()) {
-        throw exception(std::string("FileReader: Buffer length exceeded"));
-    }
-    cursor_ += length;
-    return std::string((char*)&buffer_[cursor_-length], length);
+    const char *p = (const char*)ReadBytes(length);
+    return std::string(p, length);
 }
 
 inline std::wstring FileReader::ReadString(bool utf8) {
     size_t length = (size_t)Read<std::int32_t>();
-    if(cursor_+length>buffer_.size()) {
-        throw exception(std::string("FileReader: Buffer length exceeded"));
-    }
-    cursor_ += length;
+    const std::uint8_t *p = ReadBytes(length);
     if(!utf8) {
 #ifdef MMD_WINDOWS
-        return std::wstring((wchar_t*)&buffer_[cursor_-length], length/sizeof(wchar_t));
+        return std::wstring((const wchar_t*)p, length/sizeof(wchar_t));
 #else
-        return std::wstring((std::uint16_t*)&buffer_[cursor_-length], (std::uint16_t*)&buffer_[cursor_]);
+        return std::wstring((const std::uint16_t*)p, (const std::uint16_t*)(p+length));
 #endif
     } else {
-        return UTF8ToUTF16String(std::string((char*)&buffer_[cursor_-length], length));
+        return UTF8ToUTF16String(std::string((const char*)p, length));
     }
 }
 
+inline const std::uint8_t *FileReader::ReadBytes(size_t length) {
+    if(length>GetLength()-cursor_) {
+        throw exception(std::string("FileReader: Buffer length exceeded"));
+    }
+    const std::uint8_t *p = GetData()+cursor_;
+    cursor_ += length;
+    return p;
+}
+
 inline buffer_type& FileReader::GetBuffer() { return buffer_; }
 inline const buffer_type& FileReader::GetBuffer() const { return buffer_; }
+inline bool FileReader::IsMapped() const { return mapping_.IsOpen(); }
+
+inline const std::uint8_t *FileReader::GetData() const {
+    if(mapping_.IsOpen()) {
+        return mapping_.GetData();
+    }
+    return buffer_.empty() ? NULL : &buffer_[0];
+}
 inline void FileReader::Reset() { cursor_ = 0; }
 
 inline const std::wstring& FileReader::GetPath() const {
@@ -154,13 +170,13 @@ inline std::wstring FileReader::GetLocation() const {
 }
 
 inline void FileReader::Seek(size_t position) {
-    if(position<=buffer_.size()) {
+    if(position<=GetLength()) {
         cursor_ = position;
     }
 }
 
 inline size_t FileReader::GetLength() const {
-    return buffer_.size();
+    return mapping_.IsOpen() ? mapping_.GetLength() : buffer_.size();
 }
 
 inline size_t FileReader::GetPosition() const {
@@ -168,9 +184,111 @@ inline size_t FileReader::GetPosition() const {
 }
 
 inline ptrdiff_t FileReader::GetRemainedLength() const {
-    return buffer_.size()-cursor_;
+    return GetLength()-cursor_;
 }
 
+inline MappedFile::MappedFile() : data_(NULL), length_(0)
+#ifdef MMD_WINDOWS
+  , file_(INVALID_HANDLE_VALUE), mapping_(NULL)
+#endif
+{}
+
+inline MappedFile::MappedFile(const std::wstring &filename, bool sequential) : data_(NULL), length_(0)
+#ifdef MMD_WINDOWS
+  , file_(INVALID_HANDLE_VALUE), mapping_(NULL)
+#endif
+{
+    Open(filename, sequential);
+}
+
+inline MappedFile::~MappedFile() {
+    Close();
+}
+
+inline void MappedFile::Open(const std::wstring &filename, bool sequential) {
+    Close();
+#ifdef MMD_WINDOWS
+    DWORD flags = sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+    file_ = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if(file_==INVALID_HANDLE_VALUE) {
+        throw exception(std::string("MappedFile: Cannot open file."));
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file_, &size)||size.QuadPart==0) {
+        Close();
+        throw exception(std::string("MappedFile: File is empty."));
+    }
+    mapping_ = CreateFileMappingW(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping_==NULL) {
+        Close();
+        throw exception(std::string("MappedFile: Cannot map file."));
+    }
+    data_ = (const std::uint8_t*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if(data_==NULL) {
+        Close();
+        throw exception(std::string("MappedFile: Cannot map file."));
+    }
+    length_ = (size_t)size.QuadPart;
+#else
+    int fd = open(UTF16ToNativeString(filename).c_str(), O_RDONLY);
+    if(fd<0) {
+        throw exception(std::string("MappedFile: Cannot open file."));
+    }
+    struct stat st;
+    if(fstat(fd, &st)!=0||st.st_size==0) {
+        close(fd);
+        throw exception(std::string("MappedFile: File is empty."));
+    }
+    // Read-only, so a shared mapping: the pages are the page cache's own.
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    if(data==MAP_FAILED) {
+        throw exception(std::string("MappedFile: Cannot map file."));
+    }
+    if(sequential) {
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+    data_ = (const std::uint8_t*)data;
+    length_ = (size_t)st.st_size;
+#endif
+}
+
+inline void MappedFile::Close() {
+#ifdef MMD_WINDOWS
+    if(data_!=NULL) {
+        UnmapViewOfFile(data_);
+    }
+    if(mapping_!=NULL) {
+        CloseHandle(mapping_);
+        mapping_ = NULL;
+    }
+    if(file_!=INVALID_HANDLE_VALUE) {
+        CloseHandle(file_);
+        file_ = INVALID_HANDLE_VALUE;
+    }
+#else
+    if(data_!=NULL) {
+        munmap((void*)data_, length_);
+    }
+#endif
+    data_ = NULL;
+    length_ = 0;
+}
+
+inline bool MappedFile::IsOpen() const { return data_!=NULL; }
+inline const std::uint8_t *MappedFile::GetData() const { return data_; }
+inline size_t MappedFile::GetLength() const { return length_; }
+
+inline std::uint64_t HashFNV1a(const void *data, size_t length) {
+    const std::uint8_t *p = (const std::uint8_t*)data;
+    std::uint64_t hash = 14695981039346656037ull;
+    for(size_t i=0;i<length;++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
 inline std::wstring s2ws(const std::string &s) {
     size_t wl = s.size()+1;
@@ -210,23 +328,27 @@ inline std::wstring UTF8ToUTF16String(const std::string &s) {
     return ws;
 }
 
+// Code page 932, the Shift-JIS MMD writes, without locale or iconv.
 inline std::wstring ShiftJISToUTF16String(const std::string &s) {
-#ifdef MMD_WINDOWS
-    std::string c_locale = setlocale(LC_ALL, NULL);
-    setlocale(LC_ALL, "Japanese_Japan.932");
-    std::wstring ws = s2ws(s);
-    setlocale(LC_ALL, c_locale.c_str());
+    static const std::uint16_t double_byte_table[] = {
+#include "sjis_table.inc"
+    };
+    std::wstring ws;
+    ws.reserve(s.size());
+    for(size_t i=0;i<s.size();++i) {
+        std::uint8_t c = std::uint8_t(s[i]);
+        if(c<0x80) {
+            ws.push_back(wchar_t(c));
+        } else if(c>=0xA1&&c<=0xDF) {
+            // Half-width katakana.
+            ws.push_back(wchar_t(0xFF61+(c-0xA1)));
+        } else if(((c>=0x81&&c<=0x9F)||(c>=0xE0&&c<=0xFC))&&i+1<s.size()&&
+                  std::uint8_t(s[i+1])>=0x40&&std::uint8_t(s[i+1])<=0xFC) {
+            size_t row = c<0xA0 ? c-0x81 : c-0xE0+31;
+            ws.push_back(wchar_t(double_byte_table[row*189+std::uint8_t(s[++i])-0x40]));
+        } else {
+            ws.push_back(wchar_t(0xFFFD));
+        }
+    }
     return ws;
-#else
-    iconv_t cd = iconv_open("UTF-16", "SHIFT-JIS");
-    std::vector<char> from_buffer(s.begin(), s.end());
-    std::vector<char> to_buffer(s.size()*4+1, '\0');
-    char* from_ptr = &from_buffer[0];
-    char* to_ptr = &to_buffer[0];
-    size_t from_length = s.size();
-    size_t to_length = s.size()*4+1;
-    iconv(cd, &from_ptr, &from_length, &to_ptr, &to_length);
-    iconv_close(cd);
-    return std::wstring((std::uint16_t*)&to_buffer[0], (std::uint16_t*)&to_buffer[s.size()*4-to_length+1]);
-#endif
 }
@@ -420,6 +420,7 @@ namespace mmd {
     template <typename T> Vector3D<T> transform(const Vector3D<T>& v, const Matrix4x4<T>& m);
 
     template <typename T> Quaternion<T> AxisToQuaternion(const Vector3D<T>& axis, typename Vector3D<T>::elem_type angle);
+    template <typename T> Quaternion<T> RotateMatrixToQuaternion(const Matrix4x4<T>& m);
 
     template <typename T> Vector3D<T> QuaternionToXYZ(const Quaternion<T>& quaternion);
     template <typename T> Vector3D<T> QuaternionToXZY(const Quaternion<T>& quaternion);
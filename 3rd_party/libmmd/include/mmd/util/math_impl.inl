@@ -1056,6 +1056,37 @@ template <typename T> inline Quaternion<T> AxisToQuaternion(const Vector3D<T>& a
     }
     return result.q;
 }
+// Inverse of Quaternion::ToRotateMatrix; m must be a pure rotation.
+template <typename T> inline Quaternion<T> RotateMatrixToQuaternion(const Matrix4x4<T>& m) {
+    Quaternion<T> result;
+    T trace = m.r.v[0].v[0]+m.r.v[1].v[1]+m.r.v[2].v[2];
+    if(trace>T(0)) {
+        T s = math::sqrt(trace+T(1))*T(2);
+        result.e = T(0.25)*s;
+        result.i = (m.r.v[1].v[2]-m.r.v[2].v[1])/s;
+        result.j = (m.r.v[2].v[0]-m.r.v[0].v[2])/s;
+        result.k = (m.r.v[0].v[1]-m.r.v[1].v[0])/s;
+    } else if((m.r.v[0].v[0]>m.r.v[1].v[1])&&(m.r.v[0].v[0]>m.r.v[2].v[2])) {
+        T s = math::sqrt(T(1)+m.r.v[0].v[0]-m.r.v[1].v[1]-m.r.v[2].v[2])*T(2);
+        result.e = (m.r.v[1].v[2]-m.r.v[2].v[1])/s;
+        result.i = T(0.25)*s;
+        result.j = (m.r.v[0].v[1]+m.r.v[1].v[0])/s;
+        result.k = (m.r.v[2].v[0]+m.r.v[0].v[2])/s;
+    } else if(m.r.v[1].v[1]>m.r.v[2].v[2]) {
+        T s = math::sqrt(T(1)+m.r.v[1].v[1]-m.r.v[0].v[0]-m.r.v[2].v[2])*T(2);
+        result.e = (m.r.v[2].v[0]-m.r.v[0].v[2])/s;
+        result.i = (m.r.v[0].v[1]+m.r.v[1].v[0])/s;
+        result.j = T(0.25)*s;
+        result.k = (m.r.v[1].v[2]+m.r.v[2].v[1])/s;
+    } else {
+        T s = math::sqrt(T(1)+m.r.v[2].v[2]-m.r.v[0].v[0]-m.r.v[1].v[1])*T(2);
+        result.e = (m.r.v[0].v[1]-m.r.v[1].v[0])/s;
+        result.i = (m.r.v[2].v[0]+m.r.v[0].v[2])/s;
+        result.j = (m.r.v[1].v[2]+m.r.v[2].v[1])/s;
+        result.k = T(0.25)*s;
+    }
+    return result;
+}
 template <typename T> inline Vector3D<T> QuaternionToXYZ(const Quaternion<T>& quaternion) {
     T ii = quaternion.i*quaternion.i;
     T jj = quaternion.j*quaternion.j;
@@ -12,6 +12,7 @@
 #include "sokol_log.h"
 #include "sokol_glue.h"
 #include "sokol_time.h"
+#include "sokol_audio.h"
 #include "imgui.h"
 #include "imgui_internal.h"
 #include "util/sokol_imgui.h"
@@ -21,6 +22,7 @@
 
 #include "mmd/mmd.hxx"
 #include "mmd-bullet/mmd-bullet.hxx"
+#include "mmd-pbd/mmd-pbd.hxx"
 #include "HandmadeMath.h"
 #include "shader/main.glsl.h"
 #include "shader/ground.glsl.h"
@@ -40,6 +42,15 @@
 #include <fstream>
 #include <algorithm>
 #include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #ifndef _WIN32
 #include <sys/stat.h>
 #include <unistd.h>
@@ -53,10 +64,13 @@ struct Vertex {
     float uv[2];
 };
 
-// Sequencer interface for VMD animation
+std::wstring utf8_to_wstring(const std::string& str);
+std::string wstring_to_utf8(const std::wstring& wstr);
+
+// Sequencer interface for VMD animation, with a keyframe track per bone and morph
 class MotionSequencer : public ImSequencer::SequenceInterface {
 public:
-    MotionSequencer(std::shared_ptr<mmd::Motion> motion) : motion_(motion) {
+    MotionSequencer(std::shared_ptr<mmd::CompiledMotion> motion) : motion_(motion), key_num_(0) {
         if (motion_) {
             // Create a simple entry representing the entire animation
             int max_frame = static_cast<int>(motion_->GetLength());
@@ -64,6 +78,18 @@ public:
                 max_frame = 10000; // Default if length is 0
             }
             entries_.push_back({0, max_frame, 0});
+
+            // Tracks point into the compiled image; its frame arrays are sorted
+            for (size_t i = 0; i < motion_->GetBoneTrackNum(); ++i) {
+                tracks_.push_back({wstring_to_utf8(motion_->GetBoneTrackName(i)),
+                                   motion_->GetBoneFrames(i), motion_->GetBoneKeyNum(i), false});
+                key_num_ += motion_->GetBoneKeyNum(i);
+            }
+            for (size_t i = 0; i < motion_->GetMorphTrackNum(); ++i) {
+                tracks_.push_back({wstring_to_utf8(motion_->GetMorphTrackName(i)),
+                                   motion_->GetMorphFrames(i), motion_->GetMorphKeyNum(i), true});
+                key_num_ += motion_->GetMorphKeyNum(i);
+            }
         }
     }
     
@@ -110,17 +136,720 @@ public:
     virtual void DoubleClick(int index) override {
         // Could seek to frame on double click
     }
+
+    size_t GetTrackNum() const {
+        return tracks_.size();
+    }
+
+    size_t GetKeyNum() const {
+        return key_num_;
+    }
+
+    // Draw the keyframes of every track from first_frame, frame_width pixels
+    // per frame. Only the rows in view are visited (ImGuiListClipper), and in
+    // each row a binary search finds the first key in the frame window, then
+    // at most one key per pixel column is drawn. Dense motions with hundreds
+    // of thousands of keys therefore cost what is on screen. Returns the
+    // frame clicked (snapped to a key within a few pixels), or -1.
+    int DrawTracks(int first_frame, float frame_width, int current_frame, float height) {
+        const float legend_width = 160.0f;
+        const float row_height = ImGui::GetTextLineHeightWithSpacing();
+        int clicked_frame = -1;
+
+        ImGui::BeginChild("##tracks", ImVec2(0.0f, height), ImGuiChildFlags_Borders);
+        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        float width = ImGui::GetContentRegionAvail().x;
+        float track_width = width - legend_width;
+        int last_frame = first_frame + static_cast<int>(track_width / frame_width) + 1;
+
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(tracks_.size()), row_height);
+        while (clipper.Step()) {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+                const Track& track = tracks_[row];
+                ImVec2 origin = ImGui::GetCursorScreenPos();
+                float keys_x = origin.x + legend_width;
+
+                if (row % 2) {
+                    draw_list->AddRectFilled(origin, ImVec2(origin.x + width, origin.y + row_height), 0x10FFFFFF);
+                }
+                draw_list->PushClipRect(origin, ImVec2(keys_x - 4.0f, origin.y + row_height), true);
+                draw_list->AddText(ImVec2(origin.x + 4.0f, origin.y), track.morph ? 0xFFB0E0B0 : 0xFFE0E0E0,
+                                   track.label.c_str());
+                draw_list->PopClipRect();
+
+                ImU32 key_color = track.morph ? 0xFF60C060 : 0xFF40A0E0;
+                const std::uint32_t* frames_end = track.frames + track.key_num;
+                const std::uint32_t* key = std::lower_bound(
+                    track.frames, frames_end, static_cast<std::uint32_t>(std::max(first_frame, 0)));
+                float center_y = origin.y + row_height * 0.5f;
+                float radius = std::min(row_height * 0.3f, std::max(frame_width * 0.5f, 2.0f));
+                while (key != frames_end && static_cast<int>(*key) <= last_frame) {
+                    float x = keys_x + (static_cast<int>(*key) - first_frame) * frame_width;
+                    draw_list->AddQuadFilled(ImVec2(x, center_y - radius), ImVec2(x + radius, center_y),
+                                             ImVec2(x, center_y + radius), ImVec2(x - radius, center_y), key_color);
+                    // Keys sharing this pixel column would be drawn over this one
+                    float next_frame = first_frame + (x - keys_x + 1.0f) / frame_width;
+                    key = std::lower_bound(key + 1, frames_end, static_cast<std::uint32_t>(std::ceil(next_frame)));
+                }
+
+                ImGui::PushID(row);
+                ImGui::InvisibleButton("##row", ImVec2(width, row_height));
+                ImGui::PopID();
+                if (ImGui::IsItemClicked() && ImGui::GetIO().MousePos.x >= keys_x) {
+                    float frame = first_frame + (ImGui::GetIO().MousePos.x - keys_x) / frame_width;
+                    clicked_frame = std::max(static_cast<int>(frame + 0.5f), 0);
+                    // Snap to the nearest key within a few pixels
+                    const std::uint32_t* nearest = std::lower_bound(
+                        track.frames, frames_end, static_cast<std::uint32_t>(clicked_frame));
+                    float snap = 4.0f / frame_width;
+                    if (nearest != frames_end && *nearest - frame <= snap) {
+                        clicked_frame = static_cast<int>(*nearest);
+                    } else if (nearest != track.frames && frame - *(nearest - 1) <= snap) {
+                        clicked_frame = static_cast<int>(*(nearest - 1));
+                    }
+                }
+            }
+        }
+        clipper.End();
+
+        // Current frame across all visible rows
+        if (current_frame >= first_frame && current_frame <= last_frame) {
+            ImVec2 window_pos = ImGui::GetWindowPos();
+            float x = window_pos.x + ImGui::GetStyle().WindowPadding.x + legend_width +
+                      (current_frame - first_frame) * frame_width;
+            draw_list->AddLine(ImVec2(x, window_pos.y), ImVec2(x, window_pos.y + ImGui::GetWindowHeight()),
+                               0xA02A2AFF, 2.0f);
+        }
+        ImGui::EndChild();
+        return clicked_frame;
+    }
     
 private:
-    std::shared_ptr<mmd::Motion> motion_;
+    std::shared_ptr<mmd::CompiledMotion> motion_;
     struct Entry {
         int start;
         int end;
         int type;
     };
     std::vector<Entry> entries_;
+
+    struct Track {
+        std::string label;
+        const std::uint32_t* frames;
+        size_t key_num;
+        bool morph;
+    };
+    std::vector<Track> tracks_;
+    size_t key_num_;
+};
+
+// A motion stacked over the main one, e.g. facial, lip sync or hand poses
+struct MotionLayer {
+    std::shared_ptr<mmd::CompiledMotion> motion;
+    std::string filename;
+    float weight;
+};
+
+// Single-producer single-consumer ring of interleaved samples: the decoder
+// thread writes, the audio thread reads, neither ever blocks on the other
+class AudioRingBuffer {
+public:
+    explicit AudioRingBuffer(size_t capacity) : data_(capacity), mask_(capacity - 1), read_(0), write_(0) {
+        // capacity must be a power of two
+    }
+
+    size_t GetReadable() const {
+        return write_.load(std::memory_order_acquire) - read_.load(std::memory_order_relaxed);
+    }
+
+    size_t GetWritable() const {
+        return data_.size() - (write_.load(std::memory_order_relaxed) - read_.load(std::memory_order_acquire));
+    }
+
+    // Producer side
+    size_t Write(const float* samples, size_t num) {
+        size_t write = write_.load(std::memory_order_relaxed);
+        num = std::min(num, GetWritable());
+        for (size_t i = 0; i < num; ++i) {
+            data_[(write + i) & mask_] = samples[i];
+        }
+        write_.store(write + num, std::memory_order_release);
+        return num;
+    }
+
+    // Consumer side
+    size_t Read(float* samples, size_t num) {
+        size_t read = read_.load(std::memory_order_relaxed);
+        num = std::min(num, GetReadable());
+        for (size_t i = 0; i < num; ++i) {
+            samples[i] = data_[(read + i) & mask_];
+        }
+        read_.store(read + num, std::memory_order_release);
+        return num;
+    }
+
+    // Consumer side, while the producer is known to be idle
+    void Discard() {
+        read_.store(write_.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    std::vector<float> data_;
+    size_t mask_;
+    std::atomic<size_t> read_;
+    std::atomic<size_t> write_;
+};
+
+// Streams a PCM WAV file through sokol_audio. A worker thread decodes (and
+// resamples, when the device runs at another rate) into a ring buffer that
+// the audio callback drains. The callback counts the frames it hands to the
+// device, which gives the playback clock; GetTime interpolates between
+// callbacks. Seeks flush the ring from the audio thread so stale samples are
+// never played.
+class AudioPlayer {
+public:
+    static const int kChannels = 2;
+
+    AudioPlayer() : ring_(1 << 17) {}
+    ~AudioPlayer() {
+        Close();
+    }
+
+    bool Open(const std::string& filename) {
+        Close();
+#ifdef _WIN32
+        file_.open(utf8_to_wstring(filename).c_str(), std::ios::binary);
+#else
+        file_.open(filename.c_str(), std::ios::binary);
+#endif
+        if (!file_ || !ReadHeader()) {
+            std::cerr << "Not a PCM WAV file: " << filename << std::endl;
+            file_.close();
+            return false;
+        }
+        if (!saudio_isvalid()) {
+            saudio_desc desc = {};
+            desc.sample_rate = sample_rate_;
+            desc.num_channels = kChannels;
+            desc.stream_userdata_cb = StreamCallback;
+            desc.user_data = this;
+            desc.logger.func = slog_func;
+            saudio_setup(&desc);
+            if (!saudio_isvalid()) {
+                std::cerr << "Audio device unavailable" << std::endl;
+                file_.close();
+                return false;
+            }
+        }
+        device_rate_ = saudio_sample_rate();
+        filename_ = filename;
+
+        playing_ = false;
+        decoded_all_ = false;
+        played_ = 0;
+        seek_frame_ = 0;
+        decode_frame_ = 0;
+        underruns_ = 0;
+        // Start with a seek to 0, so anything left from the last file is flushed
+        seek_target_ = 0;
+        seek_request_ = seek_done_ + 1;
+        stop_ = false;
+        open_ = true;
+        thread_ = std::thread(&AudioPlayer::Decode, this);
+        return true;
+    }
+
+    void Close() {
+        if (thread_.joinable()) {
+            stop_ = true;
+            thread_.join();
+        }
+        open_ = false;
+        playing_ = false;
+        if (file_.is_open()) {
+            file_.close();
+        }
+    }
+
+    bool IsOpen() const {
+        return open_;
+    }
+
+    const std::string& GetFilename() const {
+        return filename_;
+    }
+
+    double GetLength() const {
+        return sample_rate_ > 0 ? double(frame_num_) / sample_rate_ : 0.0;
+    }
+
+    void Play() {
+        playing_ = true;
+    }
+
+    void Pause() {
+        playing_ = false;
+        callback_stamp_ = 0;
+    }
+
+    bool IsPlaying() const {
+        return playing_;
+    }
+
+    void Seek(double time) {
+        seek_target_ = static_cast<int64_t>(std::max(time, 0.0) * device_rate_);
+        seek_request_.fetch_add(1);
+    }
+
+    bool IsSeeking() const {
+        return seek_request_.load() != seek_done_.load();
+    }
+
+    // Decoded to the end and drained
+    bool IsFinished() const {
+        return decoded_all_ && ring_.GetReadable() == 0;
+    }
+
+    // Position of the samples handed to the device, in seconds; the device
+    // buffer (see GetDeviceLatency) still delays them before they are heard
+    double GetTime() const {
+        uint64_t stamp = callback_stamp_.load(std::memory_order_acquire);
+        int64_t played = played_.load(std::memory_order_acquire);
+        double time = double(played) / device_rate_;
+        if (playing_ && stamp != 0) {
+            double since = stm_sec(stm_since(stamp));
+            time += std::min(since, double(callback_frames_.load()) / device_rate_);
+        }
+        return time;
+    }
+
+    double GetDeviceLatency() const {
+        return saudio_isvalid() ? double(saudio_buffer_frames()) / saudio_sample_rate() : 0.0;
+    }
+
+    size_t GetUnderrunNum() const {
+        return underruns_;
+    }
+
+private:
+    AudioPlayer(const AudioPlayer&) = delete;
+    AudioPlayer& operator=(const AudioPlayer&) = delete;
+
+    template <typename T>
+    bool ReadValue(T& value) {
+        unsigned char bytes[sizeof(T)];
+        if (!file_.read(reinterpret_cast<char*>(bytes), sizeof(T))) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            value |= static_cast<T>(bytes[i]) << (8 * i);
+        }
+        return true;
+    }
+
+    // RIFF/WAVE with integer (8, 16, 24, 32 bit) or float (32 bit) PCM
+    bool ReadHeader() {
+        char id[4];
+        uint32_t size = 0;
+        if (!file_.read(id, 4) || std::memcmp(id, "RIFF", 4) != 0 || !ReadValue(size) ||
+            !file_.read(id, 4) || std::memcmp(id, "WAVE", 4) != 0) {
+            return false;
+        }
+        bool has_format = false;
+        while (file_.read(id, 4) && ReadValue(size)) {
+            std::streamoff next = static_cast<std::streamoff>(file_.tellg()) + size + (size & 1);
+            if (std::memcmp(id, "fmt ", 4) == 0) {
+                uint16_t format = 0, channels = 0, block_align = 0, bits = 0;
+                uint32_t rate = 0, byte_rate = 0;
+                ReadValue(format);
+                ReadValue(channels);
+                ReadValue(rate);
+                ReadValue(byte_rate);
+                ReadValue(block_align);
+                ReadValue(bits);
+                if (format == 0xFFFE && size >= 40) {
+                    // WAVE_FORMAT_EXTENSIBLE: the sub-format GUID starts with the format tag
+                    uint16_t extension_size = 0, valid_bits = 0;
+                    uint32_t channel_mask = 0;
+                    ReadValue(extension_size);
+                    ReadValue(valid_bits);
+                    ReadValue(channel_mask);
+                    ReadValue(format);
+                }
+                float_format_ = format == 3;
+                if ((format != 1 && format != 3) || channels == 0 || rate == 0 ||
+                    (float_format_ ? bits != 32 : (bits != 8 && bits != 16 && bits != 24 && bits != 32)) ||
+                    block_align != channels * (bits / 8)) {
+                    return false;
+                }
+                channels_ = channels;
+                sample_rate_ = static_cast<int>(rate);
+                bits_ = bits;
+                block_align_ = block_align;
+                has_format = true;
+            } else if (std::memcmp(id, "data", 4) == 0) {
+                data_offset_ = file_.tellg();
+                frame_num_ = size / std::max<uint32_t>(block_align_, 1);
+                return has_format;
+            }
+            file_.seekg(next);
+        }
+        return false;
+    }
+
+    float DecodeSample(const unsigned char* bytes) const {
+        if (float_format_) {
+            float value;
+            std::memcpy(&value, bytes, sizeof(float));
+            return value;
+        }
+        switch (bits_) {
+        case 8:
+            return (bytes[0] - 128) / 128.0f;
+        case 16:
+            return static_cast<int16_t>(bytes[0] | (bytes[1] << 8)) / 32768.0f;
+        case 24:
+            return static_cast<int32_t>((bytes[0] << 8) | (bytes[1] << 16) | (uint32_t(bytes[2]) << 24)) / 2147483648.0f;
+        default:
+            return static_cast<int32_t>(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24)) / 2147483648.0f;
+        }
+    }
+
+    // Reads source frames [first, first + num) as stereo, zeros past the end
+    void ReadSource(int64_t first, size_t num, std::vector<float>& out) {
+        out.assign(num * kChannels, 0.0f);
+        if (first >= frame_num_) {
+            return;
+        }
+        size_t available = static_cast<size_t>(std::min<int64_t>(num, frame_num_ - first));
+        bytes_.resize(available * block_align_);
+        file_.clear();
+        file_.seekg(data_offset_ + static_cast<std::streamoff>(first) * block_align_);
+        file_.read(reinterpret_cast<char*>(bytes_.data()), bytes_.size());
+        available = static_cast<size_t>(file_.gcount()) / block_align_;
+        size_t sample_size = bits_ / 8;
+        for (size_t i = 0; i < available; ++i) {
+            const unsigned char* frame = &bytes_[i * block_align_];
+            float left = DecodeSample(frame);
+            float right = channels_ > 1 ? DecodeSample(frame + sample_size) : left;
+            out[i * kChannels] = left;
+            out[i * kChannels + 1] = right;
+        }
+    }
+
+    void Decode() {
+        const size_t chunk_frames = 1024;
+        std::vector<float> source;
+        std::vector<float> output(chunk_frames * kChannels);
+        uint32_t handled_request = 0;
+        double ratio = double(sample_rate_) / device_rate_;
+        while (!stop_) {
+            uint32_t request = seek_request_.load();
+            if (request != handled_request) {
+                // Let the audio thread drop what is queued, then restart at the target
+                handled_request = request;
+                seek_frame_ = seek_target_.load();
+                flush_ = true;
+                while (flush_ && !stop_) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                decode_frame_ = seek_frame_.load();
+                decoded_all_ = false;
+                seek_done_ = request;
+                continue;
+            }
+            if (decoded_all_ || ring_.GetWritable() < output.size()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                continue;
+            }
+
+            int64_t device_frame = decode_frame_;
+            if (static_cast<int64_t>(device_frame * ratio) >= frame_num_) {
+                decoded_all_ = true;
+                continue;
+            }
+            if (sample_rate_ == device_rate_) {
+                ReadSource(device_frame, chunk_frames, source);
+                std::copy(source.begin(), source.end(), output.begin());
+            } else {
+                // Linear interpolation between the two nearest source frames
+                double start = device_frame * ratio;
+                int64_t first = static_cast<int64_t>(start);
+                size_t span = static_cast<size_t>((device_frame + chunk_frames) * ratio) - first + 2;
+                ReadSource(first, span, source);
+                for (size_t i = 0; i < chunk_frames; ++i) {
+                    double position = (device_frame + i) * ratio - first;
+                    size_t index = static_cast<size_t>(position);
+                    float t = static_cast<float>(position - index);
+                    for (int c = 0; c < kChannels; ++c) {
+                        float a = source[index * kChannels + c];
+                        float b = source[(index + 1) * kChannels + c];
+                        output[i * kChannels + c] = a + (b - a) * t;
+                    }
+                }
+            }
+            ring_.Write(output.data(), output.size());
+            decode_frame_ = device_frame + chunk_frames;
+        }
+    }
+
+    static void StreamCallback(float* buffer, int num_frames, int num_channels, void* user_data) {
+        AudioPlayer* self = static_cast<AudioPlayer*>(user_data);
+        size_t num_samples = static_cast<size_t>(num_frames) * num_channels;
+        if (self->flush_.load(std::memory_order_acquire)) {
+            self->ring_.Discard();
+            self->played_.store(self->seek_frame_.load(), std::memory_order_release);
+            self->callback_stamp_.store(0, std::memory_order_release);
+            self->flush_.store(false, std::memory_order_release);
+        }
+        bool seeking = self->seek_request_.load() != self->seek_done_.load();
+        if (!self->open_ || !self->playing_ || seeking || num_channels != kChannels) {
+            std::fill(buffer, buffer + num_samples, 0.0f);
+            return;
+        }
+        size_t read = self->ring_.Read(buffer, num_samples);
+        std::fill(buffer + read, buffer + num_samples, 0.0f);
+        if (read < num_samples && !self->decoded_all_) {
+            ++self->underruns_;
+        }
+        self->played_.fetch_add(static_cast<int64_t>(read / kChannels), std::memory_order_release);
+        self->callback_frames_.store(static_cast<int>(read / kChannels));
+        self->callback_stamp_.store(stm_now(), std::memory_order_release);
+    }
+
+    std::ifstream file_;
+    std::string filename_;
+    std::streamoff data_offset_ = 0;
+    int64_t frame_num_ = 0;
+    int sample_rate_ = 0;
+    int device_rate_ = 0;
+    int channels_ = 0;
+    int bits_ = 0;
+    int block_align_ = 0;
+    bool float_format_ = false;
+    std::vector<unsigned char> bytes_;
+
+    AudioRingBuffer ring_;
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> open_{false};
+    std::atomic<bool> playing_{false};
+    std::atomic<bool> decoded_all_{false};
+    std::atomic<bool> flush_{false};
+
+    // Clock and seek positions in device frames
+    std::atomic<int64_t> played_{0};
+    std::atomic<int> callback_frames_{0};
+    std::atomic<uint64_t> callback_stamp_{0};
+    std::atomic<int64_t> seek_target_{0};
+    std::atomic<int64_t> seek_frame_{0};
+    std::atomic<int64_t> decode_frame_{0};
+    std::atomic<uint32_t> seek_request_{0};
+    std::atomic<uint32_t> seek_done_{0};
+    std::atomic<size_t> underruns_{0};
+};
+
+// Runs physics on a worker thread, one frame behind the render thread. The
+// reactor simulates a private copy of the poser: Submit hands it the
+// pre-physics pose of frame N and returns at once, and Present poses the
+// render poser with the finished frame N-1 (kinematic and physics bones
+// alike), so everything shown is one frame late but consistent. Results are
+// double buffered: the worker writes one set of skinning matrices while the
+// render thread reads the other.
+//
+// The reactor must not be touched from the render thread unless Wait() has
+// returned since the last Submit.
+class PhysicsPipeline {
+public:
+    ~PhysicsPipeline() {
+        Stop();
+    }
+
+    void Start(mmd::BulletPhysicsReactor& reactor, mmd::Poser& poser) {
+        Stop();
+        reactor_ = &reactor;
+        poser_ = &poser;
+        physics_poser_ = std::make_unique<mmd::Poser>(poser.GetModel());
+        physics_poser_->CopyPosing(poser);
+        reactor.RemovePoser(poser);
+        reactor.AddPoser(*physics_poser_);
+        for (Result& result : results_) {
+            result.valid = false;
+        }
+        write_index_ = 0;
+        read_index_ = 1;
+        busy_ = false;
+        stop_ = false;
+        thread_ = std::thread(&PhysicsPipeline::Run, this);
+    }
+
+    // Hands physics back to the render thread
+    void Stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_ready_.notify_one();
+        thread_.join();
+        reactor_->RemovePoser(*physics_poser_);
+        reactor_->AddPoser(*poser_);
+        physics_poser_.reset();
+    }
+
+    bool IsRunning() const {
+        return thread_.joinable();
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_done_.wait(lock, [this] { return !busy_; });
+    }
+
+    // Starts simulating the render poser's current (pre-physics) pose,
+    // settling the bodies first after a jump (see BulletPhysicsReactor::Settle)
+    void Submit(float dt, int settle_steps = 0) {
+        Wait();
+        physics_poser_->CopyPosing(*poser_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            dt_ = dt;
+            settle_steps_ = settle_steps;
+            busy_ = true;
+            // The worker may finish and swap before Present: latch the finished side now
+            read_index_ = 1 - write_index_;
+        }
+        work_ready_.notify_one();
+    }
+
+    // Poses the render poser as the last finished frame; false if there is none
+    bool Present() {
+        const Result& result = results_[read_index_];
+        if (!result.valid) {
+            return false;
+        }
+        for (size_t i = 0; i < result.morph_rates.size(); ++i) {
+            poser_->SetMorphPose(i, mmd::Motion::MorphPose(result.morph_rates[i]));
+        }
+        for (size_t i = 0; i < result.skinning_matrices.size(); ++i) {
+            poser_->SetSkinningMatrix(i, result.skinning_matrices[i]);
+        }
+        poser_->SkinnedPosing();
+        return true;
+    }
+
+    // React time of the last finished frame, in microseconds; call after Wait
+    double GetReactTime() const {
+        return react_us_;
+    }
+
+    // Forget finished frames, e.g. after a seek
+    void Discard() {
+        Wait();
+        for (Result& result : results_) {
+            result.valid = false;
+        }
+    }
+
+private:
+    struct Result {
+        std::vector<mmd::Matrix4f> skinning_matrices;
+        std::vector<float> morph_rates;
+        bool valid = false;
+    };
+
+    void Run() {
+        for (;;) {
+            float dt;
+            int settle_steps;
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_ready_.wait(lock, [this] { return busy_ || stop_; });
+                if (stop_) {
+                    return;
+                }
+                dt = dt_;
+                settle_steps = settle_steps_;
+                index = write_index_;
+            }
+
+            reactor_->Settle(settle_steps);
+            uint64_t react_start = stm_now();
+            reactor_->React(dt);
+            double react_us = stm_us(stm_since(react_start));
+            physics_poser_->PostPhysicsPosing();
+
+            Result& result = results_[index];
+            size_t bone_num = physics_poser_->GetModel().GetBoneNum();
+            size_t morph_num = physics_poser_->GetModel().GetMorphNum();
+            result.skinning_matrices.resize(bone_num);
+            for (size_t i = 0; i < bone_num; ++i) {
+                result.skinning_matrices[i] = physics_poser_->GetSkinningMatrix(i);
+            }
+            result.morph_rates.resize(morph_num);
+            for (size_t i = 0; i < morph_num; ++i) {
+                result.morph_rates[i] = physics_poser_->GetMorphPose(i).GetWeight();
+            }
+            result.valid = true;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                write_index_ = 1 - write_index_;
+                react_us_ = react_us;
+                busy_ = false;
+            }
+            work_done_.notify_all();
+        }
+    }
+
+    mmd::BulletPhysicsReactor* reactor_ = nullptr;
+    mmd::Poser* poser_ = nullptr;
+    std::unique_ptr<mmd::Poser> physics_poser_;
+    Result results_[2];
+    int write_index_ = 0;  // the result the worker fills next
+    int read_index_ = 1;  // the result Present shows, render thread only
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+    bool busy_ = false;
+    bool stop_ = false;
+    float dt_ = 0.0f;
+    int settle_steps_ = 0;
+    double react_us_ = 0.0;
+};
+
+// A further model, loaded from its own .pmx, standing beside the main model in
+// the scene. It has its own geometry and textures and shares only the physics
+// world
+struct SceneCharacter {
+    std::string filename;
+    std::shared_ptr<mmd::Model> model;
+    std::unique_ptr<mmd::Poser> poser;
+    std::unique_ptr<mmd::InstancedMotionPlayer> motion_player;
+    sg_buffer vertex_buffer = {0};
+    sg_buffer index_buffer = {0};
+    std::vector<sg_image> material_textures;
+    std::vector<sg_view> material_texture_views;
+    mmd::Vector3f offset;  // from the main model, model units
+    bool physics_enabled = true;
+    bool visible = true;
 };
 
+// A model drawn this frame: its geometry, material textures and model matrix
+struct ModelDraw {
+    const mmd::Model* model;
+    sg_buffer vertex_buffer;
+    sg_buffer index_buffer;
+    const std::vector<sg_view>* texture_views;
+    HMM_Mat4 matrix;
+};
 
 // Application state
 struct {
@@ -130,11 +859,73 @@ struct {
     sg_pass_action ui_pass_action;
     
     std::shared_ptr<mmd::Model> model;
-    std::shared_ptr<mmd::Motion> motion;
+    std::uint64_t model_hash = 0;  // of the PMX file
+    std::shared_ptr<mmd::CompiledMotion> motion;
     std::unique_ptr<mmd::Poser> poser;
-    std::unique_ptr<mmd::MotionPlayer> motion_player;
+    std::vector<MotionLayer> motion_layers;
+    std::unique_ptr<mmd::LayeredMotionPlayer> motion_player;
+
+    // Pre-baked poses of the current model/motion pair, produced by a worker thread
+    bool bake_enabled = false;
+    size_t bake_memory_budget = 64 * 1024 * 1024;
+    std::unique_ptr<mmd::BakedMotion> baked_motion;
+    std::thread bake_thread;
+    std::atomic<bool> bake_cancel{false};
+    std::atomic<bool> bake_ready{false};
+
+    // Evaluated poses by frame, restored while scrubbing the timeline
+    bool pose_cache_enabled = true;
+    int pose_cache_budget = 32;  // MB
+    std::unique_ptr<mmd::PoseCache> pose_cache;
+    std::vector<float> pose_cache_physics;
+
+    // Lossy keyframe reduction of motions as they are compiled (--compress)
+    bool compress_motion = false;
+    mmd::MotionCompressor motion_compressor;
+
+    // VMD camera motion, driving the viewport camera while enabled
+    mmd::CameraMotion camera_motion;
+    std::unique_ptr<mmd::CameraMotionPlayer> camera_player;
+    bool camera_motion_enabled = true;
+    std::string camera_filename;  // --camera argument
+
+    // Song played along with the motion; its clock drives g_state.time while playing
+    AudioPlayer audio;
+    std::string audio_filename;  // --audio argument
+    bool audio_sync_enabled = true;
+    float audio_latency_ms = -1.0f;  // device buffer latency until set
+    float audio_drift = 0.0f;  // last correction, seconds
     std::unique_ptr<mmd::BulletPhysicsReactor> physics_reactor;
     bool physics_enabled = true;  // Enable physics simulation by default
+    int physics_rate = 60;  // fixed physics steps per second
+    int physics_max_steps = 4;  // per rendered frame
+    int physics_threads = 1;  // --physics-threads; needs MMD_BULLET_MULTITHREADING
+    bool physics_pipelined = false;  // --pipelined-physics; shows poses one frame late
+    bool physics_deterministic = false;  // --deterministic-physics; steps follow motion frames
+    PhysicsPipeline physics_pipeline;
+    int physics_settle_steps = 30;  // fixed steps run after a jump, 0 snaps
+    int physics_settle_threshold = 15;  // frames; longer seeks settle
+    bool physics_settle_pending = false;  // a new motion settles on its first frame
+    long long physics_last_frame = -1;
+    mmd::BulletPhysicsReactor::LodPolicy physics_lod;  // applied each frame, with the camera
+    std::vector<mmd::BulletPhysicsReactor::GroupStats> physics_group_stats;  // as the last React left them
+    double physics_react_us = 0.0;
+
+    // Further models, all posers in one physics world (further .pmx arguments, --characters)
+    std::vector<SceneCharacter> characters;
+    mmd::MotionEvaluationCache character_motion_cache;
+    float character_spacing = 1.2f;  // meters between neighbours
+    float character_stagger = 0.0f;  // motion frames between neighbours
+    bool characters_collide = true;  // with each other; a poser always collides with itself
+    int initial_character_num = 0;  // --characters: copies of the main model
+
+    // Recorded physics of the current model/motion pair, replacing React once ready
+    bool physics_bake_enabled = false;  // --bake-physics
+    std::unique_ptr<mmd::PhysicsCache> physics_bake;
+    std::thread physics_bake_thread;
+    std::atomic<bool> physics_bake_cancel{false};
+    std::atomic<bool> physics_bake_ready{false};
+    std::atomic<size_t> physics_bake_progress{0};
     bool physics_window_open = false;  // Physics control window visibility
 
     sg_buffer vertex_buffer = {0};
@@ -164,7 +955,9 @@ struct {
     bool keys_down[256] = {false};
     
     std::string model_filename;
+    std::vector<std::string> model_corpus_filenames;  // further .pmx arguments: characters, and the --benchmark corpus
     std::string motion_filename;
+    std::vector<std::string> motion_layer_filenames;  // further .vmd arguments
     
     // ImGuizmo model transform
     bool guizmo_enabled = false;
@@ -191,6 +984,9 @@ struct {
     bool animation_playing = true;  // Animation playback state
     bool sequencer_manual_control = false;  // Whether user is manually controlling sequencer
     int sequencer_last_frame = -1;  // Track last frame to detect manual changes
+    bool track_view_enabled = true;
+    float track_view_frame_width = 4.0f;  // pixels per frame
+    float track_view_height = 240.0f;
     
     // Skybox resources
     sg_image environment_cubemap = {0};
@@ -229,6 +1025,24 @@ struct {
     float light_intensity = 1.0f;
     bool shadows_enabled = true;
     bool light_window_open = false;
+
+    // VMD light motion, driving light_direction and light_color while enabled
+    mmd::LightMotion light_motion;
+    bool light_motion_enabled = true;
+
+    // Light view/projection, rebuilt only when light_direction changes
+    HMM_Mat4 light_view = HMM_M4D(1.0f);
+    HMM_Mat4 light_proj = HMM_M4D(1.0f);
+    HMM_Vec3 light_matrix_direction = {0.0f, 0.0f, 0.0f};
+    // Shadow map contents: the light matrix it was rendered with and whether
+    // the model geometry changed since
+    HMM_Mat4 shadow_light_mvp;
+    bool shadow_map_valid = false;
+    bool shadow_geometry_dirty = true;
+    // Whatever the pose is computed from changed, so this frame poses anew
+    // even when the motion frame did not move
+    bool pose_dirty = true;
+    long long posed_frame = -1;
     bool material_window_open = false;
 
     // Figure/Resin material parameters
@@ -577,23 +1391,25 @@ std::wstring GetAbsolutePath(const std::wstring& path) {
 #endif
 }
 
-// Load all material textures from the model
-void LoadMaterialTextures(const std::string& model_filename) {
-    if (!g_state.model || !g_state.model_loaded) {
-        return;
-    }
-    
-    // Clean up old textures and views
-    for (size_t i = 0; i < g_state.material_textures.size(); ++i) {
-        if (g_state.material_textures[i].id != 0 && g_state.material_textures[i].id != g_state.default_texture.id) {
-            sg_destroy_image(g_state.material_textures[i]);
+// Release material textures and views; the default texture is shared and kept
+void ReleaseMaterialTextures(std::vector<sg_image>& textures, std::vector<sg_view>& views) {
+    for (size_t i = 0; i < textures.size(); ++i) {
+        if (textures[i].id != 0 && textures[i].id != g_state.default_texture.id) {
+            sg_destroy_image(textures[i]);
         }
-        if (i < g_state.material_texture_views.size() && g_state.material_texture_views[i].id != 0) {
-            sg_destroy_view(g_state.material_texture_views[i]);
+        if (i < views.size() && views[i].id != 0 && views[i].id != g_state.default_texture_view.id) {
+            sg_destroy_view(views[i]);
         }
     }
-    g_state.material_textures.clear();
-    g_state.material_texture_views.clear();
+    textures.clear();
+    views.clear();
+}
+
+// Load all material textures of a model, resolved next to its file
+void LoadMaterialTextures(const mmd::Model& model, const std::string& model_filename,
+                          std::vector<sg_image>& textures, std::vector<sg_view>& views) {
+    // Clean up old textures and views
+    ReleaseMaterialTextures(textures, views);
     
     // Get model directory from filename (convert to absolute path first)
     std::wstring model_dir;
@@ -615,12 +1431,12 @@ void LoadMaterialTextures(const std::string& model_filename) {
     
     std::cout << "Model directory: " << wstring_to_utf8(model_dir) << std::endl;
     
-    size_t part_num = g_state.model->GetPartNum();
-    g_state.material_textures.resize(part_num, g_state.default_texture);
-    g_state.material_texture_views.resize(part_num, g_state.default_texture_view);
+    size_t part_num = model.GetPartNum();
+    textures.resize(part_num, g_state.default_texture);
+    views.resize(part_num, g_state.default_texture_view);
     
     for (size_t i = 0; i < part_num; ++i) {
-        const mmd::Model::Part& part = g_state.model->GetPart(i);
+        const mmd::Model::Part& part = model.GetPart(i);
         const mmd::Material& material = part.GetMaterial();
         
         const mmd::Texture* texture = material.GetTexture();
@@ -631,96 +1447,722 @@ void LoadMaterialTextures(const std::string& model_filename) {
                 std::cout << "Loading texture " << i << ": " << wstring_to_utf8(texture_path) << std::endl;
             }
             sg_image loaded_tex = LoadTexture(texture_path, model_dir);
-            g_state.material_textures[i] = loaded_tex;
+            textures[i] = loaded_tex;
             
             // Create persistent view for this texture
             sg_view_desc view_desc = {};
             view_desc.texture.image = loaded_tex;
-            g_state.material_texture_views[i] = sg_make_view(&view_desc);
+            views[i] = sg_make_view(&view_desc);
         } else {
-            g_state.material_textures[i] = g_state.default_texture;
-            g_state.material_texture_views[i] = g_state.default_texture_view;
+            textures[i] = g_state.default_texture;
+            views[i] = g_state.default_texture_view;
         }
     }
     
-    std::cout << "Loaded " << g_state.material_textures.size() << " material textures" << std::endl;
+    std::cout << "Loaded " << textures.size() << " material textures" << std::endl;
 }
 
-// Load PMX model
-bool LoadPMXModel(const std::string& filename) {
-    try {
-        std::wstring wfilename = utf8_to_wstring(filename);
-        mmd::FileReader file(wfilename);
-        
-        // Read PMX file
-        mmd::PmxReader reader(file);
-        g_state.model = std::make_shared<mmd::Model>();
-        reader.ReadModel(*g_state.model);
-        g_state.model_loaded = true;
-        
-        // Create poser for the model
-        if (g_state.model) {
-            g_state.poser = std::make_unique<mmd::Poser>(*g_state.model);
-            
-            // Initialize physics engine
-            g_state.physics_reactor = std::make_unique<mmd::BulletPhysicsReactor>();
-            if (g_state.physics_reactor && g_state.poser) {
-                g_state.physics_reactor->AddPoser(*g_state.poser);
-                std::cout << "  Physics engine initialized" << std::endl;
-                std::cout << "  Rigid bodies: " << g_state.model->GetRigidBodyNum() << std::endl;
-                std::cout << "  Constraints: " << g_state.model->GetConstraintNum() << std::endl;
-            }
-            
-            // Create motion player if motion is already loaded
-            if (g_state.motion && g_state.poser) {
-                g_state.motion_player = std::make_unique<mmd::MotionPlayer>(*g_state.motion, *g_state.poser);
-            }
-        }
-        
-        std::wstring model_name = g_state.model->GetName();
-        std::string model_name_utf8 = wstring_to_utf8(model_name);
-        std::cout << "Loaded PMX model: " << model_name_utf8 << std::endl;
-        std::cout << "  Vertices: " << g_state.model->GetVertexNum() << std::endl;
-        std::cout << "  Triangles: " << g_state.model->GetTriangleNum() << std::endl;
-        std::cout << "  Bones: " << g_state.model->GetBoneNum() << std::endl;
-        std::cout << "  Parts: " << g_state.model->GetPartNum() << std::endl;
-        
-        // Load material textures (pass filename for path resolution)
-        LoadMaterialTextures(filename);
-        
-        return true;
-    } catch (const mmd::exception& e) {
-        std::cerr << "Error loading PMX model: " << e.what() << std::endl;
-        return false;
-    } catch (...) {
-        std::cerr << "Unknown error loading PMX model" << std::endl;
-        return false;
+// Load all material textures from the main model
+void LoadMaterialTextures(const std::string& model_filename) {
+    if (!g_state.model || !g_state.model_loaded) {
+        return;
     }
+    LoadMaterialTextures(*g_state.model, model_filename, g_state.material_textures, g_state.material_texture_views);
 }
 
-// Load VMD motion file
-bool LoadVMDMotion(const std::string& filename) {
-    try {
-        std::wstring wfilename = utf8_to_wstring(filename);
-        mmd::FileReader file(wfilename);
-        
-        mmd::VmdReader reader(file);
-        g_state.motion = std::make_shared<mmd::Motion>();
-        reader.ReadMotion(*g_state.motion);
+// Create the static index buffer of a model, its triangles wound for the
+// pipeline's backface culling
+sg_buffer MakeIndexBuffer(const mmd::Model& model, const char* label) {
+    size_t triangle_num = model.GetTriangleNum();
+    std::vector<uint32_t> indices;
+    indices.reserve(triangle_num * 3);
+    
+    for (size_t i = 0; i < triangle_num; ++i) {
+        const mmd::Vector3D<std::uint32_t>& triangle = model.GetTriangle(i);
+        // workaround for backface culling
+        indices.push_back(triangle.v[2]);
+        indices.push_back(triangle.v[1]);
+        indices.push_back(triangle.v[0]);
+    }
+    
+    if (indices.empty()) {
+        std::cerr << "Error: Index data is empty!" << std::endl;
+        return sg_buffer{SG_INVALID_ID};
+    }
+    sg_buffer_desc ibuf_desc = {};
+    ibuf_desc.usage.index_buffer = true;
+    ibuf_desc.data.ptr = indices.data();
+    ibuf_desc.data.size = indices.size() * sizeof(uint32_t);
+    ibuf_desc.label = label;
+    sg_buffer index_buffer = sg_make_buffer(&ibuf_desc);
+    
+    if (index_buffer.id == SG_INVALID_ID) {
+        std::cerr << "Error: Failed to create index buffer!" << std::endl;
+    }
+    return index_buffer;
+}
+
+// Stop the pose bake worker and drop its result
+void StopPoseBake() {
+    if (g_state.bake_thread.joinable()) {
+        g_state.bake_cancel = true;
+        g_state.bake_thread.join();
+    }
+    g_state.bake_cancel = false;
+    g_state.bake_ready = false;
+    g_state.baked_motion.reset();
+}
+
+// Bake the current model/motion pair in the background. The worker poses its
+// own Poser, so the render thread keeps evaluating live until bake_ready.
+// Layered motions are not baked, as their weights change live.
+void StartPoseBake() {
+    StopPoseBake();
+    if (!g_state.model || !g_state.motion || !g_state.poser || !g_state.motion_layers.empty()) {
+        return;
+    }
+
+    g_state.baked_motion = std::make_unique<mmd::BakedMotion>(
+        *g_state.poser, g_state.motion->GetLength() + 1, g_state.bake_memory_budget);
+    if (g_state.baked_motion->GetFrameNum() <= g_state.motion->GetLength()) {
+        std::cout << "Pose bake limited to " << g_state.baked_motion->GetFrameNum()
+                  << " frames by the memory budget" << std::endl;
+    }
+
+    std::shared_ptr<mmd::Model> model = g_state.model;
+    std::shared_ptr<mmd::CompiledMotion> motion = g_state.motion;
+    mmd::BakedMotion* baked = g_state.baked_motion.get();
+    g_state.bake_thread = std::thread([model, motion, baked]() {
+        mmd::Poser poser(*model);
+        mmd::MotionPlayer player(*motion, poser);
+        for (size_t frame = 0; frame < baked->GetFrameNum(); ++frame) {
+            if (g_state.bake_cancel) {
+                return;
+            }
+            player.SeekFrame(frame);
+            poser.PrePhysicsPosing();
+            baked->Capture(frame, poser);
+        }
+        g_state.bake_ready = true;
+    });
+}
+
+// Stop the physics recorder and drop its result
+void StopPhysicsBake() {
+    if (g_state.physics_bake_thread.joinable()) {
+        g_state.physics_bake_cancel = true;
+        g_state.physics_bake_thread.join();
+    }
+    g_state.physics_bake_cancel = false;
+    g_state.physics_bake_ready = false;
+    g_state.physics_bake_progress = 0;
+    g_state.physics_bake.reset();
+}
+
+// The camera in the model's own space and units, where physics level of detail
+// measures distances
+mmd::Vector3f CameraModelPosition() {
+    HMM_Mat4 model_mat;
+    std::memcpy(&model_mat, g_state.model_matrix, sizeof(model_mat));
+    HMM_Vec4 camera = HMM_MulM4V4(HMM_InvGeneralM4(model_mat), HMM_V4V(g_state.camera_pos, 1.0f));
+    const float meter_to_mmd = 10.0f;
+    mmd::Vector3f position;
+    position.p.x = camera.X * meter_to_mmd;
+    position.p.y = camera.Y * meter_to_mmd;
+    position.p.z = camera.Z * meter_to_mmd;
+    return position;
+}
+
+// Move a cache file written aside over the one it refreshes. std::rename does
+// not replace an existing file on Windows
+bool ReplaceCacheFile(const std::string& temp_filename, const std::string& cache_filename) {
+#ifdef _WIN32
+    return MoveFileExW(utf8_to_wstring(temp_filename).c_str(), utf8_to_wstring(cache_filename).c_str(),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(temp_filename.c_str(), cache_filename.c_str()) == 0;
+#endif
+}
+
+// Everything recorded physics depends on: model, motion and physics settings
+std::uint64_t PhysicsBakeHash() {
+    mmd::Vector3f direction = g_state.physics_reactor->GetGravityDirection();
+    const float settings[8] = {
+        static_cast<float>(g_state.physics_rate), static_cast<float>(g_state.physics_max_steps),
+        static_cast<float>(g_state.physics_settle_steps), g_state.physics_reactor->GetGravityStrength(),
+        direction.p.x, direction.p.y, direction.p.z, g_state.physics_reactor->IsHasFloor() ? 1.0f : 0.0f
+    };
+    return (g_state.model_hash * 31 + g_state.motion->GetSourceHash()) * 31
+         + mmd::HashFNV1a(settings, sizeof(settings));
+}
+
+// Record the physics of the current model/motion pair in the background, one
+// React per frame at 30 fps, or read it from <vmd>.phys when that was recorded
+// with the same model, motion and settings. Playback applies the exact bits of
+// the recorded run, so renders repeat and any frame can be sought. Layered
+// motions are not recorded, as their weights change live.
+void StartPhysicsBake() {
+    StopPhysicsBake();
+    if (!g_state.model || !g_state.motion || !g_state.physics_reactor || !g_state.motion_layers.empty()) {
+        return;
+    }
+
+    std::uint64_t hash = PhysicsBakeHash();
+    size_t frame_num = g_state.motion->GetLength() + 1;
+    std::string cache_filename = g_state.motion_filename + ".phys";
+    if (mmd::FileReader::FileExists(utf8_to_wstring(cache_filename))) {
+        try {
+            auto cached = std::make_unique<mmd::PhysicsCache>(utf8_to_wstring(cache_filename));
+            if (cached->GetSourceHash() == hash && cached->GetFrameNum() == frame_num) {
+                std::cout << "Read recorded physics " << cache_filename << std::endl;
+                g_state.physics_bake = std::move(cached);
+                g_state.physics_bake_progress = frame_num;
+                g_state.physics_bake_ready = true;
+                return;
+            }
+        } catch (const mmd::exception& e) {
+            std::cerr << "Ignoring recorded physics: " << e.what() << std::endl;
+        }
+    }
+
+    std::shared_ptr<mmd::Model> model = g_state.model;
+    std::shared_ptr<mmd::CompiledMotion> motion = g_state.motion;
+    int rate = g_state.physics_rate;
+    int max_steps = g_state.physics_max_steps;
+    int settle_steps = g_state.physics_settle_steps;
+    float gravity_strength = g_state.physics_reactor->GetGravityStrength();
+    mmd::Vector3f gravity_direction = g_state.physics_reactor->GetGravityDirection();
+    bool has_floor = g_state.physics_reactor->IsHasFloor();
+    g_state.physics_bake_thread = std::thread([=]() {
+        mmd::Poser poser(*model);
+        mmd::MotionPlayer player(*motion, poser);
+        mmd::BulletPhysicsReactor reactor;
+        reactor.SetFixedStepRate(static_cast<float>(rate));
+        reactor.SetMaxStepNum(max_steps);
+        reactor.SetGravityStrength(gravity_strength);
+        reactor.SetGravityDirection(gravity_direction);
+        reactor.SetFloor(has_floor);
+        reactor.AddPoser(poser);
+
+        std::vector<size_t> bones;
+        std::vector<size_t> fixed_bones;
+        reactor.GetPhysicsBones(poser, bones, fixed_bones);
+        auto cache = std::make_unique<mmd::PhysicsCache>(*model, bones, fixed_bones, hash);
+        for (size_t frame = 0; frame < frame_num; ++frame) {
+            if (g_state.physics_bake_cancel) {
+                return;
+            }
+            player.SeekFrame(frame);
+            poser.PrePhysicsPosing();
+            if (frame == 0) {
+                // As the viewer does when a motion starts
+                reactor.Settle(settle_steps);
+            }
+            reactor.React(1.0f / 30.0f);
+            cache->Capture(frame, poser);
+            g_state.physics_bake_progress = frame + 1;
+        }
+
+        // Write aside and replace, like the compiled motion cache; a loaded
+        // cache is read into memory, so nothing maps the stale file
+        mmd::buffer_type image;
+        cache->Save(image);
+        std::string temp_filename = cache_filename + ".tmp";
+        {
+            std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&image[0]), image.size());
+        }
+        if (!ReplaceCacheFile(temp_filename, cache_filename)) {
+            std::remove(temp_filename.c_str());
+            std::cerr << "Cannot write recorded physics " << cache_filename << std::endl;
+        }
+
+        g_state.physics_bake = std::move(cache);
+        g_state.physics_bake_ready = true;
+    });
+}
+
+// Drop cached poses; call whenever something other than the frame changes the pose
+void ClearPoseCache() {
+    if (g_state.pose_cache) {
+        g_state.pose_cache->Clear();
+    }
+    g_state.pose_dirty = true;
+}
+
+// Scene characters stand in a row with the main model, alternately to its
+// right and left
+mmd::Vector3f CharacterOffset(size_t index) {
+    const float meter_to_mmd = 10.0f;
+    size_t place = index + 1;  // the main model stands at 0
+    float side = place % 2 == 1 ? 1.0f : -1.0f;
+    mmd::Vector3f offset;
+    offset.p.x = side * static_cast<float>((place + 1) / 2) * g_state.character_spacing * meter_to_mmd;
+    offset.p.y = 0.0f;
+    offset.p.z = 0.0f;
+    return offset;
+}
+
+void PlaceCharacters() {
+    for (size_t i = 0; i < g_state.characters.size(); ++i) {
+        SceneCharacter& character = g_state.characters[i];
+        character.offset = CharacterOffset(i);
+        if (g_state.physics_reactor) {
+            g_state.physics_reactor->SetPoserOffset(*character.poser, character.offset);
+        }
+    }
+    g_state.shadow_geometry_dirty = true;
+}
+
+// Characters collide with each other, or each poser keeps to a scene group of
+// its own, the main poser in the first
+void ApplyCharacterCollision() {
+    if (!g_state.physics_reactor || !g_state.poser || g_state.characters.empty()) {
+        return;
+    }
+    for (size_t place = 0; place <= g_state.characters.size(); ++place) {
+        const mmd::Poser& poser = place == 0 ? *g_state.poser : *g_state.characters[place - 1].poser;
+        unsigned group = g_state.characters_collide ? 1u : 1u << (place % 32);
+        unsigned mask = g_state.characters_collide ? ~0u : group;
+        g_state.physics_reactor->SetPoserCollision(poser, group, mask);
+    }
+}
+
+// A character left out of physics keeps its motion but no longer swings
+void SetCharacterPhysics(SceneCharacter& character, bool enabled) {
+    character.physics_enabled = enabled;
+    g_state.pose_dirty = true;
+    if (!g_state.physics_reactor) {
+        return;
+    }
+    if (enabled) {
+        g_state.physics_reactor->AddPoser(*character.poser);
+        g_state.physics_reactor->SetPoserOffset(*character.poser, character.offset);
+        ApplyCharacterCollision();
+        g_state.physics_settle_pending = true;
+    } else {
+        g_state.physics_reactor->RemovePoser(*character.poser);
+    }
+}
+
+// Characters play the main motion, without its layers, through one evaluation
+// cache: characters on the same frame share a single evaluation
+void RebuildCharacterPlayers() {
+    for (SceneCharacter& character : g_state.characters) {
+        character.motion_player.reset();
+    }
+    g_state.pose_dirty = true;
+    g_state.character_motion_cache.Clear();
+    if (!g_state.motion) {
+        return;
+    }
+    g_state.character_motion_cache.SetCapacity(std::max<size_t>(8, g_state.characters.size() + 1));
+    for (size_t i = 0; i < g_state.characters.size(); ++i) {
+        SceneCharacter& character = g_state.characters[i];
+        character.motion_player = std::make_unique<mmd::InstancedMotionPlayer>(
+            g_state.character_motion_cache, *g_state.motion, *character.poser);
+        character.motion_player->SetOffset(static_cast<double>(i + 1) * g_state.character_stagger);
+    }
+}
+
+// Release the GPU resources of a character
+void ReleaseCharacterResources(SceneCharacter& character) {
+    if (character.vertex_buffer.id != 0) {
+        sg_destroy_buffer(character.vertex_buffer);
+        character.vertex_buffer.id = 0;
+    }
+    if (character.index_buffer.id != 0) {
+        sg_destroy_buffer(character.index_buffer);
+        character.index_buffer.id = 0;
+    }
+    ReleaseMaterialTextures(character.material_textures, character.material_texture_views);
+}
+
+// Load a character from its .pmx into the main model's physics world
+bool AddCharacter(const std::string& filename) {
+    if (!g_state.model || !g_state.poser) {
+        return false;
+    }
+
+    SceneCharacter character;
+    character.filename = filename;
+    try {
+        mmd::FileReader file(utf8_to_wstring(filename), true);
+        mmd::PmxReader reader(file);
+        character.model = std::make_shared<mmd::Model>();
+        reader.ReadModel(*character.model);
+    } catch (const mmd::exception& e) {
+        std::cerr << "Error loading character " << filename << ": " << e.what() << std::endl;
+        return false;
+    }
+    if (character.model->GetVertexNum() == 0) {
+        std::cerr << "Character " << filename << " has no vertices" << std::endl;
+        return false;
+    }
+
+    // The shared world steps once per frame for all posers, on this thread
+    g_state.physics_pipeline.Stop();
+    g_state.physics_pipelined = false;
+
+    character.poser = std::make_unique<mmd::Poser>(*character.model);
+    character.offset = CharacterOffset(g_state.characters.size());
+    sg_buffer_desc vbuf_desc = {};
+    vbuf_desc.size = character.model->GetVertexNum() * sizeof(Vertex);
+    vbuf_desc.usage.stream_update = true;
+    vbuf_desc.label = "character-vertices";
+    character.vertex_buffer = sg_make_buffer(&vbuf_desc);
+    character.index_buffer = MakeIndexBuffer(*character.model, "character-indices");
+    if (character.index_buffer.id == SG_INVALID_ID) {
+        ReleaseCharacterResources(character);
+        return false;
+    }
+    LoadMaterialTextures(*character.model, filename, character.material_textures, character.material_texture_views);
+    std::cout << "Added character: " << wstring_to_utf8(character.model->GetName()) << " ("
+              << character.model->GetRigidBodyNum() << " rigid bodies)" << std::endl;
+    g_state.characters.push_back(std::move(character));
+
+    SetCharacterPhysics(g_state.characters.back(), true);
+    RebuildCharacterPlayers();
+    return true;
+}
+
+void RemoveCharacter(size_t index) {
+    SceneCharacter& character = g_state.characters[index];
+    if (g_state.physics_reactor && character.physics_enabled) {
+        g_state.physics_reactor->RemovePoser(*character.poser);
+    }
+    ReleaseCharacterResources(character);
+    g_state.characters.erase(g_state.characters.begin() + index);
+
+    // The others close the gap, with the scene groups and stagger of their new places
+    PlaceCharacters();
+    ApplyCharacterCollision();
+    RebuildCharacterPlayers();
+}
+
+void ClearCharacters() {
+    while (!g_state.characters.empty()) {
+        RemoveCharacter(g_state.characters.size() - 1);
+    }
+}
+
+// Create the motion player for the current poser: the main motion at the
+// bottom, then the motion layers in the order they were added
+void RebuildMotionPlayer() {
+    ClearPoseCache();
+    g_state.physics_settle_pending = true;
+    g_state.motion_player.reset();
+    RebuildCharacterPlayers();
+    if (!g_state.poser || !g_state.motion) {
+        return;
+    }
+    g_state.motion_player = std::make_unique<mmd::LayeredMotionPlayer>(*g_state.poser);
+    g_state.motion_player->AddLayer(*g_state.motion);
+    for (const MotionLayer& layer : g_state.motion_layers) {
+        g_state.motion_player->AddLayer(*layer.motion, layer.weight);
+    }
+}
+
+// Load PMX model
+bool LoadPMXModel(const std::string& filename) {
+    StopPoseBake();
+    StopPhysicsBake();
+    g_state.physics_pipeline.Stop();
+    try {
+        std::wstring wfilename = utf8_to_wstring(filename);
+        mmd::FileReader file(wfilename, true);
+        g_state.model_hash = mmd::HashFNV1a(file.GetData(), file.GetLength());
+        
+        // Read PMX file
+        mmd::PmxReader reader(file);
+        g_state.model = std::make_shared<mmd::Model>();
+        reader.ReadModel(*g_state.model);
+        g_state.model_loaded = true;
+        g_state.model_filename = filename;  // copies of it join as characters
+        
+        // Create poser for the model
+        if (g_state.model) {
+            g_state.poser = std::make_unique<mmd::Poser>(*g_state.model);
+            g_state.pose_cache = std::make_unique<mmd::PoseCache>(
+                static_cast<size_t>(g_state.pose_cache_budget) * 1024 * 1024);
+            
+            // Initialize physics engine
+            g_state.physics_reactor = std::make_unique<mmd::BulletPhysicsReactor>(g_state.physics_threads);
+            g_state.physics_reactor->SetFixedStepRate(static_cast<float>(g_state.physics_rate));
+            g_state.physics_reactor->SetMaxStepNum(g_state.physics_max_steps);
+            if (g_state.physics_reactor && g_state.poser) {
+                g_state.physics_reactor->AddPoser(*g_state.poser);
+                std::cout << "  Physics engine initialized (" << g_state.physics_reactor->GetThreadNum()
+                          << " threads)" << std::endl;
+                std::cout << "  Rigid bodies: " << g_state.model->GetRigidBodyNum() << std::endl;
+                std::cout << "  Constraints: " << g_state.model->GetConstraintNum() << std::endl;
+                // Characters keep their models and join the new world
+                for (SceneCharacter& character : g_state.characters) {
+                    if (character.physics_enabled) {
+                        SetCharacterPhysics(character, true);
+                    }
+                }
+                if (g_state.physics_pipelined && g_state.characters.empty()) {
+                    g_state.physics_pipeline.Start(*g_state.physics_reactor, *g_state.poser);
+                }
+                if (g_state.physics_deterministic) {
+                    g_state.physics_reactor->SetDeterministic(true);
+                    g_state.physics_reactor->Reset();
+                }
+            }
+            
+            // Create motion player if motion is already loaded
+            RebuildMotionPlayer();
+        }
+        
+        std::wstring model_name = g_state.model->GetName();
+        std::string model_name_utf8 = wstring_to_utf8(model_name);
+        std::cout << "Loaded PMX model: " << model_name_utf8 << std::endl;
+        std::cout << "  Vertices: " << g_state.model->GetVertexNum() << std::endl;
+        std::cout << "  Triangles: " << g_state.model->GetTriangleNum() << std::endl;
+        std::cout << "  Bones: " << g_state.model->GetBoneNum() << std::endl;
+        std::cout << "  Parts: " << g_state.model->GetPartNum() << std::endl;
+        
+        // Load material textures (pass filename for path resolution)
+        LoadMaterialTextures(filename);
+
+        if (g_state.bake_enabled) {
+            StartPoseBake();
+        }
+        if (g_state.physics_bake_enabled) {
+            StartPhysicsBake();
+        }
+        
+        return true;
+    } catch (const mmd::exception& e) {
+        std::cerr << "Error loading PMX model: " << e.what() << std::endl;
+        return false;
+    } catch (...) {
+        std::cerr << "Unknown error loading PMX model" << std::endl;
+        return false;
+    }
+}
+
+// Parse a VMD motion and report the memory saved by sharing interpolation
+// curves between keyframes
+void ParseVMDMotion(const std::wstring& filename, mmd::Motion& motion) {
+    mmd::FileReader file(filename, true);
+    mmd::VmdReader reader(file);
+    reader.ReadMotion(motion);
+
+    size_t bone_keyframe_num = motion.GetBoneKeyframeNum();
+    size_t morph_keyframe_num = motion.GetMorphKeyframeNum();
+    size_t curve_refs = bone_keyframe_num * 4 + morph_keyframe_num;
+    size_t curve_num = motion.GetInterpolatorNum();
+    size_t resident_size = motion.GetResidentSize();
+    size_t embedded_size = resident_size
+        + curve_refs * (sizeof(mmd::interpolator) - sizeof(std::uint32_t))
+        - curve_num * sizeof(mmd::interpolator);
+    std::cout << "  Keyframes: " << bone_keyframe_num << " bone, " << morph_keyframe_num << " morph" << std::endl;
+    std::cout << "  Interpolation curves: " << curve_num << " unique of " << curve_refs << " references" << std::endl;
+    std::cout << "  Resident size: " << resident_size / 1024 << " KB (" << embedded_size / 1024
+              << " KB with per-keyframe curves)" << std::endl;
+}
+
+// Compress a parsed motion and report the reduction and the error it costs
+void CompressMotion(const mmd::MotionCompressor& compressor, mmd::Motion& motion) {
+    mmd::Motion compressed;
+    compressor.Compress(motion, compressed);
+    mmd::MotionCompressor::Deviation deviation
+        = mmd::MotionCompressor::Measure(motion, mmd::CompiledMotion(compressed));
+    std::cout << "  Compressed keyframes: " << motion.GetBoneKeyframeNum() << " -> "
+              << compressed.GetBoneKeyframeNum() << " bone, " << motion.GetMorphKeyframeNum()
+              << " -> " << compressed.GetMorphKeyframeNum() << " morph" << std::endl;
+    std::cout << "  Max error: " << deviation.rotation * 180.0f / 3.14159265f << " deg, "
+              << deviation.translation << " translation, " << deviation.morph << " morph" << std::endl;
+    std::swap(motion, compressed);
+}
+
+// Load a VMD motion through its compiled cache (<vmd>.cmot next to it). The
+// cache is mapped as is when its recorded source hash matches the VMD;
+// otherwise the VMD is parsed and the cache rewritten. A cache that cannot be
+// written only costs the next load a parse.
+std::shared_ptr<mmd::CompiledMotion> LoadCompiledMotion(const std::string& filename) {
+    std::uint64_t source_hash;
+    {
+        mmd::MappedFile source(utf8_to_wstring(filename));
+        source_hash = mmd::HashFNV1a(source.GetData(), source.GetLength());
+    }
+    // The cache also depends on the compression settings
+    if (g_state.compress_motion) {
+        const float tolerances[3] = {
+            g_state.motion_compressor.GetRotationTolerance(),
+            g_state.motion_compressor.GetTranslationTolerance(),
+            g_state.motion_compressor.GetMorphTolerance()
+        };
+        source_hash ^= mmd::HashFNV1a(tolerances, sizeof(tolerances)) * 31
+                     + (g_state.motion_compressor.IsCurveRefitEnabled() ? 1 : 0);
+    }
+
+    std::string cache_filename = filename + ".cmot";
+    if (mmd::FileReader::FileExists(utf8_to_wstring(cache_filename))) {
+        try {
+            auto cached = std::make_shared<mmd::CompiledMotion>(utf8_to_wstring(cache_filename));
+            if (cached->GetSourceHash() == source_hash) {
+                std::cout << "  Mapped compiled motion cache " << cache_filename << std::endl;
+                return cached;
+            }
+            // Unmapped before it is replaced; Windows cannot replace a mapped file
+            cached.reset();
+        } catch (const mmd::exception& e) {
+            std::cerr << "  Ignoring compiled motion cache: " << e.what() << std::endl;
+        }
+    }
+
+    mmd::Motion motion;
+    ParseVMDMotion(utf8_to_wstring(filename), motion);
+    if (g_state.compress_motion) {
+        CompressMotion(g_state.motion_compressor, motion);
+    }
+
+    // Write aside and replace, so a failed write leaves the old cache whole.
+    // A motion still in use mapping the stale cache keeps it valid on POSIX;
+    // on Windows it blocks the replace, and this load plays from memory
+    mmd::buffer_type image;
+    mmd::CompiledMotion::Compile(motion, source_hash, image);
+    std::string temp_filename = cache_filename + ".tmp";
+    {
+        std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&image[0]), image.size());
+    }
+    if (ReplaceCacheFile(temp_filename, cache_filename)) {
+        try {
+            return std::make_shared<mmd::CompiledMotion>(utf8_to_wstring(cache_filename));
+        } catch (const mmd::exception& e) {
+            std::cerr << "  Cannot map compiled motion cache: " << e.what() << std::endl;
+        }
+    } else {
+        std::remove(temp_filename.c_str());
+        std::cerr << "  Cannot write compiled motion cache " << cache_filename << std::endl;
+    }
+    return std::make_shared<mmd::CompiledMotion>(motion);
+}
+
+// Load the camera section of a VMD file; files without camera keys are ignored
+bool LoadVMDCamera(const std::string& filename) {
+    try {
+        mmd::FileReader file(utf8_to_wstring(filename), true);
+        mmd::VmdReader reader(file);
+        mmd::CameraMotion camera_motion;
+        reader.ReadCameraMotion(camera_motion);
+        if (camera_motion.GetKeyframeNum() == 0) {
+            return false;
+        }
+        g_state.camera_motion = camera_motion;
+        g_state.camera_player = std::make_unique<mmd::CameraMotionPlayer>(g_state.camera_motion);
+        std::cout << "Loaded VMD camera: " << camera_motion.GetKeyframeNum() << " keyframes, "
+                  << camera_motion.GetLength() << " frames" << std::endl;
+        return true;
+    } catch (const mmd::exception& e) {
+        std::cerr << "Error loading VMD camera: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Load the light section of a VMD file; files without light keys are ignored
+bool LoadVMDLight(const std::string& filename) {
+    try {
+        mmd::FileReader file(utf8_to_wstring(filename), true);
+        mmd::VmdReader reader(file);
+        mmd::LightMotion light_motion;
+        reader.ReadLightMotion(light_motion);
+        if (light_motion.GetKeyframeNum() == 0) {
+            return false;
+        }
+        g_state.light_motion = light_motion;
+        std::cout << "Loaded VMD light: " << light_motion.GetKeyframeNum() << " keyframes" << std::endl;
+        return true;
+    } catch (const mmd::exception& e) {
+        std::cerr << "Error loading VMD light: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Set the directional light from the VMD light motion at the given time
+void ApplyLightMotion(double time) {
+    mmd::LightMotion::LightPose pose = g_state.light_motion.GetLightPose(time);
+    const mmd::Vector3f& color = pose.GetColor();
+    const mmd::Vector3f& direction = pose.GetDirection();
+
+    // MMD's default light color 154/255 corresponds to our white light
+    const float color_scale = 255.0f / 154.0f;
+    g_state.light_color = HMM_Vec3{color.p.x * color_scale, color.p.y * color_scale, color.p.z * color_scale};
+    HMM_Vec3 light_direction = HMM_Vec3{direction.p.x, direction.p.y, direction.p.z};
+    float len = HMM_LenV3(light_direction);
+    if (len > 0.001f) {
+        g_state.light_direction = HMM_DivV3F(light_direction, len);
+    }
+}
+
+// Place the viewport camera at the VMD camera pose for the given frame
+void ApplyCameraMotion(double frame, HMM_Vec3& up) {
+    const mmd::CameraMotion::CameraPose& pose = g_state.camera_player->SeekFrame(frame);
+    const float mmd_to_meter = 0.1f;
+    const mmd::Vector3f& target = pose.GetPosition();
+    const mmd::Vector3f& rotation = pose.GetRotation();
+
+    // MMD orients the camera by Rx(rx) * Ry(ry) * Rz(-rz) and keeps it at the
+    // signed distance along its view axis from the target
+    float cx = cosf(rotation.p.x), sx = sinf(rotation.p.x);
+    float cy = cosf(rotation.p.y), sy = sinf(rotation.p.y);
+    float cz = cosf(-rotation.p.z), sz = sinf(-rotation.p.z);
+    HMM_Vec3 axis_y = {-cy * sz, cx * cz - sx * sy * sz, sx * cz + cx * sy * sz};
+    HMM_Vec3 axis_z = {sy, -sx * cy, cx * cy};
+
+    g_state.camera_target = HMM_MulV3F(HMM_Vec3{target.p.x, target.p.y, target.p.z}, mmd_to_meter);
+    g_state.camera_pos = HMM_Add(g_state.camera_target, HMM_MulV3F(axis_z, pose.GetFocalLength() * mmd_to_meter));
+    g_state.camera_fov = pose.GetFOV();
+    up = axis_y;
+}
+
+// Load VMD motion file
+bool LoadVMDMotion(const std::string& filename) {
+    StopPoseBake();
+    StopPhysicsBake();
+    if (g_state.motion && filename == g_state.motion_filename) {
+        // Reloading the playing motion: its mapping of the cache goes first,
+        // so a stale cache can be replaced
+        g_state.motion_loaded = false;
+        g_state.sequencer.reset();
+        g_state.motion.reset();
+        RebuildMotionPlayer();
+    }
+    try {
+        std::shared_ptr<mmd::CompiledMotion> motion = LoadCompiledMotion(filename);
+        g_state.motion_player.reset();
+        g_state.motion = motion;
         g_state.motion_loaded = true;
+        g_state.motion_filename = filename;
         
         // Create sequencer for animation timeline
         g_state.sequencer = std::make_unique<MotionSequencer>(g_state.motion);
         
         // Create motion player if both model and motion are loaded
-        if (g_state.model && g_state.motion && g_state.poser) {
-            g_state.motion_player = std::make_unique<mmd::MotionPlayer>(*g_state.motion, *g_state.poser);
-        }
+        RebuildMotionPlayer();
         
         std::wstring motion_name = g_state.motion->GetName();
         std::string motion_name_utf8 = wstring_to_utf8(motion_name);
         std::cout << "Loaded VMD motion: " << motion_name_utf8 << std::endl;
-        
+        std::cout << "  Tracks: " << g_state.motion->GetBoneTrackNum() << " bone, "
+                  << g_state.motion->GetMorphTrackNum() << " morph" << std::endl;
+        std::cout << "  Compiled image: " << g_state.motion->GetImageSize() / 1024 << " KB" << std::endl;
+
+        // Camera and light keys in the same file drive the viewport as well
+        LoadVMDCamera(filename);
+        LoadVMDLight(filename);
+
+        if (g_state.bake_enabled) {
+            StartPoseBake();
+        }
+        if (g_state.physics_bake_enabled) {
+            StartPhysicsBake();
+        }
+
         return true;
     } catch (const mmd::exception& e) {
         std::cerr << "Error loading VMD motion: " << e.what() << std::endl;
@@ -731,6 +2173,55 @@ bool LoadVMDMotion(const std::string& filename) {
     }
 }
 
+// Stack a VMD motion over the main motion
+bool AddMotionLayer(const std::string& filename) {
+    StopPoseBake();
+    StopPhysicsBake();
+    try {
+        MotionLayer layer;
+        layer.motion = LoadCompiledMotion(filename);
+        layer.filename = filename;
+        layer.weight = 1.0f;
+        g_state.motion_layers.push_back(layer);
+        RebuildMotionPlayer();
+        std::cout << "Added motion layer: " << wstring_to_utf8(layer.motion->GetName()) << std::endl;
+        return true;
+    } catch (const mmd::exception& e) {
+        std::cerr << "Error loading motion layer: " << e.what() << std::endl;
+    }
+    if (g_state.bake_enabled) {
+        StartPoseBake();
+    }
+    if (g_state.physics_bake_enabled) {
+        StartPhysicsBake();
+    }
+    return false;
+}
+
+// Drop a motion layer, baking again once the main motion plays alone
+void RemoveMotionLayer(size_t index) {
+    g_state.motion_layers.erase(g_state.motion_layers.begin() + index);
+    RebuildMotionPlayer();
+    if (g_state.bake_enabled) {
+        StartPoseBake();
+    }
+    if (g_state.physics_bake_enabled) {
+        StartPhysicsBake();
+    }
+}
+
+// Open a WAV file to play along with the motion
+bool LoadAudio(const std::string& filename) {
+    if (!g_state.audio.Open(filename)) {
+        return false;
+    }
+    if (g_state.audio_latency_ms < 0.0f) {
+        g_state.audio_latency_ms = static_cast<float>(g_state.audio.GetDeviceLatency() * 1000.0);
+    }
+    std::cout << "Loaded audio: " << filename << " (" << g_state.audio.GetLength() << "s)" << std::endl;
+    return true;
+}
+
 // Update model vertex buffers (initial creation)
 void UpdateModelBuffers() {
     if (!g_state.model || !g_state.model_loaded) return;
@@ -745,7 +2236,6 @@ void UpdateModelBuffers() {
     
     // Prepare vertex data
     std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
     
     size_t vertex_num = g_state.model->GetVertexNum();
     vertices.reserve(vertex_num);
@@ -774,18 +2264,6 @@ void UpdateModelBuffers() {
         vertices.push_back(v);
     }
     
-    // Prepare index data
-    size_t triangle_num = g_state.model->GetTriangleNum();
-    indices.reserve(triangle_num * 3);
-    
-    for (size_t i = 0; i < triangle_num; ++i) {
-        const mmd::Vector3D<std::uint32_t>& triangle = g_state.model->GetTriangle(i);
-        // workaround for backface culling
-        indices.push_back(triangle.v[2]);
-        indices.push_back(triangle.v[1]);
-        indices.push_back(triangle.v[0]);
-    }
-    
     // Create vertex buffer with dynamic usage for animation updates
     // For stream_update buffers, we must not provide initial data
     // Initial data will be uploaded in UpdateDeformedVertices() on first frame
@@ -796,35 +2274,27 @@ void UpdateModelBuffers() {
     g_state.vertex_buffer = sg_make_buffer(&vbuf_desc);
     
     // Create index buffer (static, doesn't change)
-    if (indices.empty()) {
-        std::cerr << "Error: Index data is empty!" << std::endl;
-        return;
-    }
-    sg_buffer_desc ibuf_desc = {};
-    ibuf_desc.usage.index_buffer = true;
-    ibuf_desc.data.ptr = indices.data();
-    ibuf_desc.data.size = indices.size() * sizeof(uint32_t);
-    ibuf_desc.label = "model-indices";
-    g_state.index_buffer = sg_make_buffer(&ibuf_desc);
-    
+    g_state.index_buffer = MakeIndexBuffer(*g_state.model, "model-indices");
     if (g_state.index_buffer.id == SG_INVALID_ID) {
-        std::cerr << "Error: Failed to create index buffer!" << std::endl;
         return;
     }
     
     // Update bindings
     g_state.bind.vertex_buffers[0] = g_state.vertex_buffer;
     g_state.bind.index_buffer = g_state.index_buffer;
+    g_state.shadow_geometry_dirty = true;
 }
 
-// Update vertex buffer with deformed vertices (called each frame after Deform())
-void UpdateDeformedVertices() {
-    if (!g_state.model || !g_state.model_loaded || !g_state.poser || g_state.vertex_buffer.id == 0) {
+// Update a vertex buffer with the deformed vertices of a poser's model
+// (called each frame after Deform())
+void UpdateDeformedVertices(const mmd::Poser& poser, sg_buffer vertex_buffer) {
+    if (vertex_buffer.id == 0) {
         return;
     }
     
-    size_t vertex_num = g_state.model->GetVertexNum();
-    if (vertex_num == 0 || g_state.poser->pose_image.coordinates.size() < vertex_num) {
+    const mmd::Model& model = poser.GetModel();
+    size_t vertex_num = model.GetVertexNum();
+    if (vertex_num == 0 || poser.pose_image.coordinates.size() < vertex_num) {
         return;
     }
     
@@ -836,12 +2306,12 @@ void UpdateDeformedVertices() {
     const float mmd_to_meter = 0.1f; // 10 cm = 0.1 m
     
     for (size_t i = 0; i < vertex_num; ++i) {
-        mmd::Model::Vertex<mmd::ref> vertex = g_state.model->GetVertex(i);
+        mmd::Model::Vertex<mmd::cref> vertex = model.GetVertex(i);
         mmd::Vector2f uv = vertex.GetUVCoordinate();
         
         // Use deformed coordinates and normals from pose_image
-        const mmd::Vector3f& pos = g_state.poser->pose_image.coordinates[i];
-        const mmd::Vector3f& normal = g_state.poser->pose_image.normals[i];
+        const mmd::Vector3f& pos = poser.pose_image.coordinates[i];
+        const mmd::Vector3f& normal = poser.pose_image.normals[i];
         
         Vertex v;
         // Convert position from centimeters to meters
@@ -859,7 +2329,7 @@ void UpdateDeformedVertices() {
     }
     
     // Update vertex buffer with deformed data
-    sg_update_buffer(g_state.vertex_buffer, sg_range{vertices.data(), vertices.size() * sizeof(Vertex)});
+    sg_update_buffer(vertex_buffer, sg_range{vertices.data(), vertices.size() * sizeof(Vertex)});
 }
 
 // Create ground plane geometry (white stage)
@@ -1386,46 +2856,191 @@ void init(void) {
     default_view_desc.texture.image = g_state.default_texture;
     g_state.default_texture_view = sg_make_view(&default_view_desc);
     
-    // Create skybox shader and pipeline
-    sg_shader skybox_shd = sg_make_shader(ibl_skybox_shader_desc(sg_query_backend()));
-    sg_pipeline_desc skybox_pip_desc = {};
-    skybox_pip_desc.shader = skybox_shd;
-    skybox_pip_desc.layout.attrs[ATTR_ibl_skybox_position].format = SG_VERTEXFORMAT_FLOAT3;
-    skybox_pip_desc.depth.write_enabled = false;
-    skybox_pip_desc.depth.compare = SG_COMPAREFUNC_LESS_EQUAL;
-    skybox_pip_desc.cull_mode = SG_CULLMODE_FRONT;
-    skybox_pip_desc.primitive_type = SG_PRIMITIVETYPE_TRIANGLES;
-    skybox_pip_desc.sample_count = 4;  // Enable 4x MSAA for anti-aliasing
-    skybox_pip_desc.label = "skybox-pipeline";
-    g_state.skybox_pip = sg_make_pipeline(&skybox_pip_desc);
+    // Create skybox shader and pipeline
+    sg_shader skybox_shd = sg_make_shader(ibl_skybox_shader_desc(sg_query_backend()));
+    sg_pipeline_desc skybox_pip_desc = {};
+    skybox_pip_desc.shader = skybox_shd;
+    skybox_pip_desc.layout.attrs[ATTR_ibl_skybox_position].format = SG_VERTEXFORMAT_FLOAT3;
+    skybox_pip_desc.depth.write_enabled = false;
+    skybox_pip_desc.depth.compare = SG_COMPAREFUNC_LESS_EQUAL;
+    skybox_pip_desc.cull_mode = SG_CULLMODE_FRONT;
+    skybox_pip_desc.primitive_type = SG_PRIMITIVETYPE_TRIANGLES;
+    skybox_pip_desc.sample_count = 4;  // Enable 4x MSAA for anti-aliasing
+    skybox_pip_desc.label = "skybox-pipeline";
+    g_state.skybox_pip = sg_make_pipeline(&skybox_pip_desc);
+    
+    // Load HDR and create cubemap
+    std::string hdr_path = "assets/hdr/modern_evening_street_2k.hdr";
+    if (LoadHDRAndCreateCubemap(hdr_path)) {
+        g_state.ibl_initialized = true;
+        std::cout << "IBL initialized successfully" << std::endl;
+    } else {
+        std::cerr << "Failed to initialize IBL" << std::endl;
+    }
+    
+    // Try to load model and motion files if they exist
+    if (!g_state.model_filename.empty()) {
+        LoadPMXModel(g_state.model_filename);
+        if (g_state.model_loaded) {
+            UpdateModelBuffers();
+        }
+    }
+    if (!g_state.motion_filename.empty() && LoadVMDMotion(g_state.motion_filename)) {
+        for (const std::string& filename : g_state.motion_layer_filenames) {
+            AddMotionLayer(filename);
+        }
+    }
+    if (!g_state.camera_filename.empty()) {
+        LoadVMDCamera(g_state.camera_filename);
+        LoadVMDLight(g_state.camera_filename);
+    }
+    if (!g_state.audio_filename.empty()) {
+        LoadAudio(g_state.audio_filename);
+    }
+    for (const std::string& filename : g_state.model_corpus_filenames) {
+        AddCharacter(filename);
+    }
+    for (int i = 0; i < g_state.initial_character_num; ++i) {
+        AddCharacter(g_state.model_filename);
+    }
+    
+    std::cout << "MMD Renderer initialized" << std::endl;
+    std::cout << "Usage: Load PMX and VMD files via code or command line" << std::endl;
+}
+
+// Build the light view/projection used for shadow mapping from light_direction
+void UpdateLightMatrices() {
+    // Calculate light space MVP for shadow mapping
+    // For directional light, we need to create a view matrix looking along the light direction
+    // Light direction points from light source to scene (so we negate it for view direction)
+    HMM_Vec3 light_dir = g_state.light_direction;
+    
+    // Ensure light direction is normalized
+    float light_len = HMM_LenV3(light_dir);
+    if (light_len > 0.001f) {
+        light_dir = HMM_DivV3F(light_dir, light_len);
+    } else {
+        // Fallback to default direction if invalid
+        light_dir = HMM_NormV3(HMM_Vec3{0.0f, -1.0f, 0.0f});
+    }
+    
+    // Calculate up vector perpendicular to light direction
+    // Use world up (0,1,0) as reference, but adjust if light is too vertical
+    HMM_Vec3 world_up = HMM_Vec3{0.0f, 1.0f, 0.0f};
+    HMM_Vec3 right = HMM_Cross(light_dir, world_up);
+    float right_len = HMM_LenV3(right);
+    
+    // If light direction is too close to world up, use a different reference
+    if (right_len < 0.001f) {
+        world_up = HMM_Vec3{0.0f, 0.0f, 1.0f}; // Use forward as reference instead
+        right = HMM_Cross(light_dir, world_up);
+        right_len = HMM_LenV3(right);
+    }
     
-    // Load HDR and create cubemap
-    std::string hdr_path = "assets/hdr/modern_evening_street_2k.hdr";
-    if (LoadHDRAndCreateCubemap(hdr_path)) {
-        g_state.ibl_initialized = true;
-        std::cout << "IBL initialized successfully" << std::endl;
+    // Normalize right vector
+    if (right_len > 0.001f) {
+        right = HMM_DivV3F(right, right_len);
     } else {
-        std::cerr << "Failed to initialize IBL" << std::endl;
+        right = HMM_Vec3{1.0f, 0.0f, 0.0f}; // Fallback
     }
     
-    // Try to load model and motion files if they exist
-    if (!g_state.model_filename.empty()) {
-        LoadPMXModel(g_state.model_filename);
-        if (g_state.model_loaded) {
-            UpdateModelBuffers();
+    // Calculate actual up vector (perpendicular to light direction)
+    // Following official demo pattern: use cross product to ensure orthogonality
+    HMM_Vec3 light_up = HMM_Cross(right, light_dir);
+    float up_len = HMM_LenV3(light_up);
+    if (up_len > 0.001f) {
+        light_up = HMM_DivV3F(light_up, up_len);
+    } else {
+        // If light is nearly vertical, use a fixed up vector
+        // Check if light is pointing up or down
+        if (abs(light_dir.Y) > 0.9f) {
+            // Light is nearly vertical, use forward as up reference
+            light_up = HMM_Vec3{0.0f, 0.0f, 1.0f};
+            // Recalculate right to ensure orthogonality
+            right = HMM_Cross(light_dir, light_up);
+            right = HMM_DivV3F(right, HMM_LenV3(right));
+            light_up = HMM_Cross(right, light_dir);
+        } else {
+            light_up = HMM_Vec3{0.0f, 1.0f, 0.0f}; // Fallback to world up
         }
     }
-    if (!g_state.motion_filename.empty()) {
-        LoadVMDMotion(g_state.motion_filename);
-    }
+
+    // Position light far away in the direction opposite to light_dir
+    // For directional light, position doesn't matter much, but we place it far away
+    // The light direction points from light source to scene, so we negate it for position
+    // Use a reasonable distance that covers the scene (in meters)
+    HMM_Vec3 light_pos = HMM_MulV3F(light_dir, -50.0f); // 50 meters away
+    HMM_Vec3 light_target = HMM_Vec3{0.0f, 0.0f, 0.0f}; // Look at origin (scene center)
     
-    std::cout << "MMD Renderer initialized" << std::endl;
-    std::cout << "Usage: Load PMX and VMD files via code or command line" << std::endl;
+    // Use orthographic projection for directional light
+    // Make sure the frustum is large enough to cover the scene (in meters)
+    // Adjust these values based on your scene size
+    // For a character model (~1.6m tall) on a 50m x 50m ground, we need a larger frustum
+    float light_size = 5.0f; // Size of light frustum: 5m x 5m (covers 5 meters in each direction from center)
+    float light_near = 0.1f;  // 0.1 meter
+    float light_far = 100.0f;  // 100 meters (should cover the scene)
+    g_state.light_proj = HMM_Orthographic_RH_ZO(-light_size, light_size, -light_size, light_size, light_near, light_far);
+    g_state.light_view = HMM_LookAt_RH(light_pos, light_target, light_up);
+    g_state.light_matrix_direction = g_state.light_direction;
+}
+
+// Make the audio clock the master clock while both play: audio follows the
+// play/pause state and seeks, and animation time is pulled toward what is
+// being heard. Small drift is corrected gradually so motion stays smooth;
+// large gaps (a stall or a seek landing) are snapped.
+void SyncAudio() {
+    AudioPlayer& audio = g_state.audio;
+    if (!audio.IsOpen()) {
+        return;
+    }
+    bool playing = g_state.animation_playing && !g_state.sequencer_manual_control;
+    if (!playing || !g_state.audio_sync_enabled) {
+        if (audio.IsPlaying()) {
+            audio.Pause();
+        }
+        return;
+    }
+    if (!audio.IsPlaying()) {
+        audio.Seek(g_state.time);
+        audio.Play();
+        return;
+    }
+    if (audio.IsSeeking() || audio.IsFinished()) {
+        return;
+    }
+
+    const double snap_threshold = 0.25;  // seconds
+    const double correction_rate = 0.1;  // fraction of the drift removed per frame
+    double heard_time = audio.GetTime() - g_state.audio_latency_ms / 1000.0;
+    double drift = heard_time - g_state.time;
+    if (std::fabs(drift) > snap_threshold) {
+        if (heard_time < 0.0 || heard_time > audio.GetLength()) {
+            // Animation ran past the song: restart the song where the animation is
+            audio.Seek(g_state.time);
+        } else {
+            g_state.time = static_cast<float>(heard_time);
+        }
+    } else {
+        g_state.time += static_cast<float>(drift * correction_rate);
+    }
+    g_state.audio_drift = static_cast<float>(drift);
+}
+
+// Back to the first frame; a playing song goes back with it, or SyncAudio
+// would snap the animation to where the song was
+void RewindAnimation() {
+    g_state.time = 0.0f;
+    if (g_state.audio.IsOpen()) {
+        g_state.audio.Seek(0.0);
+    }
 }
 
 // Frame update function
 void frame(void) {
     const float dt = sapp_frame_duration();
+
+    // Physics submitted last frame finishes before anything touches the reactor
+    g_state.physics_pipeline.Wait();
     
     int width = sapp_width();
     int height = sapp_height();
@@ -1455,7 +3070,7 @@ void frame(void) {
                         if (g_state.model_loaded) {
                             UpdateModelBuffers();
                             // Reset animation time when loading new model
-                            g_state.time = 0.0f;
+                            RewindAnimation();
                         }
                     }
                     NFD_FreePathU8(outPath);
@@ -1474,7 +3089,7 @@ void frame(void) {
                     std::string filename(outPath);
                     if (LoadVMDMotion(filename)) {
                         // Reset animation time when loading new motion
-                        g_state.time = 0.0f;
+                        RewindAnimation();
                     }
                     NFD_FreePathU8(outPath);
                 } else if (result == NFD_CANCEL) {
@@ -1483,6 +3098,46 @@ void frame(void) {
                     std::cerr << "Error opening file dialog: " << NFD_GetError() << std::endl;
                 }
             }
+            if (ImGui::MenuItem("Add VMD Motion Layer...", nullptr, false, g_state.motion_loaded)) {
+                nfdu8char_t* outPath = nullptr;
+                nfdu8filteritem_t filterItem[1] = {{"VMD Motion Files", "vmd"}};
+                nfdresult_t result = NFD_OpenDialogU8(&outPath, filterItem, 1, nullptr);
+
+                if (result == NFD_OKAY) {
+                    AddMotionLayer(std::string(outPath));
+                    NFD_FreePathU8(outPath);
+                } else if (result == NFD_ERROR) {
+                    std::cerr << "Error opening file dialog: " << NFD_GetError() << std::endl;
+                }
+            }
+            if (ImGui::MenuItem("Open VMD Camera/Light...")) {
+                nfdu8char_t* outPath = nullptr;
+                nfdu8filteritem_t filterItem[1] = {{"VMD Camera Files", "vmd"}};
+                nfdresult_t result = NFD_OpenDialogU8(&outPath, filterItem, 1, nullptr);
+
+                if (result == NFD_OKAY) {
+                    std::string filename(outPath);
+                    bool has_light = LoadVMDLight(filename);
+                    if (!LoadVMDCamera(filename) && !has_light) {
+                        std::cerr << "No camera or light keyframes in " << filename << std::endl;
+                    }
+                    NFD_FreePathU8(outPath);
+                } else if (result == NFD_ERROR) {
+                    std::cerr << "Error opening file dialog: " << NFD_GetError() << std::endl;
+                }
+            }
+            if (ImGui::MenuItem("Open Audio...")) {
+                nfdu8char_t* outPath = nullptr;
+                nfdu8filteritem_t filterItem[1] = {{"WAV Audio Files", "wav"}};
+                nfdresult_t result = NFD_OpenDialogU8(&outPath, filterItem, 1, nullptr);
+
+                if (result == NFD_OKAY) {
+                    LoadAudio(std::string(outPath));
+                    NFD_FreePathU8(outPath);
+                } else if (result == NFD_ERROR) {
+                    std::cerr << "Error opening file dialog: " << NFD_GetError() << std::endl;
+                }
+            }
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("sokol-gfx")) {
@@ -1541,6 +3196,14 @@ void frame(void) {
             ImGui::DragFloat("Distance (m)", &g_state.camera_distance, 0.1f, 0.5f, 20.0f);
             ImGui::DragFloat("Rotation X", &g_state.camera_rotation_x, 0.01f, -3.14f, 3.14f);
             ImGui::DragFloat("Rotation Y", &g_state.camera_rotation_y, 0.01f, -1.57f, 1.57f);
+
+            ImGui::Separator();
+            if (g_state.camera_player) {
+                ImGui::Checkbox("Use VMD Camera", &g_state.camera_motion_enabled);
+                ImGui::Text("%zu keyframes, %zu frames", g_state.camera_motion.GetKeyframeNum(), g_state.camera_motion.GetLength());
+            } else {
+                ImGui::TextDisabled("No VMD camera loaded");
+            }
             
             ImGui::Separator();
             ImGui::Text("Controls:");
@@ -1588,6 +3251,14 @@ void frame(void) {
             // Light intensity
             ImGui::DragFloat("Intensity", &g_state.light_intensity, 0.1f, 0.0f, 10.0f);
             
+            ImGui::Separator();
+            if (g_state.light_motion.GetKeyframeNum() > 0) {
+                ImGui::Checkbox("Use VMD Light", &g_state.light_motion_enabled);
+                ImGui::Text("%zu keyframes", g_state.light_motion.GetKeyframeNum());
+            } else {
+                ImGui::TextDisabled("No VMD light loaded");
+            }
+
             ImGui::Separator();
             ImGui::Checkbox("Enable Shadows", &g_state.shadows_enabled);
         }
@@ -1634,6 +3305,7 @@ void frame(void) {
             
             // Enable/disable physics (only if not cleaning up)
             if (ImGui::Checkbox("Enable Physics", &g_state.physics_enabled)) {
+                ClearPoseCache();
                 if (!g_state.physics_enabled && g_state.physics_reactor && g_state.poser) {
                     // Reset physics when disabling
                     g_state.physics_reactor->Reset();
@@ -1641,6 +3313,221 @@ void frame(void) {
             }
             
             if (g_state.physics_reactor) {
+                ImGui::Separator();
+                ImGui::Text("Time Step");
+                if (ImGui::SliderInt("Rate (Hz)", &g_state.physics_rate, 30, 240)) {
+                    g_state.physics_reactor->SetFixedStepRate(static_cast<float>(g_state.physics_rate));
+                    ClearPoseCache();
+                }
+                if (ImGui::SliderInt("Max Steps per Frame", &g_state.physics_max_steps, 1, 16)) {
+                    g_state.physics_reactor->SetMaxStepNum(g_state.physics_max_steps);
+                }
+                ImGui::Text("Steps last frame: %d, %d threads", g_state.physics_reactor->GetLastStepNum(),
+                            g_state.physics_reactor->GetThreadNum());
+                ImGui::SliderInt("Settle Steps", &g_state.physics_settle_steps, 0, 120);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Fixed steps run when a motion loads or the timeline jumps,\n"
+                                      "easing the bodies into the new pose. 0 lets them snap.");
+                }
+                ImGui::SliderInt("Settle After Jumps Over (frames)", &g_state.physics_settle_threshold, 1, 120);
+                if (ImGui::Checkbox("Bake Physics", &g_state.physics_bake_enabled)) {
+                    if (g_state.physics_bake_enabled) {
+                        StartPhysicsBake();
+                    } else {
+                        StopPhysicsBake();
+                    }
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Records the physics of the whole motion once (saved next to it as .phys)\n"
+                                      "and plays it back instead of simulating: identical on every run and\n"
+                                      "exact at any frame.");
+                }
+                if (g_state.physics_bake_enabled) {
+                    ImGui::SameLine();
+                    if (g_state.physics_bake_ready) {
+                        if (g_state.physics_bake->GetSourceHash() == PhysicsBakeHash()) {
+                            ImGui::Text("%zu frames (%.1f MB)", g_state.physics_bake->GetFrameNum(),
+                                        g_state.physics_bake->GetDataSize() / (1024.0 * 1024.0));
+                        } else if (ImGui::Button("Settings changed: Record Again")) {
+                            StartPhysicsBake();
+                        }
+                    } else if (g_state.physics_bake_thread.joinable()) {
+                        ImGui::Text("Recording %zu / %zu", g_state.physics_bake_progress.load(),
+                                    g_state.motion ? g_state.motion->GetLength() + 1 : size_t(0));
+                    } else {
+                        ImGui::TextDisabled("Needs a motion without layers");
+                    }
+                }
+                if (ImGui::Checkbox("Deterministic", &g_state.physics_deterministic)) {
+                    g_state.physics_reactor->SetDeterministic(g_state.physics_deterministic);
+                    g_state.physics_reactor->Reset();
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Steps physics by motion frames with fixed solver settings, so the\n"
+                                      "same motion simulates the same way on every run. Pausing freezes\n"
+                                      "the bodies. Needs a single physics thread.");
+                }
+                if (g_state.physics_deterministic) {
+                    ImGui::SameLine();
+                    ImGui::Text("Checksum %016llx",
+                                static_cast<unsigned long long>(g_state.physics_reactor->GetChecksum()));
+                }
+                ImGui::BeginDisabled(!g_state.characters.empty());
+                if (ImGui::Checkbox("Pipelined (1 frame latency)", &g_state.physics_pipelined) && g_state.poser) {
+                    if (g_state.physics_pipelined) {
+                        g_state.physics_pipeline.Start(*g_state.physics_reactor, *g_state.poser);
+                    } else {
+                        g_state.physics_pipeline.Stop();
+                    }
+                    ClearPoseCache();
+                }
+                ImGui::EndDisabled();
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+                    ImGui::SetTooltip("Simulate on a worker thread while the previous frame renders.\n"
+                                      "The model is shown one frame behind the motion.\n"
+                                      "Not with further characters.");
+                }
+
+                ImGui::Separator();
+                ImGui::Text("Level of Detail");
+                ImGui::Checkbox("Enable Level of Detail", &g_state.physics_lod.enabled);
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Bodies that are not worth simulating follow the animation instead,\n"
+                                      "and bodies at rest may sleep. Off in deterministic mode.");
+                }
+                if (g_state.physics_lod.enabled) {
+                    ImGui::DragFloat("Min Mass", &g_state.physics_lod.min_mass, 0.01f, 0.0f, 10.0f);
+                    ImGui::DragFloat("Min Size", &g_state.physics_lod.min_size, 0.01f, 0.0f, 5.0f);
+                    if (ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("Bounding radius, in model units (0.1 m)");
+                    }
+                    float far_distance = g_state.physics_lod.far_distance * 0.1f;
+                    if (ImGui::DragFloat("Far Distance (m)", &far_distance, 0.1f, 0.0f, 100.0f)) {
+                        g_state.physics_lod.far_distance = far_distance * 10.0f;
+                    }
+                    if (ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("Bodies farther from the camera follow the animation; 0 for no limit");
+                    }
+                    ImGui::Checkbox("Sleep at Rest", &g_state.physics_lod.sleep);
+                    if (g_state.physics_lod.sleep) {
+                        ImGui::DragFloat("Sleep Speed", &g_state.physics_lod.sleep_linear_velocity, 0.01f, 0.0f, 10.0f);
+                        ImGui::DragFloat("Sleep Spin", &g_state.physics_lod.sleep_angular_velocity, 0.01f, 0.0f, 10.0f);
+                    }
+                }
+
+                // Per collision group: a box simulates the group. Cost shares the
+                // React time by the bodies and joints each group has awake.
+                const std::vector<mmd::BulletPhysicsReactor::GroupStats>& group_stats = g_state.physics_group_stats;
+                size_t total_work = 0;
+                for (const mmd::BulletPhysicsReactor::GroupStats& stats : group_stats) {
+                    total_work += stats.awake_num + stats.constraint_num;
+                }
+                ImGui::Text("React: %.0f us", g_state.physics_react_us);
+                if (ImGui::BeginTable("PhysicsGroups", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+                    ImGui::TableSetupColumn("Group");
+                    ImGui::TableSetupColumn("Bodies");
+                    ImGui::TableSetupColumn("Simulated");
+                    ImGui::TableSetupColumn("Awake");
+                    ImGui::TableSetupColumn("Joints");
+                    ImGui::TableSetupColumn("Cost (us)");
+                    ImGui::TableHeadersRow();
+                    for (size_t i = 0; i < group_stats.size(); ++i) {
+                        const mmd::BulletPhysicsReactor::GroupStats& stats = group_stats[i];
+                        if (stats.body_num == 0) {
+                            continue;
+                        }
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        bool simulated = !g_state.physics_lod.disabled_groups.test(i);
+                        ImGui::PushID(static_cast<int>(i));
+                        if (ImGui::Checkbox("", &simulated)) {
+                            g_state.physics_lod.disabled_groups.set(i, !simulated);
+                            g_state.physics_lod.enabled = true;
+                        }
+                        ImGui::PopID();
+                        ImGui::SameLine();
+                        ImGui::Text("%zu", i + 1);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%zu", stats.body_num);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%zu", stats.simulated_num);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%zu", stats.awake_num);
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%zu", stats.constraint_num);
+                        ImGui::TableNextColumn();
+                        size_t work = stats.awake_num + stats.constraint_num;
+                        ImGui::Text("%.0f", total_work > 0 ? g_state.physics_react_us * work / total_work : 0.0);
+                    }
+                    ImGui::EndTable();
+                }
+
+                ImGui::Separator();
+                ImGui::Text("Characters");
+                ImGui::BeginDisabled(!g_state.model_loaded || g_state.characters.size() >= 15);
+                if (ImGui::Button("Add Character...")) {
+                    nfdu8char_t* outPath = nullptr;
+                    nfdu8filteritem_t filterItem[1] = {{"PMX Model Files", "pmx"}};
+                    nfdresult_t result = NFD_OpenDialogU8(&outPath, filterItem, 1, nullptr);
+                    if (result == NFD_OKAY) {
+                        AddCharacter(outPath);
+                        NFD_FreePathU8(outPath);
+                    } else if (result != NFD_CANCEL) {
+                        std::cerr << "Error opening file dialog: " << NFD_GetError() << std::endl;
+                    }
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Add Copy")) {
+                    AddCharacter(g_state.model_filename);
+                }
+                ImGui::EndDisabled();
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+                    ImGui::SetTooltip("Further models beside the main one, each from its own .pmx, playing the\n"
+                                      "main motion. All posers share one physics world: one broadphase and one\n"
+                                      "solver step per frame. Recorded physics, the pose cache and pipelining\n"
+                                      "are off meanwhile.");
+                }
+                if (!g_state.characters.empty()) {
+                    if (ImGui::DragFloat("Spacing (m)", &g_state.character_spacing, 0.05f, 0.0f, 10.0f)) {
+                        PlaceCharacters();
+                    }
+                    if (ImGui::DragFloat("Stagger (frames)", &g_state.character_stagger, 1.0f, 0.0f, 300.0f)) {
+                        for (size_t i = 0; i < g_state.characters.size(); ++i) {
+                            if (g_state.characters[i].motion_player) {
+                                g_state.characters[i].motion_player->SetOffset(
+                                    static_cast<double>(i + 1) * g_state.character_stagger);
+                            }
+                        }
+                    }
+                    if (ImGui::Checkbox("Collide Between Characters", &g_state.characters_collide)) {
+                        ApplyCharacterCollision();
+                    }
+                    for (size_t i = 0; i < g_state.characters.size(); ++i) {
+                        SceneCharacter& character = g_state.characters[i];
+                        ImGui::PushID(static_cast<int>(i));
+                        ImGui::Text("%zu %s", i + 1, wstring_to_utf8(character.model->GetName()).c_str());
+                        if (ImGui::IsItemHovered()) {
+                            ImGui::SetTooltip("%s", character.filename.c_str());
+                        }
+                        ImGui::SameLine();
+                        bool physics_enabled = character.physics_enabled;
+                        if (ImGui::Checkbox("Physics", &physics_enabled)) {
+                            SetCharacterPhysics(character, physics_enabled);
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::Checkbox("Visible", &character.visible)) {
+                            g_state.shadow_geometry_dirty = true;
+                        }
+                        ImGui::SameLine();
+                        bool removed = ImGui::Button("Remove");
+                        ImGui::PopID();
+                        if (removed) {
+                            RemoveCharacter(i);
+                            break;
+                        }
+                    }
+                }
+
                 ImGui::Separator();
                 ImGui::Text("Gravity Settings");
                 
@@ -1756,6 +3643,7 @@ void frame(void) {
     if (g_state.animation_playing && !g_state.sequencer_manual_control) {
         g_state.time += dt;
     }
+    SyncAudio();
     
     // Update sequencer current frame from animation time (sync sequencer with animation)
     // This happens BEFORE sequencer window is drawn, so sequencer can detect manual changes
@@ -1784,30 +3672,148 @@ void frame(void) {
     // Update animation and deformed vertices
     // Ensure Deform() is called before UpdateDeformedVertices() to populate pose_image
     if (g_state.model_loaded && g_state.poser) {
+        // The shadow map is redrawn only for a pose that changed: another
+        // frame, bodies that moved, or new pose inputs
+        bool pose_changed = g_state.pose_dirty;
+        g_state.pose_dirty = false;
+
         // Reset posing first (clears all bone poses and morphs)
         g_state.poser->ResetPosing();
+        for (SceneCharacter& character : g_state.characters) {
+            character.poser->ResetPosing();
+        }
         
         // Then apply motion if available
         if (g_state.motion_loaded && g_state.motion_player) {
             // Calculate current frame (assuming 30 FPS)
             size_t frame = static_cast<size_t>(g_state.time * 30.0f);
-            
-            // Seek to current frame and apply motion (sets bone poses and morphs)
-            g_state.motion_player->SeekFrame(frame);
-            
-            // After setting bone poses, we need to update bone transforms
-            // ResetPosing() already called PrePhysicsPosing() and PostPhysicsPosing(),
-            // but after SeekFrame() we need to update transforms again
-            g_state.poser->PrePhysicsPosing();
-            
-            // Run physics simulation if enabled and not cleaning up
-            if (g_state.physics_enabled && g_state.physics_reactor) {
-                // Step physics simulation (dt is in seconds, MMD uses 30 FPS = 1/30 second per frame)
-                const float physics_dt = 1.0f / 30.0f;
-                g_state.physics_reactor->React(physics_dt);
+            bool physics_active = g_state.physics_enabled && g_state.physics_reactor;
+            bool physics_pipelined = physics_active && g_state.physics_pipeline.IsRunning();
+            bool scrubbing = g_state.sequencer_manual_control || !g_state.animation_playing;
+            // Characters share the world: the pose cache and recorded physics
+            // only hold the main poser
+            bool characters = !g_state.characters.empty();
+            // Recorded physics replaces the reactor while it matches the current settings
+            bool physics_baked = physics_active && !characters && g_state.physics_bake_ready && g_state.motion_layers.empty() &&
+                                 frame < g_state.physics_bake->GetFrameNum() &&
+                                 g_state.physics_bake->GetSourceHash() == PhysicsBakeHash();
+            // Frames moved since the last one physics saw, negative when stepping back
+            long long frame_jump = g_state.physics_last_frame < 0 ? 0 :
+                static_cast<long long>(frame) - g_state.physics_last_frame;
+            g_state.physics_last_frame = static_cast<long long>(frame);
+            if (static_cast<long long>(frame) != g_state.posed_frame) {
+                pose_changed = true;
+                g_state.posed_frame = static_cast<long long>(frame);
             }
+
+            // A frame seen before is restored while scrubbing: no sampling, IK or physics
+            if (g_state.pose_cache_enabled && g_state.pose_cache && scrubbing && !characters &&
+                g_state.pose_cache->Restore(frame, *g_state.poser, &g_state.pose_cache_physics)) {
+                if (physics_active && !g_state.pose_cache_physics.empty()) {
+                    g_state.physics_reactor->LoadState(g_state.pose_cache_physics);
+                }
+                if (physics_pipelined) {
+                    g_state.physics_pipeline.Discard();
+                }
+            } else {
+                if (g_state.bake_ready && g_state.motion_layers.empty() && frame < g_state.baked_motion->GetFrameNum()) {
+                    // Baked frame: array reads replace keyframe search, curves, morphs and IK
+                    g_state.baked_motion->Apply(frame, *g_state.poser);
+                } else {
+                    // Seek to current frame and apply motion (sets bone poses and morphs)
+                    g_state.motion_player->SeekFrame(frame);
+                
+                    // After setting bone poses, we need to update bone transforms
+                    // ResetPosing() already called PrePhysicsPosing() and PostPhysicsPosing(),
+                    // but after SeekFrame() we need to update transforms again
+                    g_state.poser->PrePhysicsPosing();
+                }
+                for (SceneCharacter& character : g_state.characters) {
+                    if (character.motion_player) {
+                        character.motion_player->SeekFrame(frame);
+                        character.poser->PrePhysicsPosing();
+                    }
+                }
             
-            g_state.poser->PostPhysicsPosing();
+                // A new motion or a long seek eases the bodies in rather than snapping them.
+                // Deterministic physics cannot run backwards: any step back settles
+                int settle_steps = 0;
+                if (physics_active && !physics_baked && (g_state.physics_settle_pending ||
+                                       std::llabs(frame_jump) > g_state.physics_settle_threshold ||
+                                       (g_state.physics_deterministic && frame_jump < 0))) {
+                    settle_steps = g_state.physics_settle_steps;
+                }
+                g_state.physics_settle_pending = false;
+
+                // Deterministic physics steps by motion frames, not by how long frames took
+                float physics_dt = dt;
+                if (g_state.physics_deterministic) {
+                    physics_dt = (settle_steps > 0 ? 1.0f : static_cast<float>(std::max(frame_jump, 0LL))) / 30.0f;
+                }
+
+                // Level of detail follows the camera; the reactor must be idle to take it
+                if (physics_active && !physics_baked) {
+                    if (physics_pipelined) {
+                        g_state.physics_pipeline.Wait();
+                        g_state.physics_react_us = g_state.physics_pipeline.GetReactTime();
+                    }
+                    g_state.physics_group_stats = g_state.physics_reactor->GetGroupStats();
+                    g_state.physics_reactor->SetLodPolicy(g_state.physics_lod);
+                    g_state.physics_reactor->SetLodViewer(CameraModelPosition());
+
+                    // Sleeping bodies stay put; awake ones move with any time step
+                    size_t awake_num = 0;
+                    for (const mmd::BulletPhysicsReactor::GroupStats& stats : g_state.physics_group_stats) {
+                        awake_num += stats.awake_num;
+                    }
+                    if (settle_steps > 0 || (physics_dt > 0.0f && awake_num > 0)) {
+                        pose_changed = true;
+                    }
+                }
+
+                if (physics_baked) {
+                    g_state.physics_bake->Apply(frame, *g_state.poser);
+                    g_state.poser->PostPhysicsPosing();
+                    if (physics_pipelined) {
+                        // Nothing submitted: the last pipelined frame is stale by now
+                        g_state.physics_pipeline.Discard();
+                    }
+                } else if (physics_pipelined) {
+                    // This frame simulates on the physics thread while the last one is drawn
+                    g_state.physics_pipeline.Submit(physics_dt, settle_steps);
+                    if (!g_state.physics_pipeline.Present()) {
+                        g_state.poser->PostPhysicsPosing();
+                    }
+                } else {
+                    // Run physics simulation if enabled and not cleaning up
+                    if (physics_active) {
+                        g_state.physics_reactor->Settle(settle_steps);
+                        // Advance physics by the real frame time; the reactor runs fixed
+                        // steps and interpolates between them, whatever the refresh rate
+                        uint64_t react_start = stm_now();
+                        g_state.physics_reactor->React(physics_dt);
+                        g_state.physics_react_us = stm_us(stm_since(react_start));
+                    }
+
+                    g_state.poser->PostPhysicsPosing();
+                    for (SceneCharacter& character : g_state.characters) {
+                        if (character.motion_player) {
+                            character.poser->PostPhysicsPosing();
+                        }
+                    }
+                }
+
+                // Pipelined poses are a frame late and the reactor is busy: not cached
+                if (g_state.pose_cache_enabled && g_state.pose_cache && !characters &&
+                    (physics_baked || !physics_pipelined)) {
+                    if (physics_active && !physics_baked) {
+                        g_state.physics_reactor->SaveState(g_state.pose_cache_physics);
+                        g_state.pose_cache->Store(frame, *g_state.poser, &g_state.pose_cache_physics);
+                    } else {
+                        g_state.pose_cache->Store(frame, *g_state.poser);
+                    }
+                }
+            }
             
             // // Debug: print frame number every second
             // static size_t last_frame = 0;
@@ -1817,11 +3823,21 @@ void frame(void) {
             // }
         }
         
+        if (pose_changed) {
+            g_state.shadow_geometry_dirty = true;
+        }
+
         // Apply deformation (calculates deformed vertex positions)
         g_state.poser->Deform();
         
         // Update vertex buffer with deformed vertices (only once per frame)
-        UpdateDeformedVertices();
+        UpdateDeformedVertices(*g_state.poser, g_state.vertex_buffer);
+        for (SceneCharacter& character : g_state.characters) {
+            if (character.visible) {
+                character.poser->Deform();
+                UpdateDeformedVertices(*character.poser, character.vertex_buffer);
+            }
+        }
     }
     
     // Handle continuous keyboard input for camera movement (WASD)
@@ -1880,22 +3896,32 @@ void frame(void) {
         }
     }
     
-    // Update camera position based on rotation and distance (orbit camera)
-    float cos_y = cosf(g_state.camera_rotation_y);
-    float sin_y = sinf(g_state.camera_rotation_y);
-    float cos_x = cosf(g_state.camera_rotation_x);
-    float sin_x = sinf(g_state.camera_rotation_x);
-    
-    HMM_Vec3 camera_offset;
-    camera_offset.X = g_state.camera_distance * cos_y * sin_x;
-    camera_offset.Y = g_state.camera_distance * sin_y;
-    camera_offset.Z = g_state.camera_distance * cos_y * cos_x;
-    
-    g_state.camera_pos = HMM_Add(g_state.camera_target, camera_offset);
+    if (g_state.light_motion_enabled && g_state.light_motion.GetKeyframeNum() > 0) {
+        ApplyLightMotion(g_state.time);
+    }
+
+    HMM_Vec3 camera_up = HMM_Vec3{0.0f, 1.0f, 0.0f};
+    if (g_state.camera_motion_enabled && g_state.camera_player) {
+        // VMD camera motion replaces the orbit camera
+        ApplyCameraMotion(g_state.time * 30.0, camera_up);
+    } else {
+        // Update camera position based on rotation and distance (orbit camera)
+        float cos_y = cosf(g_state.camera_rotation_y);
+        float sin_y = sinf(g_state.camera_rotation_y);
+        float cos_x = cosf(g_state.camera_rotation_x);
+        float sin_x = sinf(g_state.camera_rotation_x);
+        
+        HMM_Vec3 camera_offset;
+        camera_offset.X = g_state.camera_distance * cos_y * sin_x;
+        camera_offset.Y = g_state.camera_distance * sin_y;
+        camera_offset.Z = g_state.camera_distance * cos_y * cos_x;
+        
+        g_state.camera_pos = HMM_Add(g_state.camera_target, camera_offset);
+    }
     
     // Calculate MVP matrix
     HMM_Mat4 proj = HMM_Perspective_RH_ZO(g_state.camera_fov * HMM_DegToRad, (float)width / (float)height, 0.1f, 1000.0f);
-    HMM_Mat4 view = HMM_LookAt_RH(g_state.camera_pos, g_state.camera_target, HMM_Vec3{0.0f, 1.0f, 0.0f});
+    HMM_Mat4 view = HMM_LookAt_RH(g_state.camera_pos, g_state.camera_target, camera_up);
     
     // Convert model matrix from ImGuizmo format (column-major float array) to HMM_Mat4
     HMM_Mat4 model_mat = HMM_M4D(1.0f);
@@ -1926,91 +3952,49 @@ void frame(void) {
         // Column 3 (stored at indices 12-15) - translation part
         model_mat.Elements[0][3] = g_state.model_matrix[12];
         model_mat.Elements[1][3] = g_state.model_matrix[13];
-        model_mat.Elements[2][3] = g_state.model_matrix[14];
-        model_mat.Elements[3][3] = g_state.model_matrix[15];
-        
-        // Transpose the entire matrix to fix rotation direction
-        // This is necessary because ImGuizmo's matrix format doesn't match HMM's convention
-        model_mat = HMM_TransposeM4(model_mat);
-    }
-    HMM_Mat4 mvp = proj * view * model_mat;
-    
-    // Calculate light space MVP for shadow mapping
-    // For directional light, we need to create a view matrix looking along the light direction
-    // Light direction points from light source to scene (so we negate it for view direction)
-    HMM_Vec3 light_dir = g_state.light_direction;
-    
-    // Ensure light direction is normalized
-    float light_len = HMM_LenV3(light_dir);
-    if (light_len > 0.001f) {
-        light_dir = HMM_DivV3F(light_dir, light_len);
-    } else {
-        // Fallback to default direction if invalid
-        light_dir = HMM_NormV3(HMM_Vec3{0.0f, -1.0f, 0.0f});
-    }
-    
-    // Calculate up vector perpendicular to light direction
-    // Use world up (0,1,0) as reference, but adjust if light is too vertical
-    HMM_Vec3 world_up = HMM_Vec3{0.0f, 1.0f, 0.0f};
-    HMM_Vec3 right = HMM_Cross(light_dir, world_up);
-    float right_len = HMM_LenV3(right);
-    
-    // If light direction is too close to world up, use a different reference
-    if (right_len < 0.001f) {
-        world_up = HMM_Vec3{0.0f, 0.0f, 1.0f}; // Use forward as reference instead
-        right = HMM_Cross(light_dir, world_up);
-        right_len = HMM_LenV3(right);
+        model_mat.Elements[2][3] = g_state.model_matrix[14];
+        model_mat.Elements[3][3] = g_state.model_matrix[15];
+        
+        // Transpose the entire matrix to fix rotation direction
+        // This is necessary because ImGuizmo's matrix format doesn't match HMM's convention
+        model_mat = HMM_TransposeM4(model_mat);
     }
     
-    // Normalize right vector
-    if (right_len > 0.001f) {
-        right = HMM_DivV3F(right, right_len);
-    } else {
-        right = HMM_Vec3{1.0f, 0.0f, 0.0f}; // Fallback
+    // Light matrices follow the light direction; rebuild them only when it moved
+    if (g_state.light_direction.X != g_state.light_matrix_direction.X ||
+        g_state.light_direction.Y != g_state.light_matrix_direction.Y ||
+        g_state.light_direction.Z != g_state.light_matrix_direction.Z) {
+        UpdateLightMatrices();
     }
-    
-    // Calculate actual up vector (perpendicular to light direction)
-    // Following official demo pattern: use cross product to ensure orthogonality
-    HMM_Vec3 light_up = HMM_Cross(right, light_dir);
-    float up_len = HMM_LenV3(light_up);
-    if (up_len > 0.001f) {
-        light_up = HMM_DivV3F(light_up, up_len);
-    } else {
-        // If light is nearly vertical, use a fixed up vector
-        // Check if light is pointing up or down
-        if (abs(light_dir.Y) > 0.9f) {
-            // Light is nearly vertical, use forward as up reference
-            light_up = HMM_Vec3{0.0f, 0.0f, 1.0f};
-            // Recalculate right to ensure orthogonality
-            right = HMM_Cross(light_dir, light_up);
-            right = HMM_DivV3F(right, HMM_LenV3(right));
-            light_up = HMM_Cross(right, light_dir);
-        } else {
-            light_up = HMM_Vec3{0.0f, 1.0f, 0.0f}; // Fallback to world up
+    const HMM_Mat4& light_proj = g_state.light_proj;
+    const HMM_Mat4& light_view = g_state.light_view;
+    HMM_Mat4 light_mvp = light_proj * light_view * model_mat;
+
+    // The model, then each visible character at its offset, each with its own
+    // buffers and textures
+    const float mmd_to_meter = 0.1f;
+    std::vector<ModelDraw> model_draws;
+    if (g_state.model_loaded && g_state.vertex_buffer.id != 0 && g_state.index_buffer.id != 0) {
+        model_draws.push_back({g_state.model.get(), g_state.vertex_buffer, g_state.index_buffer,
+                               &g_state.material_texture_views, model_mat});
+    }
+    for (const SceneCharacter& character : g_state.characters) {
+        if (character.visible && character.vertex_buffer.id != 0 && character.index_buffer.id != 0) {
+            HMM_Vec3 offset = {character.offset.p.x * mmd_to_meter, character.offset.p.y * mmd_to_meter,
+                               character.offset.p.z * mmd_to_meter};
+            model_draws.push_back({character.model.get(), character.vertex_buffer, character.index_buffer,
+                                   &character.material_texture_views, model_mat * HMM_Translate(offset)});
         }
     }
-
-    // Position light far away in the direction opposite to light_dir
-    // For directional light, position doesn't matter much, but we place it far away
-    // The light direction points from light source to scene, so we negate it for position
-    // Use a reasonable distance that covers the scene (in meters)
-    HMM_Vec3 light_pos = HMM_MulV3F(light_dir, -50.0f); // 50 meters away
-    HMM_Vec3 light_target = HMM_Vec3{0.0f, 0.0f, 0.0f}; // Look at origin (scene center)
-    
-    // Use orthographic projection for directional light
-    // Make sure the frustum is large enough to cover the scene (in meters)
-    // Adjust these values based on your scene size
-    // For a character model (~1.6m tall) on a 50m x 50m ground, we need a larger frustum
-    float light_size = 5.0f; // Size of light frustum: 5m x 5m (covers 5 meters in each direction from center)
-    float light_near = 0.1f;  // 0.1 meter
-    float light_far = 100.0f;  // 100 meters (should cover the scene)
-    HMM_Mat4 light_proj = HMM_Orthographic_RH_ZO(-light_size, light_size, -light_size, light_size, light_near, light_far);
-    HMM_Mat4 light_view = HMM_LookAt_RH(light_pos, light_target, light_up);
-    HMM_Mat4 light_mvp = light_proj * light_view * model_mat;
     
     // Render shadow pass first (before main rendering)
-    // Use persistent shadow pass (like official demo)
-    if (g_state.shadows_enabled && g_state.shadow_map.id != 0) {
+    // Use persistent shadow pass (like official demo); the map is kept until
+    // the light matrix or the model geometry changes
+    bool shadow_map_stale = !g_state.shadow_map_valid || g_state.shadow_geometry_dirty ||
+        memcmp(&light_mvp, &g_state.shadow_light_mvp, sizeof(HMM_Mat4)) != 0;
+    if (!g_state.shadows_enabled) {
+        g_state.shadow_map_valid = false;
+    } else if (g_state.shadow_map.id != 0 && shadow_map_stale) {
         sg_push_debug_group("Shaodw pass");
         sg_pass _shadow_pass = {0};
         _shadow_pass.action = g_state.shadow_pass_action;
@@ -2019,21 +4003,21 @@ void frame(void) {
         sg_begin_pass(&_shadow_pass);
         sg_apply_pipeline(g_state.shadow_pip);
 
-        // Render model to shadow map
-        if (g_state.model_loaded && g_state.vertex_buffer.id != 0 && g_state.index_buffer.id != 0) {
+        // Render models to shadow map
+        for (const ModelDraw& draw : model_draws) {
             shadow_vs_params_t shadow_vs_params;
-            shadow_vs_params.light_mvp = light_mvp;
+            shadow_vs_params.light_mvp = light_proj * light_view * draw.matrix;
             
             sg_bindings shadow_bind = {};
-            shadow_bind.vertex_buffers[0] = g_state.vertex_buffer;
-            shadow_bind.index_buffer = g_state.index_buffer;
+            shadow_bind.vertex_buffers[0] = draw.vertex_buffer;
+            shadow_bind.index_buffer = draw.index_buffer;
             sg_apply_bindings(&shadow_bind);
             sg_apply_uniforms(0, SG_RANGE(shadow_vs_params));
             
             // Render all parts
-            size_t part_num = g_state.model->GetPartNum();
+            size_t part_num = draw.model->GetPartNum();
             for (size_t part_idx = 0; part_idx < part_num; ++part_idx) {
-                const mmd::Model::Part& part = g_state.model->GetPart(part_idx);
+                const mmd::Model::Part& part = draw.model->GetPart(part_idx);
                 const size_t base_shift = part.GetBaseShift();
                 const size_t triangle_num = part.GetTriangleNum();
                 
@@ -2049,6 +4033,10 @@ void frame(void) {
         
         sg_end_pass();
         sg_pop_debug_group();
+
+        g_state.shadow_light_mvp = light_mvp;
+        g_state.shadow_map_valid = true;
+        g_state.shadow_geometry_dirty = false;
     }
 
     // Begin main rendering pass
@@ -2090,13 +4078,11 @@ void frame(void) {
     
     // Model mode: draw loaded model (render by parts/materials)
     // Simplified: only albedo + rim light, no IBL or directional light
-    if (g_state.model_loaded && g_state.vertex_buffer.id != 0 && g_state.index_buffer.id != 0) {
+    if (!model_draws.empty()) {
         sg_apply_pipeline(g_state.pip);
         
         // Update VS params (no light_mvp needed anymore)
         mmd_vs_params_t vs_params;
-        vs_params.mvp = mvp;
-        vs_params.model = model_mat;
         
         // FS params: view_pos, rim light, and specular parameters
         mmd_fs_params_t fs_params;
@@ -2111,36 +4097,42 @@ void frame(void) {
         fs_params.light_intensity = g_state.light_intensity;
         
         // Render each part with its own texture
-        size_t part_num = g_state.model->GetPartNum();
-        for (size_t part_idx = 0; part_idx < part_num; ++part_idx) {
-            const mmd::Model::Part& part = g_state.model->GetPart(part_idx);
-            const size_t base_shift = part.GetBaseShift();
-            const size_t triangle_num = part.GetTriangleNum();
-            
-            if (triangle_num == 0) continue;
-            
-            sg_bindings bind = {};
-            bind.vertex_buffers[0] = g_state.vertex_buffer;
-            bind.index_buffer = g_state.index_buffer;
-            
-            // Use persistent view for material texture (slot 0 for diffuse texture)
-            sg_view material_view = (part_idx < g_state.material_texture_views.size() && g_state.material_texture_views[part_idx].id != 0)
-                ? g_state.material_texture_views[part_idx]
-                : g_state.default_texture_view;
-            
-            // Bind only diffuse texture (slot 0)
-            bind.views[0] = material_view;
-            bind.samplers[0] = g_state.default_sampler;
-            
-            sg_apply_bindings(&bind);
-            sg_apply_uniforms(0, SG_RANGE(vs_params));
-            sg_apply_uniforms(1, SG_RANGE(fs_params)); // fs_params is now binding 1
+        for (const ModelDraw& draw : model_draws) {
+            vs_params.mvp = proj * view * draw.matrix;
+            vs_params.model = draw.matrix;
+            const std::vector<sg_view>& texture_views = *draw.texture_views;
+
+            size_t part_num = draw.model->GetPartNum();
+            for (size_t part_idx = 0; part_idx < part_num; ++part_idx) {
+                const mmd::Model::Part& part = draw.model->GetPart(part_idx);
+                const size_t base_shift = part.GetBaseShift();
+                const size_t triangle_num = part.GetTriangleNum();
+                
+                if (triangle_num == 0) continue;
+                
+                sg_bindings bind = {};
+                bind.vertex_buffers[0] = draw.vertex_buffer;
+                bind.index_buffer = draw.index_buffer;
+                
+                // Use persistent view for material texture (slot 0 for diffuse texture)
+                sg_view material_view = (part_idx < texture_views.size() && texture_views[part_idx].id != 0)
+                    ? texture_views[part_idx]
+                    : g_state.default_texture_view;
+                
+                // Bind only diffuse texture (slot 0)
+                bind.views[0] = material_view;
+                bind.samplers[0] = g_state.default_sampler;
+                
+                sg_apply_bindings(&bind);
+                sg_apply_uniforms(0, SG_RANGE(vs_params));
+                sg_apply_uniforms(1, SG_RANGE(fs_params)); // fs_params is now binding 1
 
-            // Draw this part's triangles
-            int index_offset = (int)(base_shift * 3);
-            int index_count = (int)(triangle_num * 3);
-            if (index_count > 0) {
-                sg_draw(index_offset, index_count, 1);
+                // Draw this part's triangles
+                int index_offset = (int)(base_shift * 3);
+                int index_count = (int)(triangle_num * 3);
+                if (index_count > 0) {
+                    sg_draw(index_offset, index_count, 1);
+                }
             }
         }
     }
@@ -2241,7 +4233,7 @@ void frame(void) {
             ImGui::SameLine();
             if (ImGui::Button("Stop")) {
                 g_state.animation_playing = false;
-                g_state.time = 0.0f;
+                RewindAnimation();
                 g_state.sequencer_current_frame = 0;
                 g_state.sequencer_manual_control = false;
                 g_state.sequencer_last_frame = 0;
@@ -2250,6 +4242,94 @@ void frame(void) {
             ImGui::Text("Frame: %d / %d", g_state.sequencer_current_frame, g_state.sequencer ? g_state.sequencer->GetFrameMax() : 0);
             ImGui::SameLine();
             ImGui::Text("Time: %.2fs", g_state.time);
+
+            if (ImGui::Checkbox("Compress Motion", &g_state.compress_motion)) {
+                LoadVMDMotion(g_state.motion_filename);
+            }
+            ImGui::SameLine();
+            if (ImGui::Checkbox("Bake Poses", &g_state.bake_enabled)) {
+                if (g_state.bake_enabled) {
+                    StartPoseBake();
+                } else {
+                    StopPoseBake();
+                }
+            }
+            if (g_state.bake_enabled && g_state.baked_motion) {
+                ImGui::SameLine();
+                if (g_state.bake_ready) {
+                    ImGui::Text("%zu frames baked (%.1f MB)", g_state.baked_motion->GetFrameNum(),
+                                g_state.baked_motion->GetResidentSize() / (1024.0 * 1024.0));
+                } else {
+                    ImGui::Text("Baking...");
+                }
+            }
+
+            if (g_state.audio.IsOpen()) {
+                std::string audio_name = g_state.audio.GetFilename();
+                audio_name = audio_name.substr(audio_name.find_last_of("/\\") + 1);
+                ImGui::Checkbox("Sync to Audio", &g_state.audio_sync_enabled);
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(120.0f);
+                ImGui::DragFloat("Latency (ms)", &g_state.audio_latency_ms, 1.0f, 0.0f, 500.0f, "%.0f");
+                ImGui::SameLine();
+                ImGui::Text("%s  %.2f / %.2fs  drift %+.1f ms  %zu underruns", audio_name.c_str(),
+                            g_state.audio.GetTime(), g_state.audio.GetLength(),
+                            g_state.audio_drift * 1000.0f, g_state.audio.GetUnderrunNum());
+            }
+
+            if (ImGui::Checkbox("Pose Cache", &g_state.pose_cache_enabled)) {
+                ClearPoseCache();
+            }
+            if (g_state.pose_cache_enabled && g_state.pose_cache) {
+                mmd::PoseCache& cache = *g_state.pose_cache;
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(120.0f);
+                if (ImGui::SliderInt("Budget (MB)", &g_state.pose_cache_budget, 1, 512)) {
+                    cache.SetMemoryBudget(static_cast<size_t>(g_state.pose_cache_budget) * 1024 * 1024);
+                }
+                ImGui::SameLine();
+                ImGui::Text("%zu hits, %zu misses, %zu frames (%.1f MB)",
+                            cache.GetHitNum(), cache.GetMissNum(), cache.GetFrameNum(),
+                            cache.GetResidentSize() / (1024.0 * 1024.0));
+                ImGui::SameLine();
+                if (ImGui::Button("Clear Cache")) {
+                    cache.Clear();
+                }
+            }
+
+            // Motion layers over the main motion; fades take one second from the current frame
+            for (size_t i = 0; i < g_state.motion_layers.size(); ++i) {
+                MotionLayer& layer = g_state.motion_layers[i];
+                mmd::LayeredMotionPlayer* player = g_state.motion_player.get();
+                ImGui::PushID(static_cast<int>(i));
+                std::string label = wstring_to_utf8(layer.motion->GetName());
+                if (label.empty()) {
+                    label = layer.filename.substr(layer.filename.find_last_of("/\\") + 1);
+                }
+                if (ImGui::SliderFloat(label.c_str(), &layer.weight, 0.0f, 1.0f) && player) {
+                    player->SetLayerWeight(i + 1, layer.weight);
+                    ClearPoseCache();
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Fade In") && player) {
+                    layer.weight = 1.0f;
+                    player->FadeLayer(i + 1, layer.weight, g_state.time * 30.0, 30.0);
+                    ClearPoseCache();
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Fade Out") && player) {
+                    layer.weight = 0.0f;
+                    player->FadeLayer(i + 1, layer.weight, g_state.time * 30.0, 30.0);
+                    ClearPoseCache();
+                }
+                ImGui::SameLine();
+                bool remove = ImGui::Button("Remove");
+                ImGui::PopID();
+                if (remove) {
+                    RemoveMotionLayer(i);
+                    break;
+                }
+            }
             
             ImGui::Separator();
             
@@ -2289,6 +4369,27 @@ void frame(void) {
                 }
             }
             
+            // Keyframes per bone and morph track, sharing the sequencer's first frame
+            ImGui::Checkbox("Keyframe Tracks", &g_state.track_view_enabled);
+            if (g_state.track_view_enabled) {
+                ImGui::SameLine();
+                ImGui::SetNextItemWidth(120.0f);
+                ImGui::SliderFloat("Zoom", &g_state.track_view_frame_width, 0.1f, 20.0f, "%.1f px/frame",
+                                   ImGuiSliderFlags_Logarithmic);
+                ImGui::SameLine();
+                ImGui::Text("%zu tracks, %zu keys", g_state.sequencer->GetTrackNum(), g_state.sequencer->GetKeyNum());
+                int clicked_frame = g_state.sequencer->DrawTracks(
+                    g_state.sequencer_first_frame, g_state.track_view_frame_width,
+                    g_state.sequencer_current_frame, g_state.track_view_height);
+                if (clicked_frame >= 0) {
+                    g_state.sequencer_current_frame = clicked_frame;
+                    g_state.sequencer_last_frame = clicked_frame;
+                    g_state.time = clicked_frame / 30.0f;
+                    g_state.animation_playing = false;
+                    g_state.sequencer_manual_control = true;
+                }
+            }
+            
             ImGui::End();
         }
     }
@@ -2304,9 +4405,18 @@ void frame(void) {
 
 // Cleanup function
 void cleanup(void) {
+    StopPoseBake();
+    StopPhysicsBake();
+    g_state.physics_pipeline.Stop();
+    g_state.audio.Close();
+    if (saudio_isvalid()) {
+        saudio_shutdown();
+    }
+
     if (g_state.physics_reactor->IsHasFloor()) {
         g_state.physics_reactor->SetFloor(false);
     }
+    ClearCharacters();
     
     if (g_state.vertex_buffer.id != 0) {
         sg_destroy_buffer(g_state.vertex_buffer);
@@ -2327,14 +4437,7 @@ void cleanup(void) {
         sg_destroy_sampler(g_state.default_sampler);
     }
     // Clean up material textures and views
-    for (size_t i = 0; i < g_state.material_textures.size(); ++i) {
-        if (g_state.material_textures[i].id != 0 && g_state.material_textures[i].id != g_state.default_texture.id) {
-            sg_destroy_image(g_state.material_textures[i]);
-        }
-        if (i < g_state.material_texture_views.size() && g_state.material_texture_views[i].id != 0) {
-            sg_destroy_view(g_state.material_texture_views[i]);
-        }
-    }
+    ReleaseMaterialTextures(g_state.material_textures, g_state.material_texture_views);
     if (g_state.default_texture_view.id != 0) {
         sg_destroy_view(g_state.default_texture_view);
     }
@@ -2479,21 +4582,789 @@ void input(const sapp_event* ev) {
     }
 }
 
+// Plays the motion at 30 fps through a physics reactor, returning the time per
+// React and the mean second difference of the world positions of the bones
+// physics poses, a measure of how much they shake from frame to frame.
+template <typename Reactor>
+void BenchmarkReactor(Reactor& reactor, mmd::Model& model, const mmd::Motion& motion, size_t frame_num,
+                      double& react_us, double& jitter) {
+    mmd::Poser poser(model);
+    mmd::MotionPlayer player(motion, poser);
+    reactor.AddPoser(poser);
+    std::vector<size_t> bones, fixed_bones;
+    reactor.GetPhysicsBones(poser, bones, fixed_bones);
+
+    std::vector<mmd::Vector3f> positions[3];
+    for (int i = 0; i < 3; ++i) {
+        positions[i].resize(bones.size());
+    }
+    uint64_t react_ticks = 0;
+    double jitter_sum = 0.0;
+    size_t jitter_num = 0;
+    for (size_t frame = 0; frame < frame_num; ++frame) {
+        player.SeekFrame(frame);
+        poser.PrePhysicsPosing();
+        uint64_t start = stm_now();
+        reactor.React(1.0f / 30.0f);
+        react_ticks += stm_since(start);
+        poser.PostPhysicsPosing();
+
+        std::vector<mmd::Vector3f>& current = positions[frame % 3];
+        for (size_t i = 0; i < bones.size(); ++i) {
+            const mmd::Matrix4f& m = poser.GetSkinningMatrix(bones[i]);
+            const mmd::Vector3f& p = model.GetBone(bones[i]).GetPosition();
+            for (int c = 0; c < 3; ++c) {
+                current[i].v[c] = p.v[0] * m.v[c] + p.v[1] * m.v[4 + c] + p.v[2] * m.v[8 + c] + m.v[12 + c];
+            }
+        }
+        if (frame >= 2) {
+            const std::vector<mmd::Vector3f>& last = positions[(frame + 2) % 3];
+            const std::vector<mmd::Vector3f>& before = positions[(frame + 1) % 3];
+            for (size_t i = 0; i < bones.size(); ++i) {
+                mmd::Vector3f a = current[i] - last[i] * 2.0f + before[i];
+                jitter_sum += std::sqrt(a * a);
+                ++jitter_num;
+            }
+        }
+    }
+    reactor.RemovePoser(poser);
+    react_us = stm_us(react_ticks) / double(std::max(frame_num, size_t(1)));
+    jitter = jitter_num > 0 ? jitter_sum / double(jitter_num) : 0.0;
+}
+
+// Headless benchmark (--benchmark): loads the model and motion given on the
+// command line without creating a window, prints timings and returns.
+int RunBenchmark() {
+    if (g_state.model_filename.empty() || g_state.motion_filename.empty()) {
+        std::cerr << "Benchmark needs a .pmx model and a .vmd motion" << std::endl;
+        return 1;
+    }
+
+    stm_setup();
+    try {
+        // Model parse from a buffered and from a mapped reader. The buffered
+        // one goes first and brings the file into the page cache, so the two
+        // differ by the copy, not by disk reads.
+        mmd::Model model;
+        mmd::Model buffered_model;
+        uint64_t start = stm_now();
+        {
+            mmd::FileReader file(utf8_to_wstring(g_state.model_filename));
+            mmd::PmxReader reader(file);
+            reader.ReadModel(buffered_model);
+        }
+        double buffered_ms = stm_ms(stm_since(start));
+        start = stm_now();
+        {
+            mmd::FileReader file(utf8_to_wstring(g_state.model_filename), true);
+            mmd::PmxReader reader(file);
+            reader.ReadModel(model);
+        }
+        double mapped_ms = stm_ms(stm_since(start));
+        std::cout << "Model load benchmark:" << std::endl;
+        std::cout << "  PMX read and parse, buffered: " << buffered_ms << " ms" << std::endl;
+        std::cout << "  PMX map and parse: " << mapped_ms << " ms" << std::endl;
+
+        // Every .pmx on the command line, best of a few mapped parses each
+        std::vector<std::string> corpus(1, g_state.model_filename);
+        corpus.insert(corpus.end(), g_state.model_corpus_filenames.begin(), g_state.model_corpus_filenames.end());
+        double corpus_ms = 0.0;
+        size_t corpus_bytes = 0;
+        std::cout << "  Corpus, best of 3 parses:" << std::endl;
+        for (const std::string& filename : corpus) {
+            double best_ms = 0.0;
+            size_t file_bytes = 0;
+            size_t vertex_num = 0;
+            for (int run = 0; run < 3; ++run) {
+                mmd::Model corpus_model;
+                start = stm_now();
+                mmd::FileReader file(utf8_to_wstring(filename), true);
+                mmd::PmxReader reader(file);
+                reader.ReadModel(corpus_model);
+                double ms = stm_ms(stm_since(start));
+                best_ms = run == 0 ? ms : std::min(best_ms, ms);
+                file_bytes = file.GetLength();
+                vertex_num = corpus_model.GetVertexNum();
+            }
+            corpus_ms += best_ms;
+            corpus_bytes += file_bytes;
+            std::cout << "    " << filename << ": " << best_ms << " ms, " << vertex_num << " vertices, "
+                      << (best_ms > 0.0 ? file_bytes / 1048576.0 / (best_ms / 1000.0) : 0.0) << " MB/s" << std::endl;
+        }
+        if (corpus.size() > 1) {
+            std::cout << "    total: " << corpus_ms << " ms, "
+                      << (corpus_ms > 0.0 ? corpus_bytes / 1048576.0 / (corpus_ms / 1000.0) : 0.0) << " MB/s" << std::endl;
+        }
+
+        start = stm_now();
+        mmd::Motion motion;
+        {
+            mmd::FileReader file(utf8_to_wstring(g_state.motion_filename), true);
+            mmd::VmdReader reader(file);
+            reader.ReadMotion(motion);
+        }
+        double parse_ms = stm_ms(stm_since(start));
+
+        // Writes the cache if it is missing or stale, so the load below maps it
+        LoadCompiledMotion(g_state.motion_filename);
+        start = stm_now();
+        std::shared_ptr<mmd::CompiledMotion> compiled = LoadCompiledMotion(g_state.motion_filename);
+        double compiled_ms = stm_ms(stm_since(start));
+
+        std::cout << "Motion load benchmark: " << compiled->GetImageSize() / 1024 << " KB compiled image" << std::endl;
+        std::cout << "  VMD parse: " << parse_ms << " ms ("
+                  << (motion.GetBoneKeyframeNum() + motion.GetMorphKeyframeNum()) / std::max(parse_ms, 1e-3)
+                  << " keyframes/ms)" << std::endl;
+        std::cout << "  Compiled cache load (hash + map): " << compiled_ms << " ms" << std::endl;
+
+        mmd::Poser poser(model);
+        mmd::MotionPlayer player(motion, poser);
+
+        // Tracks the motion actually drives, i.e. what MotionPlayer binds
+        std::vector<std::pair<std::wstring, size_t>> bones;
+        std::vector<std::pair<std::wstring, size_t>> morphs;
+        for (size_t i = 0; i < model.GetBoneNum(); ++i) {
+            if (motion.IsBoneRegistered(model.GetBone(i).GetName())) {
+                bones.push_back(std::make_pair(model.GetBone(i).GetName(), i));
+            }
+        }
+        for (size_t i = 0; i < model.GetMorphNum(); ++i) {
+            if (motion.IsMorphRegistered(model.GetMorph(i).GetName())) {
+                morphs.push_back(std::make_pair(model.GetMorph(i).GetName(), i));
+            }
+        }
+
+        const size_t frame_num = motion.GetLength() + 1;
+        const int repeat = 20;
+        std::cout << "Motion sampling benchmark: " << bones.size() << " bone tracks, "
+                  << morphs.size() << " morph tracks, " << frame_num << " frames x " << repeat << std::endl;
+
+        // Per-track scalar sampling, one Bezier lookup per channel
+        start = stm_now();
+        for (int r = 0; r < repeat; ++r) {
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                for (const auto& morph : morphs) {
+                    poser.SetMorphPose(morph.second, motion.GetMorphPose(morph.first, frame));
+                }
+                for (const auto& bone : bones) {
+                    poser.SetBonePose(bone.second, motion.GetBonePose(bone.first, frame));
+                }
+            }
+        }
+        double scalar_us = stm_us(stm_since(start)) / double(repeat * frame_num);
+
+        // Batched sampling through MotionPlayer
+        start = stm_now();
+        for (int r = 0; r < repeat; ++r) {
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                player.SeekFrame(frame);
+            }
+        }
+        double batched_us = stm_us(stm_since(start)) / double(repeat * frame_num);
+
+        mmd::MotionPlayer compiled_player(*compiled, poser);
+        start = stm_now();
+        for (int r = 0; r < repeat; ++r) {
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                compiled_player.SeekFrame(frame);
+            }
+        }
+        double compiled_us = stm_us(stm_since(start)) / double(repeat * frame_num);
+
+        std::cout << "  Per-track sampling: " << scalar_us << " us/frame" << std::endl;
+        std::cout << "  MotionPlayer::SeekFrame: " << batched_us << " us/frame" << std::endl;
+        std::cout << "  MotionPlayer::SeekFrame (compiled): " << compiled_us << " us/frame" << std::endl;
+
+        // Layered playback, one and three layers of the same motion
+        mmd::LayeredMotionPlayer layered_player(poser);
+        double layered_us[2];
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+                layered_player.AddLayer(*compiled, 0.5f);
+                layered_player.AddLayer(*compiled, 0.5f);
+            } else {
+                layered_player.AddLayer(*compiled);
+            }
+            start = stm_now();
+            for (int r = 0; r < repeat; ++r) {
+                for (size_t frame = 0; frame < frame_num; ++frame) {
+                    layered_player.SeekFrame(frame);
+                }
+            }
+            layered_us[pass] = stm_us(stm_since(start)) / double(repeat * frame_num);
+        }
+        std::cout << "  LayeredMotionPlayer::SeekFrame: " << layered_us[0] << " us/frame (1 layer), "
+                  << layered_us[1] << " us/frame (3 layers)" << std::endl;
+
+        // Crowd of posers on one motion: a player each against a shared evaluation cache
+        const size_t crowd_num = 16;
+        std::vector<std::unique_ptr<mmd::Poser>> crowd;
+        std::vector<std::unique_ptr<mmd::MotionPlayer>> crowd_players;
+        std::vector<std::unique_ptr<mmd::InstancedMotionPlayer>> crowd_instances;
+        mmd::MotionEvaluationCache evaluation_cache;
+        for (size_t i = 0; i < crowd_num; ++i) {
+            crowd.push_back(std::make_unique<mmd::Poser>(model));
+            crowd_players.push_back(std::make_unique<mmd::MotionPlayer>(*compiled, *crowd.back()));
+            crowd_instances.push_back(std::make_unique<mmd::InstancedMotionPlayer>(evaluation_cache, *compiled, *crowd.back()));
+        }
+        start = stm_now();
+        for (size_t frame = 0; frame < frame_num; ++frame) {
+            for (size_t i = 0; i < crowd_num; ++i) {
+                crowd_players[i]->SeekFrame(frame);
+            }
+        }
+        double crowd_separate_us = stm_us(stm_since(start)) / double(frame_num);
+        start = stm_now();
+        for (size_t frame = 0; frame < frame_num; ++frame) {
+            for (size_t i = 0; i < crowd_num; ++i) {
+                crowd_instances[i]->SeekFrame(frame);
+            }
+        }
+        double crowd_shared_us = stm_us(stm_since(start)) / double(frame_num);
+        std::cout << "Motion instancing benchmark: " << crowd_num << " posers" << std::endl;
+        std::cout << "  MotionPlayer each: " << crowd_separate_us << " us/frame" << std::endl;
+        std::cout << "  InstancedMotionPlayer: " << crowd_shared_us << " us/frame ("
+                  << evaluation_cache.GetMissNum() << " evaluations, "
+                  << evaluation_cache.GetHitNum() << " shared)" << std::endl;
+
+        // Camera sampling, cursor against keyframe search, at the render rate
+        mmd::CameraMotion camera_motion;
+        {
+            mmd::FileReader file(utf8_to_wstring(g_state.camera_filename.empty() ? g_state.motion_filename : g_state.camera_filename));
+            mmd::VmdReader reader(file);
+            reader.ReadCameraMotion(camera_motion);
+        }
+        if (camera_motion.GetKeyframeNum() > 0) {
+            const size_t step_num = (camera_motion.GetLength() + 1) * 2;
+            mmd::CameraMotionPlayer camera_player(camera_motion);
+            float search_sum = 0.0f;
+            float cursor_sum = 0.0f;
+            start = stm_now();
+            for (int r = 0; r < repeat; ++r) {
+                for (size_t step = 0; step < step_num; ++step) {
+                    search_sum += camera_motion.GetCameraPose(step / 60.0).GetFOV();
+                }
+            }
+            double search_us = stm_us(stm_since(start)) / double(repeat * step_num);
+            start = stm_now();
+            for (int r = 0; r < repeat; ++r) {
+                for (size_t step = 0; step < step_num; ++step) {
+                    cursor_sum += camera_player.SeekFrame(step * 0.5).GetFOV();
+                }
+            }
+            double cursor_us = stm_us(stm_since(start)) / double(repeat * step_num);
+            std::cout << "Camera sampling benchmark: " << camera_motion.GetKeyframeNum() << " keyframes ("
+                      << (search_sum == cursor_sum ? "consistent" : "MISMATCH") << ")" << std::endl;
+            std::cout << "  CameraMotion::GetCameraPose: " << search_us << " us/frame" << std::endl;
+            std::cout << "  CameraMotionPlayer::SeekFrame: " << cursor_us << " us/frame" << std::endl;
+        }
+
+        // Keyframe reduction: size, sampling time and error against the source
+        mmd::Motion reduced;
+        start = stm_now();
+        g_state.motion_compressor.Compress(motion, reduced);
+        double compress_ms = stm_ms(stm_since(start));
+        mmd::CompiledMotion full_image(motion);
+        mmd::CompiledMotion reduced_image(reduced);
+        mmd::MotionCompressor::Deviation deviation = mmd::MotionCompressor::Measure(motion, reduced_image);
+
+        mmd::MotionPlayer full_player(full_image, poser);
+        mmd::MotionPlayer reduced_player(reduced_image, poser);
+        start = stm_now();
+        for (int r = 0; r < repeat; ++r) {
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                full_player.SeekFrame(frame);
+            }
+        }
+        double full_us = stm_us(stm_since(start)) / double(repeat * frame_num);
+        start = stm_now();
+        for (int r = 0; r < repeat; ++r) {
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                reduced_player.SeekFrame(frame);
+            }
+        }
+        double reduced_us = stm_us(stm_since(start)) / double(repeat * frame_num);
+
+        std::cout << "Motion compression benchmark: " << compress_ms << " ms" << std::endl;
+        std::cout << "  Keyframes: " << motion.GetBoneKeyframeNum() + motion.GetMorphKeyframeNum() << " -> "
+                  << reduced.GetBoneKeyframeNum() + reduced.GetMorphKeyframeNum() << std::endl;
+        std::cout << "  Resident size: " << motion.GetResidentSize() / 1024 << " KB -> "
+                  << reduced.GetResidentSize() / 1024 << " KB" << std::endl;
+        std::cout << "  Compiled image: " << full_image.GetImageSize() / 1024 << " KB -> "
+                  << reduced_image.GetImageSize() / 1024 << " KB" << std::endl;
+        std::cout << "  MotionPlayer::SeekFrame: " << full_us << " -> " << reduced_us << " us/frame" << std::endl;
+        std::cout << "  Max error: " << deviation.rotation * 180.0f / 3.14159265f << " deg (tolerance "
+                  << g_state.motion_compressor.GetRotationTolerance() * 180.0f / 3.14159265f << "), "
+                  << deviation.translation << " translation (" << g_state.motion_compressor.GetTranslationTolerance()
+                  << "), " << deviation.morph << " morph (" << g_state.motion_compressor.GetMorphTolerance() << ")"
+                  << std::endl;
+
+        // Live posing against baked playback
+        start = stm_now();
+        mmd::BakedMotion baked(poser, frame_num, g_state.bake_memory_budget);
+        for (size_t frame = 0; frame < baked.GetFrameNum(); ++frame) {
+            player.SeekFrame(frame);
+            poser.PrePhysicsPosing();
+            baked.Capture(frame, poser);
+        }
+        double bake_ms = stm_ms(stm_since(start));
+
+        start = stm_now();
+        for (int r = 0; r < repeat; ++r) {
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                player.SeekFrame(frame);
+                poser.PrePhysicsPosing();
+            }
+        }
+        double live_us = stm_us(stm_since(start)) / double(repeat * frame_num);
+
+        start = stm_now();
+        for (int r = 0; r < repeat; ++r) {
+            for (size_t frame = 0; frame < baked.GetFrameNum(); ++frame) {
+                baked.Apply(frame, poser);
+            }
+        }
+        double baked_us = stm_us(stm_since(start)) / double(repeat * std::max(baked.GetFrameNum(), size_t(1)));
+
+        std::cout << "  Bake: " << baked.GetFrameNum() << " frames in " << bake_ms << " ms, "
+                  << baked.GetResidentSize() / 1024 << " KB" << std::endl;
+        std::cout << "  Live pre-physics posing: " << live_us << " us/frame" << std::endl;
+        std::cout << "  Baked pre-physics posing: " << baked_us << " us/frame" << std::endl;
+
+        // React() time against the thread count, the motion played at 30 fps
+        std::cout << "Physics benchmark: " << model.GetRigidBodyNum() << " rigid bodies, "
+                  << model.GetConstraintNum() << " constraints" << std::endl;
+        int max_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+        double single_thread_us = 0.0;
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            mmd::Poser physics_poser(model);
+            mmd::MotionPlayer physics_player(motion, physics_poser);
+            mmd::BulletPhysicsReactor reactor(threads);
+            if (threads > 1 && reactor.GetThreadNum() == 1) {
+                std::cout << "  (no multi-threaded physics: needs MMD_BULLET_MULTITHREADING and several cores)" << std::endl;
+                break;
+            }
+            reactor.AddPoser(physics_poser);
+            uint64_t react_ticks = 0;
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                physics_player.SeekFrame(frame);
+                physics_poser.PrePhysicsPosing();
+                start = stm_now();
+                reactor.React(1.0f / 30.0f);
+                react_ticks += stm_since(start);
+                physics_poser.PostPhysicsPosing();
+            }
+            double react_us = stm_us(react_ticks) / double(std::max(frame_num, size_t(1)));
+            if (threads == 1) {
+                single_thread_us = react_us;
+            }
+            std::cout << "  " << reactor.GetThreadNum() << " threads: " << react_us << " us/React ("
+                      << single_thread_us / react_us << "x)" << std::endl;
+            reactor.RemovePoser(physics_poser);
+        }
+
+        {
+            mmd::Poser settle_poser(model);
+            mmd::MotionPlayer settle_player(motion, settle_poser);
+            mmd::BulletPhysicsReactor reactor;
+            reactor.AddPoser(settle_poser);
+
+            // React overhead outside stepSimulation: too short a step only
+            // synchronizes the bones with the bodies
+            uint64_t sync_ticks = 0;
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                settle_player.SeekFrame(frame);
+                settle_poser.PrePhysicsPosing();
+                start = stm_now();
+                reactor.React(0.0f);
+                sync_ticks += stm_since(start);
+                settle_poser.PostPhysicsPosing();
+            }
+            const size_t reload_num = 16;
+            start = stm_now();
+            for (size_t i = 0; i < reload_num; ++i) {
+                reactor.RemovePoser(settle_poser);
+                reactor.AddPoser(settle_poser);
+            }
+            uint64_t reload_ticks = stm_since(start);
+            std::cout << "  React without steps: " << stm_us(sync_ticks) / double(std::max(frame_num, size_t(1)))
+                      << " us/frame, remove and add poser: " << stm_us(reload_ticks) / double(reload_num)
+                      << " us" << std::endl;
+
+            // Settling after a seek costs the same whatever the distance jumped
+            const int settle_steps = 30;
+            const size_t seek_num = 8;
+            uint64_t settle_ticks = 0;
+            for (size_t i = 0; i < seek_num; ++i) {
+                settle_player.SeekFrame(frame_num * ((i * 5) % seek_num) / seek_num);
+                settle_poser.PrePhysicsPosing();
+                start = stm_now();
+                reactor.Settle(settle_steps);
+                settle_ticks += stm_since(start);
+                settle_poser.PostPhysicsPosing();
+            }
+            std::cout << "  Settle (" << settle_steps << " steps): "
+                      << stm_ms(settle_ticks) / double(seek_num) << " ms/seek" << std::endl;
+            reactor.RemovePoser(settle_poser);
+        }
+
+        // The position based reactor against Bullet, on the same motion: cost,
+        // and jitter as the mean second difference of physics bone positions
+        // (m/frame^2, lower is steadier)
+        std::cout << "Bullet vs PBD physics:" << std::endl;
+        {
+            double react_us, jitter;
+            mmd::BulletPhysicsReactor bullet;
+            BenchmarkReactor(bullet, model, motion, frame_num, react_us, jitter);
+            double bullet_us = react_us;
+            std::cout << "  Bullet: " << react_us << " us/React, jitter " << jitter << std::endl;
+            for (int threads = 1; threads <= max_threads; threads *= 2) {
+                mmd::PbdPhysicsReactor pbd(threads);
+                BenchmarkReactor(pbd, model, motion, frame_num, react_us, jitter);
+                std::cout << "  PBD, " << pbd.GetThreadNum() << " threads, " << pbd.GetSubstepNum()
+                          << " substeps: " << react_us << " us/React (" << bullet_us / react_us
+                          << "x), jitter " << jitter << std::endl;
+            }
+        }
+
+        // Instances of the model side by side in one world: a broadphase and a
+        // solver step per React, whatever the number of posers
+        std::cout << "Shared physics world:" << std::endl;
+        for (size_t poser_num = 1; poser_num <= 16; poser_num *= 2) {
+            std::vector<std::unique_ptr<mmd::Poser>> posers;
+            std::vector<std::unique_ptr<mmd::InstancedMotionPlayer>> players;
+            mmd::BulletPhysicsReactor reactor;
+            for (size_t i = 0; i < poser_num; ++i) {
+                posers.push_back(std::make_unique<mmd::Poser>(model));
+                players.push_back(std::make_unique<mmd::InstancedMotionPlayer>(evaluation_cache, *compiled, *posers.back()));
+                reactor.AddPoser(*posers.back());
+                mmd::Vector3f offset;
+                offset.p.x = 12.0f * static_cast<float>(i);
+                offset.p.y = 0.0f;
+                offset.p.z = 0.0f;
+                reactor.SetPoserOffset(*posers.back(), offset);
+            }
+            uint64_t react_ticks = 0;
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                for (size_t i = 0; i < poser_num; ++i) {
+                    players[i]->SeekFrame(frame);
+                    posers[i]->PrePhysicsPosing();
+                }
+                start = stm_now();
+                reactor.React(1.0f / 30.0f);
+                react_ticks += stm_since(start);
+                for (size_t i = 0; i < poser_num; ++i) {
+                    posers[i]->PostPhysicsPosing();
+                }
+            }
+            double react_us = stm_us(react_ticks) / double(std::max(frame_num, size_t(1)));
+            std::cout << "  " << poser_num << " models: " << react_us << " us/React, "
+                      << react_us / double(poser_num) << " us per model" << std::endl;
+        }
+    } catch (const mmd::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Reference scene for the physics checksum when no files are given: a
+// kinematic root carrying two chains of capsules, jointed with springs, which
+// swings and turns under a made-up motion. Built in code so the check needs no
+// assets.
+void AddReferenceBone(mmd::Model& model, const std::wstring& name, size_t parent, float x, float y, float z) {
+    mmd::Model::Bone& bone = model.NewBone();
+    bone.SetName(name);
+    bone.SetNameEn(name);
+    bone.SetParentIndex(parent);
+    mmd::Vector3f position;
+    position.p.x = x;
+    position.p.y = y;
+    position.p.z = z;
+    bone.SetPosition(position);
+    bone.SetTransformLevel(0);
+    bone.SetChildUseID(false);
+    bone.SetRotatable(true);
+    bone.SetMovable(true);
+    bone.SetVisible(true);
+    bone.SetControllable(true);
+    bone.SetHasIK(false);
+    bone.SetAppendRotate(false);
+    bone.SetAppendTranslate(false);
+    bone.SetRotAxisFixed(false);
+    bone.SetUseLocalAxis(false);
+    bone.SetPostPhysics(false);
+    bone.SetReceiveTransform(false);
+}
+
+void AddReferenceBody(mmd::Model& model, size_t bone, size_t group, bool kinematic, float x, float y, float z) {
+    mmd::Model::RigidBody& body = model.NewRigidBody();
+    body.SetName(L"body");
+    body.SetNameEn(L"body");
+    body.SetAssociatedBoneIndex(bone);
+    body.SetCollisionGroup(group);
+    body.GetCollisionMask().set();
+    body.GetCollisionMask().reset(group);  // links of a chain pass through each other
+    mmd::Vector3f dimensions;
+    dimensions.p.x = kinematic ? 0.5f : 0.2f;
+    dimensions.p.y = kinematic ? 0.0f : 0.6f;
+    dimensions.p.z = 0.0f;
+    body.SetShape(kinematic ? mmd::Model::RigidBody::RIGID_SHAPE_SPHERE : mmd::Model::RigidBody::RIGID_SHAPE_CAPSULE);
+    body.SetDimensions(dimensions);
+    mmd::Vector3f position;
+    position.p.x = x;
+    position.p.y = y;
+    position.p.z = z;
+    body.SetPosition(position);
+    mmd::Vector3f rotation;
+    rotation.p.x = 0.0f;
+    rotation.p.y = 0.0f;
+    rotation.p.z = kinematic ? 0.0f : 1.5708f;  // capsules lie along the chain
+    body.SetRotation(rotation);
+    body.SetMass(1.0f);
+    body.SetTranslateDamp(0.5f);
+    body.SetRotateDamp(0.5f);
+    body.SetRestitution(0.0f);
+    body.SetFriction(0.5f);
+    body.SetType(kinematic ? mmd::Model::RigidBody::RIGID_TYPE_KINEMATIC : mmd::Model::RigidBody::RIGID_TYPE_PHYSICS);
+}
+
+void AddReferenceJoint(mmd::Model& model, size_t body_a, size_t body_b, float x, float y, float z) {
+    mmd::Model::Constraint& joint = model.NewConstraint();
+    joint.SetName(L"joint");
+    joint.SetNameEn(L"joint");
+    joint.SetAssociatedRigidBodyIndex(0, body_a);
+    joint.SetAssociatedRigidBodyIndex(1, body_b);
+    mmd::Vector3f v;
+    v.p.x = x;
+    v.p.y = y;
+    v.p.z = z;
+    joint.SetPosition(v);
+    v.p.x = v.p.y = v.p.z = 0.0f;
+    joint.SetRotation(v);
+    joint.SetPositionLowLimit(v);
+    joint.SetPositionHighLimit(v);
+    joint.SetSpringTranslate(v);
+    v.p.x = v.p.y = v.p.z = -1.0f;
+    joint.SetRotationLowLimit(v);
+    v.p.x = v.p.y = v.p.z = 1.0f;
+    joint.SetRotationHighLimit(v);
+    v.p.x = v.p.y = v.p.z = 5.0f;
+    joint.SetSpringRotate(v);
+}
+
+void BuildReferencePhysicsModel(mmd::Model& model) {
+    AddReferenceBone(model, L"root", mmd::nil, 0.0f, 10.0f, 0.0f);
+    AddReferenceBody(model, 0, 0, true, 0.0f, 10.0f, 0.0f);
+    for (int chain = 0; chain < 2; ++chain) {
+        const float z = chain * 1.5f;
+        size_t parent_bone = 0;
+        size_t parent_body = 0;
+        for (int link = 1; link <= 8; ++link) {
+            const float x = static_cast<float>(link);
+            size_t bone = model.GetBoneNum();
+            AddReferenceBone(model, L"chain" + std::to_wstring(chain) + L"_" + std::to_wstring(link),
+                             parent_bone, x, 10.0f, z);
+            size_t body = model.GetRigidBodyNum();
+            AddReferenceBody(model, bone, 1, false, x, 10.0f, z);
+            AddReferenceJoint(model, parent_body, body, x - 0.5f, 10.0f, z);
+            parent_bone = bone;
+            parent_body = body;
+        }
+    }
+}
+
+void PoseReferenceFrame(mmd::Poser& poser, size_t frame) {
+    const float t = static_cast<float>(frame);
+    const float half_angle = 0.3f * std::sin(t * 0.07f);
+    mmd::Vector3f translation;
+    translation.p.x = 3.0f * std::sin(t * 0.05f);
+    translation.p.y = 0.0f;
+    translation.p.z = 0.0f;
+    mmd::Vector4f rotation;
+    rotation.p.x = 0.0f;
+    rotation.p.y = std::sin(half_angle);
+    rotation.p.z = 0.0f;
+    rotation.p.w = std::cos(half_angle);
+    poser.ResetPosing();
+    poser.SetBonePose(0, mmd::Motion::BonePose(translation, rotation));
+}
+
+// Checksum of the reference scene over its 600 frames at the default 60 Hz
+// step, from an x86-64 (SSE2) build of the bundled Bullet. Another compiler,
+// architecture or floating point mode may round differently; take the value
+// the check prints there.
+const char* const kReferencePhysicsChecksum = "08fb9bb2d5f27ce7";
+
+// Headless physics regression check (--physics-checksum [expected]): simulates
+// the model and motion given on the command line in deterministic mode, one
+// React per motion frame, and prints a checksum of every rigid body transform
+// after every step. The run is done twice, the second time after unrelated
+// posers came and went, and must agree with itself and with expected, when
+// given: a change to libmmd, Bullet or their settings that alters the
+// simulation fails the check. Without files the built-in reference scene is
+// simulated and checked against kReferencePhysicsChecksum.
+int RunPhysicsChecksum(const std::string& expected) {
+    const bool reference = g_state.model_filename.empty() && g_state.motion_filename.empty();
+    if (!reference && (g_state.model_filename.empty() || g_state.motion_filename.empty())) {
+        std::cerr << "Physics checksum needs a .pmx model and a .vmd motion, or neither" << std::endl;
+        return 1;
+    }
+    std::string expected_checksum = expected;
+    if (reference && expected_checksum.empty()) {
+        expected_checksum = kReferencePhysicsChecksum;
+    }
+
+    try {
+        mmd::Model model;
+        mmd::Motion motion;
+        size_t frame_num = 600;
+        if (reference) {
+            BuildReferencePhysicsModel(model);
+            std::cout << "Physics checksum of the built-in reference scene" << std::endl;
+        } else {
+            {
+                mmd::FileReader file(utf8_to_wstring(g_state.model_filename));
+                mmd::PmxReader reader(file);
+                reader.ReadModel(model);
+            }
+            {
+                mmd::FileReader file(utf8_to_wstring(g_state.motion_filename));
+                mmd::VmdReader reader(file);
+                reader.ReadMotion(motion);
+            }
+            frame_num = motion.GetLength() + 1;
+        }
+
+        std::uint64_t checksums[2];
+        for (int run = 0; run < 2; ++run) {
+            mmd::Poser poser(model);
+            mmd::MotionPlayer player(motion, poser);
+            mmd::BulletPhysicsReactor reactor;
+            reactor.SetDeterministic(true);
+            reactor.SetFixedStepRate(static_cast<float>(reference ? 60 : g_state.physics_rate));
+            if (run == 1) {
+                // History the deterministic Reset must wipe out
+                mmd::Poser other(model);
+                reactor.AddPoser(other);
+                reactor.SetFloor(false);
+                reactor.AddPoser(poser);
+                reactor.RemovePoser(other);
+                reactor.SetFloor(true);
+            } else {
+                reactor.AddPoser(poser);
+            }
+            if (reference) {
+                PoseReferenceFrame(poser, 0);
+            } else {
+                player.SeekFrame(0);
+            }
+            poser.PrePhysicsPosing();
+            reactor.Reset();
+
+            std::uint64_t checksum = 14695981039346656037ull;
+            size_t step_num = 0;
+            for (size_t frame = 0; frame < frame_num; ++frame) {
+                if (reference) {
+                    PoseReferenceFrame(poser, frame);
+                } else {
+                    player.SeekFrame(frame);
+                }
+                poser.PrePhysicsPosing();
+                reactor.React(1.0f / 30.0f);
+                poser.PostPhysicsPosing();
+                const std::vector<std::uint64_t>& steps = reactor.GetStepChecksums();
+                for (size_t i = 0; i < steps.size(); ++i) {
+                    checksum = (checksum ^ steps[i]) * 1099511628211ull;
+                }
+                step_num += steps.size();
+                if (run == 0 && (frame % 300 == 0 || frame + 1 == frame_num)) {
+                    std::printf("  frame %6zu: %016llx\n", frame, static_cast<unsigned long long>(checksum));
+                }
+            }
+            checksums[run] = checksum;
+            if (run == 0) {
+                std::printf("Physics checksum: %016llx (%zu frames, %zu steps, %zu rigid bodies)\n",
+                            static_cast<unsigned long long>(checksum), frame_num, step_num,
+                            model.GetRigidBodyNum());
+            }
+        }
+
+        if (checksums[1] != checksums[0]) {
+            std::printf("FAILED: a second run gave %016llx\n", static_cast<unsigned long long>(checksums[1]));
+            return 2;
+        }
+        if (!expected_checksum.empty() && std::strtoull(expected_checksum.c_str(), nullptr, 16) != checksums[0]) {
+            std::printf("FAILED: expected %s\n", expected_checksum.c_str());
+            return 3;
+        }
+    } catch (const mmd::exception& e) {
+        std::cerr << "Physics checksum failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
 // Main function
 sapp_desc sokol_main(int argc, char* argv[]) {
+    bool benchmark = false;
+    bool physics_checksum = false;
+    std::string expected_checksum;
+
     // Process command line arguments
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         std::string lower_arg = arg;
         std::transform(lower_arg.begin(), lower_arg.end(), lower_arg.begin(), ::tolower);
         
-        if (lower_arg.find(".pmx") != std::string::npos) {
-            g_state.model_filename = arg;
+        if (lower_arg == "--benchmark") {
+            benchmark = true;
+        } else if (lower_arg == "--physics-checksum") {
+            physics_checksum = true;
+            if (i + 1 < argc && std::isxdigit(static_cast<unsigned char>(argv[i + 1][0])) &&
+                std::string(argv[i + 1]).find('.') == std::string::npos) {
+                expected_checksum = argv[++i];
+            }
+        } else if (lower_arg == "--deterministic-physics") {
+            g_state.physics_deterministic = true;
+        } else if (lower_arg == "--compress") {
+            g_state.compress_motion = true;
+        } else if (lower_arg == "--camera" && i + 1 < argc) {
+            g_state.camera_filename = argv[++i];
+        } else if (lower_arg == "--bake-physics") {
+            g_state.physics_bake_enabled = true;
+        } else if (lower_arg == "--pipelined-physics") {
+            g_state.physics_pipelined = true;
+        } else if (lower_arg == "--physics-threads" && i + 1 < argc) {
+            g_state.physics_threads = std::max(std::atoi(argv[++i]), 1);
+        } else if (lower_arg == "--characters" && i + 1 < argc) {
+            g_state.initial_character_num = std::min(std::max(std::atoi(argv[++i]), 0), 15);
+        } else if (lower_arg == "--audio" && i + 1 < argc) {
+            g_state.audio_filename = argv[++i];
+        } else if (lower_arg.size() > 4 && lower_arg.compare(lower_arg.size() - 4, 4, ".wav") == 0) {
+            g_state.audio_filename = arg;
+        } else if (lower_arg.find(".pmx") != std::string::npos) {
+            if (g_state.model_filename.empty()) {
+                g_state.model_filename = arg;
+            } else {
+                g_state.model_corpus_filenames.push_back(arg);
+            }
         } else if (lower_arg.find(".vmd") != std::string::npos) {
-            g_state.motion_filename = arg;
+            if (g_state.motion_filename.empty()) {
+                g_state.motion_filename = arg;
+            } else {
+                g_state.motion_layer_filenames.push_back(arg);
+            }
         }
     }
 
+    if (benchmark) {
+        std::exit(RunBenchmark());
+    }
+    if (physics_checksum) {
+        std::exit(RunPhysicsChecksum(expected_checksum));
+    }
+
     sapp_desc _sapp_desc{};
     _sapp_desc.init_cb = init;
     _sapp_desc.frame_cb = frame;